@@ -343,11 +343,23 @@ void cliprdr_process_format_data_response(cliprdrPlugin* cliprdr, STREAM* s, uin
 	cb_event = (RDP_CB_DATA_RESPONSE_EVENT*) freerdp_event_new(RDP_EVENT_CLASS_CLIPRDR,
 		RDP_EVENT_TYPE_CB_DATA_RESPONSE, NULL, NULL);
 
+	if (dataLen > (uint32) stream_get_left(s))
+	{
+		DEBUG_WARN("dataLen %d exceeds PDU length %d", dataLen, (int) stream_get_left(s));
+		dataLen = 0;
+	}
+
 	if (dataLen > 0)
 	{
+		/**
+		 * The PDU has already been reassembled in a buffer of its own, so
+		 * move the payload to the front and hand the buffer over to the
+		 * event instead of allocating and copying another full-size one.
+		 */
+		memmove(stream_get_head(s), stream_get_tail(s), dataLen);
 		cb_event->size = dataLen;
-		cb_event->data = (uint8*) xmalloc(dataLen);
-		memcpy(cb_event->data, stream_get_tail(s), dataLen);
+		cb_event->data = stream_get_head(s);
+		stream_detach(s);
 	}
 
 	svc_plugin_send_event((rdpSvcPlugin*) cliprdr, (RDP_EVENT*) cb_event);
@@ -182,6 +182,7 @@ static void* audin_alsa_thread_func(void* arg)
 	alsa->buffer_frames = 0;
 	buffer = (uint8*) xzalloc(rbytes_per_frame * alsa->frames_per_packet);
 	freerdp_dsp_context_reset_adpcm(alsa->dsp_context);
+	freerdp_dsp_context_reset_resampler(alsa->dsp_context);
 	do
 	{
 		if ((error = snd_pcm_open(&capture_handle, alsa->device_name, SND_PCM_STREAM_CAPTURE, 0)) < 0)
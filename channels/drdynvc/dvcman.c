@@ -23,6 +23,9 @@
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/list.h>
+#include <freerdp/utils/mutex.h>
+#include <freerdp/utils/thread.h>
+#include <freerdp/utils/wait_obj.h>
 #include <freerdp/utils/load_plugin.h>
 
 #include "drdynvc_types.h"
@@ -30,7 +33,26 @@
 
 #define MAX_PLUGINS 10
 
+/* channel data is delivered by up to DVCMAN_MAX_WORKERS threads */
+#define DVCMAN_MAX_WORKERS	4
+/* the drdynvc thread blocks while this many messages wait for delivery */
+#define DVCMAN_MAX_PENDING	256
+/* message streams kept for reuse, and the largest one worth keeping */
+#define DVCMAN_STREAM_POOL_SIZE		8
+#define DVCMAN_STREAM_POOL_MAX_SIZE	(1024 * 1024)
+
 typedef struct _DVCMAN DVCMAN;
+
+typedef struct _DVCMAN_WORKER DVCMAN_WORKER;
+struct _DVCMAN_WORKER
+{
+	DVCMAN* dvcman;
+	freerdp_thread* thread;
+
+	boolean active; /* signalled or draining the queue */
+	IWTSListener* listener; /* plugin being served, NULL when idle */
+};
+
 struct _DVCMAN
 {
 	IWTSVirtualChannelManager iface;
@@ -45,6 +67,17 @@ struct _DVCMAN
 	int num_listeners;
 
 	LIST* channels;
+
+	/* protects channels, items, pending, streams and the workers */
+	freerdp_mutex mutex;
+	LIST* items;
+	int pending;
+	struct wait_obj* queue_space;
+	struct wait_obj* created;
+	LIST* streams;
+
+	DVCMAN_WORKER workers[DVCMAN_MAX_WORKERS];
+	int num_workers;
 };
 
 typedef struct _DVCMAN_LISTENER DVCMAN_LISTENER;
@@ -75,9 +108,28 @@ struct _DVCMAN_CHANNEL
 	DVCMAN* dvcman;
 	DVCMAN_CHANNEL* next;
 	uint32 channel_id;
+	IWTSListener* listener;
 	IWTSVirtualChannelCallback* channel_callback;
 
 	STREAM* dvc_data;
+	uint32 dvc_data_length;
+};
+
+enum DVCMAN_ITEM_TYPE
+{
+	DVCMAN_ITEM_DATA,
+	DVCMAN_ITEM_CLOSE,
+	DVCMAN_ITEM_CREATE
+};
+
+/* A complete message for a channel, its close request or its creation */
+typedef struct _DVCMAN_ITEM DVCMAN_ITEM;
+struct _DVCMAN_ITEM
+{
+	enum DVCMAN_ITEM_TYPE type;
+	DVCMAN_CHANNEL* channel;
+	STREAM* data;
+	boolean accepted; /* DVCMAN_ITEM_CREATE result */
 };
 
 static int dvcman_get_configuration(IWTSListener* pListener, void** ppPropertyBag)
@@ -174,6 +226,246 @@ RDP_PLUGIN_DATA* dvcman_get_plugin_data(IDRDYNVC_ENTRY_POINTS* pEntryPoints)
 	return ((DVCMAN_ENTRY_POINTS*) pEntryPoints)->plugin_data;
 }
 
+/**
+ * Takes a stream for a message of length bytes from the pool.
+ * Must be called with dvcman->mutex held.
+ */
+static STREAM* dvcman_stream_get(DVCMAN* dvcman, uint32 length)
+{
+	STREAM* s;
+
+	s = (STREAM*) list_dequeue(dvcman->streams);
+	if (s == NULL)
+		s = stream_new(0);
+
+	stream_set_pos(s, 0);
+	stream_check_size(s, length);
+
+	return s;
+}
+
+/* Must be called with dvcman->mutex held. */
+static void dvcman_stream_release(DVCMAN* dvcman, STREAM* s)
+{
+	if (list_size(dvcman->streams) < DVCMAN_STREAM_POOL_SIZE &&
+		stream_get_size(s) <= DVCMAN_STREAM_POOL_MAX_SIZE)
+		list_enqueue(dvcman->streams, s);
+	else
+		stream_free(s);
+}
+
+static void dvcman_channel_free(DVCMAN_CHANNEL* channel)
+{
+	if (channel->channel_callback)
+		channel->channel_callback->OnClose(channel->channel_callback);
+
+	if (channel->dvc_data)
+		stream_free(channel->dvc_data);
+
+	xfree(channel);
+}
+
+/**
+ * Pick the first queued item whose plugin is not being served by another
+ * worker, so that a plugin sees its channels' data and close requests in
+ * the order they came in and is never called from two threads at once.
+ * Must be called with dvcman->mutex held.
+ */
+static DVCMAN_ITEM* dvcman_dequeue_runnable_item(DVCMAN* dvcman)
+{
+	int i;
+	LIST_ITEM* curr;
+	DVCMAN_ITEM* item;
+
+	for (curr = dvcman->items->head; curr; curr = curr->next)
+	{
+		item = (DVCMAN_ITEM*) curr->data;
+
+		for (i = 0; i < dvcman->num_workers; i++)
+		{
+			if (dvcman->workers[i].listener == item->channel->listener)
+				break;
+		}
+		if (i < dvcman->num_workers)
+			continue;
+
+		list_remove(dvcman->items, item);
+		return item;
+	}
+
+	return NULL;
+}
+
+static void dvcman_accept_channel(DVCMAN_ITEM* item)
+{
+	int bAccept;
+	IWTSVirtualChannelCallback* pCallback;
+	DVCMAN_CHANNEL* channel = item->channel;
+	DVCMAN_LISTENER* listener = (DVCMAN_LISTENER*) channel->listener;
+
+	bAccept = 1;
+	pCallback = NULL;
+
+	if (listener->listener_callback->OnNewChannelConnection(listener->listener_callback,
+		(IWTSVirtualChannel*) channel, NULL, &bAccept, &pCallback) == 0 && bAccept == 1)
+	{
+		DEBUG_DVC("listener %s created new channel %d",
+			  listener->channel_name, channel->channel_id);
+		channel->channel_callback = pCallback;
+		item->accepted = true;
+	}
+}
+
+static void dvcman_process_item(DVCMAN* dvcman, DVCMAN_ITEM* item)
+{
+	DVCMAN_CHANNEL* channel = item->channel;
+
+	switch (item->type)
+	{
+		case DVCMAN_ITEM_CREATE:
+			dvcman_accept_channel(item);
+			break;
+
+		case DVCMAN_ITEM_CLOSE:
+			DEBUG_DVC("channel %d closed", channel->channel_id);
+			dvcman_channel_free(channel);
+			break;
+
+		case DVCMAN_ITEM_DATA:
+			channel->channel_callback->OnDataReceived(channel->channel_callback,
+				stream_get_length(item->data), stream_get_data(item->data));
+			break;
+	}
+}
+
+static void dvcman_process_items(DVCMAN_WORKER* worker)
+{
+	DVCMAN* dvcman = worker->dvcman;
+	DVCMAN_ITEM* item;
+
+	while (1)
+	{
+		if (freerdp_thread_is_stopped(worker->thread))
+			break;
+
+		freerdp_mutex_lock(dvcman->mutex);
+		item = dvcman_dequeue_runnable_item(dvcman);
+		if (item == NULL)
+		{
+			worker->active = false;
+			freerdp_mutex_unlock(dvcman->mutex);
+			break;
+		}
+		worker->listener = item->channel->listener;
+		freerdp_mutex_unlock(dvcman->mutex);
+
+		dvcman_process_item(dvcman, item);
+
+		freerdp_mutex_lock(dvcman->mutex);
+		worker->listener = NULL;
+		if (item->data != NULL)
+			dvcman_stream_release(dvcman, item->data);
+		dvcman->pending--;
+		wait_obj_set(dvcman->queue_space);
+		freerdp_mutex_unlock(dvcman->mutex);
+
+		/* a creation item belongs to dvcman_create_channel, which waits for it */
+		if (item->type == DVCMAN_ITEM_CREATE)
+			wait_obj_set(dvcman->created);
+		else
+			xfree(item);
+	}
+}
+
+static void* dvcman_thread_func(void* arg)
+{
+	DVCMAN_WORKER* worker = (DVCMAN_WORKER*) arg;
+
+	while (1)
+	{
+		freerdp_thread_wait(worker->thread);
+
+		if (freerdp_thread_is_stopped(worker->thread))
+			break;
+
+		freerdp_thread_reset(worker->thread);
+		dvcman_process_items(worker);
+	}
+
+	freerdp_thread_quit(worker->thread);
+
+	return NULL;
+}
+
+/**
+ * Blocks the drdynvc thread while the queue is full and returns with
+ * dvcman->mutex held. Only the drdynvc thread adds items, so there is still
+ * room for one when the caller queues it under the same lock.
+ */
+static void dvcman_lock_queue_space(DVCMAN* dvcman)
+{
+	freerdp_mutex_lock(dvcman->mutex);
+
+	while (dvcman->pending >= DVCMAN_MAX_PENDING)
+	{
+		wait_obj_clear(dvcman->queue_space);
+		freerdp_mutex_unlock(dvcman->mutex);
+		wait_obj_select(&dvcman->queue_space, 1, -1);
+		freerdp_mutex_lock(dvcman->mutex);
+	}
+}
+
+/**
+ * Hands an item over to the workers. Must be called with dvcman->mutex held
+ * from dvcman_lock_queue_space, so that the channel cannot be closed and
+ * freed before the item is queued.
+ */
+static void dvcman_queue_item(DVCMAN* dvcman, DVCMAN_ITEM* item)
+{
+	int i;
+	DVCMAN_WORKER* worker = NULL;
+
+	list_enqueue(dvcman->items, item);
+	dvcman->pending++;
+
+	for (i = 0; i < dvcman->num_workers; i++)
+	{
+		if (!dvcman->workers[i].active)
+		{
+			worker = &dvcman->workers[i];
+			break;
+		}
+	}
+
+	if (worker == NULL && dvcman->num_workers < DVCMAN_MAX_WORKERS)
+	{
+		worker = &dvcman->workers[dvcman->num_workers++];
+		worker->dvcman = dvcman;
+		worker->thread = freerdp_thread_new();
+		freerdp_thread_start(worker->thread, dvcman_thread_func, worker);
+	}
+
+	/* with every worker active, the item is picked up when one drains the queue */
+	if (worker != NULL)
+	{
+		worker->active = true;
+		freerdp_thread_signal(worker->thread);
+	}
+}
+
+static void dvcman_queue_new_item(DVCMAN* dvcman, enum DVCMAN_ITEM_TYPE type,
+	DVCMAN_CHANNEL* channel, STREAM* data)
+{
+	DVCMAN_ITEM* item;
+
+	item = xnew(DVCMAN_ITEM);
+	item->type = type;
+	item->channel = channel;
+	item->data = data;
+
+	dvcman_queue_item(dvcman, item);
+}
+
 IWTSVirtualChannelManager* dvcman_new(drdynvcPlugin* plugin)
 {
 	DVCMAN* dvcman;
@@ -183,6 +475,11 @@ IWTSVirtualChannelManager* dvcman_new(drdynvcPlugin* plugin)
 	dvcman->iface.PushEvent = dvcman_push_event;
 	dvcman->drdynvc = plugin;
 	dvcman->channels = list_new();
+	dvcman->mutex = freerdp_mutex_new();
+	dvcman->items = list_new();
+	dvcman->queue_space = wait_obj_new();
+	dvcman->created = wait_obj_new();
+	dvcman->streams = list_new();
 
 	return (IWTSVirtualChannelManager*) dvcman;
 }
@@ -212,27 +509,46 @@ int dvcman_load_plugin(IWTSVirtualChannelManager* pChannelMgr, RDP_PLUGIN_DATA*
 	return 0;
 }
 
-static void dvcman_channel_free(DVCMAN_CHANNEL* channel)
-{
-	if (channel->channel_callback)
-		channel->channel_callback->OnClose(channel->channel_callback);
-
-	xfree(channel);
-}
-
 void dvcman_free(IWTSVirtualChannelManager* pChannelMgr)
 {
 	int i;
+	STREAM* s;
 	IWTSPlugin* pPlugin;
+	DVCMAN_ITEM* item;
 	DVCMAN_LISTENER* listener;
 	DVCMAN_CHANNEL* channel;
 	DVCMAN* dvcman = (DVCMAN*) pChannelMgr;
 
+	for (i = 0; i < dvcman->num_workers; i++)
+	{
+		freerdp_thread_stop(dvcman->workers[i].thread);
+		freerdp_thread_free(dvcman->workers[i].thread);
+	}
+
+	/* undelivered data is dropped, pending close requests still close their channel */
+	while ((item = (DVCMAN_ITEM*) list_dequeue(dvcman->items)) != NULL)
+	{
+		if (item->type == DVCMAN_ITEM_CLOSE)
+			dvcman_channel_free(item->channel);
+		else if (item->data != NULL)
+			stream_free(item->data);
+		xfree(item);
+	}
+	list_free(dvcman->items);
+
 	while ((channel = (DVCMAN_CHANNEL*) list_dequeue(dvcman->channels)) != NULL)
 		dvcman_channel_free(channel);
 
 	list_free(dvcman->channels);
 
+	while ((s = (STREAM*) list_dequeue(dvcman->streams)) != NULL)
+		stream_free(s);
+	list_free(dvcman->streams);
+
+	wait_obj_free(dvcman->queue_space);
+	wait_obj_free(dvcman->created);
+	freerdp_mutex_free(dvcman->mutex);
+
 	for (i = 0; i < dvcman->num_listeners; i++)
 	{
 		listener = (DVCMAN_LISTENER*) dvcman->listeners[i];
@@ -275,6 +591,33 @@ static int dvcman_write_channel(IWTSVirtualChannel* pChannel, uint32 cbSize, uin
 	return drdynvc_write_data(channel->dvcman->drdynvc, channel->channel_id, pBuffer, cbSize);
 }
 
+/**
+ * Removes the given channel's undelivered data from the queue.
+ * Must be called with dvcman->mutex held.
+ */
+static void dvcman_discard_items(DVCMAN* dvcman, DVCMAN_CHANNEL* channel)
+{
+	LIST_ITEM* curr;
+	LIST_ITEM* next;
+	DVCMAN_ITEM* item;
+
+	for (curr = dvcman->items->head; curr; curr = next)
+	{
+		next = curr->next;
+		item = (DVCMAN_ITEM*) curr->data;
+
+		if (item->channel == channel)
+		{
+			list_remove(dvcman->items, item);
+			dvcman_stream_release(dvcman, item->data);
+			xfree(item);
+			dvcman->pending--;
+		}
+	}
+
+	wait_obj_set(dvcman->queue_space);
+}
+
 static int dvcman_close_channel_iface(IWTSVirtualChannel* pChannel)
 {
 	DVCMAN_CHANNEL* channel = (DVCMAN_CHANNEL*) pChannel;
@@ -282,21 +625,36 @@ static int dvcman_close_channel_iface(IWTSVirtualChannel* pChannel)
 
 	DEBUG_DVC("id=%d", channel->channel_id);
 
+	freerdp_mutex_lock(dvcman->mutex);
+
+	/* a channel the server already closed is freed by its queued close request */
 	if (list_remove(dvcman->channels, channel) == NULL)
-		DEBUG_WARN("channel not found");
+	{
+		freerdp_mutex_unlock(dvcman->mutex);
+		DEBUG_DVC("channel already closing");
+		return 1;
+	}
+
+	dvcman_discard_items(dvcman, channel);
+
+	freerdp_mutex_unlock(dvcman->mutex);
 
 	dvcman_channel_free(channel);
 
 	return 1;
 }
 
+/**
+ * The plugin is asked to accept the channel on a worker, like its data and
+ * close requests, so it is never entered from two threads at once.
+ */
 int dvcman_create_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelId, const char* ChannelName)
 {
 	int i;
-	int bAccept;
+	boolean accepted;
+	DVCMAN_ITEM* item;
 	DVCMAN_LISTENER* listener;
 	DVCMAN_CHANNEL* channel;
-	IWTSVirtualChannelCallback* pCallback;
 	DVCMAN* dvcman = (DVCMAN*) pChannelMgr;
 
 	for (i = 0; i < dvcman->num_listeners; i++)
@@ -310,17 +668,26 @@ int dvcman_create_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 Channel
 			channel->iface.Close = dvcman_close_channel_iface;
 			channel->dvcman = dvcman;
 			channel->channel_id = ChannelId;
+			channel->listener = (IWTSListener*) listener;
+
+			item = xnew(DVCMAN_ITEM);
+			item->type = DVCMAN_ITEM_CREATE;
+			item->channel = channel;
+
+			wait_obj_clear(dvcman->created);
+			dvcman_lock_queue_space(dvcman);
+			dvcman_queue_item(dvcman, item);
+			freerdp_mutex_unlock(dvcman->mutex);
 
-			bAccept = 1;
-			pCallback = NULL;
+			wait_obj_select(&dvcman->created, 1, -1);
+			accepted = item->accepted;
+			xfree(item);
 
-			if (listener->listener_callback->OnNewChannelConnection(listener->listener_callback,
-				(IWTSVirtualChannel*) channel, NULL, &bAccept, &pCallback) == 0 && bAccept == 1)
+			if (accepted)
 			{
-				DEBUG_DVC("listener %s created new channel %d",
-					  listener->channel_name, channel->channel_id);
-				channel->channel_callback = pCallback;
+				freerdp_mutex_lock(dvcman->mutex);
 				list_add(dvcman->channels, channel);
+				freerdp_mutex_unlock(dvcman->mutex);
 
 				return 0;
 			}
@@ -336,6 +703,7 @@ int dvcman_create_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 Channel
 	return 1;
 }
 
+/* Must be called with dvcman->mutex held. */
 static DVCMAN_CHANNEL* dvcman_find_channel_by_id(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelId)
 {
 	LIST_ITEM* curr;
@@ -355,25 +723,32 @@ static DVCMAN_CHANNEL* dvcman_find_channel_by_id(IWTSVirtualChannelManager* pCha
 int dvcman_close_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelId)
 {
 	DVCMAN_CHANNEL* channel;
-	IWTSVirtualChannel* ichannel;
+	DVCMAN* dvcman = (DVCMAN*) pChannelMgr;
+
+	dvcman_lock_queue_space(dvcman);
 
 	channel = dvcman_find_channel_by_id(pChannelMgr, ChannelId);
 
 	if (channel == NULL)
 	{
+		freerdp_mutex_unlock(dvcman->mutex);
 		DEBUG_WARN("ChannelId %d not found!", ChannelId);
 		return 1;
 	}
 
+	list_remove(dvcman->channels, channel);
+
 	if (channel->dvc_data)
 	{
-		stream_free(channel->dvc_data);
+		dvcman_stream_release(dvcman, channel->dvc_data);
 		channel->dvc_data = NULL;
 	}
 
-	DEBUG_DVC("dvcman_close_channel: channel %d closed", ChannelId);
-	ichannel = (IWTSVirtualChannel*)channel;
-	ichannel->Close(ichannel);
+	/* closed by a worker once the data queued before it has been delivered */
+	DEBUG_DVC("dvcman_close_channel: channel %d closing", ChannelId);
+	dvcman_queue_new_item(dvcman, DVCMAN_ITEM_CLOSE, channel, NULL);
+
+	freerdp_mutex_unlock(dvcman->mutex);
 
 	return 0;
 }
@@ -381,32 +756,50 @@ int dvcman_close_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelI
 int dvcman_receive_channel_data_first(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelId, uint32 length)
 {
 	DVCMAN_CHANNEL* channel;
+	DVCMAN* dvcman = (DVCMAN*) pChannelMgr;
+
+	freerdp_mutex_lock(dvcman->mutex);
 
 	channel = dvcman_find_channel_by_id(pChannelMgr, ChannelId);
 
 	if (channel == NULL)
 	{
+		freerdp_mutex_unlock(dvcman->mutex);
 		DEBUG_WARN("ChannelId %d not found!", ChannelId);
 		return 1;
 	}
 
+	/* an unfinished message is dropped and its stream reused */
 	if (channel->dvc_data)
-		stream_free(channel->dvc_data);
+	{
+		stream_set_pos(channel->dvc_data, 0);
+		stream_check_size(channel->dvc_data, length);
+	}
+	else
+	{
+		channel->dvc_data = dvcman_stream_get(dvcman, length);
+	}
+	channel->dvc_data_length = length;
 
-	channel->dvc_data = stream_new(length);
+	freerdp_mutex_unlock(dvcman->mutex);
 
 	return 0;
 }
 
 int dvcman_receive_channel_data(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelId, uint8* data, uint32 data_size)
 {
-	int error = 0;
+	STREAM* s = NULL;
 	DVCMAN_CHANNEL* channel;
+	DVCMAN* dvcman = (DVCMAN*) pChannelMgr;
+
+	/* the channel is looked up and its message queued under one lock */
+	dvcman_lock_queue_space(dvcman);
 
 	channel = dvcman_find_channel_by_id(pChannelMgr, ChannelId);
 
 	if (channel == NULL)
 	{
+		freerdp_mutex_unlock(dvcman->mutex);
 		DEBUG_WARN("ChannelId %d not found!", ChannelId);
 		return 1;
 	}
@@ -414,30 +807,35 @@ int dvcman_receive_channel_data(IWTSVirtualChannelManager* pChannelMgr, uint32 C
 	if (channel->dvc_data)
 	{
 		/* Fragmented data */
-		if (stream_get_length(channel->dvc_data) + data_size > stream_get_size(channel->dvc_data))
+		if (stream_get_length(channel->dvc_data) + data_size > channel->dvc_data_length)
 		{
 			DEBUG_WARN("data exceeding declared length!");
-			stream_free(channel->dvc_data);
+			dvcman_stream_release(dvcman, channel->dvc_data);
 			channel->dvc_data = NULL;
+			freerdp_mutex_unlock(dvcman->mutex);
 			return 1;
 		}
 
 		stream_write(channel->dvc_data, data, data_size);
 
-		if (stream_get_length(channel->dvc_data) >= stream_get_size(channel->dvc_data))
+		if (stream_get_length(channel->dvc_data) >= channel->dvc_data_length)
 		{
-			error = channel->channel_callback->OnDataReceived(channel->channel_callback,
-				stream_get_size(channel->dvc_data), stream_get_data(channel->dvc_data));
-			stream_free(channel->dvc_data);
+			s = channel->dvc_data;
 			channel->dvc_data = NULL;
 		}
 	}
 	else
 	{
-		error = channel->channel_callback->OnDataReceived(channel->channel_callback, data_size, data);
+		s = dvcman_stream_get(dvcman, data_size);
+		stream_write(s, data, data_size);
 	}
 
-	return error;
+	if (s != NULL)
+		dvcman_queue_new_item(dvcman, DVCMAN_ITEM_DATA, channel, s);
+
+	freerdp_mutex_unlock(dvcman->mutex);
+
+	return 0;
 }
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
@@ -89,6 +89,7 @@ static boolean tsmf_alsa_set_format(ITSMFAudioDevice* audio,
 		return false;
 
 	snd_pcm_drop(alsa->out_handle);
+	freerdp_dsp_context_reset_resampler(alsa->dsp_context);
 
 	alsa->actual_rate = alsa->source_rate = sample_rate;
 	alsa->actual_channels = alsa->source_channels = channels;
@@ -227,6 +228,9 @@ static uint64 tsmf_alsa_get_latency(ITSMFAudioDevice* audio)
 
 static void tsmf_alsa_flush(ITSMFAudioDevice* audio)
 {
+	TSMFALSAAudioDevice* alsa = (TSMFALSAAudioDevice*) audio;
+
+	freerdp_dsp_context_reset_resampler(alsa->dsp_context);
 }
 
 static void tsmf_alsa_free(ITSMFAudioDevice* audio)
@@ -30,7 +30,6 @@
 #include <freerdp/utils/thread.h>
 #include <freerdp/utils/mutex.h>
 #include <freerdp/utils/event.h>
-#include <freerdp/utils/sleep.h>
 #include <freerdp/plugins/tsmf.h>
 
 #include "drdynvc_types.h"
@@ -44,6 +43,9 @@
 
 #define AUDIO_TOLERANCE 10000000LL
 
+/* number of video frames decoded ahead of presentation */
+#define TSMF_DECODE_AHEAD 4
+
 struct _TSMF_PRESENTATION
 {
 	uint8 presentation_id[GUID_SIZE];
@@ -102,10 +104,18 @@ struct _TSMF_STREAM
 
 	freerdp_thread* thread;
 
-	LIST* sample_list;
+	/**
+	 * Video decoders that return frames run on their own thread, which keeps up to
+	 * TSMF_DECODE_AHEAD frames in decoded_list so that presentation never waits on
+	 * decoding. Both lists are protected by the stream thread mutex, and generation
+	 * is bumped on flush to drop frames decoded from flushed samples.
+	 */
+	freerdp_thread* decode_thread;
+	boolean decode_ahead;
+	uint32 generation;
 
-	/* The sample ack response queue will be accessed only by the stream thread. */
-	LIST* sample_ack_list;
+	LIST* sample_list;
+	LIST* decoded_list;
 };
 
 struct _TSMF_SAMPLE
@@ -119,6 +129,8 @@ struct _TSMF_SAMPLE
 	uint8* data;
 	uint32 decoded_size;
 	uint32 pixfmt;
+	uint32 width;
+	uint32 height;
 
 	TSMF_STREAM* stream;
 	IWTSVirtualChannelCallback* channel_callback;
@@ -130,6 +142,17 @@ static uint64 last_played_audio_time = 0;
 static pthread_mutex_t tsmf_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int TERMINATING = 0;
 
+/**
+ * Pending acks of all streams are kept in a single heap ordered by ack_time and
+ * sent by one thread, which sleeps until the earliest one is due. The heap is
+ * protected by the ack thread mutex.
+ */
+static freerdp_thread* ack_thread = NULL;
+static int ack_thread_refs = 0;
+static TSMF_SAMPLE** ack_heap = NULL;
+static int ack_heap_size = 0;
+static int ack_heap_capacity = 0;
+
 static uint64 get_current_time(void)
 {
 	struct timeval tp;
@@ -145,8 +168,9 @@ static TSMF_SAMPLE* tsmf_stream_pop_sample(TSMF_STREAM* stream, int sync)
 	TSMF_SAMPLE* sample;
 	boolean pending = false;
 	TSMF_PRESENTATION* presentation = stream->presentation;
+	LIST* list = (stream->decode_ahead ? stream->decoded_list : stream->sample_list);
 
-	if (list_size(stream->sample_list) == 0)
+	if (list_size(list) == 0)
 		return NULL;
 
 	if (sync)
@@ -190,12 +214,16 @@ static TSMF_SAMPLE* tsmf_stream_pop_sample(TSMF_STREAM* stream, int sync)
 		return NULL;
 
 	freerdp_thread_lock(stream->thread);
-	sample = (TSMF_SAMPLE*) list_dequeue(stream->sample_list);
+	sample = (TSMF_SAMPLE*) list_dequeue(list);
 	freerdp_thread_unlock(stream->thread);
 
 	if (sample && sample->end_time > stream->last_end_time)
 		stream->last_end_time = sample->end_time;
 
+	/* room for one more frame to be decoded ahead */
+	if (sample && stream->decode_ahead)
+		freerdp_thread_signal(stream->decode_thread);
+
 	return sample;
 }
 
@@ -211,29 +239,186 @@ static void tsmf_sample_ack(TSMF_SAMPLE* sample)
 	tsmf_playback_ack(sample->channel_callback, sample->sample_id, sample->duration, sample->data_size);
 }
 
-static void tsmf_sample_queue_ack(TSMF_SAMPLE* sample)
+static void tsmf_ack_heap_push(TSMF_SAMPLE* sample)
 {
-	TSMF_STREAM* stream = sample->stream;
+	int i;
+	int parent;
+
+	if (ack_heap_size == ack_heap_capacity)
+	{
+		ack_heap_capacity = (ack_heap_capacity > 0 ? ack_heap_capacity * 2 : 64);
+		ack_heap = (TSMF_SAMPLE**) xrealloc(ack_heap, ack_heap_capacity * sizeof(TSMF_SAMPLE*));
+	}
+
+	for (i = ack_heap_size++; i > 0; i = parent)
+	{
+		parent = (i - 1) / 2;
+		if (ack_heap[parent]->ack_time <= sample->ack_time)
+			break;
+		ack_heap[i] = ack_heap[parent];
+	}
+	ack_heap[i] = sample;
+}
+
+static void tsmf_ack_heap_sift_down(int i)
+{
+	int child;
+	TSMF_SAMPLE* sample;
+
+	sample = ack_heap[i];
+	for (; (child = 2 * i + 1) < ack_heap_size; i = child)
+	{
+		if (child + 1 < ack_heap_size && ack_heap[child + 1]->ack_time < ack_heap[child]->ack_time)
+			child++;
+		if (sample->ack_time <= ack_heap[child]->ack_time)
+			break;
+		ack_heap[i] = ack_heap[child];
+	}
+	ack_heap[i] = sample;
+}
 
-	list_enqueue(stream->sample_ack_list, sample);
+static TSMF_SAMPLE* tsmf_ack_heap_pop(void)
+{
+	TSMF_SAMPLE* sample;
+
+	sample = ack_heap[0];
+	ack_heap[0] = ack_heap[--ack_heap_size];
+	if (ack_heap_size > 0)
+		tsmf_ack_heap_sift_down(0);
+
+	return sample;
 }
 
-static void tsmf_stream_process_ack(TSMF_STREAM* stream)
+static void* tsmf_ack_thread_func(void* arg)
 {
+	freerdp_thread* thread = (freerdp_thread*) arg;
 	TSMF_SAMPLE* sample;
 	uint64 ack_time;
+	int timeout;
 
-	ack_time = get_current_time();
-	while (list_size(stream->sample_ack_list) > 0 && !freerdp_thread_is_stopped(stream->thread))
+	while (1)
 	{
-		sample = (TSMF_SAMPLE*) list_peek(stream->sample_ack_list);
-		if (!sample || sample->ack_time > ack_time)
+		timeout = -1;
+
+		/* acks are sent under the lock so that a stream cannot go away under them */
+		freerdp_thread_lock(thread);
+		while (ack_heap_size > 0)
+		{
+			ack_time = get_current_time();
+			if (ack_heap[0]->ack_time > ack_time)
+			{
+				/* round up to whole milliseconds, times are in 100ns units */
+				timeout = (int) ((ack_heap[0]->ack_time - ack_time + 9999) / 10000);
+				break;
+			}
+			sample = tsmf_ack_heap_pop();
+			tsmf_sample_ack(sample);
+			tsmf_sample_free(sample);
+		}
+		freerdp_thread_unlock(thread);
+
+		freerdp_thread_wait_timeout(thread, timeout);
+
+		if (freerdp_thread_is_stopped(thread))
 			break;
 
-		sample = list_dequeue(stream->sample_ack_list);
-		tsmf_sample_ack(sample);
-		tsmf_sample_free(sample);
+		freerdp_thread_reset(thread);
 	}
+
+	freerdp_thread_quit(thread);
+
+	return NULL;
+}
+
+static void tsmf_ack_thread_ref(void)
+{
+	pthread_mutex_lock(&tsmf_mutex);
+	if (ack_thread_refs++ == 0)
+	{
+		ack_thread = freerdp_thread_new();
+		freerdp_thread_start(ack_thread, tsmf_ack_thread_func, ack_thread);
+	}
+	pthread_mutex_unlock(&tsmf_mutex);
+}
+
+static void tsmf_ack_thread_unref(void)
+{
+	pthread_mutex_lock(&tsmf_mutex);
+	if (--ack_thread_refs == 0)
+	{
+		freerdp_thread_stop(ack_thread);
+		freerdp_thread_free(ack_thread);
+		ack_thread = NULL;
+
+		while (ack_heap_size > 0)
+			tsmf_sample_free(tsmf_ack_heap_pop());
+		xfree(ack_heap);
+		ack_heap = NULL;
+		ack_heap_capacity = 0;
+	}
+	pthread_mutex_unlock(&tsmf_mutex);
+}
+
+static void tsmf_sample_queue_ack(TSMF_SAMPLE* sample)
+{
+	boolean earliest;
+
+	freerdp_thread_lock(ack_thread);
+	tsmf_ack_heap_push(sample);
+	earliest = (ack_heap[0] == sample);
+	freerdp_thread_unlock(ack_thread);
+
+	/* the ack thread only needs waking up when its next deadline moved */
+	if (earliest)
+		freerdp_thread_signal(ack_thread);
+}
+
+/* drops the pending acks of a stream */
+static void tsmf_stream_cancel_acks(TSMF_STREAM* stream)
+{
+	int i;
+	int n = 0;
+
+	freerdp_thread_lock(ack_thread);
+	for (i = 0; i < ack_heap_size; i++)
+	{
+		if (ack_heap[i]->stream == stream)
+			tsmf_sample_free(ack_heap[i]);
+		else
+			ack_heap[n++] = ack_heap[i];
+	}
+	ack_heap_size = n;
+	for (i = n / 2 - 1; i >= 0; i--)
+		tsmf_ack_heap_sift_down(i);
+	freerdp_thread_unlock(ack_thread);
+}
+
+/* sleeps until the system time t, returning early when the stream is stopped */
+static void tsmf_stream_wait_until(TSMF_STREAM* stream, uint64 t)
+{
+	uint64 now;
+
+	while (!freerdp_thread_is_stopped(stream->thread) && (now = get_current_time()) < t)
+	{
+		freerdp_thread_wait_timeout(stream->thread, (int) ((t - now + 9999) / 10000));
+		freerdp_thread_reset(stream->thread);
+	}
+}
+
+/* the other streams may be waiting for this one to move the presentation clock */
+static void tsmf_presentation_wake_streams(TSMF_PRESENTATION* presentation, TSMF_STREAM* stream)
+{
+	LIST_ITEM* item;
+	TSMF_STREAM* s;
+
+	freerdp_mutex_lock(presentation->mutex);
+	for (item = presentation->stream_list->head; item; item = item->next)
+	{
+		s = (TSMF_STREAM*) item->data;
+		if (s != stream)
+			freerdp_thread_signal(s->thread);
+	}
+	freerdp_mutex_unlock(presentation->mutex);
 }
 
 TSMF_PRESENTATION* tsmf_presentation_new(const uint8* guid, IWTSVirtualChannelCallback* pChannelCallback)
@@ -323,7 +508,7 @@ static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 			(sample->end_time >= presentation->audio_start_time ||
 			sample->end_time < stream->last_end_time))
 		{
-			freerdp_usleep((stream->next_start_time - t) / 10);
+			tsmf_stream_wait_until(stream, stream->next_start_time);
 		}
 		stream->next_start_time = t + sample->duration - 50000;
 
@@ -362,8 +547,8 @@ static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 		vevent->frame_data = sample->data;
 		vevent->frame_size = sample->decoded_size;
 		vevent->frame_pixfmt = sample->pixfmt;
-		vevent->frame_width = sample->stream->width;
-		vevent->frame_height = sample->stream->height;
+		vevent->frame_width = sample->width;
+		vevent->frame_height = sample->height;
 		vevent->x = presentation->output_x;
 		vevent->y = presentation->output_y;
 		vevent->width = presentation->output_width;
@@ -437,7 +622,8 @@ static void tsmf_sample_playback_audio(TSMF_SAMPLE* sample)
 	stream->presentation->audio_end_time = sample->end_time + latency;
 }
 
-static void tsmf_sample_playback(TSMF_SAMPLE* sample)
+/* decodes a sample, the decoded data replaces the sample data when the decoder returns it */
+static boolean tsmf_sample_decode(TSMF_SAMPLE* sample)
 {
 	boolean ret = false;
 	uint32 width;
@@ -455,11 +641,7 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
 	}
 
 	if (!ret)
-	{
-		tsmf_sample_ack(sample);
-		tsmf_sample_free(sample);
-		return;
-	}
+		return false;
 
 	xfree(sample->data);
 	sample->data = NULL;
@@ -470,11 +652,7 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
 		{
 			pixfmt = stream->decoder->GetDecodedFormat(stream->decoder);
 			if (pixfmt == ((uint32) -1))
-			{
-				tsmf_sample_ack(sample);
-				tsmf_sample_free(sample);
-				return;
-			}
+				return false;
 			sample->pixfmt = pixfmt;
 		}
 
@@ -489,11 +667,23 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
 				stream->height = height;
 			}
 		}
+		sample->width = stream->width;
+		sample->height = stream->height;
 	}
 
 	if (stream->decoder->GetDecodedData)
-	{
 		sample->data = stream->decoder->GetDecodedData(stream->decoder, &sample->decoded_size);
+
+	return true;
+}
+
+/* presents a decoded sample and schedules its ack */
+static void tsmf_sample_present(TSMF_SAMPLE* sample)
+{
+	TSMF_STREAM* stream = sample->stream;
+
+	if (stream->decoder->GetDecodedData)
+	{
 		switch (sample->stream->major_type)
 		{
 			case TSMF_MAJOR_TYPE_VIDEO:
@@ -615,6 +805,78 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
         }
 }
 
+static void tsmf_sample_playback(TSMF_SAMPLE* sample)
+{
+	if (!tsmf_sample_decode(sample))
+	{
+		tsmf_sample_ack(sample);
+		tsmf_sample_free(sample);
+		return;
+	}
+
+	tsmf_sample_present(sample);
+}
+
+static void* tsmf_stream_decode_func(void* arg)
+{
+	TSMF_SAMPLE* sample;
+	TSMF_STREAM* stream = (TSMF_STREAM*) arg;
+	uint32 generation;
+	boolean stopped;
+
+	DEBUG_DVC("in %d", stream->stream_id);
+
+	while (1)
+	{
+		/* on stop, what is left is decoded only when the stream has ended */
+		stopped = freerdp_thread_is_stopped(stream->decode_thread);
+		if (stopped && !stream->eos && !stream->presentation->eos)
+			break;
+
+		sample = NULL;
+		freerdp_thread_lock(stream->thread);
+		if (stopped || list_size(stream->decoded_list) < TSMF_DECODE_AHEAD)
+			sample = (TSMF_SAMPLE*) list_dequeue(stream->sample_list);
+		generation = stream->generation;
+		freerdp_thread_unlock(stream->thread);
+
+		if (!sample)
+		{
+			if (stopped)
+				break;
+			freerdp_thread_wait(stream->decode_thread);
+			freerdp_thread_reset(stream->decode_thread);
+			continue;
+		}
+
+		if (!tsmf_sample_decode(sample))
+		{
+			tsmf_sample_ack(sample);
+			tsmf_sample_free(sample);
+			continue;
+		}
+
+		freerdp_thread_lock(stream->thread);
+		if (generation == stream->generation)
+		{
+			list_enqueue(stream->decoded_list, sample);
+			sample = NULL;
+		}
+		freerdp_thread_unlock(stream->thread);
+
+		if (sample)
+			tsmf_sample_free(sample); /* flushed while being decoded */
+		else
+			freerdp_thread_signal(stream->thread);
+	}
+
+	freerdp_thread_quit(stream->decode_thread);
+
+	DEBUG_DVC("out %d", stream->stream_id);
+
+	return NULL;
+}
+
 static void* tsmf_stream_playback_func(void* arg)
 {
 	TSMF_SAMPLE* sample;
@@ -641,19 +903,32 @@ static void* tsmf_stream_playback_func(void* arg)
 			}
 		}
 	}
+	/* woken up by new samples, decoded frames and the progress of the other streams */
 	while (!freerdp_thread_is_stopped(stream->thread))
 	{
-		tsmf_stream_process_ack(stream);
 		sample = tsmf_stream_pop_sample(stream, 1);
 		if (sample)
-			tsmf_sample_playback(sample);
-		else
-			freerdp_usleep(5000);
+		{
+			if (stream->decode_ahead)
+				tsmf_sample_present(sample);
+			else
+				tsmf_sample_playback(sample);
+			tsmf_presentation_wake_streams(presentation, stream);
+			continue;
+		}
+
+		freerdp_thread_wait(stream->thread);
+		freerdp_thread_reset(stream->thread);
 	}
 	if (stream->eos || presentation->eos)
 	{
 		while ((sample = tsmf_stream_pop_sample(stream, 1)) != NULL)
-			tsmf_sample_playback(sample);
+		{
+			if (stream->decode_ahead)
+				tsmf_sample_present(sample);
+			else
+				tsmf_sample_playback(sample);
+		}
 	}
 	if (stream->audio)
 	{
@@ -672,6 +947,10 @@ static void tsmf_stream_start(TSMF_STREAM* stream)
 {
 	if (!freerdp_thread_is_running(stream->thread))
 	{
+		stream->decode_ahead = (stream->major_type == TSMF_MAJOR_TYPE_VIDEO &&
+			stream->decoder && stream->decoder->GetDecodedData);
+		if (stream->decode_ahead)
+			freerdp_thread_start(stream->decode_thread, tsmf_stream_decode_func, stream);
 		freerdp_thread_start(stream->thread, tsmf_stream_playback_func, stream);
 	}
 }
@@ -684,6 +963,11 @@ static void tsmf_stream_stop(TSMF_STREAM* stream)
 	if (!stream->decoder)
 		return;
 
+	/* the decoder thread goes first, so that an ended stream is fully decoded for playback */
+	if (freerdp_thread_is_running(stream->decode_thread))
+	{
+		freerdp_thread_stop(stream->decode_thread);
+	}
 	if (freerdp_thread_is_running(stream->thread))
 	{
 		freerdp_thread_stop(stream->thread);
@@ -837,11 +1121,15 @@ static void tsmf_stream_flush(TSMF_STREAM* stream)
 {
 	TSMF_SAMPLE* sample;
 
-	while ((sample = tsmf_stream_pop_sample(stream, 0)) != NULL)
+	freerdp_thread_lock(stream->thread);
+	while ((sample = list_dequeue(stream->sample_list)) != NULL)
 		tsmf_sample_free(sample);
-
-	while ((sample = list_dequeue(stream->sample_ack_list)) != NULL)
+	while ((sample = list_dequeue(stream->decoded_list)) != NULL)
 		tsmf_sample_free(sample);
+	stream->generation++;
+	freerdp_thread_unlock(stream->thread);
+
+	tsmf_stream_cancel_acks(stream);
 
 	if (stream->audio)
 		stream->audio->Flush(stream->audio);
@@ -909,8 +1197,11 @@ TSMF_STREAM* tsmf_stream_new(TSMF_PRESENTATION* presentation, uint32 stream_id)
 	stream->stream_id = stream_id;
 	stream->presentation = presentation;
 	stream->thread = freerdp_thread_new();
+	stream->decode_thread = freerdp_thread_new();
 	stream->sample_list = list_new();
-	stream->sample_ack_list = list_new();
+	stream->decoded_list = list_new();
+
+	tsmf_ack_thread_ref();
 
 	freerdp_mutex_lock(presentation->mutex);
 	list_enqueue(presentation->stream_list, stream);
@@ -974,6 +1265,8 @@ void tsmf_stream_end(TSMF_STREAM* stream)
 {
 	stream->eos = 1;
 	stream->presentation->eos = 1;
+
+	tsmf_presentation_wake_streams(stream->presentation, NULL);
 }
 
 void tsmf_stream_free(TSMF_STREAM* stream)
@@ -988,7 +1281,7 @@ void tsmf_stream_free(TSMF_STREAM* stream)
 	freerdp_mutex_unlock(presentation->mutex);
 
 	list_free(stream->sample_list);
-	list_free(stream->sample_ack_list);
+	list_free(stream->decoded_list);
 
 	if (stream->decoder)
 	{
@@ -997,6 +1290,9 @@ void tsmf_stream_free(TSMF_STREAM* stream)
 	}
 
 	freerdp_thread_free(stream->thread);
+	freerdp_thread_free(stream->decode_thread);
+
+	tsmf_ack_thread_unref();
 
 	xfree(stream);
 	stream = 0;
@@ -1031,6 +1327,11 @@ void tsmf_stream_push_sample(TSMF_STREAM* stream, IWTSVirtualChannelCallback* pC
 	freerdp_thread_lock(stream->thread);
 	list_enqueue(stream->sample_list, sample);
 	freerdp_thread_unlock(stream->thread);
+
+	if (stream->decode_ahead)
+		freerdp_thread_signal(stream->decode_thread);
+	else
+		freerdp_thread_signal(stream->thread);
 }
 
 static void tsmf_signal_handler(int s)
@@ -58,7 +58,7 @@ void devman_free(DEVMAN* devman)
 
 static void devman_register_device(DEVMAN* devman, DEVICE* device)
 {
-	device->id = devman->id_sequence++;
+	device->id = devman_next_id(devman);
 	list_add(devman->devices, device);
 
 	DEBUG_SVC("device %d.%s registered", device->id, device->name);
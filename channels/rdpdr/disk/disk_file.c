@@ -295,6 +295,64 @@ DISK_FILE* disk_file_new(const char* base_path, const char* path, uint32 id,
 	return file;
 }
 
+static void disk_file_free_entries(DISK_FILE* file)
+{
+	int i;
+
+	for (i = 0; i < file->num_entries; i++)
+		xfree(file->entries[i].name);
+	xfree(file->entries);
+
+	file->entries = NULL;
+	file->num_entries = 0;
+	file->next_entry = 0;
+}
+
+/**
+ * Read the whole directory once, keeping the entries that match the query
+ * pattern together with their stat data, so that the one-entry-per-request
+ * enumeration done by the server does not rescan and restat the directory.
+ */
+static void disk_file_load_entries(DISK_FILE* file)
+{
+	struct dirent* ent;
+	DISK_DIR_ENTRY* entry;
+	int size = 0;
+#ifndef FSTATAT
+	char* ent_path;
+#endif
+
+	disk_file_free_entries(file);
+	rewinddir(file->dir);
+
+	while ((ent = readdir(file->dir)) != NULL)
+	{
+		if (file->pattern && !disk_file_wildcard_match(file->pattern, ent->d_name))
+			continue;
+
+		if (file->num_entries == size)
+		{
+			size = (size > 0 ? size * 2 : 32);
+			file->entries = (DISK_DIR_ENTRY*) xrealloc(file->entries, size * sizeof(DISK_DIR_ENTRY));
+		}
+
+		entry = &file->entries[file->num_entries++];
+		entry->name = xstrdup(ent->d_name);
+		memset(&entry->st, 0, sizeof(struct STAT));
+
+#ifdef FSTATAT
+		if (FSTATAT(dirfd(file->dir), ent->d_name, &entry->st, 0) != 0)
+			DEBUG_WARN("stat %s/%s failed. errno = %d", file->fullpath, ent->d_name, errno);
+#else
+		ent_path = xmalloc(strlen(file->fullpath) + strlen(ent->d_name) + 2);
+		sprintf(ent_path, "%s/%s", file->fullpath, ent->d_name);
+		if (STAT(ent_path, &entry->st) != 0)
+			DEBUG_WARN("stat %s failed. errno = %d", ent_path, errno);
+		xfree(ent_path);
+#endif
+	}
+}
+
 void disk_file_free(DISK_FILE* file)
 {
 	if (file->fd != -1)
@@ -310,38 +368,50 @@ void disk_file_free(DISK_FILE* file)
 			unlink(file->fullpath);
 	}
 
+	disk_file_free_entries(file);
 	xfree(file->pattern);
 	xfree(file->fullpath);
 	xfree(file);
 }
 
-boolean disk_file_seek(DISK_FILE* file, uint64 Offset)
-{
-	if (file->is_dir || file->fd == -1)
-		return false;
-
-	if (LSEEK(file->fd, Offset, SEEK_SET) == (off_t)-1)
-		return false;
-
-	return true;
-}
-
-boolean disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length)
+/* positional I/O leaves the file offset alone, so requests on one file need no seek */
+boolean disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length, uint64 Offset)
 {
 	ssize_t r;
 
 	if (file->is_dir || file->fd == -1)
 		return false;
 
-	r = read(file->fd, buffer, *Length);
+	r = PREAD(file->fd, buffer, *Length, Offset);
 	if (r < 0)
 		return false;
 	*Length = (uint32)r;
 
+#ifdef HAVE_POSIX_FADVISE
+	/* a client copying a file reads it front to back: widen kernel readahead and
+	 * start fetching the following chunks while this one is being sent */
+	if (Offset > 0 && Offset == file->next_offset)
+	{
+		if (!file->sequential)
+		{
+			posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			file->sequential = true;
+		}
+		if (r > 0)
+			posix_fadvise(file->fd, Offset + r, (off_t)r * 4, POSIX_FADV_WILLNEED);
+	}
+	else if (file->sequential)
+	{
+		posix_fadvise(file->fd, 0, 0, POSIX_FADV_NORMAL);
+		file->sequential = false;
+	}
+#endif
+	file->next_offset = Offset + r;
+
 	return true;
 }
 
-boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length)
+boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length, uint64 Offset)
 {
 	ssize_t r;
 
@@ -350,11 +420,12 @@ boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length)
 
 	while (Length > 0)
 	{
-		r = write(file->fd, buffer, Length);
+		r = PWRITE(file->fd, buffer, Length, Offset);
 		if (r == -1)
 			return false;
 		Length -= r;
 		buffer += r;
+		Offset += r;
 	}
 
 	return true;
@@ -510,7 +581,7 @@ boolean disk_file_set_information(DISK_FILE* file, uint32 FsInformationClass, ui
 boolean disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint8 InitialQuery,
 	const char* path, STREAM* output)
 {
-	struct dirent* ent;
+	DISK_DIR_ENTRY* entry;
 	char* ent_path;
 	struct STAT st;
 	UNICONV* uniconv;
@@ -528,7 +599,6 @@ boolean disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, ui
 
 	if (InitialQuery != 0)
 	{
-		rewinddir(file->dir);
 		xfree(file->pattern);
 
 		if (path[0])
@@ -537,24 +607,10 @@ boolean disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, ui
 			file->pattern = NULL;
 	}
 
-	if (file->pattern)
-	{
-		do
-		{
-			ent = readdir(file->dir);
-			if (ent == NULL)
-				continue;
+	if (InitialQuery != 0 || file->entries == NULL)
+		disk_file_load_entries(file);
 
-			if (disk_file_wildcard_match(file->pattern, ent->d_name))
-				break;
-		} while (ent);
-	}
-	else
-	{
-		ent = readdir(file->dir);
-	}
-
-	if (ent == NULL)
+	if (file->next_entry >= file->num_entries)
 	{
 		DEBUG_SVC("  pattern %s not found.", file->pattern);
 		stream_write_uint32(output, 0); /* Length */
@@ -562,19 +618,13 @@ boolean disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, ui
 		return false;
 	}
 
-	memset(&st, 0, sizeof(struct STAT));
-	ent_path = xmalloc(strlen(file->fullpath) + strlen(ent->d_name) + 2);
-	sprintf(ent_path, "%s/%s", file->fullpath, ent->d_name);
-	if (STAT(ent_path, &st) != 0)
-	{
-		DEBUG_WARN("stat %s failed. errno = %d", ent_path, errno);
-	}
+	entry = &file->entries[file->next_entry++];
+	st = entry->st;
 
-	DEBUG_SVC("  pattern %s matched %s", file->pattern, ent_path);
-	xfree(ent_path);
+	DEBUG_SVC("  pattern %s matched %s", file->pattern, entry->name);
 
 	uniconv = freerdp_uniconv_new();
-	ent_path = freerdp_uniconv_out(uniconv, ent->d_name, &len);
+	ent_path = freerdp_uniconv_out(uniconv, entry->name, &len);
 	freerdp_uniconv_free(uniconv);
 
 	ret = true;
@@ -30,20 +30,28 @@
 #define STAT stat
 #define OPEN open
 #define LSEEK lseek
+#define PREAD pread
+#define PWRITE pwrite
 #define FSTAT fstat
 #define STATVFS statvfs
 #elif defined(__APPLE__) || defined(__FreeBSD__)
 #define STAT stat
 #define OPEN open
 #define LSEEK lseek
+#define PREAD pread
+#define PWRITE pwrite
 #define FSTAT fstat
+#define FSTATAT fstatat
 #define STATVFS statvfs
 #define O_LARGEFILE 0
 #else
 #define STAT stat64
 #define OPEN open64
 #define LSEEK lseek64
+#define PREAD pread64
+#define PWRITE pwrite64
 #define FSTAT fstat64
+#define FSTATAT fstatat64
 #define STATVFS statvfs64
 #endif
 
@@ -64,10 +72,19 @@
 
 
 
+typedef struct _DISK_DIR_ENTRY DISK_DIR_ENTRY;
+struct _DISK_DIR_ENTRY
+{
+	char* name;
+	struct STAT st;
+};
+
 typedef struct _DISK_FILE DISK_FILE;
 struct _DISK_FILE
 {
 	uint32 id;
+	DISK_FILE* hash_next; /* chain in the device's FileId table */
+
 	boolean is_dir;
 	int fd;
 	int err;
@@ -77,15 +94,22 @@ struct _DISK_FILE
 	char* filename;
 	char* pattern;
 	boolean delete_pending;
+
+	/* matching entries of a directory, captured on the initial query */
+	DISK_DIR_ENTRY* entries;
+	int num_entries;
+	int next_entry;
+
+	uint64 next_offset; /* where a sequential read would continue */
+	boolean sequential;
 };
 
 DISK_FILE* disk_file_new(const char* base_path, const char* path, uint32 id,
 	uint32 DesiredAccess, uint32 CreateDisposition, uint32 CreateOptions);
 void disk_file_free(DISK_FILE* file);
 
-boolean disk_file_seek(DISK_FILE* file, uint64 Offset);
-boolean disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length);
-boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length);
+boolean disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length, uint64 Offset);
+boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length, uint64 Offset);
 boolean disk_file_query_information(DISK_FILE* file, uint32 FsInformationClass, STREAM* output);
 boolean disk_file_set_information(DISK_FILE* file, uint32 FsInformationClass, uint32 Length, STREAM* input);
 boolean disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint8 InitialQuery,
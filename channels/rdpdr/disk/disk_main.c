@@ -36,6 +36,8 @@
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/unicode.h>
 #include <freerdp/utils/list.h>
+#include <freerdp/utils/mutex.h>
+#include <freerdp/utils/wait_obj.h>
 #include <freerdp/utils/thread.h>
 #include <freerdp/utils/svc_plugin.h>
 
@@ -43,16 +45,43 @@
 #include "rdpdr_types.h"
 #include "disk_file.h"
 
+/* IRPs on different files are served by up to DISK_MAX_WORKERS threads */
+#define DISK_MAX_WORKERS	4
+/* disk_irp_request blocks while this many IRPs are queued or in progress */
+#define DISK_MAX_PENDING	64
+/* buckets of the open file table, a power of two */
+#define DISK_FILE_TABLE_SIZE	256
+/* larger read requests are answered with a short read */
+#define DISK_MAX_READ_LENGTH	0x100000
+
 typedef struct _DISK_DEVICE DISK_DEVICE;
+
+typedef struct _DISK_WORKER DISK_WORKER;
+struct _DISK_WORKER
+{
+	DISK_DEVICE* disk;
+	freerdp_thread* thread;
+
+	boolean active; /* signalled or draining the queue */
+	boolean busy; /* processing an IRP on FileId */
+	uint32 FileId;
+};
+
 struct _DISK_DEVICE
 {
 	DEVICE device;
 
 	char* path;
-	LIST* files;
+	DISK_FILE* files[DISK_FILE_TABLE_SIZE];
 
+	/* protects files, irp_list, pending and the workers */
+	freerdp_mutex mutex;
 	LIST* irp_list;
-	freerdp_thread* thread;
+	int pending;
+	struct wait_obj* queue_space;
+
+	int num_workers;
+	DISK_WORKER workers[DISK_MAX_WORKERS];
 
 	DEVMAN* devman;
 	pcRegisterDevice UnregisterDevice;
@@ -93,16 +122,39 @@ disk_map_posix_err(int fs_errno)
 
 static DISK_FILE* disk_get_file_by_id(DISK_DEVICE* disk, uint32 id)
 {
-	LIST_ITEM* item;
 	DISK_FILE* file;
 
-	for (item = disk->files->head; item; item = item->next)
-	{
-		file = (DISK_FILE*)item->data;
-		if (file->id == id)
-			return file;
-	}
-	return NULL;
+	freerdp_mutex_lock(disk->mutex);
+	file = disk->files[id & (DISK_FILE_TABLE_SIZE - 1)];
+	while (file != NULL && file->id != id)
+		file = file->hash_next;
+	freerdp_mutex_unlock(disk->mutex);
+
+	return file;
+}
+
+static void disk_add_file(DISK_DEVICE* disk, DISK_FILE* file)
+{
+	DISK_FILE** bucket;
+
+	freerdp_mutex_lock(disk->mutex);
+	bucket = &disk->files[file->id & (DISK_FILE_TABLE_SIZE - 1)];
+	file->hash_next = *bucket;
+	*bucket = file;
+	freerdp_mutex_unlock(disk->mutex);
+}
+
+static void disk_remove_file(DISK_DEVICE* disk, DISK_FILE* file)
+{
+	DISK_FILE** link;
+
+	freerdp_mutex_lock(disk->mutex);
+	link = &disk->files[file->id & (DISK_FILE_TABLE_SIZE - 1)];
+	while (*link != NULL && *link != file)
+		link = &(*link)->hash_next;
+	if (*link != NULL)
+		*link = file->hash_next;
+	freerdp_mutex_unlock(disk->mutex);
 }
 
 static void disk_process_irp_create(DISK_DEVICE* disk, IRP* irp)
@@ -127,7 +179,7 @@ static void disk_process_irp_create(DISK_DEVICE* disk, IRP* irp)
 	path = freerdp_uniconv_in(uniconv, stream_get_tail(irp->input), PathLength);
 	freerdp_uniconv_free(uniconv);
 
-	FileId = irp->devman->id_sequence++;
+	FileId = devman_next_id(irp->devman);
 
 	file = disk_file_new(disk->path, path, FileId,
 		DesiredAccess, CreateDisposition, CreateOptions);
@@ -151,7 +203,7 @@ static void disk_process_irp_create(DISK_DEVICE* disk, IRP* irp)
 	}
 	else
 	{
-		list_enqueue(disk->files, file);
+		disk_add_file(disk, file);
 
 		switch (CreateDisposition)
 		{
@@ -198,7 +250,7 @@ static void disk_process_irp_close(DISK_DEVICE* disk, IRP* irp)
 	{
 		DEBUG_SVC("%s(%d) closed.", file->fullpath, file->id);
 
-		list_remove(disk->files, file);
+		disk_remove_file(disk, file);
 		disk_file_free(file);
 	}
 
@@ -212,7 +264,7 @@ static void disk_process_irp_read(DISK_DEVICE* disk, IRP* irp)
 	DISK_FILE* file;
 	uint32 Length;
 	uint64 Offset;
-	uint8* buffer = NULL;
+	int pos;
 
 	stream_read_uint32(irp->input, Length);
 	stream_read_uint64(irp->input, Offset);
@@ -226,21 +278,19 @@ static void disk_process_irp_read(DISK_DEVICE* disk, IRP* irp)
 
 		DEBUG_WARN("FileId %d not valid.", irp->FileId);
 	}
-	else if (!disk_file_seek(file, Offset))
-	{
-		irp->IoStatus = STATUS_UNSUCCESSFUL;
-		Length = 0;
-
-		DEBUG_WARN("seek %s(%d) failed.", file->fullpath, file->id);
-	}
 	else
 	{
-		buffer = (uint8*)xmalloc(Length);
-		if (!disk_file_read(file, buffer, &Length))
+		if (Length > DISK_MAX_READ_LENGTH)
+			Length = DISK_MAX_READ_LENGTH;
+
+		/* read straight into the response, after the Length field */
+		pos = stream_get_pos(irp->output);
+		stream_check_size(irp->output, (size_t) Length + 4);
+		stream_set_pos(irp->output, pos + 4);
+
+		if (!disk_file_read(file, stream_get_tail(irp->output), &Length, Offset))
 		{
 			irp->IoStatus = STATUS_UNSUCCESSFUL;
-			xfree(buffer);
-			buffer = NULL;
 			Length = 0;
 
 			DEBUG_WARN("read %s(%d) failed.", file->fullpath, file->id);
@@ -249,15 +299,12 @@ static void disk_process_irp_read(DISK_DEVICE* disk, IRP* irp)
 		{
 			DEBUG_SVC("read %llu-%llu from %s(%d).", Offset, Offset + Length, file->fullpath, file->id);
 		}
+
+		stream_set_pos(irp->output, pos);
 	}
 
 	stream_write_uint32(irp->output, Length);
-	if (Length > 0)
-	{
-		stream_check_size(irp->output, Length);
-		stream_write(irp->output, buffer, Length);
-	}
-	xfree(buffer);
+	stream_seek(irp->output, Length);
 
 	irp->Complete(irp);
 }
@@ -281,14 +328,7 @@ static void disk_process_irp_write(DISK_DEVICE* disk, IRP* irp)
 
 		DEBUG_WARN("FileId %d not valid.", irp->FileId);
 	}
-	else if (!disk_file_seek(file, Offset))
-	{
-		irp->IoStatus = STATUS_UNSUCCESSFUL;
-		Length = 0;
-
-		DEBUG_WARN("seek %s(%d) failed.", file->fullpath, file->id);
-	}
-	else if (!disk_file_write(file, stream_get_tail(irp->input), Length))
+	else if (!disk_file_write(file, stream_get_tail(irp->input), Length, Offset))
 	{
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 		Length = 0;
@@ -572,42 +612,87 @@ static void disk_process_irp(DISK_DEVICE* disk, IRP* irp)
 	}
 }
 
-static void disk_process_irp_list(DISK_DEVICE* disk)
+/**
+ * Pick the first queued IRP whose file is not being worked on by another
+ * worker, so requests on the same FileId complete in the order they came in.
+ * Must be called with disk->mutex held.
+ */
+static IRP* disk_dequeue_runnable_irp(DISK_DEVICE* disk)
+{
+	LIST_ITEM* item;
+	IRP* irp;
+	int i;
+
+	for (item = disk->irp_list->head; item; item = item->next)
+	{
+		irp = (IRP*)item->data;
+
+		if (irp->FileId != 0)
+		{
+			for (i = 0; i < disk->num_workers; i++)
+			{
+				if (disk->workers[i].busy && disk->workers[i].FileId == irp->FileId)
+					break;
+			}
+			if (i < disk->num_workers)
+				continue;
+		}
+
+		list_remove(disk->irp_list, irp);
+		return irp;
+	}
+
+	return NULL;
+}
+
+static void disk_process_irp_list(DISK_WORKER* worker)
 {
+	DISK_DEVICE* disk = worker->disk;
 	IRP* irp;
 
 	while (1)
 	{
-		if (freerdp_thread_is_stopped(disk->thread))
+		if (freerdp_thread_is_stopped(worker->thread))
 			break;
 
-		freerdp_thread_lock(disk->thread);
-		irp = (IRP*)list_dequeue(disk->irp_list);
-		freerdp_thread_unlock(disk->thread);
-
+		freerdp_mutex_lock(disk->mutex);
+		irp = disk_dequeue_runnable_irp(disk);
 		if (irp == NULL)
+		{
+			worker->active = false;
+			freerdp_mutex_unlock(disk->mutex);
 			break;
+		}
+		worker->busy = true;
+		worker->FileId = irp->FileId;
+		freerdp_mutex_unlock(disk->mutex);
 
 		disk_process_irp(disk, irp);
+
+		freerdp_mutex_lock(disk->mutex);
+		worker->busy = false;
+		disk->pending--;
+		wait_obj_set(disk->queue_space);
+		freerdp_mutex_unlock(disk->mutex);
 	}
 }
 
 static void* disk_thread_func(void* arg)
 {
-	DISK_DEVICE* disk = (DISK_DEVICE*)arg;
+	DISK_WORKER* worker = (DISK_WORKER*)arg;
 
 	while (1)
 	{
-		freerdp_thread_wait(disk->thread);
+		freerdp_thread_wait(worker->thread);
 
-		if (freerdp_thread_is_stopped(disk->thread))
+		if (freerdp_thread_is_stopped(worker->thread))
 			break;
 
-		freerdp_thread_reset(disk->thread);
-		disk_process_irp_list(disk);
+		freerdp_thread_reset(worker->thread);
+		disk_process_irp_list(worker);
 	}
 
-	freerdp_thread_quit(disk->thread);
+	freerdp_thread_quit(worker->thread);
 
 	return NULL;
 }
@@ -615,12 +700,47 @@ static void* disk_thread_func(void* arg)
 static void disk_irp_request(DEVICE* device, IRP* irp)
 {
 	DISK_DEVICE* disk = (DISK_DEVICE*)device;
+	DISK_WORKER* worker = NULL;
+	int i;
+
+	freerdp_mutex_lock(disk->mutex);
+
+	while (disk->pending >= DISK_MAX_PENDING)
+	{
+		wait_obj_clear(disk->queue_space);
+		freerdp_mutex_unlock(disk->mutex);
+		wait_obj_select(&disk->queue_space, 1, -1);
+		freerdp_mutex_lock(disk->mutex);
+	}
 
-	freerdp_thread_lock(disk->thread);
 	list_enqueue(disk->irp_list, irp);
-	freerdp_thread_unlock(disk->thread);
+	disk->pending++;
 
-	freerdp_thread_signal(disk->thread);
+	for (i = 0; i < disk->num_workers; i++)
+	{
+		if (!disk->workers[i].active)
+		{
+			worker = &disk->workers[i];
+			break;
+		}
+	}
+
+	if (worker == NULL && disk->num_workers < DISK_MAX_WORKERS)
+	{
+		worker = &disk->workers[disk->num_workers++];
+		worker->disk = disk;
+		worker->thread = freerdp_thread_new();
+		freerdp_thread_start(worker->thread, disk_thread_func, worker);
+	}
+
+	/* with every worker active, the IRP is picked up when one drains its queue */
+	if (worker != NULL)
+		worker->active = true;
+
+	freerdp_mutex_unlock(disk->mutex);
+
+	if (worker != NULL)
+		freerdp_thread_signal(worker->thread);
 }
 
 static void disk_free(DEVICE* device)
@@ -628,17 +748,29 @@ static void disk_free(DEVICE* device)
 	DISK_DEVICE* disk = (DISK_DEVICE*)device;
 	IRP* irp;
 	DISK_FILE* file;
+	int i;
 
-	freerdp_thread_stop(disk->thread);
-	freerdp_thread_free(disk->thread);
+	for (i = 0; i < disk->num_workers; i++)
+	{
+		freerdp_thread_stop(disk->workers[i].thread);
+		freerdp_thread_free(disk->workers[i].thread);
+	}
 
 	while ((irp = (IRP*)list_dequeue(disk->irp_list)) != NULL)
 		irp->Discard(irp);
 	list_free(disk->irp_list);
 
-	while ((file = (DISK_FILE*)list_dequeue(disk->files)) != NULL)
-		disk_file_free(file);
-	list_free(disk->files);
+	for (i = 0; i < DISK_FILE_TABLE_SIZE; i++)
+	{
+		while ((file = disk->files[i]) != NULL)
+		{
+			disk->files[i] = file->hash_next;
+			disk_file_free(file);
+		}
+	}
+
+	wait_obj_free(disk->queue_space);
+	freerdp_mutex_free(disk->mutex);
 	xfree(disk);
 }
 
@@ -667,14 +799,12 @@ int DeviceServiceEntry(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints)
 			stream_write_uint8(disk->device.data, name[i] < 0 ? '_' : name[i]);
 
 		disk->path = path;
-		disk->files = list_new();
 
+		disk->mutex = freerdp_mutex_new();
 		disk->irp_list = list_new();
-		disk->thread = freerdp_thread_new();
+		disk->queue_space = wait_obj_new();
 
 		pEntryPoints->RegisterDevice(pEntryPoints->devman, (DEVICE*)disk);
-
-		freerdp_thread_start(disk->thread, disk_thread_func, disk);
 	}
 
 	return 0;
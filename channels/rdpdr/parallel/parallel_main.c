@@ -72,7 +72,7 @@ static void parallel_process_irp_create(PARALLEL_DEVICE* parallel, IRP* irp)
 	path = freerdp_uniconv_in(uniconv, stream_get_tail(irp->input), PathLength);
 	freerdp_uniconv_free(uniconv);
 
-	parallel->id = irp->devman->id_sequence++;
+	parallel->id = devman_next_id(irp->devman);
 	parallel->file = open(parallel->path, O_RDWR);
 	if (parallel->file < 0)
 	{
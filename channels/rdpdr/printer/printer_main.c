@@ -52,7 +52,7 @@ static void printer_process_irp_create(PRINTER_DEVICE* printer_dev, IRP* irp)
 	rdpPrintJob* printjob = NULL;
 
 	if (printer_dev->printer != NULL)
-		printjob = printer_dev->printer->CreatePrintJob(printer_dev->printer, irp->devman->id_sequence++);
+		printjob = printer_dev->printer->CreatePrintJob(printer_dev->printer, devman_next_id(irp->devman));
 
 	if (printjob != NULL)
 	{
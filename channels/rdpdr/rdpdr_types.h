@@ -26,6 +26,10 @@
 #include <freerdp/utils/list.h>
 #include <freerdp/utils/svc_plugin.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 typedef struct _DEVICE DEVICE;
 typedef struct _IRP IRP;
 typedef struct _DEVMAN DEVMAN;
@@ -72,6 +76,13 @@ struct _DEVMAN
 	LIST* devices;
 };
 
+/* takes the next device or file id; devices call it from their own threads */
+#ifdef _WIN32
+#define devman_next_id(_devman) ((uint32) InterlockedIncrement((LONG volatile*) &(_devman)->id_sequence) - 1)
+#else
+#define devman_next_id(_devman) __sync_fetch_and_add(&(_devman)->id_sequence, 1)
+#endif
+
 typedef void (*pcRegisterDevice)(DEVMAN* devman, DEVICE* device);
 
 struct _DEVICE_SERVICE_ENTRY_POINTS
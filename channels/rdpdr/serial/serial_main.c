@@ -91,7 +91,7 @@ static void serial_process_irp_create(SERIAL_DEVICE* serial, IRP* irp)
 	path = freerdp_uniconv_in(uniconv, stream_get_tail(irp->input), PathLength);
 	freerdp_uniconv_free(uniconv);
 
-	FileId = irp->devman->id_sequence++;
+	FileId = devman_next_id(irp->devman);
 
 	tty = serial_tty_new(serial->path, FileId);
 	if (tty == NULL)
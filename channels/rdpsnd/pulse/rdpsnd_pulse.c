@@ -472,6 +472,24 @@ static void rdpsnd_pulse_play(rdpsndDevicePlugin* device, uint8* data, int size)
 	pa_threaded_mainloop_unlock(pulse->mainloop);
 }
 
+static int rdpsnd_pulse_get_latency(rdpsndDevicePlugin* device)
+{
+	rdpsndPulsePlugin* pulse = (rdpsndPulsePlugin*)device;
+	pa_usec_t usec;
+	int negative;
+	int latency = -1;
+
+	if (!pulse->stream)
+		return -1;
+
+	pa_threaded_mainloop_lock(pulse->mainloop);
+	if (pa_stream_get_latency(pulse->stream, &usec, &negative) == 0)
+		latency = (negative ? 0 : (int) (usec / 1000));
+	pa_threaded_mainloop_unlock(pulse->mainloop);
+
+	return latency;
+}
+
 static void rdpsnd_pulse_start(rdpsndDevicePlugin* device)
 {
 	rdpsndPulsePlugin* pulse = (rdpsndPulsePlugin*)device;
@@ -497,6 +515,7 @@ int FreeRDPRdpsndDeviceEntry(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS pEntryPoints)
 	pulse->device.Start = rdpsnd_pulse_start;
 	pulse->device.Close = rdpsnd_pulse_close;
 	pulse->device.Free = rdpsnd_pulse_free;
+	pulse->device.GetLatency = rdpsnd_pulse_get_latency;
 
 	data = pEntryPoints->plugin_data;
 	if (data && strcmp((char*)data->data[0], "pulse") == 0)
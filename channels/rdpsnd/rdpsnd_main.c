@@ -30,11 +30,19 @@
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/list.h>
+#include <freerdp/utils/thread.h>
 #include <freerdp/utils/load_plugin.h>
 #include <freerdp/utils/svc_plugin.h>
 
 #include "rdpsnd_main.h"
 
+/* bounds of the adaptive jitter buffer, in milliseconds */
+#define RDPSND_PREBUFFER_MIN 40
+#define RDPSND_PREBUFFER_MAX 400
+
+/* the device is closed when no wave follows a close within this delay */
+#define RDPSND_CLOSE_DELAY 2000
+
 struct rdpsnd_plugin
 {
 	rdpSvcPlugin plugin;
@@ -44,15 +52,31 @@ struct rdpsnd_plugin
 	uint8 cBlockNo;
 	rdpsndFormat* supported_formats;
 	int n_supported_formats;
-	int current_format;
 
 	boolean expectingWave;
 	uint8 waveData[4];
 	uint16 waveDataSize;
 	uint32 wTimeStamp; /* server timestamp */
 	uint32 wave_timestamp; /* client timestamp */
+	uint16 wFormatNo;
+
+	/**
+	 * Waves are played by the playback thread, which owns the device once
+	 * connected. The wave queue and the jitter estimate are protected by the
+	 * thread mutex, the playback state below them is private to the thread.
+	 */
+	freerdp_thread* playback_thread;
+	LIST* wave_list;
+	uint32 queued_ms;
+	int pending_closes;
+	uint32 jitter; /* interarrival jitter in 1/16 ms */
+	uint32 last_arrival;
+	uint32 last_duration;
 
 	boolean is_open;
+	int current_format;
+	boolean prebuffering;
+	uint32 play_end;
 	uint32 close_timestamp;
 
 	uint16 fixed_format;
@@ -70,6 +94,18 @@ struct data_out_item
 	uint32 out_timestamp;
 };
 
+/* a wave waiting for playback, data is NULL for a close */
+struct rdpsnd_wave
+{
+	STREAM* data;
+	rdpsndFormat format;
+	uint16 wFormatNo;
+	uint16 wTimeStamp;
+	uint8 cBlockNo;
+	uint32 arrival;
+	uint32 duration;
+};
+
 /* get time in milliseconds */
 static uint32 get_mstime(void)
 {
@@ -79,47 +115,6 @@ static uint32 get_mstime(void)
 	return (tp.tv_sec * 1000) + (tp.tv_usec / 1000);
 }
 
-/* process the linked list of data that has queued to be sent */
-static void rdpsnd_process_interval(rdpSvcPlugin* plugin)
-{
-	rdpsndPlugin* rdpsnd = (rdpsndPlugin*)plugin;
-	struct data_out_item* item;
-	uint32 cur_time;
-
-	while (list_size(rdpsnd->data_out_list) > 0)
-	{
-		item = (struct data_out_item*)list_peek(rdpsnd->data_out_list) ;
-		cur_time = get_mstime();
-		if (!item || cur_time <= item->out_timestamp)
-			break;
-
-		item = (struct data_out_item*)list_dequeue(rdpsnd->data_out_list);
-		svc_plugin_send(plugin, item->data_out);
-		xfree(item);
-
-		DEBUG_SVC("processed data_out");
-	}
-
-	if (rdpsnd->is_open && rdpsnd->close_timestamp > 0)
-	{
-		cur_time = get_mstime();
-		if (cur_time > rdpsnd->close_timestamp)
-		{
-			if (rdpsnd->device)
-				IFCALL(rdpsnd->device->Close, rdpsnd->device);
-			rdpsnd->is_open = false;
-			rdpsnd->close_timestamp = 0;
-
-			DEBUG_SVC("processed close");
-		}
-	}
-
-	if (list_size(rdpsnd->data_out_list) == 0 && !rdpsnd->is_open)
-	{
-		rdpsnd->plugin.interval_ms = 0;
-	}
-}
-
 static void rdpsnd_free_supported_formats(rdpsndPlugin* rdpsnd)
 {
 	uint16 i;
@@ -276,10 +271,8 @@ static void rdpsnd_process_message_training(rdpsndPlugin* rdpsnd, STREAM* data_i
 
 static void rdpsnd_process_message_wave_info(rdpsndPlugin* rdpsnd, STREAM* data_in, uint16 BodySize)
 {
-	uint16 wFormatNo;
-
 	stream_read_uint16(data_in, rdpsnd->wTimeStamp);
-	stream_read_uint16(data_in, wFormatNo);
+	stream_read_uint16(data_in, rdpsnd->wFormatNo);
 	stream_read_uint8(data_in, rdpsnd->cBlockNo);
 	stream_seek(data_in, 3); /* bPad */
 	stream_read(data_in, rdpsnd->waveData, 4);
@@ -287,72 +280,346 @@ static void rdpsnd_process_message_wave_info(rdpsndPlugin* rdpsnd, STREAM* data_
 	rdpsnd->wave_timestamp = get_mstime();
 	rdpsnd->expectingWave = true;
 
-	DEBUG_SVC("waveDataSize %d wFormatNo %d", rdpsnd->waveDataSize, wFormatNo);
+	DEBUG_SVC("waveDataSize %d wFormatNo %d", rdpsnd->waveDataSize, rdpsnd->wFormatNo);
+}
 
-	rdpsnd->close_timestamp = 0;
-	if (!rdpsnd->is_open)
+/* playback time of size bytes of wave data, in milliseconds */
+static uint32 rdpsnd_get_wave_duration(rdpsndFormat* format, int size)
+{
+	int block_frames;
+	uint32 frames;
+
+	if (format->nSamplesPerSec == 0 || format->nChannels == 0 || format->nBlockAlign == 0)
+		return 0;
+
+	switch (format->wFormatTag)
 	{
-		rdpsnd->current_format = wFormatNo;
-		rdpsnd->is_open = true;
-		if (rdpsnd->device)
-			IFCALL(rdpsnd->device->Open, rdpsnd->device, &rdpsnd->supported_formats[wFormatNo],
-				rdpsnd->latency);
+		case 2: /* MS ADPCM */
+			block_frames = (format->nBlockAlign - 7 * format->nChannels) * 2 / format->nChannels + 2;
+			break;
+		case 0x11: /* IMA ADPCM */
+			block_frames = (format->nBlockAlign - 4 * format->nChannels) * 2 / format->nChannels + 1;
+			break;
+		default:
+			block_frames = 1;
+			break;
+	}
+	if (block_frames <= 0)
+		return 0;
+
+	frames = size / format->nBlockAlign * block_frames +
+		(size % format->nBlockAlign) * block_frames / format->nBlockAlign;
+
+	return frames * 1000 / format->nSamplesPerSec;
+}
+
+static void rdpsnd_free_wave(struct rdpsnd_wave* wave)
+{
+	if (wave->data)
+		stream_free(wave->data);
+	xfree(wave);
+}
+
+static void rdpsnd_queue_wave(rdpsndPlugin* rdpsnd, struct rdpsnd_wave* wave)
+{
+	sint32 d;
+
+	freerdp_thread_lock(rdpsnd->playback_thread);
+
+	if (wave->data)
+	{
+		/* RFC 3550 interarrival jitter, J += (|D| - J) / 16 */
+		if (rdpsnd->last_arrival != 0)
+		{
+			d = (sint32) (wave->arrival - rdpsnd->last_arrival) - (sint32) rdpsnd->last_duration;
+			if (d < 0)
+				d = -d;
+			rdpsnd->jitter = rdpsnd->jitter + d - (rdpsnd->jitter >> 4);
+		}
+		rdpsnd->last_arrival = wave->arrival;
+		rdpsnd->last_duration = wave->duration;
 	}
-	else if (wFormatNo != rdpsnd->current_format)
+	else
 	{
-		rdpsnd->current_format = wFormatNo;
-		if (rdpsnd->device)
-			IFCALL(rdpsnd->device->SetFormat, rdpsnd->device, &rdpsnd->supported_formats[wFormatNo],
-				rdpsnd->latency);
+		/* the silence after a close says nothing about the network */
+		rdpsnd->last_arrival = 0;
+		rdpsnd->pending_closes++;
 	}
+
+	list_enqueue(rdpsnd->wave_list, wave);
+	rdpsnd->queued_ms += wave->duration;
+
+	freerdp_thread_unlock(rdpsnd->playback_thread);
+
+	freerdp_thread_signal(rdpsnd->playback_thread);
 }
 
 /* header is not removed from data in this function */
 static void rdpsnd_process_message_wave(rdpsndPlugin* rdpsnd, STREAM* data_in)
 {
-	uint16 wTimeStamp;
-	uint32 delay_ms;
-	uint32 process_ms;
-	struct data_out_item* item;
+	struct rdpsnd_wave* wave;
 
 	rdpsnd->expectingWave = 0;
 	memcpy(stream_get_head(data_in), rdpsnd->waveData, 4);
 	if (stream_get_size(data_in) != rdpsnd->waveDataSize)
 	{
 		DEBUG_WARN("size error");
+		stream_free(data_in);
+		return;
+	}
+	if (rdpsnd->wFormatNo >= rdpsnd->n_supported_formats)
+	{
+		DEBUG_WARN("invalid wFormatNo %d", rdpsnd->wFormatNo);
+		stream_free(data_in);
 		return;
 	}
+
+	wave = xnew(struct rdpsnd_wave);
+	wave->data = data_in;
+	wave->format = rdpsnd->supported_formats[rdpsnd->wFormatNo];
+	wave->format.data = NULL;
+	wave->wFormatNo = rdpsnd->wFormatNo;
+	wave->wTimeStamp = rdpsnd->wTimeStamp;
+	wave->cBlockNo = rdpsnd->cBlockNo;
+	wave->arrival = rdpsnd->wave_timestamp;
+	wave->duration = rdpsnd_get_wave_duration(&wave->format, stream_get_size(data_in));
+
+	DEBUG_SVC("data_size %d duration_ms %u", stream_get_size(data_in), wave->duration);
+
+	rdpsnd_queue_wave(rdpsnd, wave);
+}
+
+static void rdpsnd_process_message_close(rdpsndPlugin* rdpsnd)
+{
+	DEBUG_SVC("server closes.");
+
+	/* the close is queued behind the waves still waiting for playback */
+	rdpsnd_queue_wave(rdpsnd, xnew(struct rdpsnd_wave));
+}
+
+/* how long playback is held back to absorb arrival jitter, in milliseconds */
+static uint32 rdpsnd_get_prebuffer_target(rdpsndPlugin* rdpsnd)
+{
+	uint32 target;
+
+	target = (rdpsnd->latency > 0 ? rdpsnd->latency : 0) + (rdpsnd->jitter >> 4) * 2;
+	if (target < RDPSND_PREBUFFER_MIN)
+		target = RDPSND_PREBUFFER_MIN;
+	if (target > RDPSND_PREBUFFER_MAX)
+		target = RDPSND_PREBUFFER_MAX;
+
+	return target;
+}
+
+static int rdpsnd_min_timeout(int timeout, uint32 deadline, uint32 now)
+{
+	sint32 remaining;
+
+	remaining = (sint32) (deadline - now);
+	if (remaining < 0)
+		remaining = 0;
+
+	return (timeout < 0 || remaining < timeout ? remaining : timeout);
+}
+
+/* milliseconds until the playback thread has work to do, -1 when idle */
+static int rdpsnd_get_playback_timeout(rdpsndPlugin* rdpsnd)
+{
+	struct data_out_item* item;
+	struct rdpsnd_wave* wave;
+	uint32 now;
+	int timeout = -1;
+
+	now = get_mstime();
+
+	item = (struct data_out_item*) list_peek(rdpsnd->data_out_list);
+	if (item)
+		timeout = rdpsnd_min_timeout(timeout, item->out_timestamp, now);
+
+	if (rdpsnd->close_timestamp > 0)
+		timeout = rdpsnd_min_timeout(timeout, rdpsnd->close_timestamp, now);
+
+	freerdp_thread_lock(rdpsnd->playback_thread);
+	wave = (struct rdpsnd_wave*) list_peek(rdpsnd->wave_list);
+	if (wave && rdpsnd->prebuffering)
+		timeout = rdpsnd_min_timeout(timeout, wave->arrival + rdpsnd_get_prebuffer_target(rdpsnd), now);
+	freerdp_thread_unlock(rdpsnd->playback_thread);
+
+	return timeout;
+}
+
+/**
+ * Dequeue the next wave for playback. After an underrun, waves are held back
+ * until the jitter buffer target is queued, the oldest one has waited that
+ * long or the server closed the stream.
+ */
+static struct rdpsnd_wave* rdpsnd_next_wave(rdpsndPlugin* rdpsnd)
+{
+	struct rdpsnd_wave* wave;
+	uint32 target;
+	uint32 now;
+
+	now = get_mstime();
+
+	freerdp_thread_lock(rdpsnd->playback_thread);
+
+	wave = (struct rdpsnd_wave*) list_peek(rdpsnd->wave_list);
+	if (wave)
+	{
+		if (!rdpsnd->prebuffering && (sint32) (now - rdpsnd->play_end) > 0)
+			rdpsnd->prebuffering = true;
+
+		if (rdpsnd->prebuffering)
+		{
+			target = rdpsnd_get_prebuffer_target(rdpsnd);
+			if (rdpsnd->queued_ms >= target || rdpsnd->pending_closes > 0 ||
+				(sint32) (now - wave->arrival) >= (sint32) target)
+			{
+				DEBUG_SVC("prebuffered %u ms, target %u ms", rdpsnd->queued_ms, target);
+				rdpsnd->prebuffering = false;
+			}
+		}
+
+		if (rdpsnd->prebuffering)
+		{
+			wave = NULL;
+		}
+		else
+		{
+			list_dequeue(rdpsnd->wave_list);
+			rdpsnd->queued_ms -= wave->duration;
+			if (!wave->data)
+				rdpsnd->pending_closes--;
+		}
+	}
+
+	freerdp_thread_unlock(rdpsnd->playback_thread);
+
+	return wave;
+}
+
+/* plays a wave and schedules its confirm for when the device has played it out */
+static void rdpsnd_play_wave(rdpsndPlugin* rdpsnd, struct rdpsnd_wave* wave)
+{
+	struct data_out_item* item;
+	int latency = -1;
+
+	rdpsnd->close_timestamp = 0;
+	if (!rdpsnd->is_open)
+	{
+		rdpsnd->current_format = wave->wFormatNo;
+		rdpsnd->is_open = true;
+		if (rdpsnd->device)
+			IFCALL(rdpsnd->device->Open, rdpsnd->device, &wave->format, rdpsnd->latency);
+	}
+	else if (wave->wFormatNo != rdpsnd->current_format)
+	{
+		rdpsnd->current_format = wave->wFormatNo;
+		if (rdpsnd->device)
+			IFCALL(rdpsnd->device->SetFormat, rdpsnd->device, &wave->format, rdpsnd->latency);
+	}
+
 	if (rdpsnd->device)
-		IFCALL(rdpsnd->device->Play, rdpsnd->device, stream_get_head(data_in), stream_get_size(data_in));
+	{
+		IFCALL(rdpsnd->device->Play, rdpsnd->device, stream_get_head(wave->data), stream_get_size(wave->data));
+		if (rdpsnd->device->GetLatency)
+			latency = rdpsnd->device->GetLatency(rdpsnd->device);
+	}
 
-	process_ms = get_mstime() - rdpsnd->wave_timestamp;
-	delay_ms = 250;
-	wTimeStamp = rdpsnd->wTimeStamp + delay_ms;
+	/* without a playback position, assume the wave starts playing right away */
+	if (latency < 0)
+		latency = wave->duration;
+	rdpsnd->play_end = get_mstime() + latency;
 
-	DEBUG_SVC("data_size %d delay_ms %u process_ms %u",
-		stream_get_size(data_in), delay_ms, process_ms);
+	DEBUG_SVC("cBlockNo %d played out in %d ms, %u ms after arrival",
+		wave->cBlockNo, latency, rdpsnd->play_end - wave->arrival);
 
 	item = xnew(struct data_out_item);
 	item->data_out = stream_new(8);
 	stream_write_uint8(item->data_out, SNDC_WAVECONFIRM);
 	stream_write_uint8(item->data_out, 0);
 	stream_write_uint16(item->data_out, 4);
-	stream_write_uint16(item->data_out, wTimeStamp);
-	stream_write_uint8(item->data_out, rdpsnd->cBlockNo); /* cConfirmedBlockNo */
+	stream_write_uint16(item->data_out, wave->wTimeStamp + (rdpsnd->play_end - wave->arrival));
+	stream_write_uint8(item->data_out, wave->cBlockNo); /* cConfirmedBlockNo */
 	stream_write_uint8(item->data_out, 0); /* bPad */
-	item->out_timestamp = rdpsnd->wave_timestamp + delay_ms;
+	item->out_timestamp = rdpsnd->play_end;
 
 	list_enqueue(rdpsnd->data_out_list, item);
-	rdpsnd->plugin.interval_ms = 10;
 }
 
-static void rdpsnd_process_message_close(rdpsndPlugin* rdpsnd)
+/* sends the confirms of the waves that have been played out */
+static void rdpsnd_send_confirms(rdpsndPlugin* rdpsnd)
 {
-	DEBUG_SVC("server closes.");
-	if (rdpsnd->device)
-		IFCALL(rdpsnd->device->Start, rdpsnd->device);
-	rdpsnd->close_timestamp = get_mstime() + 2000;
-	rdpsnd->plugin.interval_ms = 10;
+	struct data_out_item* item;
+	uint32 now;
+
+	now = get_mstime();
+
+	while ((item = (struct data_out_item*) list_peek(rdpsnd->data_out_list)) != NULL)
+	{
+		if ((sint32) (item->out_timestamp - now) > 0)
+			break;
+
+		list_dequeue(rdpsnd->data_out_list);
+		svc_plugin_send((rdpSvcPlugin*) rdpsnd, item->data_out);
+		xfree(item);
+
+		DEBUG_SVC("processed data_out");
+	}
+}
+
+static void* rdpsnd_playback_thread_func(void* arg)
+{
+	rdpsndPlugin* rdpsnd = (rdpsndPlugin*) arg;
+	freerdp_thread* thread = rdpsnd->playback_thread;
+	struct rdpsnd_wave* wave;
+
+	rdpsnd->prebuffering = true;
+
+	while (1)
+	{
+		freerdp_thread_wait_timeout(thread, rdpsnd_get_playback_timeout(rdpsnd));
+
+		if (freerdp_thread_is_stopped(thread))
+			break;
+
+		freerdp_thread_reset(thread);
+
+		rdpsnd_send_confirms(rdpsnd);
+
+		while ((wave = rdpsnd_next_wave(rdpsnd)) != NULL)
+		{
+			if (wave->data)
+			{
+				rdpsnd_play_wave(rdpsnd, wave);
+			}
+			else
+			{
+				/* start whatever the device holds back and close once idle */
+				if (rdpsnd->device)
+					IFCALL(rdpsnd->device->Start, rdpsnd->device);
+				rdpsnd->close_timestamp = get_mstime() + RDPSND_CLOSE_DELAY;
+			}
+			rdpsnd_free_wave(wave);
+
+			rdpsnd_send_confirms(rdpsnd);
+		}
+
+		if (rdpsnd->close_timestamp > 0 &&
+			(sint32) (get_mstime() - rdpsnd->close_timestamp) >= 0)
+		{
+			if (rdpsnd->is_open && rdpsnd->device)
+				IFCALL(rdpsnd->device->Close, rdpsnd->device);
+			rdpsnd->is_open = false;
+			rdpsnd->close_timestamp = 0;
+
+			DEBUG_SVC("processed close");
+		}
+	}
+
+	freerdp_thread_quit(thread);
+
+	return NULL;
 }
 
 static void rdpsnd_process_message_setvolume(rdpsndPlugin* rdpsnd, STREAM* data_in)
@@ -373,8 +640,8 @@ static void rdpsnd_process_receive(rdpSvcPlugin* plugin, STREAM* data_in)
 
 	if (rdpsnd->expectingWave)
 	{
+		/* the wave takes ownership of data_in */
 		rdpsnd_process_message_wave(rdpsnd, data_in);
-		stream_free(data_in);
 		return;
 	}
 
@@ -483,9 +750,8 @@ static void rdpsnd_process_connect(rdpSvcPlugin* plugin)
 
 	DEBUG_SVC("connecting");
 
-	plugin->interval_callback = rdpsnd_process_interval;
-
 	rdpsnd->data_out_list = list_new();
+	rdpsnd->wave_list = list_new();
 	rdpsnd->latency = -1;
 
 	data = (RDP_PLUGIN_DATA*)plugin->channel_entry_points.pExtendedData;
@@ -511,6 +777,9 @@ static void rdpsnd_process_connect(rdpSvcPlugin* plugin)
 	{
 		DEBUG_WARN("no sound device.");
 	}
+
+	rdpsnd->playback_thread = freerdp_thread_new();
+	freerdp_thread_start(rdpsnd->playback_thread, rdpsnd_playback_thread_func, rdpsnd);
 }
 
 static void rdpsnd_process_event(rdpSvcPlugin* plugin, RDP_EVENT* event)
@@ -522,10 +791,21 @@ static void rdpsnd_process_terminate(rdpSvcPlugin* plugin)
 {
 	rdpsndPlugin* rdpsnd = (rdpsndPlugin*)plugin;
 	struct data_out_item* item;
+	struct rdpsnd_wave* wave;
+
+	if (rdpsnd->playback_thread)
+	{
+		freerdp_thread_stop(rdpsnd->playback_thread);
+		freerdp_thread_free(rdpsnd->playback_thread);
+	}
 
 	if (rdpsnd->device)
 		IFCALL(rdpsnd->device->Free, rdpsnd->device);
 
+	while ((wave = list_dequeue(rdpsnd->wave_list)) != NULL)
+		rdpsnd_free_wave(wave);
+	list_free(rdpsnd->wave_list);
+
 	while ((item = list_dequeue(rdpsnd->data_out_list)) != NULL)
 	{
 		stream_free(item->data_out);
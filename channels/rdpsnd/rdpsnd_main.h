@@ -34,6 +34,7 @@ typedef void (*pcPlay) (rdpsndDevicePlugin* device, uint8* data, int size);
 typedef void (*pcStart) (rdpsndDevicePlugin* device);
 typedef void (*pcClose) (rdpsndDevicePlugin* device);
 typedef void (*pcFree) (rdpsndDevicePlugin* device);
+typedef int (*pcGetLatency) (rdpsndDevicePlugin* device);
 
 struct rdpsnd_device_plugin
 {
@@ -45,6 +46,8 @@ struct rdpsnd_device_plugin
 	pcStart Start;
 	pcClose Close;
 	pcFree Free;
+	/* milliseconds of audio queued in the device, -1 if unknown */
+	pcGetLatency GetLatency;
 };
 
 #define RDPSND_DEVICE_EXPORT_FUNC_NAME "FreeRDPRdpsndDeviceEntry"
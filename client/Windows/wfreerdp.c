@@ -296,7 +296,7 @@ boolean wf_post_connect(freerdp* instance)
 		wfi->hdc->alpha = wfi->clrconv->alpha;
 		wfi->hdc->invert = wfi->clrconv->invert;
 
-		wfi->hdc->hwnd = (HGDI_WND) xmalloc(sizeof(GDI_WND));
+		wfi->hdc->hwnd = (HGDI_WND) xzalloc(sizeof(GDI_WND));
 		wfi->hdc->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 		wfi->hdc->hwnd->invalid->null = 1;
 
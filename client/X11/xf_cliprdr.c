@@ -21,12 +21,25 @@
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <freerdp/utils/event.h>
+#include <freerdp/utils/time.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/unicode.h>
 #include <freerdp/plugins/cliprdr.h>
 
 #include "xf_cliprdr.h"
 
+/**
+ * Server data larger than this is dropped once it has been delivered and is
+ * requested again on the next paste instead of being kept around.
+ */
+#define CLIPRDR_CACHE_MAX_SIZE		(4 * 1024 * 1024)
+
+/* Local clipboard data larger than this is not transferred to the server */
+#define CLIPRDR_MAX_DATA_SIZE		(256 * 1024 * 1024)
+
+/* An INCR transfer the requestor has not advanced for this long (in microseconds) is abandoned */
+#define CLIPRDR_INCR_TIMEOUT		(10 * 1000000)
+
 typedef struct clipboard_format_mapping clipboardFormatMapping;
 struct clipboard_format_mapping
 {
@@ -55,7 +68,17 @@ struct clipboard_context
 	uint32 data_format;
 	uint32 data_alt_format;
 	int data_length;
+	uint8 data_header[14];
+	int data_header_length;
 	XEvent* respond;
+	int max_request_size;
+
+	/* INCR transfer to a local requestor */
+	Window incr_requestor;
+	Atom incr_property;
+	Atom incr_target;
+	int incr_offset;
+	uint64 incr_time;
 
 	/* client->server data */
 	Window owner;
@@ -67,6 +90,8 @@ struct clipboard_context
 	boolean incr_starts;
 	uint8* incr_data;
 	int incr_data_length;
+	int incr_data_capacity;
+	boolean incr_overflow;
 };
 
 void xf_cliprdr_init(xfInfo* xfi, rdpChannels* chanman)
@@ -136,6 +161,9 @@ void xf_cliprdr_init(xfInfo* xfi, rdpChannels* chanman)
 	cb->num_targets = 2;
 
 	cb->incr_atom = XInternAtom(xfi->display, "INCR", false);
+
+	/* Anything that does not fit in a single request is sent with INCR */
+	cb->max_request_size = XMaxRequestSize(xfi->display) * 4 - 1024;
 }
 
 void xf_cliprdr_uninit(xfInfo* xfi)
@@ -729,15 +757,37 @@ static boolean xf_cliprdr_get_requested_data(xfInfo* xfi, Atom target)
 	{
 		DEBUG_X11("INCR started");
 		cb->incr_starts = true;
+		cb->incr_overflow = false;
 		if (cb->incr_data)
 		{
 			xfree(cb->incr_data);
 			cb->incr_data = NULL;
 		}
 		cb->incr_data_length = 0;
+		cb->incr_data_capacity = 0;
+
+		/* The INCR property holds a lower bound of the size, use it to size the buffer */
+		if (XGetWindowProperty(xfi->display, xfi->drawable,
+			cb->property_atom, 0, 1, 0, cb->incr_atom,
+			&type, &format, &length, &dummy, &data) == Success && data)
+		{
+			if (format == 32 && length == 1 &&
+				*((long*) data) > 0 && *((long*) data) <= CLIPRDR_MAX_DATA_SIZE)
+			{
+				cb->incr_data_capacity = (int) *((long*) data);
+				cb->incr_data = (uint8*) xmalloc(cb->incr_data_capacity);
+			}
+			XFree(data);
+		}
+		data = NULL;
+
 		/* Data will be followed in PropertyNotify event */
 		has_data = true;
 	}
+	else if (!cb->incr_starts && bytes_left > CLIPRDR_MAX_DATA_SIZE)
+	{
+		DEBUG_X11_CLIPRDR("%d bytes exceed the clipboard size limit", (int) bytes_left);
+	}
 	else
 	{
 		if (bytes_left <= 0)
@@ -759,9 +809,32 @@ static boolean xf_cliprdr_get_requested_data(xfInfo* xfi, Atom target)
 			{
 				bytes_left = length * format / 8;
 				DEBUG_X11("%d bytes", (int)bytes_left);
-				cb->incr_data = (uint8*) xrealloc(cb->incr_data, cb->incr_data_length + bytes_left);
-				memcpy(cb->incr_data + cb->incr_data_length, data, bytes_left);
-				cb->incr_data_length += bytes_left;
+
+				if (!cb->incr_overflow &&
+					cb->incr_data_length + bytes_left > CLIPRDR_MAX_DATA_SIZE)
+				{
+					/* Keep consuming chunks so the owner completes, but drop the data */
+					DEBUG_X11_CLIPRDR("INCR data exceeds the clipboard size limit");
+					cb->incr_overflow = true;
+					xfree(cb->incr_data);
+					cb->incr_data = NULL;
+					cb->incr_data_length = 0;
+					cb->incr_data_capacity = 0;
+				}
+
+				if (!cb->incr_overflow)
+				{
+					if (cb->incr_data_length + bytes_left > cb->incr_data_capacity)
+					{
+						cb->incr_data_capacity = MAX(cb->incr_data_capacity * 2,
+							cb->incr_data_length + bytes_left);
+						cb->incr_data = (uint8*) xrealloc(cb->incr_data, cb->incr_data_capacity);
+					}
+
+					memcpy(cb->incr_data + cb->incr_data_length, data, bytes_left);
+					cb->incr_data_length += bytes_left;
+				}
+
 				XFree(data);
 				data = NULL;
 			}
@@ -812,31 +885,206 @@ static void xf_cliprdr_provide_targets(xfInfo* xfi, XEvent* respond)
 	}
 }
 
-static void xf_cliprdr_provide_data(xfInfo* xfi, XEvent* respond)
+/**
+ * Write a range of the cached data, i.e. the optional header followed by the
+ * data itself, to a property. A zero length writes an empty property.
+ */
+static void xf_cliprdr_write_data(xfInfo* xfi, Window window, Atom property, Atom target, int offset, int length)
 {
+	int n;
+	int mode = PropModeReplace;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
-	if (respond->xselection.property != None)
+	if (offset < cb->data_header_length)
 	{
-		XChangeProperty(xfi->display,
-			respond->xselection.requestor,
-			respond->xselection.property,
-			respond->xselection.target, 8, PropModeReplace,
-			(uint8*) cb->data, cb->data_length);
+		n = MIN(length, cb->data_header_length - offset);
+		XChangeProperty(xfi->display, window, property, target, 8, mode,
+			cb->data_header + offset, n);
+		mode = PropModeAppend;
+		offset += n;
+		length -= n;
+	}
+
+	if (length > 0 || mode == PropModeReplace)
+	{
+		XChangeProperty(xfi->display, window, property, target, 8, mode,
+			cb->data + offset - cb->data_header_length, length);
 	}
 }
 
-static void xf_cliprdr_process_cb_format_list_event(xfInfo* xfi, RDP_CB_FORMAT_LIST_EVENT* event)
+/**
+ * The INCR requestor is another client's window, which may be destroyed at any
+ * time. Requests on it are made with X errors trapped, so that a BadWindow
+ * fails the transfer instead of going to the default handler, which exits.
+ */
+
+static boolean xf_cliprdr_x_error;
+
+static int xf_cliprdr_error_handler(Display* display, XErrorEvent* event)
+{
+	xf_cliprdr_x_error = true;
+	return 0;
+}
+
+static XErrorHandler xf_cliprdr_trap_errors(xfInfo* xfi)
+{
+	XSync(xfi->display, false);
+	xf_cliprdr_x_error = false;
+	return XSetErrorHandler(xf_cliprdr_error_handler);
+}
+
+static boolean xf_cliprdr_untrap_errors(xfInfo* xfi, XErrorHandler handler)
+{
+	XSync(xfi->display, false);
+	XSetErrorHandler(handler);
+	return !xf_cliprdr_x_error;
+}
+
+static void xf_cliprdr_end_incr(xfInfo* xfi)
+{
+	XErrorHandler handler;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	if (cb->incr_requestor != None)
+	{
+		handler = xf_cliprdr_trap_errors(xfi);
+		XSelectInput(xfi->display, cb->incr_requestor, NoEventMask);
+		xf_cliprdr_untrap_errors(xfi, handler);
+		cb->incr_requestor = None;
+	}
+}
+
+static void xf_cliprdr_clear_data(xfInfo* xfi)
 {
-	int i, j;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
+	xf_cliprdr_end_incr(xfi);
+
 	if (cb->data)
 	{
 		xfree(cb->data);
 		cb->data = NULL;
 	}
 
+	cb->data_length = 0;
+	cb->data_header_length = 0;
+}
+
+static void xf_cliprdr_trim_data(xfInfo* xfi)
+{
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	if (cb->incr_requestor == None && cb->data_length > CLIPRDR_CACHE_MAX_SIZE)
+		xf_cliprdr_clear_data(xfi);
+}
+
+static void xf_cliprdr_send_incr_chunk(xfInfo* xfi)
+{
+	int length;
+	XErrorHandler handler;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	length = MIN(cb->max_request_size,
+		cb->data_header_length + cb->data_length - cb->incr_offset);
+
+	DEBUG_X11_CLIPRDR("INCR chunk offset=%d length=%d", cb->incr_offset, length);
+
+	handler = xf_cliprdr_trap_errors(xfi);
+	xf_cliprdr_write_data(xfi, cb->incr_requestor, cb->incr_property,
+		cb->incr_target, cb->incr_offset, length);
+
+	if (!xf_cliprdr_untrap_errors(xfi, handler))
+	{
+		DEBUG_X11_CLIPRDR("INCR requestor is gone");
+		cb->incr_requestor = None;
+		xf_cliprdr_trim_data(xfi);
+		return;
+	}
+
+	cb->incr_offset += length;
+	cb->incr_time = freerdp_get_time_usec();
+
+	/* The zero-length chunk marks the end of the transfer */
+	if (length == 0)
+	{
+		xf_cliprdr_end_incr(xfi);
+		xf_cliprdr_trim_data(xfi);
+	}
+
+	XFlush(xfi->display);
+}
+
+static void xf_cliprdr_provide_data(xfInfo* xfi, XEvent* respond)
+{
+	long size;
+	XErrorHandler handler;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	if (respond->xselection.property == None)
+		return;
+
+	size = cb->data_header_length + cb->data_length;
+
+	if (size <= cb->max_request_size)
+	{
+		xf_cliprdr_write_data(xfi, respond->xselection.requestor,
+			respond->xselection.property, respond->xselection.target, 0, size);
+		return;
+	}
+
+	/**
+	 * Too large for a single request: announce an INCR transfer and send
+	 * the data in chunks each time the requestor deletes the property.
+	 * Only one such transfer is kept, a new one replaces the previous.
+	 */
+	xf_cliprdr_end_incr(xfi);
+
+	DEBUG_X11_CLIPRDR("INCR start size=%ld", size);
+
+	cb->incr_requestor = respond->xselection.requestor;
+	cb->incr_property = respond->xselection.property;
+	cb->incr_target = respond->xselection.target;
+	cb->incr_offset = 0;
+	cb->incr_time = freerdp_get_time_usec();
+
+	handler = xf_cliprdr_trap_errors(xfi);
+	XSelectInput(xfi->display, cb->incr_requestor, PropertyChangeMask);
+	XChangeProperty(xfi->display, cb->incr_requestor, cb->incr_property,
+		cb->incr_atom, 32, PropModeReplace, (uint8*) &size, 1);
+
+	if (!xf_cliprdr_untrap_errors(xfi, handler))
+	{
+		DEBUG_X11_CLIPRDR("INCR requestor is gone");
+		cb->incr_requestor = None;
+	}
+}
+
+/**
+ * Abandons an INCR transfer whose requestor has stopped reading, so that
+ * its data can be released. Called periodically from the main loop.
+ */
+void xf_cliprdr_check_incr(xfInfo* xfi)
+{
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	if (cb == NULL || cb->incr_requestor == None)
+		return;
+
+	if (freerdp_get_time_usec() - cb->incr_time > CLIPRDR_INCR_TIMEOUT)
+	{
+		DEBUG_X11_CLIPRDR("INCR transfer timed out at offset=%d", cb->incr_offset);
+		xf_cliprdr_end_incr(xfi);
+		xf_cliprdr_trim_data(xfi);
+	}
+}
+
+static void xf_cliprdr_process_cb_format_list_event(xfInfo* xfi, RDP_CB_FORMAT_LIST_EVENT* event)
+{
+	int i, j;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	xf_cliprdr_clear_data(xfi);
+
 	if (cb->formats)
 		xfree(cb->formats);
 
@@ -869,31 +1117,43 @@ static void xf_cliprdr_process_cb_format_list_event(xfInfo* xfi, RDP_CB_FORMAT_L
 	XFlush(xfi->display);
 }
 
-static void xf_cliprdr_process_text(clipboardContext* cb, uint8* data, int size)
+/**
+ * The converters below work in place on the received buffer where they can,
+ * taking it over from the event rather than building a full-size copy.
+ */
+
+static void xf_cliprdr_process_raw(clipboardContext* cb, RDP_CB_DATA_RESPONSE_EVENT* event)
+{
+	cb->data = event->data;
+	cb->data_length = event->size;
+	event->data = NULL;
+	event->size = 0;
+}
+
+static void xf_cliprdr_process_text(clipboardContext* cb, RDP_CB_DATA_RESPONSE_EVENT* event)
 {
-	cb->data = (uint8*) xmalloc(size);
-	memcpy(cb->data, data, size);
-	cb->data_length = size;
+	xf_cliprdr_process_raw(cb, event);
 	crlf2lf(cb->data, &cb->data_length);
 }
 
-static void xf_cliprdr_process_unicodetext(clipboardContext* cb, uint8* data, int size)
+static void xf_cliprdr_process_unicodetext(clipboardContext* cb, RDP_CB_DATA_RESPONSE_EVENT* event)
 {
 	UNICONV* uniconv;
 
 	uniconv = freerdp_uniconv_new();
-	cb->data = (uint8*) freerdp_uniconv_in(uniconv, data, size);
+	cb->data = (uint8*) freerdp_uniconv_in(uniconv, event->data, event->size);
 	freerdp_uniconv_free(uniconv);
 	cb->data_length = strlen((char*) cb->data);
 	crlf2lf(cb->data, &cb->data_length);
 }
 
-static void xf_cliprdr_process_dib(clipboardContext* cb, uint8* data, int size)
+static void xf_cliprdr_process_dib(clipboardContext* cb, RDP_CB_DATA_RESPONSE_EVENT* event)
 {
 	STREAM* s;
 	uint16 bpp;
 	uint32 offset;
 	uint32 ncolors;
+	int size = event->size;
 
 	/* size should be at least sizeof(BITMAPINFOHEADER) */
 	if (size < 40)
@@ -903,36 +1163,36 @@ static void xf_cliprdr_process_dib(clipboardContext* cb, uint8* data, int size)
 	}
 
 	s = stream_new(0);
-	stream_attach(s, data, size);
+	stream_attach(s, event->data, size);
 	stream_seek(s, 14);
 	stream_read_uint16(s, bpp);
 	stream_read_uint32(s, ncolors);
 	offset = 14 + 40 + (bpp <= 8 ? (ncolors == 0 ? (1 << bpp) : ncolors) * 4 : 0);
-	stream_detach(s);
-	stream_free(s);
 
 	DEBUG_X11_CLIPRDR("offset=%d bpp=%d ncolors=%d", offset, bpp, ncolors);
 
-	s = stream_new(14 + size);
+	/* The BMP file header is kept apart and sent in front of the DIB */
+	stream_attach(s, cb->data_header, sizeof(cb->data_header));
 	stream_write_uint8(s, 'B');
 	stream_write_uint8(s, 'M');
 	stream_write_uint32(s, 14 + size);
 	stream_write_uint32(s, 0);
 	stream_write_uint32(s, offset);
-	stream_write(s, data, size);
-
-	cb->data = stream_get_head(s);
-	cb->data_length = stream_get_length(s);
 	stream_detach(s);
 	stream_free(s);
+
+	cb->data_header_length = sizeof(cb->data_header);
+	xf_cliprdr_process_raw(cb, event);
 }
 
-static void xf_cliprdr_process_html(clipboardContext* cb, uint8* data, int size)
+static void xf_cliprdr_process_html(clipboardContext* cb, RDP_CB_DATA_RESPONSE_EVENT* event)
 {
 	char* start_str;
 	char* end_str;
 	int start;
 	int end;
+	uint8* data = event->data;
+	int size = event->size;
 
 	start_str = strstr((char*) data, "StartHTML:");
 	end_str = strstr((char*) data, "EndHTML:");
@@ -949,8 +1209,8 @@ static void xf_cliprdr_process_html(clipboardContext* cb, uint8* data, int size)
 		return;
 	}
 
-	cb->data = (uint8*) xmalloc(size - start + 1);
-	memcpy(cb->data, data + start, end - start);
+	memmove(data, data + start, end - start);
+	xf_cliprdr_process_raw(cb, event);
 	cb->data_length = end - start;
 	crlf2lf(cb->data, &cb->data_length);
 }
@@ -973,37 +1233,31 @@ static void xf_cliprdr_process_cb_data_response_event(xfInfo* xfi, RDP_CB_DATA_R
 	}
 	else
 	{
-		if (cb->data)
-		{
-			xfree(cb->data);
-			cb->data = NULL;
-		}
+		xf_cliprdr_clear_data(xfi);
+
 		switch (cb->data_format)
 		{
 			case CB_FORMAT_RAW:
 			case CB_FORMAT_PNG:
 			case CB_FORMAT_JPEG:
 			case CB_FORMAT_GIF:
-				cb->data = event->data;
-				cb->data_length = event->size;
-				event->data = NULL;
-				event->size = 0;
+				xf_cliprdr_process_raw(cb, event);
 				break;
 
 			case CB_FORMAT_TEXT:
-				xf_cliprdr_process_text(cb, event->data, event->size);
+				xf_cliprdr_process_text(cb, event);
 				break;
 
 			case CB_FORMAT_UNICODETEXT:
-				xf_cliprdr_process_unicodetext(cb, event->data, event->size);
+				xf_cliprdr_process_unicodetext(cb, event);
 				break;
 
 			case CB_FORMAT_DIB:
-				xf_cliprdr_process_dib(cb, event->data, event->size);
+				xf_cliprdr_process_dib(cb, event);
 				break;
 
 			case CB_FORMAT_HTML:
-				xf_cliprdr_process_html(cb, event->data, event->size);
+				xf_cliprdr_process_html(cb, event);
 				break;
 
 			default:
@@ -1011,6 +1265,7 @@ static void xf_cliprdr_process_cb_data_response_event(xfInfo* xfi, RDP_CB_DATA_R
 				break;
 		}
 		xf_cliprdr_provide_data(xfi, cb->respond);
+		xf_cliprdr_trim_data(xfi);
 	}
 
 	XSendEvent(xfi->display, cb->respond->xselection.requestor, 0, 0, cb->respond);
@@ -1153,11 +1408,7 @@ boolean xf_cliprdr_process_selection_request(xfInfo* xfi, XEvent* xevent)
 				 * Send clipboard data request to the server.
 				 * Response will be postponed after receiving the data
 				 */
-				if (cb->data)
-				{
-					xfree(cb->data);
-					cb->data = NULL;
-				}
+				xf_cliprdr_clear_data(xfi);
 
 				respond->xselection.property = xevent->xselectionrequest.property;
 				cb->respond = respond;
@@ -1196,6 +1447,15 @@ boolean xf_cliprdr_process_property_notify(xfInfo* xfi, XEvent* xevent)
 {
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
+	if (xevent->xproperty.window == cb->incr_requestor &&
+		xevent->xproperty.atom == cb->incr_property &&
+		xevent->xproperty.state == PropertyDelete)
+	{
+		/* The requestor consumed the previous INCR chunk */
+		xf_cliprdr_send_incr_chunk(xfi);
+		return true;
+	}
+
 	if (xevent->xproperty.atom != cb->property_atom)
 		return false; /* Not cliprdr-related */
 
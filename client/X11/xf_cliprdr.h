@@ -30,6 +30,7 @@ boolean xf_cliprdr_process_selection_request(xfInfo* xfi, XEvent* xevent);
 boolean xf_cliprdr_process_selection_clear(xfInfo* xfi, XEvent* xevent);
 boolean xf_cliprdr_process_property_notify(xfInfo* xfi, XEvent* xevent);
 void xf_cliprdr_check_owner(xfInfo* xfi);
+void xf_cliprdr_check_incr(xfInfo* xfi);
 
 #ifdef WITH_DEBUG_X11_CLIPRDR
 #define DEBUG_X11_CLIPRDR(fmt, ...) DEBUG_CLASS(X11_CLIPRDR, fmt, ## __VA_ARGS__)
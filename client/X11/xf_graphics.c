@@ -268,6 +268,135 @@ void xf_Glyph_Draw(rdpContext* context, rdpGlyph* glyph, int x, int y)
 	XSetStipple(xfi->display, xfi->gc, xfi->bitmap_mono);
 }
 
+/* largest mask composed at once, wider text runs are drawn in tiles (X limits pixmaps to 32767) */
+#define XF_GLYPH_BATCH_TILE		2048
+
+/**
+ * Compose the atlas glyphs of a batch falling inside the given tile into a
+ * 1bpp mask, upload it and use it as the stipple for a single fill.
+ */
+
+static void xf_glyph_draw_batch_tile(rdpContext* context, GLYPH_BATCH* batch,
+		int left, int top, int width, int height)
+{
+	int i;
+	int dx, px, py;
+	int x0, y0, x1, y1;
+	int scanline;
+	uint8* srcp;
+	uint8* dstp;
+	XImage* image;
+	GLYPH_ATLAS* atlas;
+	GLYPH_BATCH_ITEM* item;
+	xfInfo* xfi = ((xfContext*) context)->xfi;
+
+	atlas = batch->atlas;
+	scanline = (width + 7) / 8;
+
+	if (scanline * height > xfi->glyph_batch_mask_size)
+	{
+		xfi->glyph_batch_mask_size = scanline * height;
+		xfi->glyph_batch_mask = (uint8*) xrealloc(xfi->glyph_batch_mask, xfi->glyph_batch_mask_size);
+	}
+
+	memset(xfi->glyph_batch_mask, 0, scanline * height);
+
+	if ((width > xfi->glyph_batch_width) || (height > xfi->glyph_batch_height))
+	{
+		if (xfi->glyph_batch)
+			XFreePixmap(xfi->display, xfi->glyph_batch);
+
+		xfi->glyph_batch_width = (width > xfi->glyph_batch_width) ? width : xfi->glyph_batch_width;
+		xfi->glyph_batch_height = (height > xfi->glyph_batch_height) ? height : xfi->glyph_batch_height;
+
+		xfi->glyph_batch = XCreatePixmap(xfi->display, xfi->drawing,
+				xfi->glyph_batch_width, xfi->glyph_batch_height, 1);
+	}
+
+	for (i = 0; i < (int) batch->count; i++)
+	{
+		item = &batch->items[i];
+
+		if (item->cx == 0)
+			continue;
+
+		x0 = (item->x > left) ? item->x : left;
+		y0 = (item->y > top) ? item->y : top;
+		x1 = (item->x + (int) item->cx < left + width) ? item->x + (int) item->cx : left + width;
+		y1 = (item->y + (int) item->cy < top + height) ? item->y + (int) item->cy : top + height;
+
+		for (py = y0; py < y1; py++)
+		{
+			srcp = &atlas->data[(item->atlasY + py - item->y) * atlas->width + item->atlasX];
+			dstp = &xfi->glyph_batch_mask[(py - top) * scanline];
+
+			for (px = x0; px < x1; px++)
+			{
+				if (srcp[px - item->x])
+				{
+					dx = px - left;
+					dstp[dx / 8] |= (0x80 >> (dx % 8));
+				}
+			}
+		}
+	}
+
+	image = XCreateImage(xfi->display, xfi->visual, 1,
+			ZPixmap, 0, (char*) xfi->glyph_batch_mask, width, height, 8, scanline);
+
+	image->byte_order = MSBFirst;
+	image->bitmap_bit_order = MSBFirst;
+
+	XInitImage(image);
+	XPutImage(xfi->display, xfi->glyph_batch, xfi->gc_mono, image, 0, 0, 0, 0, width, height);
+	XFree(image);
+
+	XSetStipple(xfi->display, xfi->gc, xfi->glyph_batch);
+	XSetTSOrigin(xfi->display, xfi->gc, left, top);
+	XFillRectangle(xfi->display, xfi->drawing, xfi->gc, left, top, width, height);
+	XSetStipple(xfi->display, xfi->gc, xfi->bitmap_mono);
+}
+
+/**
+ * Draw all glyphs of a text order at once: the glyph bits are composed
+ * from the atlas into a single 1bpp mask which is uploaded and used as
+ * the stipple for one fill, instead of one stipple fill per glyph.
+ */
+
+void xf_Glyph_DrawBatch(rdpContext* context, GLYPH_BATCH* batch)
+{
+	int i;
+	int x, y;
+	int width, height;
+	GLYPH_BATCH_ITEM* item;
+
+	if ((batch->right <= batch->left) || (batch->bottom <= batch->top))
+		return;
+
+	for (i = 0; i < (int) batch->count; i++)
+	{
+		item = &batch->items[i];
+
+		/* not in the atlas */
+		if (item->cx == 0)
+			xf_Glyph_Draw(context, item->glyph, item->x, item->y);
+	}
+
+	for (y = batch->top; y < batch->bottom; y += XF_GLYPH_BATCH_TILE)
+	{
+		height = batch->bottom - y;
+		height = (height > XF_GLYPH_BATCH_TILE) ? XF_GLYPH_BATCH_TILE : height;
+
+		for (x = batch->left; x < batch->right; x += XF_GLYPH_BATCH_TILE)
+		{
+			width = batch->right - x;
+			width = (width > XF_GLYPH_BATCH_TILE) ? XF_GLYPH_BATCH_TILE : width;
+
+			xf_glyph_draw_batch_tile(context, batch, x, y, width, height);
+		}
+	}
+}
+
 void xf_Glyph_BeginDraw(rdpContext* context, int x, int y, int width, int height, uint32 bgcolor, uint32 fgcolor)
 {
 	xfInfo* xfi = ((xfContext*) context)->xfi;
@@ -345,6 +474,7 @@ void xf_register_graphics(rdpGraphics* graphics)
 	glyph->Draw = xf_Glyph_Draw;
 	glyph->BeginDraw = xf_Glyph_BeginDraw;
 	glyph->EndDraw = xf_Glyph_EndDraw;
+	glyph->DrawBatch = xf_Glyph_DrawBatch;
 
 	graphics_register_glyph(graphics, glyph);
 	xfree(glyph);
@@ -50,6 +50,7 @@
 #include <freerdp/utils/semaphore.h>
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/event.h>
+#include <freerdp/utils/dsp.h>
 #include <freerdp/utils/signal.h>
 #include <freerdp/utils/passphrase.h>
 #include <freerdp/plugins/cliprdr.h>
@@ -584,12 +585,6 @@ boolean xf_pre_connect(freerdp* instance)
 	xfi->WM_PROTOCOLS = XInternAtom(xfi->display, "WM_PROTOCOLS", False);
 	xfi->WM_DELETE_WINDOW = XInternAtom(xfi->display, "WM_DELETE_WINDOW", False);
 
-	xf_kbd_init(xfi);
-
-	xfi->clrconv = freerdp_clrconv_new(CLRCONV_ALPHA);
-
-	instance->context->cache = cache_new(instance->settings);
-
 	xfi->xfds = ConnectionNumber(xfi->display);
 	xfi->screen_number = DefaultScreen(xfi->display);
 	xfi->screen = ScreenOfDisplay(xfi->display, xfi->screen_number);
@@ -610,6 +605,30 @@ boolean xf_pre_connect(freerdp* instance)
 	return true;
 }
 
+/**
+ * Callback given to freerdp_connect() for the local initialization that does not depend on the server.
+ * It runs on its own thread while the connection is negotiated, once xf_pre_connect() has returned.
+ *
+ * @param instance - pointer to the rdp_freerdp structure that contains the connection's parameters.
+ *
+ * @return true if successful. false otherwise.
+ */
+boolean xf_parallel_pre_connect(freerdp* instance)
+{
+	xfInfo* xfi = ((xfContext*) instance->context)->xfi;
+
+	if (instance->settings->authentication_only)
+		return true;
+
+	xf_kbd_init(xfi);
+
+	xfi->clrconv = freerdp_clrconv_new(CLRCONV_ALPHA);
+
+	instance->context->cache = cache_new(instance->settings);
+
+	return true;
+}
+
 void cpuid(unsigned info, unsigned *eax, unsigned *ebx, unsigned *ecx, unsigned *edx)
 {
 #ifdef __GNUC__
@@ -717,10 +736,13 @@ boolean xf_post_connect(freerdp* instance)
 #ifdef WITH_SSE2
 	/* detect only if needed */
 	cpu = xf_detect_cpu();
+	if (xfi->sw_gdi)
+		gdi_set_cpu_opt(instance->context->gdi, cpu);
 	if (rfx_context)
 		rfx_context_set_cpu_opt(rfx_context, cpu);
 	if (nsc_context)
 		nsc_context_set_cpu_opt(nsc_context, cpu);
+	freerdp_dsp_set_cpu_opt(cpu);
 #endif
 
 	xfi->width = instance->settings->width;
@@ -768,6 +790,8 @@ boolean xf_post_connect(freerdp* instance)
 		bitmap_cache_register_callbacks(instance->update);
 		offscreen_cache_register_callbacks(instance->update);
 		palette_cache_register_callbacks(instance->update);
+
+		instance->context->cache->bitmap->dstBpp = xfi->bpp;
 	}
 
 	instance->context->rail = rail_new(instance->settings);
@@ -980,6 +1004,25 @@ void xf_process_channel_event(rdpChannels* chanman, freerdp* instance)
 	}
 }
 
+static void xf_print_bitmap_cache_stats(rdpCache* cache)
+{
+	uint32 i;
+	BITMAP_CACHE_STATS stats;
+
+	if ((cache == NULL) || (cache->bitmap == NULL))
+		return;
+
+	for (i = 0; i < cache->bitmap->maxCells; i++)
+	{
+		bitmap_cache_get_stats(cache->bitmap, i, &stats);
+
+		DEBUG_X11("bitmap cache cell %d: hits %d misses %d decodes %d evictions %d "
+			"resident %d entries / %d bytes, compressed %d bytes", i,
+			stats.hits, stats.misses, stats.decodes, stats.evictions,
+			stats.entriesResident, stats.bytesResident, stats.bytesCompressed);
+	}
+}
+
 void xf_window_free(xfInfo* xfi)
 {
 	rdpContext* context = xfi->instance->context;
@@ -1017,6 +1060,18 @@ void xf_window_free(xfInfo* xfi)
 		xfi->bitmap_mono = 0;
 	}
 
+	if (xfi->glyph_batch)
+	{
+		XFreePixmap(xfi->display, xfi->glyph_batch);
+		xfi->glyph_batch = 0;
+	}
+
+	if (xfi->glyph_batch_mask != NULL)
+	{
+		xfree(xfi->glyph_batch_mask);
+		xfi->glyph_batch_mask = NULL;
+	}
+
 	if (xfi->image)
 	{
 		xfi->image->data = NULL;
@@ -1026,6 +1081,8 @@ void xf_window_free(xfInfo* xfi)
 
 	if (context != NULL)
 	{
+			xf_print_bitmap_cache_stats(context->cache);
+
 			cache_free(context->cache);
 			context->cache = NULL;
 
@@ -1154,6 +1211,8 @@ int xfreerdp_run(freerdp* instance)
 		timeout.tv_sec = 5;
 		select_status = select(max_fds + 1, &rfds_set, &wfds_set, NULL, &timeout);
 
+		xf_cliprdr_check_incr(xfi);
+
 		if (select_status == 0)
 		{
 			//freerdp_send_keep_alive(instance);
@@ -1285,6 +1344,7 @@ int main(int argc, char* argv[])
 
 	instance = freerdp_new();
 	instance->PreConnect = xf_pre_connect;
+	instance->ParallelPreConnect = xf_parallel_pre_connect;
 	instance->PostConnect = xf_post_connect;
 	instance->Authenticate = xf_authenticate;
 	instance->VerifyCertificate = xf_verify_certificate;
@@ -95,6 +95,11 @@ struct xf_info
 	Display* display;
 	Drawable drawable;
 	Pixmap bitmap_mono;
+	Pixmap glyph_batch;
+	int glyph_batch_width;
+	int glyph_batch_height;
+	uint8* glyph_batch_mask;
+	int glyph_batch_mask_size;
 	Colormap colormap;
 	int screen_number;
 	int scanline_pad;
@@ -19,7 +19,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
 #include <freerdp/gdi/gdi.h>
 #include <freerdp/codec/color.h>
 #include "test_color.h"
@@ -44,6 +46,7 @@ int add_color_suite(void)
 	add_test_function(color_GetRGB16);
 	add_test_function(color_GetBGR_565);
 	add_test_function(color_GetBGR16);
+	add_test_function(color_image_convert_32bpp);
 
 	return 0;
 }
@@ -150,5 +153,70 @@ void test_color_GetBGR16(void)
 	CU_ASSERT(b == 0xEF);
 }
 
+static int check_image_convert_32bpp(uint32* src, int count)
+{
+	int i;
+	int errors;
+	CLRCONV clrconv;
+	uint32 dst32[37];
+	uint16 dst16[37];
+	uint8 dst24[37 * 3];
+	uint8 red, green, blue;
+
+	errors = 0;
+	memset(&clrconv, 0, sizeof(CLRCONV));
+
+	clrconv.alpha = 1;
+	freerdp_image_convert((uint8*) src, (uint8*) dst32, count, 1, 32, 32, &clrconv);
+
+	for (i = 0; i < count; i++)
+		errors += (dst32[i] != (src[i] | 0xFF000000)) ? 1 : 0;
+
+	clrconv.alpha = 0;
+	clrconv.invert = 1;
+	freerdp_image_convert((uint8*) src, dst24, count, 1, 32, 24, &clrconv);
+
+	for (i = 0; i < count; i++)
+	{
+		GetRGB32(red, green, blue, src[i]);
+		errors += ((dst24[i * 3] != red) || (dst24[i * 3 + 1] != green) || (dst24[i * 3 + 2] != blue)) ? 1 : 0;
+	}
+
+	clrconv.invert = 0;
+	freerdp_image_convert((uint8*) src, (uint8*) dst16, count, 1, 32, 16, &clrconv);
+
+	for (i = 0; i < count; i++)
+	{
+		GetRGB32(red, green, blue, src[i]);
+		errors += (dst16[i] != (uint16) (RGB16(red, green, blue))) ? 1 : 0;
+	}
+
+	clrconv.invert = 1;
+	freerdp_image_convert((uint8*) src, (uint8*) dst16, count, 1, 32, 15, &clrconv);
+
+	for (i = 0; i < count; i++)
+	{
+		GetRGB32(red, green, blue, src[i]);
+		errors += (dst16[i] != (uint16) (BGR15(red, green, blue))) ? 1 : 0;
+	}
+
+	return errors;
+}
+
+void test_color_image_convert_32bpp(void)
+{
+	int i;
+	uint32 src[37];
+
+	for (i = 0; i < 37; i++)
+		src[i] = (i * 0x01234567) ^ 0x89ABCDEF;
+
+	/* 37 pixels exercise both the vector loops and their tails */
+	CU_ASSERT(check_image_convert_32bpp(src, 37) == 0);
+
+	freerdp_color_set_cpu_opt(CPU_SSE2);
+	CU_ASSERT(check_image_convert_32bpp(src, 37) == 0);
+}
+
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
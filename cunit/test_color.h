@@ -29,5 +29,6 @@ void test_color_GetRGB_565(void);
 void test_color_GetRGB16(void);
 void test_color_GetBGR_565(void);
 void test_color_GetBGR16(void);
+void test_color_image_convert_32bpp(void);
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
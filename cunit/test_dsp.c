@@ -0,0 +1,374 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Digital Sound Processing Unit Tests
+ *
+ * Copyright 2026 agent <agent@local>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
+#include <freerdp/utils/dsp.h>
+
+#include "test_dsp.h"
+
+int init_dsp_suite(void)
+{
+	return 0;
+}
+
+int clean_dsp_suite(void)
+{
+	return 0;
+}
+
+int add_dsp_suite(void)
+{
+	add_test_suite(dsp);
+
+	add_test_function(dsp_resample);
+	add_test_function(dsp_adpcm);
+
+	return 0;
+}
+
+int init_dsp_benchmark_suite(void)
+{
+	return 0;
+}
+
+int clean_dsp_benchmark_suite(void)
+{
+	return 0;
+}
+
+/* only run when named on the command line */
+int add_dsp_benchmark_suite(void)
+{
+	add_test_suite(dsp_benchmark);
+
+	add_test_function(dsp_resample_benchmark);
+
+	return 0;
+}
+
+/* interleaved 16-bit tone, the right channel at half the amplitude of the left */
+static sint16* make_tone(int frames, int channels, double freq, int rate, double amplitude)
+{
+	int i, c;
+	sint16* samples;
+
+	samples = (sint16*) malloc(frames * channels * sizeof(sint16));
+
+	for (i = 0; i < frames; i++)
+	{
+		for (c = 0; c < channels; c++)
+			samples[i * channels + c] = (sint16) (amplitude / (c + 1) * sin(2 * M_PI * freq * i / rate));
+	}
+
+	return samples;
+}
+
+/* resample frames in blocks of block_frames, returns the number of output frames */
+static int resample_blocks(FREERDP_DSP_CONTEXT* context, sint16* src, int frames, int block_frames,
+	uint32 schan, uint32 srate, uint32 rchan, uint32 rrate, sint16* dst)
+{
+	int n;
+	int total = 0;
+
+	while (frames > 0)
+	{
+		n = (frames < block_frames ? frames : block_frames);
+		context->resample(context, (uint8*) src, 2, schan, srate, n, rchan, rrate);
+		memcpy(&dst[total * rchan], context->resampled_buffer, context->resampled_frames * rchan * sizeof(sint16));
+		total += context->resampled_frames;
+		src += n * schan;
+		frames -= n;
+	}
+
+	return total;
+}
+
+static double rms(sint16* samples, int frames, int channels, int channel)
+{
+	int i;
+	double sum = 0;
+
+	for (i = 0; i < frames; i++)
+		sum += (double) samples[i * channels + channel] * samples[i * channels + channel];
+
+	return sqrt(sum / frames);
+}
+
+static void check_resample(void)
+{
+	FREERDP_DSP_CONTEXT* context;
+	sint16* src;
+	sint16* whole;
+	sint16* blocks;
+	int n_whole, n_blocks;
+
+	context = freerdp_dsp_context_new();
+	src = make_tone(44100, 2, 1000, 44100, 16000);
+	whole = (sint16*) malloc(60000 * 2 * sizeof(sint16));
+	blocks = (sint16*) malloc(60000 * 2 * sizeof(sint16));
+
+	/* one second at 44.1kHz gives one second at 48kHz, minus the filter delay */
+	n_whole = resample_blocks(context, src, 44100, 44100, 2, 44100, 2, 48000, whole);
+	CU_ASSERT(n_whole > 48000 - 32 && n_whole <= 48000);
+
+	/* 10ms blocks must produce exactly the same stream */
+	freerdp_dsp_context_reset_resampler(context);
+	n_blocks = resample_blocks(context, src, 44100, 441, 2, 44100, 2, 48000, blocks);
+	CU_ASSERT(n_blocks == n_whole);
+	CU_ASSERT(memcmp(whole, blocks, n_whole * 2 * sizeof(sint16)) == 0);
+
+	/* the tone passes at unity gain on both channels */
+	CU_ASSERT(fabs(rms(&whole[1000 * 2], 40000, 2, 0) - 16000 / sqrt(2)) < 16000 * 0.01);
+	CU_ASSERT(fabs(rms(&whole[1000 * 2], 40000, 2, 1) - 8000 / sqrt(2)) < 8000 * 0.01);
+
+	/* stereo to mono averages the channels */
+	freerdp_dsp_context_reset_resampler(context);
+	n_whole = resample_blocks(context, src, 44100, 441, 2, 44100, 1, 48000, whole);
+	CU_ASSERT(fabs(rms(&whole[1000], 40000, 1, 0) - 12000 / sqrt(2)) < 12000 * 0.01);
+	free(src);
+
+	/* a 6kHz tone is above the 4kHz Nyquist frequency of the output and must be filtered out */
+	freerdp_dsp_context_set_resample_quality(context, FREERDP_DSP_RESAMPLE_HIGH);
+	src = make_tone(48000, 1, 6000, 48000, 16000);
+	n_whole = resample_blocks(context, src, 48000, 480, 1, 48000, 1, 8000, whole);
+	CU_ASSERT(n_whole > 7900 && n_whole <= 8000);
+	CU_ASSERT(rms(&whole[100], 7000, 1, 0) < 16000 * 0.01);
+	free(src);
+
+	free(whole);
+	free(blocks);
+	freerdp_dsp_context_free(context);
+}
+
+void test_dsp_resample(void)
+{
+	check_resample();
+
+	freerdp_dsp_set_cpu_opt(CPU_SSE2);
+	check_resample();
+}
+
+void test_dsp_resample_benchmark(void)
+{
+	FREERDP_DSP_CONTEXT* context;
+	sint16* src;
+	sint16* block;
+	clock_t start;
+	double seconds;
+	int quality;
+	int i;
+
+	context = freerdp_dsp_context_new();
+	src = make_tone(44100 * 10, 2, 1000, 44100, 16000);
+
+	/* ten seconds of 44.1kHz stereo in 20ms blocks, as rdpsnd would receive them */
+	for (quality = FREERDP_DSP_RESAMPLE_LOW; quality <= FREERDP_DSP_RESAMPLE_HIGH; quality++)
+	{
+		freerdp_dsp_context_set_resample_quality(context, quality);
+		start = clock();
+
+		for (i = 0, block = src; i < 500; i++, block += 882 * 2)
+			context->resample(context, (uint8*) block, 2, 2, 44100, 882, 2, 48000);
+
+		seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+		printf("\nresample 44100->48000 stereo quality %d: %.0fx realtime", quality,
+			seconds > 0 ? 10 / seconds : 0);
+	}
+
+	free(src);
+	freerdp_dsp_context_free(context);
+}
+
+static void check_adpcm(int channels, int block_size, boolean ms)
+{
+	FREERDP_DSP_CONTEXT* encoder;
+	FREERDP_DSP_CONTEXT* decoder;
+	sint16* src;
+	uint8* encoded;
+	int encoded_size;
+	int frames;
+	int size;
+
+	/* exactly one block, MS ADPCM carries two frames in the block header */
+	if (ms)
+		frames = (block_size - 7 * channels) * 2 / channels + 2;
+	else
+		frames = (block_size - 4 * channels) * 2 / channels;
+	size = frames * channels * 2;
+
+	encoder = freerdp_dsp_context_new();
+	decoder = freerdp_dsp_context_new();
+	src = make_tone(frames, channels, 440, 22050, 16000);
+
+	/* the batch API produces exactly what the context callback does */
+	encoded = (uint8*) malloc(freerdp_dsp_adpcm_encode_max_size(size));
+	if (ms)
+	{
+		encoded_size = freerdp_dsp_encode_ms_adpcm_to(encoder, (uint8*) src, size, channels, block_size, encoded);
+		freerdp_dsp_context_reset_adpcm(encoder);
+		encoder->encode_ms_adpcm(encoder, (uint8*) src, size, channels, block_size);
+	}
+	else
+	{
+		encoded_size = freerdp_dsp_encode_ima_adpcm_to(encoder, (uint8*) src, size, channels, block_size, encoded);
+		freerdp_dsp_context_reset_adpcm(encoder);
+		encoder->encode_ima_adpcm(encoder, (uint8*) src, size, channels, block_size);
+	}
+	CU_ASSERT(encoded_size == encoder->adpcm_size);
+	CU_ASSERT(memcmp(encoded, encoder->adpcm_buffer, encoded_size) == 0);
+
+	/* and it decodes back to the tone */
+	if (ms)
+		decoder->decode_ms_adpcm(decoder, encoded, encoded_size, channels, block_size);
+	else
+		decoder->decode_ima_adpcm(decoder, encoded, encoded_size, channels, block_size);
+	CU_ASSERT(encoded_size == block_size);
+	CU_ASSERT(decoder->adpcm_size == size);
+	CU_ASSERT(fabs(rms((sint16*) decoder->adpcm_buffer + 64 * channels, frames - 128, channels, 0) -
+		16000 / sqrt(2)) < 16000 * 0.05);
+
+	free(src);
+	free(encoded);
+	freerdp_dsp_context_free(encoder);
+	freerdp_dsp_context_free(decoder);
+}
+
+/* one 64-byte stereo block of each format, as produced by the original per-sample encoder */
+
+static const uint8 ima_adpcm_encoded[64] =
+{
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0x0D, 0x01, 0x12, 0x22, 0x1C, 0x81, 0x13, 0x32,
+	0x81, 0x22, 0x24, 0x41, 0x01, 0x04, 0x03, 0x34, 0x11, 0x71, 0x81, 0x21,
+	0x41, 0x31, 0x72, 0x20, 0xFF, 0x0F, 0x08, 0x00, 0xFF, 0x0F, 0x08, 0x00,
+	0x08, 0x00, 0x10, 0x08, 0x00, 0x80, 0x00, 0x81, 0x11, 0x08, 0x11, 0x82,
+	0x01, 0x10, 0x10, 0x10
+};
+
+static const sint16 ima_adpcm_decoded[112] =
+{
+	-11, -11, -41, -41, -104, -104, -240, -240, -533, -533,
+	-1164, -1164, -2521, -2521, -5431, -5431, -10004, -9173, -9396, -7664,
+	-7736, -6292, -7233, -6707, -4946, -4061, -3700, -3031, -1810, -1470,
+	-93, 518, 843, 1292, 559, 1526, 1850, 3446, 3023, 3704,
+	4943, 5346, 6234, 5559, 6937, 7305, 8857, 8947, 9631, 9586,
+	10334, 11332, 10973, 12035, 13883, 13527, 15129, 14497, 14751, 17141,
+	15781, 17519, 17342, 19236, 13082, 14552, 3951, 4507, -15627, -17029,
+	-12829, -13952, -15372, -16750, -13060, -14207, -10958, -11895, -9047, -9793,
+	-10784, -7882, -9205, -6145, -7770, -4566, -6465, -6001, -5279, -4696,
+	-2044, -3510, -3024, -275, -2133, -1255, 298, 1419, 2507, 2229,
+	1838, 2965, 2446, 4973, 4106, 5581, 5615, 7241, 7902, 7744,
+	7487, 9116
+};
+
+static const uint8 ms_adpcm_encoded[64] =
+{
+	0x00, 0x00, 0x10, 0x00, 0x10, 0x00, 0x31, 0xBD, 0x73, 0xBC, 0xC6, 0xB2,
+	0xD6, 0xB9, 0x87, 0x77, 0x77, 0x77, 0x37, 0x31, 0x10, 0x22, 0x21, 0x31,
+	0x63, 0x11, 0x43, 0x23, 0x12, 0x01, 0x35, 0x20, 0x53, 0x21, 0x14, 0x34,
+	0x10, 0x23, 0x21, 0x75, 0x11, 0x04, 0x21, 0x22, 0x88, 0x88, 0xDE, 0x00,
+	0x10, 0x00, 0x00, 0x01, 0x10, 0x01, 0x10, 0x00, 0x11, 0x21, 0x01, 0x10,
+	0x12, 0x21, 0x00, 0x12
+};
+
+static const sint16 ms_adpcm_decoded[104] =
+{
+	-19770, -17962, -17103, -17293, -17231, -17181, -16895, -16915, -16090, -16278,
+	-14165, -14752, -12188, -11098, -10412, -9847, -9881, -9847, -8927, -7831,
+	-8071, -6926, -6919, -6113, -4849, -3923, -4159, -3268, -1683, -1504,
+	-199, 80, 467, 1028, 467, 1453, 2078, 3358, 3042, 3358,
+	5207, 4996, 6589, 5486, 7209, 7246, 8880, 9354, 9380, 9354,
+	10278, 11052, 11084, 11560, 13618, 13840, 14486, 14568, 14486, 17184,
+	15884, 17968, 17140, 19376, 12628, 14320, -908, -848, -16136, -12224,
+	-16136, -12224, -12040, -12224, -12040, -12224, -12040, -12224, -12040, -8896,
+	-9372, -8896, -9372, -6210, -7219, -6210, -7219, -6210, -5482, -4264,
+	-2362, -2516, -2362, -946, -1104, -946, 26, 1586, 2056, 2723,
+	2056, 2723, 2874, 4557
+};
+
+static void make_adpcm_input(sint16* samples, int count)
+{
+	int i;
+	uint32 seed = 1;
+
+	for (i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		samples[i] = (sint16) (((i % 64) - 32) * 600 + (sint32) ((seed >> 16) & 0x7FF) - 0x400);
+	}
+}
+
+static void check_adpcm_golden(boolean ms, const uint8* expected, int expected_size,
+		const sint16* expected_decoded, int decoded_size)
+{
+	FREERDP_DSP_CONTEXT* encoder;
+	FREERDP_DSP_CONTEXT* decoder;
+	sint16 src[256];
+	uint8 encoded[1024 + 256];
+	int encoded_size;
+	int frames;
+	int size;
+
+	frames = ms ? (64 - 7 * 2) + 2 : (64 - 4 * 2);
+	size = frames * 2 * 2;
+	make_adpcm_input(src, frames * 2);
+
+	encoder = freerdp_dsp_context_new();
+	decoder = freerdp_dsp_context_new();
+
+	if (ms)
+		encoded_size = freerdp_dsp_encode_ms_adpcm_to(encoder, (uint8*) src, size, 2, 64, encoded);
+	else
+		encoded_size = freerdp_dsp_encode_ima_adpcm_to(encoder, (uint8*) src, size, 2, 64, encoded);
+
+	CU_ASSERT(encoded_size == expected_size);
+	CU_ASSERT(memcmp(encoded, expected, expected_size) == 0);
+
+	if (ms)
+		decoder->decode_ms_adpcm(decoder, (uint8*) expected, expected_size, 2, 64);
+	else
+		decoder->decode_ima_adpcm(decoder, (uint8*) expected, expected_size, 2, 64);
+
+	CU_ASSERT(decoder->adpcm_size == decoded_size * 2);
+	CU_ASSERT(memcmp(decoder->adpcm_buffer, expected_decoded, decoded_size * 2) == 0);
+
+	freerdp_dsp_context_free(encoder);
+	freerdp_dsp_context_free(decoder);
+}
+
+void test_dsp_adpcm(void)
+{
+	check_adpcm(1, 1024, false);
+	check_adpcm(2, 2048, false);
+	check_adpcm(1, 1024, true);
+	check_adpcm(2, 2048, true);
+
+	check_adpcm_golden(false, ima_adpcm_encoded, sizeof(ima_adpcm_encoded),
+		ima_adpcm_decoded, sizeof(ima_adpcm_decoded) / sizeof(sint16));
+	check_adpcm_golden(true, ms_adpcm_encoded, sizeof(ms_adpcm_encoded),
+		ms_adpcm_decoded, sizeof(ms_adpcm_decoded) / sizeof(sint16));
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -36,7 +36,9 @@
 #include "test_channels.h"
 #include "test_cliprdr.h"
 #include "test_drdynvc.h"
+#include "test_dsp.h"
 #include "test_rfx.h"
+#include "test_security.h"
 #include "test_nsc.h"
 #include "test_freerdp.h"
 #include "test_rail.h"
@@ -117,6 +119,7 @@ struct _test_suite
 {
 	char name[32];
 	pInitTestSuite Init;
+	boolean named; /* only run when named on the command line */
 };
 typedef struct _test_suite test_suite;
 
@@ -128,6 +131,8 @@ const static test_suite suites[] =
 	{ "cliprdr", add_cliprdr_suite },
 	{ "color", add_color_suite },
 	{ "drdynvc", add_drdynvc_suite },
+	{ "dsp", add_dsp_suite },
+	{ "dsp_benchmark", add_dsp_benchmark_suite, true },
 	{ "gcc", add_gcc_suite },
 	{ "gdi", add_gdi_suite },
 	{ "license", add_license_suite },
@@ -142,6 +147,8 @@ const static test_suite suites[] =
 	{ "rail", add_rail_suite },
 	{ "rfx", add_rfx_suite },
 	{ "nsc", add_nsc_suite },
+	{ "security", add_security_suite },
+	{ "security_benchmark", add_security_benchmark_suite, true },
 	{ "sspi", add_sspi_suite },
 	{ "stream", add_stream_suite },
 	{ "utils", add_utils_suite }
@@ -159,7 +166,10 @@ int main(int argc, char* argv[])
 	if (argc < 2)
 	{
 		for (k = 0; k < N_SUITES; k++)
-			suites[k].Init();
+		{
+			if (!suites[k].named)
+				suites[k].Init();
+		}
 	}
 	else
 	{
@@ -167,7 +177,7 @@ int main(int argc, char* argv[])
 		{
 			puts("Test suites:");
 			for (k = 0; k < N_SUITES; k++)
-				printf("\t%s\n", suites[k].name);
+				printf("\t%s%s\n", suites[k].name, suites[k].named ? " (only when named)" : "");
 			printf("\nUsage: %s [suite-1] [suite-2] ...\n", argv[0]);
 			return 0;
 		}
@@ -36,6 +36,13 @@
 #include <freerdp/gdi/clipping.h>
 #include <freerdp/gdi/32bpp.h>
 
+#include "config.h"
+#include "primitives.h"
+
+#ifdef WITH_SSE2
+#include "primitives_sse2.h"
+#endif
+
 #include "test_gdi.h"
 
 int init_gdi_suite(void)
@@ -74,6 +81,8 @@ int add_gdi_suite(void)
 	add_test_function(gdi_BitBlt_8bpp);
 	add_test_function(gdi_ClipCoords);
 	add_test_function(gdi_InvalidateRegion);
+	add_test_function(gdi_CombineRegion);
+	add_test_function(gdi_primitives);
 
 	return 0;
 }
@@ -2864,13 +2873,14 @@ void test_gdi_InvalidateRegion(void)
 	gdi_SelectObject(hdc, (HGDIOBJECT) bmp);
 	gdi_SetNullClipRgn(hdc);
 
-	hdc->hwnd = (HGDI_WND) malloc(sizeof(GDI_WND));
+	hdc->hwnd = (HGDI_WND) calloc(1, sizeof(GDI_WND));
 	hdc->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 	hdc->hwnd->invalid->null = 1;
 	invalid = hdc->hwnd->invalid;
 	
 	hdc->hwnd->count = 16;
 	hdc->hwnd->cinvalid = (HGDI_RGN) malloc(sizeof(GDI_RGN) * hdc->hwnd->count);
+	hdc->hwnd->ninvalid = 0;
 
 	rgn1 = gdi_CreateRectRgn(0, 0, 0, 0);
 	rgn2 = gdi_CreateRectRgn(0, 0, 0, 0);
@@ -2988,6 +2998,197 @@ void test_gdi_InvalidateRegion(void)
 
 	gdi_InvalidateRegion(hdc, rgn1->x, rgn1->y, rgn1->w, rgn1->h);
 	CU_ASSERT(gdi_EqualRgn(invalid, rgn2) == 1);
+
+	/* far apart updates keep separate rectangles */
+	invalid->null = 1;
+	gdi_InvalidateRegion(hdc, 10, 10, 20, 20);
+	gdi_InvalidateRegion(hdc, 900, 700, 20, 20);
+	CU_ASSERT(hdc->hwnd->ninvalid == 2);
+	gdi_SetRgn(rgn2, 10, 10, 20, 20);
+	CU_ASSERT(gdi_EqualRgn(&hdc->hwnd->cinvalid[0], rgn2) == 1);
+	gdi_SetRgn(rgn2, 900, 700, 20, 20);
+	CU_ASSERT(gdi_EqualRgn(&hdc->hwnd->cinvalid[1], rgn2) == 1);
+
+	/* nearby updates are merged */
+	gdi_InvalidateRegion(hdc, 32, 10, 20, 20);
+	CU_ASSERT(hdc->hwnd->ninvalid == 2);
+	gdi_SetRgn(rgn2, 10, 10, 42, 20);
+	CU_ASSERT(gdi_EqualRgn(&hdc->hwnd->cinvalid[0], rgn2) == 1);
+
+	/* updates inside an invalid rectangle leave the region alone */
+	gdi_InvalidateRegion(hdc, 20, 12, 10, 10);
+	gdi_InvalidateRegion(hdc, 30, 10, 0, 20);
+	CU_ASSERT(hdc->hwnd->ninvalid == 2);
+	CU_ASSERT(gdi_EqualRgn(&hdc->hwnd->cinvalid[0], rgn2) == 1);
+}
+
+void test_gdi_CombineRegion(void)
+{
+	HGDI_RGN rgn;
+	HGDI_REGION region;
+	HGDI_REGION region2;
+
+	rgn = gdi_CreateRectRgn(0, 0, 0, 0);
+	region = gdi_CreateRegion();
+	region2 = gdi_CreateRegion();
+
+	/* overlapping rectangles are split in bands */
+	gdi_CombineRegionRect(region, 0, 0, 100, 100, GDI_RGN_OR);
+	gdi_CombineRegionRect(region, 50, 50, 100, 100, GDI_RGN_OR);
+	CU_ASSERT(region->count == 3);
+	gdi_SetRgn(rgn, 0, 0, 100, 50);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[0], rgn) == 1);
+	gdi_SetRgn(rgn, 0, 50, 150, 50);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[1], rgn) == 1);
+	gdi_SetRgn(rgn, 50, 100, 100, 50);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[2], rgn) == 1);
+
+	/* adjacent rectangles are coalesced */
+	gdi_EmptyRegion(region);
+	gdi_CombineRegionRect(region, 0, 0, 100, 50, GDI_RGN_OR);
+	gdi_CombineRegionRect(region, 0, 50, 100, 50, GDI_RGN_OR);
+	gdi_CombineRegionRect(region, 100, 0, 20, 100, GDI_RGN_OR);
+	CU_ASSERT(region->count == 1);
+	gdi_SetRgn(rgn, 0, 0, 120, 100);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[0], rgn) == 1);
+
+	/* punching a hole */
+	gdi_CombineRegionRect(region, 40, 40, 20, 20, GDI_RGN_DIFF);
+	CU_ASSERT(region->count == 4);
+	gdi_SetRgn(rgn, 0, 40, 40, 20);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[1], rgn) == 1);
+	gdi_SetRgn(rgn, 60, 40, 60, 20);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[2], rgn) == 1);
+
+	/* intersection */
+	gdi_CombineRegionRect(region2, 30, 30, 20, 20, GDI_RGN_OR);
+	gdi_CombineRegion(region2, region2, region, GDI_RGN_AND);
+	CU_ASSERT(region2->count == 2);
+	gdi_SetRgn(rgn, 30, 30, 20, 10);
+	CU_ASSERT(gdi_EqualRgn(&region2->rects[0], rgn) == 1);
+	gdi_SetRgn(rgn, 30, 40, 10, 10);
+	CU_ASSERT(gdi_EqualRgn(&region2->rects[1], rgn) == 1);
+
+	gdi_CombineRegion(region2, region2, region2, GDI_RGN_DIFF);
+	CU_ASSERT(region2->count == 0);
+
+	/* cheap merges are taken, the result still covers the region */
+	gdi_EmptyRegion(region);
+	gdi_CombineRegionRect(region, 0, 0, 10, 10, GDI_RGN_OR);
+	gdi_CombineRegionRect(region, 12, 0, 10, 10, GDI_RGN_OR);
+	gdi_CombineRegionRect(region, 500, 500, 10, 10, GDI_RGN_OR);
+	gdi_SimplifyRegion(region, 100, 32);
+	CU_ASSERT(region->count == 2);
+	gdi_SetRgn(rgn, 0, 0, 22, 10);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[0], rgn) == 1);
+
+	gdi_SimplifyRegion(region, 100, 1);
+	CU_ASSERT(region->count == 1);
+	gdi_SetRgn(rgn, 0, 0, 510, 510);
+	CU_ASSERT(gdi_EqualRgn(&region->rects[0], rgn) == 1);
+
+	gdi_DeleteRegion(region);
+	gdi_DeleteRegion(region2);
+	free(rgn);
+}
+
+static void fill_random(uint8* data, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		data[i] = rand() & 0xFF;
+}
+
+static void fill_random_mask(uint8* data, int length)
+{
+	int i;
+
+	/* glyph masks only contain 0x00 or 0xFF, with long empty runs */
+	for (i = 0; i < length; i++)
+		data[i] = ((rand() % 3) == 0) ? 0xFF : 0x00;
+
+	if (length > 32)
+		memset(&data[length / 2], 0, 16);
+}
+
+void test_gdi_primitives(void)
+{
+	int width;
+	uint8* src;
+	uint8* mask;
+	uint8* pattern;
+	uint8* dst_c;
+	uint8* dst_simd;
+	GDI_PRIMITIVES c;
+	GDI_PRIMITIVES simd;
+
+	gdi_primitives_init_c(&c);
+	gdi_primitives_init_c(&simd);
+
+#ifdef WITH_SSE2
+	gdi_primitives_init_sse2(&simd);
+#endif
+
+	src = (uint8*) malloc(256 * 4);
+	mask = (uint8*) malloc(256);
+	pattern = (uint8*) malloc(8 * 4);
+	dst_c = (uint8*) malloc(256 * 4);
+	dst_simd = (uint8*) malloc(256 * 4);
+
+	/* odd widths exercise the scalar tails of the vector loops */
+	for (width = 0; width < 256; width += (width < 40) ? 1 : 13)
+	{
+		fill_random(src, width * 4);
+		fill_random(pattern, 8 * 4);
+		fill_random_mask(mask, width);
+
+		fill_random(dst_c, width * 4);
+		memcpy(dst_simd, dst_c, width * 4);
+		c.fill_32bpp((uint32*) dst_c, width, 0xFF123456);
+		simd.fill_32bpp((uint32*) dst_simd, width, 0xFF123456);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		c.fill_16bpp((uint16*) dst_c, width, 0xA5C3);
+		simd.fill_16bpp((uint16*) dst_simd, width, 0xA5C3);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 2) == 0);
+
+		c.pattern_32bpp((uint32*) dst_c, width, (uint32*) pattern);
+		simd.pattern_32bpp((uint32*) dst_simd, width, (uint32*) pattern);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		c.pattern_16bpp((uint16*) dst_c, width, (uint16*) pattern);
+		simd.pattern_16bpp((uint16*) dst_simd, width, (uint16*) pattern);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		fill_random(dst_c, width * 4);
+		memcpy(dst_simd, dst_c, width * 4);
+		c.rop_and(dst_c, src, width * 4);
+		simd.rop_and(dst_simd, src, width * 4);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		c.rop_or(dst_c, src, width * 4);
+		simd.rop_or(dst_simd, src, width * 4);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		c.rop_xor(dst_c, src, width * 4);
+		simd.rop_xor(dst_simd, src, width * 4);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		c.glyph_blend_32bpp((uint32*) dst_c, mask, width, 0xFF00FF00);
+		simd.glyph_blend_32bpp((uint32*) dst_simd, mask, width, 0xFF00FF00);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+
+		c.glyph_blend_16bpp((uint16*) dst_c, mask, width, 0x07E0);
+		simd.glyph_blend_16bpp((uint16*) dst_simd, mask, width, 0x07E0);
+		CU_ASSERT(memcmp(dst_c, dst_simd, width * 4) == 0);
+	}
+
+	free(src);
+	free(mask);
+	free(pattern);
+	free(dst_c);
+	free(dst_simd);
 }
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
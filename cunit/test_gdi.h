@@ -45,5 +45,7 @@ void test_gdi_BitBlt_16bpp(void);
 void test_gdi_BitBlt_8bpp(void);
 void test_gdi_ClipCoords(void);
 void test_gdi_InvalidateRegion(void);
+void test_gdi_CombineRegion(void);
+void test_gdi_primitives(void);
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
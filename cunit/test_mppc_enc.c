@@ -460,6 +460,8 @@ int add_mppc_enc_suite(void)
 {
 	add_test_suite(mppc_enc);
 	add_test_function(mppc_enc);
+	add_test_function(mppc_enc_rdp4);
+	add_test_function(mppc_enc_chunks);
 	return 0;
 }
 
@@ -590,5 +592,128 @@ void test_mppc_enc(void)
 	mppc_enc_free(enc);
 	mppc_dec_free(rmppc);
 }
+
+void test_mppc_enc_rdp4(void)
+{
+	int i;
+	int len;
+	int offset;
+	uint32 roff;
+	uint32 rlen;
+	struct rdp_mppc_enc* enc;
+	struct rdp_mppc_dec* rmppc;
+	int data_len = sizeof(decompressed_rd5_data);
+
+	rmppc = mppc_dec_new();
+	CU_ASSERT((enc = mppc_enc_new(PROTO_RDP_40)) != NULL);
+
+	/* feed the data a few times in virtual channel sized chunks, wrapping the 8K history */
+	for (i = 0; i < 4; i++)
+	{
+		for (offset = 0; offset < data_len; offset += len)
+		{
+			len = MIN(1600, data_len - offset);
+
+			CU_ASSERT(compress_rdp(enc, (uint8*) decompressed_rd5_data + offset, len) != false);
+
+			if (enc->flags & PACKET_COMPRESSED)
+			{
+				CU_ASSERT((enc->flags & CompressionTypeMask) == PACKET_COMPR_TYPE_8K);
+				CU_ASSERT(enc->bytes_in_opb < len);
+				CU_ASSERT(decompress_rdp_4(rmppc, (uint8*) enc->outputBuffer,
+						enc->bytes_in_opb, enc->flags, &roff, &rlen) != false);
+				CU_ASSERT(len == rlen);
+				CU_ASSERT(memcmp(decompressed_rd5_data + offset, &rmppc->history_buf[roff], rlen) == 0);
+			}
+		}
+	}
+
+	mppc_enc_free(enc);
+	mppc_dec_free(rmppc);
+}
+
+/* round-trip one chunk, returns false if the decoded data does not match */
+static boolean mppc_enc_round_trip(struct rdp_mppc_enc* enc, struct rdp_mppc_dec* rmppc, uint8* data, int len)
+{
+	uint32 roff;
+	uint32 rlen;
+
+	if (!compress_rdp(enc, data, len))
+		return false;
+
+	if (!(enc->flags & PACKET_COMPRESSED))
+		return true;
+
+	if (enc->bytes_in_opb > len)
+		return false;
+
+	if (!decompress_rdp(rmppc, (uint8*) enc->outputBuffer, enc->bytes_in_opb, enc->flags, &roff, &rlen))
+		return false;
+
+	return (rlen == len) && (memcmp(data, &rmppc->history_buf[roff], rlen) == 0);
+}
+
+void test_mppc_enc_chunks(void)
+{
+	int i, k;
+	int len;
+	int offset;
+	uint8* data;
+	boolean ok;
+	struct rdp_mppc_enc* enc;
+	struct rdp_mppc_dec* rmppc;
+	int data_len = 256 * 1024;
+	int protocols[2] = { PROTO_RDP_40, PROTO_RDP_50 };
+
+	/* a mix of repetitive, random and constant runs */
+	data = (uint8*) malloc(data_len);
+	srand(1);
+	for (i = 0; i < data_len; i++)
+	{
+		if ((i / 4096) % 3 == 0)
+			data[i] = decompressed_rd5_data[i % sizeof(decompressed_rd5_data)];
+		else if ((i / 4096) % 3 == 1)
+			data[i] = rand();
+		else
+			data[i] = (uint8) (i / 8192);
+	}
+
+	for (k = 0; k < 2; k++)
+	{
+		/* a PDU one byte longer than the channel chunk size leaves a one byte tail */
+		rmppc = mppc_dec_new();
+		enc = mppc_enc_new(protocols[k]);
+		ok = true;
+
+		for (i = 0; i < 200; i++)
+		{
+			ok &= mppc_enc_round_trip(enc, rmppc, data + (i % 16) * 1601, 1600);
+			ok &= mppc_enc_round_trip(enc, rmppc, data + (i % 16) * 1601 + 1600, 1);
+		}
+
+		CU_ASSERT(ok == true);
+		mppc_enc_free(enc);
+		mppc_dec_free(rmppc);
+
+		/* short and variable chunk lengths, up to the history size */
+		rmppc = mppc_dec_new();
+		enc = mppc_enc_new(protocols[k]);
+		ok = true;
+
+		for (i = 0; i < 2000; i++)
+		{
+			len = (i % 4 == 0) ? (rand() % 8) + 1 : (rand() % enc->buf_len) + 1;
+			offset = rand() % (data_len - len);
+			ok &= mppc_enc_round_trip(enc, rmppc, data + offset, len);
+		}
+
+		CU_ASSERT(ok == true);
+		mppc_enc_free(enc);
+		mppc_dec_free(rmppc);
+	}
+
+	free(data);
+}
+
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
@@ -23,5 +23,8 @@ int init_mppc_enc_suite(void);
 int clean_mppc_enc_suite(void);
 int add_mppc_enc_suite(void);
 
-void test_mppc_enc(void);/* Modeline for vim. Don't delete */
+void test_mppc_enc(void);
+void test_mppc_enc_rdp4(void);
+void test_mppc_enc_chunks(void);
+/* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,281 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * RDP Security Unit Tests
+ *
+ * Copyright 2026 agent <agent@local>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <freerdp/freerdp.h>
+#include <freerdp/utils/blob.h>
+
+#include "rdp.h"
+#include "security.h"
+
+#include "test_security.h"
+
+int init_security_suite(void)
+{
+	return 0;
+}
+
+int clean_security_suite(void)
+{
+	return 0;
+}
+
+int add_security_suite(void)
+{
+	add_test_suite(security);
+
+	add_test_function(security_sign_and_encrypt);
+	add_test_function(security_sign_and_encrypt_buffers);
+
+	return 0;
+}
+
+int init_security_benchmark_suite(void)
+{
+	return 0;
+}
+
+int clean_security_benchmark_suite(void)
+{
+	return 0;
+}
+
+/* only run when named on the command line */
+int add_security_benchmark_suite(void)
+{
+	add_test_suite(security_benchmark);
+
+	add_test_function(security_sign_and_encrypt_benchmark);
+
+	return 0;
+}
+
+static rdpRdp* security_rdp_new(int encryption_method)
+{
+	int i;
+	rdpRdp* rdp;
+	uint8 client_random[32];
+
+	rdp = rdp_new(NULL);
+	rdp->settings->encryption_method = encryption_method;
+	freerdp_blob_alloc(rdp->settings->server_random, 32);
+
+	for (i = 0; i < 32; i++)
+	{
+		client_random[i] = i;
+		((uint8*) rdp->settings->server_random->data)[i] = 0xFF - i;
+	}
+
+	security_establish_keys(client_random, rdp);
+	rdp->rc4_decrypt_key = crypto_rc4_init(rdp->decrypt_key, rdp->rc4_key_len);
+	rdp->rc4_encrypt_key = crypto_rc4_init(rdp->encrypt_key, rdp->rc4_key_len);
+
+	return rdp;
+}
+
+static void fill_data(uint8* data, int length, int seed)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		data[i] = (uint8) (i * 7 + seed);
+}
+
+/* the MAC as specified in MS-RDPBCGR 5.3.6.1, hashing MACKeyN and the pads for every PDU */
+static void reference_mac_signature(rdpRdp* rdp, uint8* data, uint32 length, boolean salted, uint8* output)
+{
+	int i;
+	CryptoMd5 md5;
+	CryptoSha1 sha1;
+	uint8 pad[48];
+	uint8 length_le[4];
+	uint8 use_count_le[4];
+	uint8 md5_digest[CRYPTO_MD5_DIGEST_LENGTH];
+	uint8 sha1_digest[CRYPTO_SHA1_DIGEST_LENGTH];
+
+	for (i = 0; i < 4; i++)
+	{
+		length_le[i] = (length >> (i * 8)) & 0xFF;
+		use_count_le[i] = (rdp->encrypt_checksum_use_count >> (i * 8)) & 0xFF;
+	}
+
+	sha1 = crypto_sha1_init();
+	crypto_sha1_update(sha1, rdp->sign_key, rdp->rc4_key_len);
+	memset(pad, 0x36, 40);
+	crypto_sha1_update(sha1, pad, 40);
+	crypto_sha1_update(sha1, length_le, sizeof(length_le));
+	crypto_sha1_update(sha1, data, length);
+	if (salted)
+		crypto_sha1_update(sha1, use_count_le, sizeof(use_count_le));
+	crypto_sha1_final(sha1, sha1_digest);
+
+	md5 = crypto_md5_init();
+	crypto_md5_update(md5, rdp->sign_key, rdp->rc4_key_len);
+	memset(pad, 0x5C, 48);
+	crypto_md5_update(md5, pad, 48);
+	crypto_md5_update(md5, sha1_digest, sizeof(sha1_digest));
+	crypto_md5_final(md5, md5_digest);
+
+	memcpy(output, md5_digest, 8);
+}
+
+static void reference_sign_and_encrypt(rdpRdp* rdp, uint8* data, uint32 length, boolean salted, uint8* output)
+{
+	reference_mac_signature(rdp, data, length, salted, output);
+	security_encrypt(data, length, rdp);
+}
+
+static void check_sign_and_encrypt(int encryption_method, boolean salted)
+{
+	int i;
+	uint32 length;
+	rdpRdp* reference;
+	rdpRdp* rdp;
+	uint8* expected;
+	uint8* data;
+	uint8 expected_signature[8];
+	uint8 signature[8];
+	boolean equal = true;
+
+	reference = security_rdp_new(encryption_method);
+	rdp = security_rdp_new(encryption_method);
+	expected = (uint8*) malloc(3 * SECURITY_CHUNK_SIZE);
+	data = (uint8*) malloc(3 * SECURITY_CHUNK_SIZE);
+
+	/* enough PDUs to go through an encryption key update */
+	for (i = 0; i < 4200; i++)
+	{
+		length = (i % 37 == 0) ? (3 * SECURITY_CHUNK_SIZE - i % 5) : (i % 300) + 1;
+
+		fill_data(expected, length, i);
+		fill_data(data, length, i);
+
+		reference_sign_and_encrypt(reference, expected, length, salted, expected_signature);
+		security_sign_and_encrypt(rdp, data, length, salted, signature);
+
+		if (memcmp(expected_signature, signature, 8) != 0 || memcmp(expected, data, length) != 0)
+			equal = false;
+	}
+
+	CU_ASSERT(equal == true);
+	CU_ASSERT(rdp->encrypt_checksum_use_count == reference->encrypt_checksum_use_count);
+
+	free(expected);
+	free(data);
+	rdp_free(reference);
+	rdp_free(rdp);
+}
+
+void test_security_sign_and_encrypt(void)
+{
+	check_sign_and_encrypt(ENCRYPTION_METHOD_40BIT, false);
+	check_sign_and_encrypt(ENCRYPTION_METHOD_40BIT, true);
+	check_sign_and_encrypt(ENCRYPTION_METHOD_128BIT, false);
+	check_sign_and_encrypt(ENCRYPTION_METHOD_128BIT, true);
+}
+
+void test_security_sign_and_encrypt_buffers(void)
+{
+	rdpRdp* reference;
+	rdpRdp* rdp;
+	uint8 expected[6000];
+	uint8 data[6000];
+	uint8* buffers[3];
+	uint32 lengths[3];
+	uint8 expected_signature[8];
+	uint8 signature[8];
+
+	reference = security_rdp_new(ENCRYPTION_METHOD_128BIT);
+	rdp = security_rdp_new(ENCRYPTION_METHOD_128BIT);
+
+	fill_data(expected, sizeof(expected), 3);
+	fill_data(data, sizeof(data), 3);
+
+	/* a header, a payload spanning several chunks and a trailer */
+	buffers[0] = data;
+	lengths[0] = 11;
+	buffers[1] = data + 11;
+	lengths[1] = 5000;
+	buffers[2] = data + 5011;
+	lengths[2] = sizeof(data) - 5011;
+
+	reference_sign_and_encrypt(reference, expected, sizeof(expected), true, expected_signature);
+	security_sign_and_encrypt_buffers(rdp, buffers, lengths, 3, true, signature);
+
+	CU_ASSERT(memcmp(expected_signature, signature, 8) == 0);
+	CU_ASSERT(memcmp(expected, data, sizeof(data)) == 0);
+
+	rdp_free(reference);
+	rdp_free(rdp);
+}
+
+void test_security_sign_and_encrypt_benchmark(void)
+{
+	int i, k;
+	rdpRdp* reference;
+	rdpRdp* rdp;
+	uint8* expected;
+	uint8* data;
+	clock_t start;
+	double seconds;
+	uint8 expected_signature[8];
+	uint8 signature[8];
+	static const uint32 sizes[] = { 64, 1024, 16384 };
+
+	reference = security_rdp_new(ENCRYPTION_METHOD_128BIT);
+	rdp = security_rdp_new(ENCRYPTION_METHOD_128BIT);
+	expected = (uint8*) malloc(16384);
+	data = (uint8*) malloc(16384);
+	fill_data(expected, 16384, 0);
+	fill_data(data, 16384, 0);
+
+	/* 64MB of PDUs per size, through the reference path and the fused path */
+	for (k = 0; k < 3; k++)
+	{
+		start = clock();
+
+		for (i = 0; i < (64 * 1024 * 1024) / sizes[k]; i++)
+			reference_sign_and_encrypt(reference, expected, sizes[k], true, expected_signature);
+
+		seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+		printf("\nsign and encrypt %5d byte PDUs: reference %.0f MB/s", sizes[k],
+			seconds > 0 ? 64 / seconds : 0);
+
+		start = clock();
+
+		for (i = 0; i < (64 * 1024 * 1024) / sizes[k]; i++)
+			security_sign_and_encrypt(rdp, data, sizes[k], true, signature);
+
+		seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+		printf(", fused %.0f MB/s", seconds > 0 ? 64 / seconds : 0);
+
+		CU_ASSERT(memcmp(expected_signature, signature, 8) == 0);
+		CU_ASSERT(memcmp(expected, data, sizes[k]) == 0);
+	}
+
+	free(expected);
+	free(data);
+	rdp_free(reference);
+	rdp_free(rdp);
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
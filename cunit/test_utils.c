@@ -28,11 +28,14 @@
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <freerdp/freerdp.h>
 #include <freerdp/utils/mutex.h>
 #include <freerdp/utils/semaphore.h>
 #include <freerdp/utils/load_plugin.h>
 #include <freerdp/utils/wait_obj.h>
+#include <freerdp/utils/ring.h>
+#include <freerdp/utils/handle_table.h>
 #include <freerdp/utils/args.h>
 #include <freerdp/utils/passphrase.h>
 #include <freerdp/utils/signal.h>
@@ -58,6 +61,8 @@ int add_utils_suite(void)
 	add_test_function(semaphore);
 	add_test_function(load_plugin);
 	add_test_function(wait_obj);
+	add_test_function(ring);
+	add_test_function(handle_table);
 	add_test_function(args);
 	add_test_function(passphrase_read);
 	add_test_function(handle_signals);
@@ -121,6 +126,109 @@ void test_wait_obj(void)
 	wait_obj_free(wo);
 }
 
+#define RING_TEST_COUNT 100000
+
+static void* test_ring_producer(void* arg)
+{
+	RING* ring = (RING*) arg;
+	uint32 i;
+
+	for (i = 0; i < RING_TEST_COUNT; i++)
+		ring_enqueue(ring, &i);
+
+	return NULL;
+}
+
+void test_ring(void)
+{
+	RING* ring;
+	pthread_t thread;
+	uint32 value;
+	uint32 expected;
+	int i;
+
+	ring = ring_new(6, sizeof(uint32));
+	CU_ASSERT(ring_is_empty(ring));
+	CU_ASSERT(ring_dequeue(ring, &value) == false);
+
+	/* overfill the ring, the extra items must spill and keep their order */
+	for (i = 0; i < 20; i++)
+	{
+		value = i;
+		ring_enqueue(ring, &value);
+	}
+	CU_ASSERT(ring->spilled == 12);
+
+	for (i = 0; i < 10; i++)
+	{
+		CU_ASSERT(ring_dequeue(ring, &value) && value == i);
+	}
+
+	/* enqueues while spilled items remain must queue behind them */
+	value = 20;
+	ring_enqueue(ring, &value);
+
+	for (i = 10; i <= 20; i++)
+	{
+		CU_ASSERT(ring_dequeue(ring, &value) && value == i);
+	}
+	CU_ASSERT(ring_is_empty(ring));
+	ring_free(ring);
+
+	/* one producer thread, one consumer thread */
+	ring = ring_new(64, sizeof(uint32));
+	pthread_create(&thread, NULL, test_ring_producer, ring);
+
+	expected = 0;
+	while (expected < RING_TEST_COUNT)
+	{
+		if (ring_dequeue(ring, &value))
+		{
+			if (value != expected)
+				break;
+			expected++;
+		}
+	}
+	CU_ASSERT(expected == RING_TEST_COUNT);
+
+	pthread_join(thread, NULL);
+	CU_ASSERT(ring_is_empty(ring));
+	ring_free(ring);
+}
+
+void test_handle_table(void)
+{
+	HANDLE_TABLE* table;
+	int values[4];
+
+	table = handle_table_new(4);
+
+	handle_table_add(table, 1, &values[0]);
+	handle_table_add(table, 2, &values[1]);
+	/* 5 and 9 share the slot of 1 */
+	handle_table_add(table, 5, &values[2]);
+	handle_table_add(table, 9, &values[3]);
+
+	CU_ASSERT(handle_table_lookup(table, 0) == NULL);
+	CU_ASSERT(handle_table_lookup(table, 1) == &values[0]);
+	CU_ASSERT(handle_table_lookup(table, 2) == &values[1]);
+	CU_ASSERT(handle_table_lookup(table, 5) == &values[2]);
+	CU_ASSERT(handle_table_lookup(table, 9) == &values[3]);
+	CU_ASSERT(handle_table_lookup(table, 3) == NULL);
+	CU_ASSERT(handle_table_lookup(table, 13) == NULL);
+
+	handle_table_remove(table, 1);
+	handle_table_remove(table, 9);
+	CU_ASSERT(handle_table_lookup(table, 1) == NULL);
+	CU_ASSERT(handle_table_lookup(table, 9) == NULL);
+	CU_ASSERT(handle_table_lookup(table, 5) == &values[2]);
+
+	handle_table_add(table, 13, &values[0]);
+	CU_ASSERT(handle_table_lookup(table, 13) == &values[0]);
+
+	handle_table_free(table);
+}
+
 static int process_plugin_args(rdpSettings* settings, const char* name,
 	RDP_PLUGIN_DATA* plugin_data, void* user_data)
 {
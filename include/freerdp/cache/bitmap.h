@@ -27,14 +27,43 @@
 #include <freerdp/utils/stream.h>
 
 typedef struct _BITMAP_V2_CELL BITMAP_V2_CELL;
+typedef struct _BITMAP_V2_ENTRY BITMAP_V2_ENTRY;
+typedef struct _BITMAP_CACHE_STATS BITMAP_CACHE_STATS;
 typedef struct rdp_bitmap_cache rdpBitmapCache;
 
 #include <freerdp/cache/cache.h>
 
+struct _BITMAP_CACHE_STATS
+{
+	uint32 hits; /* lookups served from decoded bitmaps */
+	uint32 misses; /* lookups of empty entries or entries that needed decoding */
+	uint32 decodes;
+	uint32 evictions;
+	uint32 entriesResident;
+	uint32 bytesResident; /* decoded pixel data */
+	uint32 bytesCompressed; /* wire data kept for lazy decoding */
+};
+
+struct _BITMAP_V2_ENTRY
+{
+	uint32 id;
+	uint32 index;
+	uint8* data;
+	uint32 length;
+	uint32 bpp;
+	uint32 size;
+	boolean compressed;
+	boolean decoded;
+	BITMAP_V2_ENTRY* prev;
+	BITMAP_V2_ENTRY* next;
+};
+
 struct _BITMAP_V2_CELL
 {
 	uint32 number;
 	rdpBitmap** entries;
+	BITMAP_V2_ENTRY* info;
+	BITMAP_CACHE_STATS stats;
 };
 
 struct rdp_bitmap_cache
@@ -57,11 +86,20 @@ struct rdp_bitmap_cache
 	rdpUpdate* update;
 	rdpContext* context;
 	rdpSettings* settings;
+
+	uint32 dstBpp; /* depth of the backend surfaces */
+	uint32 maxMemory; /* ceiling for decoded bitmaps */
+	uint32 memoryResident; /* decoded bitmaps */
+	uint32 memoryCompressed; /* retained wire data */
+	BITMAP_V2_ENTRY* head;
+	BITMAP_V2_ENTRY* tail;
 };
 
 FREERDP_API rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index);
 FREERDP_API void bitmap_cache_put(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index, rdpBitmap* bitmap);
 
+FREERDP_API void bitmap_cache_get_stats(rdpBitmapCache* bitmap_cache, uint32 id, BITMAP_CACHE_STATS* stats);
+
 FREERDP_API void bitmap_cache_register_callbacks(rdpUpdate* update);
 
 FREERDP_API rdpBitmapCache* bitmap_cache_new(rdpSettings* settings);
@@ -37,6 +37,7 @@ struct _GLYPH_CACHE
 	uint32 number;
 	uint32 maxCellSize;
 	rdpGlyph** entries;
+	GLYPH_ATLAS atlas;
 };
 
 struct _FRAGMENT_CACHE_ENTRY
@@ -55,6 +56,9 @@ struct rdp_glyph_cache
 	FRAGMENT_CACHE fragCache;
 	GLYPH_CACHE glyphCache[10];
 
+	GLYPH_BATCH batch;
+	boolean batching;
+
 	rdpContext* context;
 	rdpSettings* settings;
 };
@@ -121,6 +121,31 @@ FREERDP_API boolean WTSVirtualChannelWrite(
 	/* __in */  uint32 Length,
 	/* __out */ uint32* pBytesWritten);
 
+/**
+ * WTSVirtualChannelAllocBuffer, WTSVirtualChannelWriteBuffer and
+ * WTSVirtualChannelFreeBuffer are FreeRDP extensions to the API.
+ *
+ * WTSVirtualChannelAllocBuffer returns a buffer of at least Length bytes
+ * taken from the channel manager's buffer pool. The caller builds its PDU in
+ * place and passes the buffer to WTSVirtualChannelWriteBuffer, which queues
+ * it without copying and hands it back to the pool once it has been sent.
+ * The buffer belongs to the channel after WTSVirtualChannelWriteBuffer has
+ * been called, whether or not it succeeds. A buffer that is not written must
+ * be released with WTSVirtualChannelFreeBuffer.
+ */
+FREERDP_API uint8* WTSVirtualChannelAllocBuffer(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint32 Length);
+
+FREERDP_API boolean WTSVirtualChannelWriteBuffer(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint8* Buffer,
+	/* __in */  uint32 Length);
+
+FREERDP_API void WTSVirtualChannelFreeBuffer(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint8* Buffer);
+
 /**
  * Closes an open virtual channel handle.
  */
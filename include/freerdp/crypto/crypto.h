@@ -83,6 +83,8 @@ typedef struct crypto_sha1_struct* CryptoSha1;
 FREERDP_API CryptoSha1 crypto_sha1_init(void);
 FREERDP_API void crypto_sha1_update(CryptoSha1 sha1, const uint8* data, uint32 length);
 FREERDP_API void crypto_sha1_final(CryptoSha1 sha1, uint8* out_data);
+FREERDP_API void crypto_sha1_digest(CryptoSha1 sha1, uint8* out_data);
+FREERDP_API void crypto_sha1_free(CryptoSha1 sha1);
 
 #define	CRYPTO_MD5_DIGEST_LENGTH	MD5_DIGEST_LENGTH
 typedef struct crypto_md5_struct* CryptoMd5;
@@ -90,6 +92,8 @@ typedef struct crypto_md5_struct* CryptoMd5;
 FREERDP_API CryptoMd5 crypto_md5_init(void);
 FREERDP_API void crypto_md5_update(CryptoMd5 md5, const uint8* data, uint32 length);
 FREERDP_API void crypto_md5_final(CryptoMd5 md5, uint8* out_data);
+FREERDP_API void crypto_md5_digest(CryptoMd5 md5, uint8* out_data);
+FREERDP_API void crypto_md5_free(CryptoMd5 md5);
 
 typedef struct crypto_rc4_struct* CryptoRc4;
 
@@ -31,15 +31,27 @@
 #include <freerdp/utils/stream.h>
 
 typedef struct rdp_tls rdpTls;
+typedef struct rdp_tls_stats rdpTlsStats;
 
 struct rdp_tls
 {
 	SSL* ssl;
 	int sockfd;
-	SSL_CTX* ctx;
 	rdpBlob public_key;
 	rdpSettings* settings;
 	rdpCertificateStore* certificate_store;
+	STREAM* write_stream;
+	int write_offset;
+	uint64 write_time;
+	int cork;
+};
+
+struct rdp_tls_stats
+{
+	uint32 client_full_handshakes;
+	uint32 client_resumed_handshakes;
+	uint32 server_full_handshakes;
+	uint32 server_resumed_handshakes;
 };
 
 FREERDP_API boolean tls_connect(rdpTls* tls);
@@ -52,12 +64,18 @@ FREERDP_API int tls_write(rdpTls* tls, uint8* data, int length);
 FREERDP_API int tls_read_all(rdpTls* tls, uint8* data, int length);
 FREERDP_API int tls_write_all(rdpTls* tls, uint8* data, int length);
 
+FREERDP_API void tls_cork(rdpTls* tls);
+FREERDP_API int tls_uncork(rdpTls* tls);
+FREERDP_API int tls_flush(rdpTls* tls);
+
 FREERDP_API boolean tls_verify_certificate(rdpTls* tls, CryptoCert cert, char* hostname);
 FREERDP_API void tls_print_certificate_error(char* hostname, char* fingerprint);
 FREERDP_API void tls_print_certificate_name_mismatch_error(char* hostname, char* common_name, char** alt_names, int alt_names_count);
 
 FREERDP_API boolean tls_print_error(char* func, SSL* connection, int value);
 
+FREERDP_API void tls_get_stats(rdpTlsStats* stats);
+
 FREERDP_API rdpTls* tls_new(rdpSettings* settings);
 FREERDP_API void tls_free(rdpTls* tls);
 
@@ -49,14 +49,38 @@ typedef void (*pContextNew)(freerdp* instance, rdpContext* context);
 typedef void (*pContextFree)(freerdp* instance, rdpContext* context);
 
 typedef boolean (*pPreConnect)(freerdp* instance);
+typedef boolean (*pParallelPreConnect)(freerdp* instance);
 typedef boolean (*pPostConnect)(freerdp* instance);
 typedef boolean (*pAuthenticate)(freerdp* instance, char** username, char** password, char** domain);
 typedef boolean (*pVerifyCertificate)(freerdp* instance, char* subject, char* issuer, char* fingerprint);
 typedef boolean (*pVerifyChangedCertificate)(freerdp* instance, char* subject, char* issuer, char* new_fingerprint, char* old_fingerprint);
 
+typedef void (*pConnectionPhase)(freerdp* instance, int phase, uint32 duration);
+
 typedef int (*pSendChannelData)(freerdp* instance, int channelId, uint8* data, int size);
 typedef int (*pReceiveChannelData)(freerdp* instance, int channelId, uint8* data, int size, int flags, int total_size);
 
+/**
+ * Phases of the client connection sequence, in the order they are entered.
+ * The time spent in each phase is reported to the ConnectionPhase callback
+ * and can be queried with freerdp_get_connection_phase_time().
+ */
+enum FREERDP_CONNECTION_PHASE
+{
+	FREERDP_PHASE_PRE_CONNECT = 0,		/* PreConnect callback */
+	FREERDP_PHASE_NEGOTIATION = 1,		/* TCP or gateway connection and X.224 negotiation */
+	FREERDP_PHASE_SECURITY = 2,		/* TLS handshake and NLA */
+	FREERDP_PHASE_LOCAL_INIT = 3,		/* waiting for the ParallelPreConnect callback to finish */
+	FREERDP_PHASE_MCS_CONNECT = 4,		/* MCS Connect Initial and Connect Response */
+	FREERDP_PHASE_MCS_ATTACH_USER = 5,	/* MCS Erect Domain and Attach User */
+	FREERDP_PHASE_MCS_CHANNEL_JOIN = 6,	/* MCS Channel Join */
+	FREERDP_PHASE_LICENSING = 7,		/* security exchange, client info and licensing */
+	FREERDP_PHASE_CAPABILITIES = 8,		/* capability exchange */
+	FREERDP_PHASE_FINALIZATION = 9,		/* connection finalization */
+	FREERDP_PHASE_POST_CONNECT = 10,	/* PostConnect callback */
+	FREERDP_PHASE_COUNT = 11
+};
+
 /**
  * Defines the context for a given instance of RDP connection.
  * It is embedded in the rdp_freerdp structure, and allocated by a call to freerdp_context_new().
@@ -168,7 +192,18 @@ struct rdp_freerdp
 															 Callback for changed certificate validation. 
 															 Used when a certificate differs from stored fingerprint.
 															 If returns true, the new fingerprint will be trusted and old thrown out. */
-	uint32 paddingD[64 - 51]; /* 51 */
+	pParallelPreConnect ParallelPreConnect; /**< (offset 53)
+												 Callback for local initialization that does not depend on the server,
+												 such as keyboard layout detection or cache allocation.
+												 It runs on a separate thread once PreConnect has returned, while the
+												 connection is negotiated, and is waited for before the MCS Connect Initial
+												 is sent. It may only change settings that are not used before that point.
+												 Must be set to NULL if not needed. */
+	pConnectionPhase ConnectionPhase; /**< (offset 54)
+										   Callback for connection timing.
+										   Called at the end of each FREERDP_CONNECTION_PHASE with its duration in microseconds.
+										   Must be set to NULL if not needed. */
+	uint32 paddingD[64 - 55]; /* 55 */
 
 	pSendChannelData SendChannelData; /* (offset 64)
 										 Callback for sending data to a channel.
@@ -193,6 +228,8 @@ FREERDP_API boolean freerdp_check_fds(freerdp* instance);
 
 FREERDP_API uint32 freerdp_error_info(freerdp* instance);
 
+FREERDP_API uint32 freerdp_get_connection_phase_time(freerdp* instance, int phase);
+
 FREERDP_API void freerdp_get_version(int* major, int* minor, int* revision);
 
 FREERDP_API freerdp* freerdp_new();
@@ -106,6 +106,11 @@
 #define GDI_OPAQUE			0x00000001
 #define GDI_TRANSPARENT			0x00000002
 
+/* Region Combine Modes */
+#define GDI_RGN_AND			0x01
+#define GDI_RGN_OR			0x02
+#define GDI_RGN_DIFF			0x04
+
 /* GDI Object Types */
 #define GDIOBJECT_BITMAP		0x00
 #define GDIOBJECT_PEN			0x01
@@ -148,6 +153,20 @@ struct _GDI_RGN
 typedef struct _GDI_RGN GDI_RGN;
 typedef GDI_RGN* HGDI_RGN;
 
+/**
+ * Complex region: rectangles sorted top to bottom, then left to right,
+ * grouped in bands sharing the same y and height. Bands do not overlap
+ * and rectangles within a band neither overlap nor touch.
+ */
+struct _GDI_REGION
+{
+	int count;
+	int size;
+	HGDI_RGN rects;
+};
+typedef struct _GDI_REGION GDI_REGION;
+typedef GDI_REGION* HGDI_REGION;
+
 struct _GDI_BITMAP
 {
 	uint8 objectType;
@@ -209,10 +228,13 @@ typedef GDI_BRUSH* HGDI_BRUSH;
 
 struct _GDI_WND
 {
-	int count;
-	int ninvalid;
-	HGDI_RGN invalid;
+	int count; /* allocated size of cinvalid */
+	int ninvalid; /* number of invalid rectangles, a banded region */
+	HGDI_RGN invalid; /* bounding box of the invalid region */
 	HGDI_RGN cinvalid;
+	GDI_REGION scratch; /* spare rectangles reused when combining regions */
+	int* bands; /* band boundaries reused when combining regions */
+	int nbands; /* allocated size of bands */
 };
 typedef struct _GDI_WND GDI_WND;
 typedef GDI_WND* HGDI_WND;
@@ -286,6 +308,7 @@ FREERDP_API uint8* gdi_get_bitmap_pointer(HGDI_DC hdcBmp, int x, int y);
 FREERDP_API uint8* gdi_get_brush_pointer(HGDI_DC hdcBrush, int x, int y);
 FREERDP_API int gdi_is_mono_pixel_set(uint8* data, int x, int y, int width);
 FREERDP_API void gdi_resize(rdpGdi* gdi, int width, int height);
+FREERDP_API void gdi_set_cpu_opt(rdpGdi* gdi, uint32 cpu_opt);
 
 FREERDP_API int gdi_init(freerdp* instance, uint32 flags, uint8* buffer);
 FREERDP_API void gdi_free(freerdp* instance);
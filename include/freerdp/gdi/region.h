@@ -42,6 +42,13 @@ FREERDP_API int gdi_CopyRect(HGDI_RECT dst, HGDI_RECT src);
 FREERDP_API int gdi_PtInRect(HGDI_RECT rc, int x, int y);
 FREERDP_API int gdi_InvalidateRegion(HGDI_DC hdc, int x, int y, int w, int h);
 
+FREERDP_API HGDI_REGION gdi_CreateRegion(void);
+FREERDP_API void gdi_DeleteRegion(HGDI_REGION region);
+FREERDP_API void gdi_EmptyRegion(HGDI_REGION region);
+FREERDP_API int gdi_CombineRegion(HGDI_REGION dst, HGDI_REGION src1, HGDI_REGION src2, int mode);
+FREERDP_API int gdi_CombineRegionRect(HGDI_REGION region, int x, int y, int w, int h, int mode);
+FREERDP_API void gdi_SimplifyRegion(HGDI_REGION region, int rectCost, int maxRects);
+
 #endif /* __GDI_REGION_H */
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
@@ -23,6 +23,10 @@
 typedef struct rdp_bitmap rdpBitmap;
 typedef struct rdp_pointer rdpPointer;
 typedef struct rdp_glyph rdpGlyph;
+typedef struct _GLYPH_ATLAS GLYPH_ATLAS;
+typedef struct _GLYPH_ATLAS_ENTRY GLYPH_ATLAS_ENTRY;
+typedef struct _GLYPH_BATCH GLYPH_BATCH;
+typedef struct _GLYPH_BATCH_ITEM GLYPH_BATCH_ITEM;
 
 #include <stdlib.h>
 #include <freerdp/api.h>
@@ -120,6 +124,7 @@ typedef void (*pGlyph_Free)(rdpContext* context, rdpGlyph* glyph);
 typedef void (*pGlyph_Draw)(rdpContext* context, rdpGlyph* glyph, int x, int y);
 typedef void (*pGlyph_BeginDraw)(rdpContext* context, int x, int y, int width, int height, uint32 bgcolor, uint32 fgcolor);
 typedef void (*pGlyph_EndDraw)(rdpContext* context, int x, int y, int width, int height, uint32 bgcolor, uint32 fgcolor);
+typedef void (*pGlyph_DrawBatch)(rdpContext* context, GLYPH_BATCH* batch);
 
 struct rdp_glyph
 {
@@ -129,7 +134,8 @@ struct rdp_glyph
 	pGlyph_Draw Draw; /* 3 */
 	pGlyph_BeginDraw BeginDraw; /* 4 */
 	pGlyph_EndDraw EndDraw; /* 5 */
-	uint32 paddingA[16 - 6]; /* 6 */
+	pGlyph_DrawBatch DrawBatch; /* 6 */
+	uint32 paddingA[16 - 7]; /* 7 */
 
 	sint32 x; /* 16 */
 	sint32 y; /* 17 */
@@ -146,6 +152,63 @@ FREERDP_API void Glyph_Free(rdpContext* context, rdpGlyph* glyph);
 FREERDP_API void Glyph_Draw(rdpContext* context, rdpGlyph* glyph, int x, int y);
 FREERDP_API void Glyph_BeginDraw(rdpContext* context, int x, int y, int width, int height, uint32 bgcolor, uint32 fgcolor);
 FREERDP_API void Glyph_EndDraw(rdpContext* context, int x, int y, int width, int height, uint32 bgcolor, uint32 fgcolor);
+FREERDP_API void Glyph_DrawBatch(rdpContext* context, GLYPH_BATCH* batch);
+
+/**
+ * Glyph atlas: all glyphs of a glyph cache slot packed into a single
+ * surface, one byte per pixel (0xFF where the glyph bit is set).
+ */
+
+struct _GLYPH_ATLAS_ENTRY
+{
+	uint32 x;
+	uint32 y;
+	uint32 cx;
+	uint32 cy;
+};
+
+struct _GLYPH_ATLAS
+{
+	uint32 width;
+	uint32 height;
+	uint8* data;
+	uint32 shelfX;
+	uint32 shelfY;
+	uint32 shelfHeight;
+	uint32 wasted;
+	uint32 dropped; /* glyphs left out of the atlas for lack of space */
+	uint32 number;
+	GLYPH_ATLAS_ENTRY* entries;
+};
+
+/**
+ * Glyph batch: all glyphs of a GlyphIndex, FastIndex or FastGlyph order,
+ * handed to the backend at once. Glyphs not present in the atlas have
+ * cx == 0 in their item and must be drawn from the rdpGlyph.
+ */
+
+struct _GLYPH_BATCH_ITEM
+{
+	rdpGlyph* glyph;
+	sint32 x;
+	sint32 y;
+	uint32 atlasX;
+	uint32 atlasY;
+	uint32 cx;
+	uint32 cy;
+};
+
+struct _GLYPH_BATCH
+{
+	GLYPH_ATLAS* atlas;
+	uint32 count;
+	uint32 size;
+	GLYPH_BATCH_ITEM* items;
+	sint32 left;
+	sint32 top;
+	sint32 right;
+	sint32 bottom;
+};
 
 /* Graphics Module */
 
@@ -295,7 +295,8 @@ struct rdp_settings
 	ALIGN64 boolean local; /* 68 */
 	ALIGN64 boolean authentication_only; /* 69 */
 	ALIGN64 boolean from_stdin; /* 70 */
-	ALIGN64 uint64 paddingC[80 - 71]; /* 71 */
+	ALIGN64 uint32 tsg_receive_window; /* 71 */
+	ALIGN64 uint64 paddingC[80 - 72]; /* 72 */
 
 	/* User Interface Parameters */
 	ALIGN64 boolean sw_gdi; /* 80 */
@@ -372,7 +373,8 @@ struct rdp_settings
 	ALIGN64 boolean disable_theming; /* 230 */
 	ALIGN64 uint32 connection_type; /* 231 */
 	ALIGN64 uint32 multifrag_max_request_size; /* 232 */
-	ALIGN64 uint64 paddingK[248 - 233]; /* 233 */
+	ALIGN64 uint32 vc_compression_flags; /* 233 */
+	ALIGN64 uint64 paddingK[248 - 234]; /* 234 */
 
 	/* Certificate */
 	ALIGN64 char* cert_file; /* 248 */
@@ -423,7 +425,8 @@ struct rdp_settings
 	ALIGN64 boolean persistent_bitmap_cache; /* 330 */
 	ALIGN64 uint32 bitmapCacheV2NumCells; /* 331 */
 	ALIGN64 BITMAP_CACHE_V2_CELL_INFO* bitmapCacheV2CellInfo; /* 332 */
-	ALIGN64 uint64 paddingQ[344 - 333]; /* 333 */
+	ALIGN64 uint32 bitmap_cache_max_memory; /* 333 */
+	ALIGN64 uint64 paddingQ[344 - 334]; /* 334 */
 
 	/* Offscreen Bitmap Cache */
 	ALIGN64 boolean offscreen_bitmap_cache; /* 344 */
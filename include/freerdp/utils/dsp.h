@@ -21,6 +21,13 @@
 #define __DSP_UTILS_H
 
 #include <freerdp/api.h>
+#include <freerdp/types.h>
+
+/* resampler filter lengths, 0 selects the default */
+#define FREERDP_DSP_RESAMPLE_DEFAULT	0
+#define FREERDP_DSP_RESAMPLE_LOW	1 /* 8 taps */
+#define FREERDP_DSP_RESAMPLE_MEDIUM	2 /* 16 taps */
+#define FREERDP_DSP_RESAMPLE_HIGH	3 /* 32 taps */
 
 union _ADPCM
 {
@@ -67,12 +74,26 @@ struct _FREERDP_DSP_CONTEXT
 		const uint8* src, int size, int channels, int block_size);
 	void (*encode_ms_adpcm)(FREERDP_DSP_CONTEXT* context,
 		const uint8* src, int size, int channels, int block_size);
+
+	/* polyphase filter state carried between resample calls */
+	int resample_quality;
+	void* resampler;
 };
 
 FREERDP_API FREERDP_DSP_CONTEXT* freerdp_dsp_context_new(void);
 FREERDP_API void freerdp_dsp_context_free(FREERDP_DSP_CONTEXT* context);
+FREERDP_API void freerdp_dsp_context_set_resample_quality(FREERDP_DSP_CONTEXT* context, int quality);
+FREERDP_API void freerdp_dsp_context_reset_resampler(FREERDP_DSP_CONTEXT* context);
+FREERDP_API void freerdp_dsp_set_cpu_opt(uint32 cpu_opt);
 #define freerdp_dsp_context_reset_adpcm(_c) memset(&_c->adpcm, 0, sizeof(ADPCM))
 
+/* upper bound of the ADPCM encoding of size bytes of 16-bit PCM */
+#define freerdp_dsp_adpcm_encode_max_size(_size) ((_size) / 2 + 1024)
+FREERDP_API int freerdp_dsp_encode_ima_adpcm_to(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int size, int channels, int block_size, uint8* dst);
+FREERDP_API int freerdp_dsp_encode_ms_adpcm_to(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int size, int channels, int block_size, uint8* dst);
+
 #endif /* __DSP_UTILS_H */
 
 /* Modeline for vim. Don't delete */
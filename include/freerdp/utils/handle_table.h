@@ -0,0 +1,59 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Handle Table Utils
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HANDLE_TABLE_UTILS_H
+#define __HANDLE_TABLE_UTILS_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+#include <freerdp/utils/mutex.h>
+#include <freerdp/utils/list.h>
+
+/**
+ * Maps small sequential non-zero handles to pointers. Lookups read the
+ * slot indexed by the handle without locking, adding and removing
+ * handles is serialized by a mutex. Handles colliding with a live slot
+ * are kept in a locked overflow list.
+ */
+typedef struct _HANDLE_TABLE_ENTRY HANDLE_TABLE_ENTRY;
+struct _HANDLE_TABLE_ENTRY
+{
+	volatile uint32 handle;
+	void* volatile value;
+};
+
+typedef struct _HANDLE_TABLE HANDLE_TABLE;
+struct _HANDLE_TABLE
+{
+	HANDLE_TABLE_ENTRY* entries;
+	uint32 mask;
+
+	freerdp_mutex mutex;
+	LIST* overflow;
+	volatile int num_overflow;
+};
+
+FREERDP_API HANDLE_TABLE* handle_table_new(int size);
+FREERDP_API void handle_table_free(HANDLE_TABLE* table);
+FREERDP_API void handle_table_add(HANDLE_TABLE* table, uint32 handle, void* value);
+FREERDP_API void handle_table_remove(HANDLE_TABLE* table, uint32 handle);
+FREERDP_API void* handle_table_lookup(HANDLE_TABLE* table, uint32 handle);
+
+#endif /* __HANDLE_TABLE_UTILS_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,55 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Single-Producer/Single-Consumer Ring Buffer Utils
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RING_UTILS_H
+#define __RING_UTILS_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+#include <freerdp/utils/mutex.h>
+#include <freerdp/utils/list.h>
+
+/**
+ * A bounded queue of fixed-size items, copied in and out by value.
+ * One thread may enqueue while another dequeues without any locking.
+ * When the ring is full, items spill to a locked overflow list, so
+ * enqueue never fails or blocks and ordering is kept.
+ */
+typedef struct _RING RING;
+struct _RING
+{
+	uint8* items;
+	int item_size;
+	uint32 mask;
+
+	volatile uint32 head; /* next slot to dequeue, written by the consumer */
+	volatile uint32 tail; /* next slot to enqueue, written by the producer */
+
+	freerdp_mutex spill_mutex;
+	LIST* spill;
+	volatile uint32 spilled;
+};
+
+FREERDP_API RING* ring_new(int capacity, int item_size);
+FREERDP_API void ring_free(RING* ring);
+FREERDP_API void ring_enqueue(RING* ring, const void* item);
+FREERDP_API boolean ring_dequeue(RING* ring, void* item);
+FREERDP_API boolean ring_is_empty(RING* ring);
+
+#endif /* __RING_UTILS_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
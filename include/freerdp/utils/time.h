@@ -31,6 +31,7 @@
 #include <freerdp/types.h>
 
 FREERDP_API uint64 freerdp_windows_gmtime();
+FREERDP_API uint64 freerdp_get_time_usec();
 FREERDP_API uint64 freerdp_get_windows_time_from_unix_time(time_t unix_time);
 FREERDP_API time_t freerdp_get_unix_time_from_windows_time(uint64 windows_time);
 FREERDP_API time_t freerdp_get_unix_time_from_generalized_time(const char* generalized_time);
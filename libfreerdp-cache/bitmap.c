@@ -62,58 +62,31 @@ void update_gdi_mem3blt(rdpContext* context, MEM3BLT_ORDER* mem3blt)
 	brush->style = style;
 }
 
+static void bitmap_cache_store(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index,
+		uint16 width, uint16 height, uint8* data, uint32 length, uint32 bpp, boolean compressed);
+
 void update_gdi_cache_bitmap(rdpContext* context, CACHE_BITMAP_ORDER* cache_bitmap)
 {
-	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
 	rdpCache* cache = context->cache;
 
-	bitmap = Bitmap_Alloc(context);
-
-	Bitmap_SetDimensions(context, bitmap, cache_bitmap->bitmapWidth, cache_bitmap->bitmapHeight);
-
-	bitmap->Decompress(context, bitmap,
-			cache_bitmap->bitmapDataStream, cache_bitmap->bitmapWidth, cache_bitmap->bitmapHeight,
-			cache_bitmap->bitmapBpp, cache_bitmap->bitmapLength, cache_bitmap->compressed);
-
-	bitmap->New(context, bitmap);
-
-	prevBitmap = bitmap_cache_get(cache->bitmap, cache_bitmap->cacheId, cache_bitmap->cacheIndex);
-
-	if (prevBitmap != NULL)
-		Bitmap_Free(context, prevBitmap);
-
-	bitmap_cache_put(cache->bitmap, cache_bitmap->cacheId, cache_bitmap->cacheIndex, bitmap);
+	bitmap_cache_store(cache->bitmap, cache_bitmap->cacheId, cache_bitmap->cacheIndex,
+			cache_bitmap->bitmapWidth, cache_bitmap->bitmapHeight, cache_bitmap->bitmapDataStream,
+			cache_bitmap->bitmapLength, cache_bitmap->bitmapBpp, cache_bitmap->compressed);
 }
 
 void update_gdi_cache_bitmap_v2(rdpContext* context, CACHE_BITMAP_V2_ORDER* cache_bitmap_v2)
 {
-	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
 	rdpCache* cache = context->cache;
 
-	bitmap = Bitmap_Alloc(context);
-
-	Bitmap_SetDimensions(context, bitmap, cache_bitmap_v2->bitmapWidth, cache_bitmap_v2->bitmapHeight);
-
 	if (cache_bitmap_v2->bitmapBpp == 0)
 	{
 		/* Workaround for Windows 8 bug where bitmapBpp is not set */
 		cache_bitmap_v2->bitmapBpp = context->instance->settings->color_depth;
 	}
 
-	bitmap->Decompress(context, bitmap,
-			cache_bitmap_v2->bitmapDataStream, cache_bitmap_v2->bitmapWidth, cache_bitmap_v2->bitmapHeight,
-			cache_bitmap_v2->bitmapBpp, cache_bitmap_v2->bitmapLength, cache_bitmap_v2->compressed);
-
-	bitmap->New(context, bitmap);
-
-	prevBitmap = bitmap_cache_get(cache->bitmap, cache_bitmap_v2->cacheId, cache_bitmap_v2->cacheIndex);
-
-	if (prevBitmap != NULL)
-		Bitmap_Free(context, prevBitmap);
-
-	bitmap_cache_put(cache->bitmap, cache_bitmap_v2->cacheId, cache_bitmap_v2->cacheIndex, bitmap);
+	bitmap_cache_store(cache->bitmap, cache_bitmap_v2->cacheId, cache_bitmap_v2->cacheIndex,
+			cache_bitmap_v2->bitmapWidth, cache_bitmap_v2->bitmapHeight, cache_bitmap_v2->bitmapDataStream,
+			cache_bitmap_v2->bitmapLength, cache_bitmap_v2->bitmapBpp, cache_bitmap_v2->compressed);
 }
 
 void update_gdi_bitmap_update(rdpContext* context, BITMAP_UPDATE* bitmap_update)
@@ -162,50 +135,317 @@ void update_gdi_bitmap_update(rdpContext* context, BITMAP_UPDATE* bitmap_update)
 	}
 }
 
-rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index)
+static boolean bitmap_cache_check_index(rdpBitmapCache* bitmap_cache, uint32 id, uint32* index, const char* op)
+{
+	if (id >= bitmap_cache->maxCells)
+	{
+		printf("%s invalid bitmap cell id: %d\n", op, id);
+		return false;
+	}
+
+	if (*index == BITMAP_CACHE_WAITING_LIST_INDEX)
+	{
+		*index = bitmap_cache->cells[id].number;
+	}
+	else if (*index > bitmap_cache->cells[id].number)
+	{
+		printf("%s invalid bitmap index %d in cell id: %d\n", op, *index, id);
+		return false;
+	}
+
+	return true;
+}
+
+static void bitmap_cache_lru_remove(rdpBitmapCache* bitmap_cache, BITMAP_V2_ENTRY* entry)
+{
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else if (bitmap_cache->head == entry)
+		bitmap_cache->head = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else if (bitmap_cache->tail == entry)
+		bitmap_cache->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+static void bitmap_cache_lru_push(rdpBitmapCache* bitmap_cache, BITMAP_V2_ENTRY* entry)
+{
+	entry->prev = NULL;
+	entry->next = bitmap_cache->head;
+
+	if (bitmap_cache->head != NULL)
+		bitmap_cache->head->prev = entry;
+	else
+		bitmap_cache->tail = entry;
+
+	bitmap_cache->head = entry;
+}
+
+/**
+ * Memory held by a decoded bitmap: the backend surface at the destination
+ * depth, plus the decompressed pixels when the backend keeps them.
+ */
+
+static uint32 bitmap_cache_decoded_size(rdpBitmapCache* bitmap_cache, rdpBitmap* bitmap)
+{
+	uint32 size;
+	uint32 pixels;
+
+	pixels = bitmap->width * bitmap->height;
+	size = pixels * ((bitmap_cache->dstBpp + 7) / 8);
+
+	if (bitmap->data != NULL)
+		size += pixels * ((bitmap->bpp + 7) / 8);
+
+	return size;
+}
+
+/**
+ * Drop the decoded pixel data and backend surface of an entry.
+ * The compressed wire data is kept so the entry can be decoded again on its next use.
+ */
+
+static void bitmap_cache_evict(rdpBitmapCache* bitmap_cache, BITMAP_V2_ENTRY* entry)
 {
 	rdpBitmap* bitmap;
+	BITMAP_V2_CELL* cell;
 
-	if (id > bitmap_cache->maxCells)
+	cell = &bitmap_cache->cells[entry->id];
+	bitmap = cell->entries[entry->index];
+
+	bitmap_cache_lru_remove(bitmap_cache, entry);
+
+	bitmap->Free(bitmap_cache->context, bitmap);
+
+	if (bitmap->data != NULL)
 	{
-		printf("get invalid bitmap cell id: %d\n", id);
-		return NULL;
+		xfree(bitmap->data);
+		bitmap->data = NULL;
+	}
+
+	bitmap_cache->memoryResident -= entry->size;
+	cell->stats.bytesResident -= entry->size;
+	cell->stats.entriesResident--;
+	cell->stats.evictions++;
+
+	entry->size = 0;
+	entry->decoded = false;
+}
+
+/**
+ * Evict least recently used decoded bitmaps until they fit the budget.
+ * Wire data is accounted separately: it is what allows an entry to be
+ * decoded again, so it is only released along with the entry itself.
+ */
+
+static void bitmap_cache_enforce_budget(rdpBitmapCache* bitmap_cache, BITMAP_V2_ENTRY* keep)
+{
+	BITMAP_V2_ENTRY* entry;
+
+	if (bitmap_cache->maxMemory == 0)
+		return;
+
+	while (bitmap_cache->memoryResident > bitmap_cache->maxMemory)
+	{
+		entry = bitmap_cache->tail;
+
+		if ((entry == NULL) || (entry == keep))
+			break;
+
+		bitmap_cache_evict(bitmap_cache, entry);
+	}
+}
+
+static void bitmap_cache_decode(rdpBitmapCache* bitmap_cache, BITMAP_V2_ENTRY* entry, rdpBitmap* bitmap)
+{
+	BITMAP_V2_CELL* cell;
+	rdpContext* context = bitmap_cache->context;
+
+	cell = &bitmap_cache->cells[entry->id];
+
+	bitmap->Decompress(context, bitmap, entry->data, bitmap->width, bitmap->height,
+			entry->bpp, entry->length, entry->compressed);
+
+	bitmap->New(context, bitmap);
+
+	entry->decoded = true;
+	entry->size = bitmap_cache_decoded_size(bitmap_cache, bitmap);
+
+	bitmap_cache->memoryResident += entry->size;
+	cell->stats.bytesResident += entry->size;
+	cell->stats.entriesResident++;
+	cell->stats.decodes++;
+
+	if (bitmap_cache->maxMemory == 0)
+	{
+		/* without a budget the entry is never evicted, so the wire data is no longer needed */
+		bitmap_cache->memoryCompressed -= entry->length;
+		cell->stats.bytesCompressed -= entry->length;
+		xfree(entry->data);
+		entry->data = NULL;
+		entry->length = 0;
+		return;
 	}
 
-	if (index == BITMAP_CACHE_WAITING_LIST_INDEX)
+	bitmap_cache_lru_push(bitmap_cache, entry);
+	bitmap_cache_enforce_budget(bitmap_cache, entry);
+}
+
+static void bitmap_cache_release(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index)
+{
+	rdpBitmap* bitmap;
+	BITMAP_V2_ENTRY* entry;
+	BITMAP_V2_CELL* cell;
+
+	cell = &bitmap_cache->cells[id];
+	entry = &cell->info[index];
+	bitmap = cell->entries[index];
+
+	if (bitmap == NULL)
+		return;
+
+	if (entry->decoded)
 	{
-		index = bitmap_cache->cells[id].number;
+		if (entry->data != NULL)
+			bitmap_cache_lru_remove(bitmap_cache, entry);
+
+		bitmap_cache->memoryResident -= entry->size;
+		cell->stats.bytesResident -= entry->size;
+		cell->stats.entriesResident--;
+
+		Bitmap_Free(bitmap_cache->context, bitmap);
 	}
-	else if (index > bitmap_cache->cells[id].number)
+	else
+	{
+		/* never decoded, the backend surface was not created */
+		xfree(bitmap);
+	}
+
+	if (entry->data != NULL)
+	{
+		bitmap_cache->memoryCompressed -= entry->length;
+		cell->stats.bytesCompressed -= entry->length;
+		xfree(entry->data);
+	}
+
+	entry->data = NULL;
+	entry->length = 0;
+	entry->size = 0;
+	entry->decoded = false;
+	cell->entries[index] = NULL;
+}
+
+static void bitmap_cache_store(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index,
+		uint16 width, uint16 height, uint8* data, uint32 length, uint32 bpp, boolean compressed)
+{
+	rdpBitmap* bitmap;
+	BITMAP_V2_ENTRY* entry;
+	BITMAP_V2_CELL* cell;
+
+	if (!bitmap_cache_check_index(bitmap_cache, id, &index, "put"))
+		return;
+
+	bitmap_cache_release(bitmap_cache, id, index);
+
+	cell = &bitmap_cache->cells[id];
+	entry = &cell->info[index];
+
+	bitmap = Bitmap_Alloc(bitmap_cache->context);
+	Bitmap_SetDimensions(bitmap_cache->context, bitmap, width, height);
+	bitmap->bpp = bpp;
+	bitmap->length = length;
+	bitmap->compressed = compressed;
+
+	entry->data = (uint8*) xmalloc(length);
+	memcpy(entry->data, data, length);
+	entry->length = length;
+	entry->bpp = bpp;
+	entry->compressed = compressed;
+	entry->decoded = false;
+	entry->size = 0;
+
+	bitmap_cache->memoryCompressed += length;
+	cell->stats.bytesCompressed += length;
+	cell->entries[index] = bitmap;
+}
+
+rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index)
+{
+	rdpBitmap* bitmap;
+	BITMAP_V2_ENTRY* entry;
+	BITMAP_V2_CELL* cell;
+
+	if (!bitmap_cache_check_index(bitmap_cache, id, &index, "get"))
+		return NULL;
+
+	cell = &bitmap_cache->cells[id];
+	entry = &cell->info[index];
+	bitmap = cell->entries[index];
+
+	if (bitmap == NULL)
 	{
-		printf("get invalid bitmap index %d in cell id: %d\n", index, id);
+		cell->stats.misses++;
 		return NULL;
 	}
 
-	bitmap = bitmap_cache->cells[id].entries[index];
+	if (!entry->decoded)
+	{
+		cell->stats.misses++;
+		bitmap_cache_decode(bitmap_cache, entry, bitmap);
+	}
+	else
+	{
+		cell->stats.hits++;
+
+		if ((entry->data != NULL) && (bitmap_cache->head != entry))
+		{
+			bitmap_cache_lru_remove(bitmap_cache, entry);
+			bitmap_cache_lru_push(bitmap_cache, entry);
+		}
+	}
 
 	return bitmap;
 }
 
 void bitmap_cache_put(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index, rdpBitmap* bitmap)
 {
-	if (id > bitmap_cache->maxCells)
-	{
-		printf("put invalid bitmap cell id: %d\n", id);
+	BITMAP_V2_ENTRY* entry;
+	BITMAP_V2_CELL* cell;
+
+	if (!bitmap_cache_check_index(bitmap_cache, id, &index, "put"))
 		return;
-	}
 
-	if (index == BITMAP_CACHE_WAITING_LIST_INDEX)
+	cell = &bitmap_cache->cells[id];
+	entry = &cell->info[index];
+
+	if (cell->entries[index] != bitmap)
+		bitmap_cache_release(bitmap_cache, id, index);
+
+	cell->entries[index] = bitmap;
+
+	if ((bitmap != NULL) && !entry->decoded)
 	{
-		index = bitmap_cache->cells[id].number;
+		/* bitmaps put directly are already decoded and cannot be evicted */
+		entry->decoded = true;
+		entry->size = bitmap_cache_decoded_size(bitmap_cache, bitmap);
+		bitmap_cache->memoryResident += entry->size;
+		cell->stats.bytesResident += entry->size;
+		cell->stats.entriesResident++;
 	}
-	else if (index > bitmap_cache->cells[id].number)
+}
+
+void bitmap_cache_get_stats(rdpBitmapCache* bitmap_cache, uint32 id, BITMAP_CACHE_STATS* stats)
+{
+	if (id >= bitmap_cache->maxCells)
 	{
-		printf("put invalid bitmap index %d in cell id: %d\n", index, id);
+		memset(stats, 0, sizeof(BITMAP_CACHE_STATS));
 		return;
 	}
 
-	bitmap_cache->cells[id].entries[index] = bitmap;
+	memcpy(stats, &bitmap_cache->cells[id].stats, sizeof(BITMAP_CACHE_STATS));
 }
 
 void bitmap_cache_register_callbacks(rdpUpdate* update)
@@ -226,7 +466,7 @@ void bitmap_cache_register_callbacks(rdpUpdate* update)
 
 rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 {
-	int i;
+	int i, j;
 	rdpBitmapCache* bitmap_cache;
 
 	bitmap_cache = (rdpBitmapCache*) xzalloc(sizeof(rdpBitmapCache));
@@ -238,6 +478,8 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 		bitmap_cache->context = bitmap_cache->update->context;
 
 		bitmap_cache->maxCells = 5;
+		bitmap_cache->dstBpp = 32;
+		bitmap_cache->maxMemory = settings->bitmap_cache_max_memory;
 
 		settings->bitmap_cache = false;
 		settings->bitmapCacheV2NumCells = 5;
@@ -259,6 +501,13 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 			bitmap_cache->cells[i].number = settings->bitmapCacheV2CellInfo[i].numEntries;
 			/* allocate an extra entry for BITMAP_CACHE_WAITING_LIST_INDEX */
 			bitmap_cache->cells[i].entries = (rdpBitmap**) xzalloc(sizeof(rdpBitmap*) * (bitmap_cache->cells[i].number + 1));
+			bitmap_cache->cells[i].info = (BITMAP_V2_ENTRY*) xzalloc(sizeof(BITMAP_V2_ENTRY) * (bitmap_cache->cells[i].number + 1));
+
+			for (j = 0; j < (int) bitmap_cache->cells[i].number + 1; j++)
+			{
+				bitmap_cache->cells[i].info[j].id = i;
+				bitmap_cache->cells[i].info[j].index = j;
+			}
 		}
 	}
 
@@ -268,23 +517,16 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 void bitmap_cache_free(rdpBitmapCache* bitmap_cache)
 {
 	int i, j;
-	rdpBitmap* bitmap;
 
 	if (bitmap_cache != NULL)
 	{
 		for (i = 0; i < (int) bitmap_cache->maxCells; i++)
 		{
 			for (j = 0; j < (int) bitmap_cache->cells[i].number + 1; j++)
-			{
-				bitmap = bitmap_cache->cells[i].entries[j];
-
-				if (bitmap != NULL)
-				{
-					Bitmap_Free(bitmap_cache->context, bitmap);
-				}
-			}
+				bitmap_cache_release(bitmap_cache, i, j);
 
 			xfree(bitmap_cache->cells[i].entries);
+			xfree(bitmap_cache->cells[i].info);
 		}
 
 		if (bitmap_cache->bitmap != NULL)
@@ -17,12 +17,206 @@
  * limitations under the License.
  */
 
+#include "config.h"
+
 #include <freerdp/freerdp.h>
+#include <freerdp/utils/debug.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/memory.h>
 
 #include <freerdp/cache/glyph.h>
 
+#ifdef WITH_DEBUG_ORDERS
+#define DEBUG_GLYPH(fmt, ...) DEBUG_CLASS(GLYPH, fmt, ## __VA_ARGS__)
+#else
+#define DEBUG_GLYPH(fmt, ...) DEBUG_NULL(fmt, ## __VA_ARGS__)
+#endif
+
+#define GLYPH_ATLAS_WIDTH		1024
+#define GLYPH_ATLAS_MIN_HEIGHT		64
+#define GLYPH_ATLAS_MAX_HEIGHT		1024
+
+static boolean glyph_atlas_alloc(GLYPH_ATLAS* atlas, uint32 cx, uint32 cy, uint32* x, uint32* y)
+{
+	if (cx > atlas->width)
+		return false;
+
+	if (atlas->shelfX + cx > atlas->width)
+	{
+		atlas->shelfY += atlas->shelfHeight;
+		atlas->shelfX = 0;
+		atlas->shelfHeight = 0;
+	}
+
+	if (atlas->shelfY + cy > atlas->height)
+		return false;
+
+	*x = atlas->shelfX;
+	*y = atlas->shelfY;
+
+	atlas->shelfX += cx;
+
+	if (cy > atlas->shelfHeight)
+		atlas->shelfHeight = cy;
+
+	return true;
+}
+
+/**
+ * Pack all live glyphs again into a surface of the given height,
+ * reclaiming the space of glyphs that have been replaced.
+ */
+
+static void glyph_atlas_repack(GLYPH_ATLAS* atlas, uint32 height)
+{
+	int i, y;
+	int dropped;
+	uint8* data;
+	uint32 newX, newY;
+	GLYPH_ATLAS_ENTRY* entry;
+
+	data = (uint8*) xzalloc(atlas->width * height);
+
+	atlas->height = height;
+	atlas->shelfX = atlas->shelfY = atlas->shelfHeight = 0;
+	atlas->wasted = 0;
+	dropped = 0;
+
+	for (i = 0; i < (int) atlas->number; i++)
+	{
+		entry = &atlas->entries[i];
+
+		if (entry->cx == 0)
+			continue;
+
+		if (!glyph_atlas_alloc(atlas, entry->cx, entry->cy, &newX, &newY))
+		{
+			entry->cx = entry->cy = 0;
+			dropped++;
+			continue;
+		}
+
+		for (y = 0; y < (int) entry->cy; y++)
+		{
+			memcpy(&data[(newY + y) * atlas->width + newX],
+				&atlas->data[(entry->y + y) * atlas->width + entry->x], entry->cx);
+		}
+
+		entry->x = newX;
+		entry->y = newY;
+	}
+
+	xfree(atlas->data);
+	atlas->data = data;
+
+	if (dropped > 0)
+	{
+		atlas->dropped += dropped;
+		DEBUG_GLYPH("%d glyphs did not fit in %dx%d, drawing them directly",
+				dropped, atlas->width, atlas->height);
+	}
+}
+
+static void glyph_atlas_put(GLYPH_ATLAS* atlas, uint32 index, rdpGlyph* glyph)
+{
+	int x, y;
+	uint8* srcp;
+	uint8* dstp;
+	int scanline;
+	uint32 atlasX, atlasY;
+	GLYPH_ATLAS_ENTRY* entry;
+
+	entry = &atlas->entries[index];
+
+	if (entry->cx != 0)
+	{
+		atlas->wasted += entry->cx * entry->cy;
+		entry->cx = entry->cy = 0;
+	}
+
+	if ((glyph == NULL) || (glyph->aj == NULL) || (glyph->cx == 0) || (glyph->cy == 0))
+		return;
+
+	if (!glyph_atlas_alloc(atlas, glyph->cx, glyph->cy, &atlasX, &atlasY))
+	{
+		if (atlas->wasted >= glyph->cx * glyph->cy)
+			glyph_atlas_repack(atlas, atlas->height);
+
+		while (!glyph_atlas_alloc(atlas, glyph->cx, glyph->cy, &atlasX, &atlasY))
+		{
+			if (atlas->height >= GLYPH_ATLAS_MAX_HEIGHT)
+			{
+				/* drawn from the rdpGlyph instead */
+				if (atlas->dropped++ == 0)
+					DEBUG_GLYPH("atlas full at %dx%d, drawing glyphs directly",
+							atlas->width, atlas->height);
+				return;
+			}
+
+			glyph_atlas_repack(atlas, (atlas->height < GLYPH_ATLAS_MIN_HEIGHT) ?
+					GLYPH_ATLAS_MIN_HEIGHT : atlas->height * 2);
+		}
+	}
+
+	/* expand the 1bpp glyph bits to one byte per pixel */
+
+	scanline = (glyph->cx + 7) / 8;
+
+	for (y = 0; y < (int) glyph->cy; y++)
+	{
+		srcp = &glyph->aj[y * scanline];
+		dstp = &atlas->data[(atlasY + y) * atlas->width + atlasX];
+
+		for (x = 0; x < (int) glyph->cx; x++)
+			dstp[x] = (srcp[x / 8] & (0x80 >> (x % 8))) ? 0xFF : 0x00;
+	}
+
+	entry->x = atlasX;
+	entry->y = atlasY;
+	entry->cx = glyph->cx;
+	entry->cy = glyph->cy;
+}
+
+static void glyph_batch_add(GLYPH_BATCH* batch, rdpGlyph* glyph, GLYPH_ATLAS_ENTRY* entry, int x, int y)
+{
+	GLYPH_BATCH_ITEM* item;
+
+	if (batch->count >= batch->size)
+	{
+		batch->size = (batch->size < 64) ? 64 : batch->size * 2;
+		batch->items = (GLYPH_BATCH_ITEM*) xrealloc(batch->items, sizeof(GLYPH_BATCH_ITEM) * batch->size);
+	}
+
+	item = &batch->items[batch->count++];
+
+	item->glyph = glyph;
+	item->x = x;
+	item->y = y;
+	item->atlasX = entry->x;
+	item->atlasY = entry->y;
+	item->cx = entry->cx;
+	item->cy = entry->cy;
+
+	if (batch->count == 1)
+	{
+		batch->left = x;
+		batch->top = y;
+		batch->right = x + glyph->cx;
+		batch->bottom = y + glyph->cy;
+	}
+	else
+	{
+		if (x < batch->left)
+			batch->left = x;
+		if (y < batch->top)
+			batch->top = y;
+		if (x + (sint32) glyph->cx > batch->right)
+			batch->right = x + glyph->cx;
+		if (y + (sint32) glyph->cy > batch->bottom)
+			batch->bottom = y + glyph->cy;
+	}
+}
+
 void update_process_glyph(rdpContext* context, uint8* data, int* index,
 		int* x, int* y, uint32 cacheId, uint32 ulCharInc, uint32 flAccel)
 {
@@ -59,7 +253,16 @@ void update_process_glyph(rdpContext* context, uint8* data, int* index,
 
 	if (glyph != NULL)
 	{
-		Glyph_Draw(context, glyph, glyph->x + *x, glyph->y + *y);
+		if (glyph_cache->batching)
+		{
+			glyph_batch_add(&glyph_cache->batch, glyph,
+				&glyph_cache->glyphCache[cacheId].atlas.entries[cacheIndex],
+				glyph->x + *x, glyph->y + *y);
+		}
+		else
+		{
+			Glyph_Draw(context, glyph, glyph->x + *x, glyph->y + *y);
+		}
 
 		if (flAccel & SO_CHAR_INC_EQUAL_BM_BASE)
 			*x += glyph->cx;
@@ -86,6 +289,15 @@ void update_process_glyph_fragments(rdpContext* context, uint8* data, uint32 len
 	else
 		Glyph_BeginDraw(context, 0, 0, 0, 0, bgcolor, fgcolor);
 
+	/* collect the glyphs of the whole order and draw them in a single batch */
+	glyph_cache->batching = (graphics->Glyph_Prototype->DrawBatch != NULL) && (cacheId < 10);
+
+	if (glyph_cache->batching)
+	{
+		glyph_cache->batch.atlas = &glyph_cache->glyphCache[cacheId].atlas;
+		glyph_cache->batch.count = 0;
+	}
+
 	while (index < (int) length)
 	{
 		switch (data[index])
@@ -155,6 +367,14 @@ void update_process_glyph_fragments(rdpContext* context, uint8* data, uint32 len
 		}
 	}
 
+	if (glyph_cache->batching)
+	{
+		if (glyph_cache->batch.count > 0)
+			Glyph_DrawBatch(context, &glyph_cache->batch);
+
+		glyph_cache->batching = false;
+	}
+
 	if (opWidth > 0 && opHeight > 0)
 		Glyph_EndDraw(context, opX, opY, opWidth, opHeight, bgcolor, fgcolor);
 	else
@@ -362,7 +582,7 @@ rdpGlyph* glyph_cache_get(rdpGlyphCache* glyph_cache, uint32 id, uint32 index)
 		return NULL;
 	}
 
-	if (index > glyph_cache->glyphCache[id].number)
+	if (index >= glyph_cache->glyphCache[id].number)
 	{
 		printf("invalid glyph cache index: %d in cache id: %d\n", index, id);
 		return NULL;
@@ -388,7 +608,7 @@ void glyph_cache_put(rdpGlyphCache* glyph_cache, uint32 id, uint32 index, rdpGly
 		return;
 	}
 
-	if (index > glyph_cache->glyphCache[id].number)
+	if (index >= glyph_cache->glyphCache[id].number)
 	{
 		printf("invalid glyph cache index: %d in cache id: %d\n", index, id);
 		return;
@@ -404,6 +624,7 @@ void glyph_cache_put(rdpGlyphCache* glyph_cache, uint32 id, uint32 index, rdpGly
 	}
 
 	glyph_cache->glyphCache[id].entries[index] = glyph;
+	glyph_atlas_put(&glyph_cache->glyphCache[id].atlas, index, glyph);
 }
 
 void* glyph_cache_fragment_get(rdpGlyphCache* glyph_cache, uint32 index, uint32* size)
@@ -466,6 +687,10 @@ rdpGlyphCache* glyph_cache_new(rdpSettings* settings)
 			glyph->glyphCache[i].number = settings->glyphCache[i].cacheEntries;
 			glyph->glyphCache[i].maxCellSize = settings->glyphCache[i].cacheMaximumCellSize;
 			glyph->glyphCache[i].entries = (rdpGlyph**) xzalloc(sizeof(rdpGlyph*) * glyph->glyphCache[i].number);
+
+			glyph->glyphCache[i].atlas.width = GLYPH_ATLAS_WIDTH;
+			glyph->glyphCache[i].atlas.number = glyph->glyphCache[i].number;
+			glyph->glyphCache[i].atlas.entries = (GLYPH_ATLAS_ENTRY*) xzalloc(sizeof(GLYPH_ATLAS_ENTRY) * glyph->glyphCache[i].number);
 		}
 
 		glyph->fragCache.entries = xzalloc(sizeof(FRAGMENT_CACHE_ENTRY) * 256);
@@ -499,6 +724,8 @@ void glyph_cache_free(rdpGlyphCache* glyph_cache)
 				}
 			}
 			xfree(glyph_cache->glyphCache[i].entries);
+			xfree(glyph_cache->glyphCache[i].atlas.entries);
+			xfree(glyph_cache->glyphCache[i].atlas.data);
 		}
 
 		for (i = 0; i < 255; i++)
@@ -508,6 +735,7 @@ void glyph_cache_free(rdpGlyphCache* glyph_cache)
 		}
 
 		xfree(glyph_cache->fragCache.entries);
+		xfree(glyph_cache->batch.items);
 		xfree(glyph_cache);
 	}
 }
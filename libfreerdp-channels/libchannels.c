@@ -42,6 +42,8 @@
 #include <freerdp/svc.h>
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/list.h>
+#include <freerdp/utils/ring.h>
+#include <freerdp/utils/handle_table.h>
 #include <freerdp/utils/semaphore.h>
 #include <freerdp/utils/mutex.h>
 #include <freerdp/utils/wait_obj.h>
@@ -51,6 +53,8 @@
 #include "libchannels.h"
 
 #define CHANNEL_MAX_COUNT 30
+#define CHANNEL_SYNC_RING_SIZE 256
+#define CHANNEL_HANDLE_TABLE_SIZE 1024
 
 struct lib_data
 {
@@ -61,6 +65,7 @@ struct lib_data
 
 struct channel_data
 {
+	rdpChannels* channels;
 	char name[CHANNEL_NAME_LEN + 1];
 	int open_handle;
 	int options;
@@ -115,9 +120,12 @@ struct rdp_channels
 	/* signal for incoming data or event */
 	struct wait_obj* signal;
 
-	/* used for sync write */
+	/**
+	 * used for sync write, the main thread consumes the ring without locking
+	 * while sync_data_mutex serializes the plugin threads writing to it
+	 */
 	freerdp_mutex sync_data_mutex;
-	LIST* sync_data_list;
+	RING* sync_data_ring;
 
 	/* used for sync event */
 	freerdp_sem event_sem;
@@ -143,6 +151,9 @@ static rdpChannelsList* g_channels_list;
 /* To generate unique sequence for all open handles */
 static int g_open_handle_sequence;
 
+/* Open handle to struct channel_data of all channel managers */
+static HANDLE_TABLE* g_open_handles;
+
 /* For locking the global resources */
 static freerdp_mutex g_mutex_init;
 static freerdp_mutex g_mutex_list;
@@ -150,30 +161,16 @@ static freerdp_mutex g_mutex_list;
 /* returns the channels for the open handle passed in */
 static rdpChannels* freerdp_channels_find_by_open_handle(int open_handle, int* pindex)
 {
-	int lindex;
-	rdpChannels* channels;
-	rdpChannelsList* channels_list;
+	struct channel_data* lchannel_data;
 
-	freerdp_mutex_lock(g_mutex_list);
+	lchannel_data = (struct channel_data*) handle_table_lookup(g_open_handles, open_handle);
 
-	for (channels_list = g_channels_list; channels_list; channels_list = channels_list->next)
-	{
-		channels = channels_list->channels;
-
-		for (lindex = 0; lindex < channels->num_channels_data; lindex++)
-		{
-			if (channels->channels_data[lindex].open_handle == open_handle)
-			{
-				freerdp_mutex_unlock(g_mutex_list);
-				*pindex = lindex;
-				return channels;
-			}
-		}
-	}
+	if (lchannel_data == NULL)
+		return NULL;
 
-	freerdp_mutex_unlock(g_mutex_list);
+	*pindex = lchannel_data - lchannel_data->channels->channels_data;
 
-	return NULL;
+	return lchannel_data->channels;
 }
 
 /* returns the channels for the rdp instance passed in */
@@ -353,6 +350,9 @@ static uint32 FREERDP_CC MyVirtualChannelInit(void** ppInitHandle, PCHANNEL_DEF
 		lchannel_data->open_handle = g_open_handle_sequence++;
 		freerdp_mutex_unlock(g_mutex_list);
 
+		lchannel_data->channels = channels;
+		handle_table_add(g_open_handles, lchannel_data->open_handle, lchannel_data);
+
 		lchannel_data->flags = 1; /* init */
 		strncpy(lchannel_data->name, lchannel_def->name, CHANNEL_NAME_LEN);
 		lchannel_data->options = lchannel_def->options;
@@ -467,7 +467,7 @@ static uint32 FREERDP_CC MyVirtualChannelWrite(uint32 openHandle, void* pData, u
 {
 	int index;
 	rdpChannels* channels;
-	struct sync_data* item;
+	struct sync_data item;
 	struct channel_data* lchannel_data;
 
 	channels = freerdp_channels_find_by_open_handle(openHandle, &index);
@@ -513,12 +513,11 @@ static uint32 FREERDP_CC MyVirtualChannelWrite(uint32 openHandle, void* pData, u
 		return CHANNEL_RC_NOT_CONNECTED;
 	}
 
-	item = xnew(struct sync_data);
-	item->data = pData;
-	item->data_length = dataLength;
-	item->user_data = pUserData;
-	item->index = index;
-	list_enqueue(channels->sync_data_list, item);
+	item.data = pData;
+	item.data_length = dataLength;
+	item.user_data = pUserData;
+	item.index = index;
+	ring_enqueue(channels->sync_data_ring, &item);
 	freerdp_mutex_unlock(channels->sync_data_mutex);
 
 	/* set the event */
@@ -587,6 +586,7 @@ int freerdp_channels_global_init(void)
 	g_init_channels = NULL;
 	g_channels_list = NULL;
 	g_open_handle_sequence = 1;
+	g_open_handles = handle_table_new(CHANNEL_HANDLE_TABLE_SIZE);
 	g_mutex_init = freerdp_mutex_new();
 	g_mutex_list = freerdp_mutex_new();
 
@@ -600,6 +600,7 @@ int freerdp_channels_global_uninit(void)
 
 	freerdp_mutex_free(g_mutex_init);
 	freerdp_mutex_free(g_mutex_list);
+	handle_table_free(g_open_handles);
 
 	return 0;
 }
@@ -612,7 +613,7 @@ rdpChannels* freerdp_channels_new(void)
 	channels = xnew(rdpChannels);
 
 	channels->sync_data_mutex = freerdp_mutex_new();
-	channels->sync_data_list = list_new();
+	channels->sync_data_ring = ring_new(CHANNEL_SYNC_RING_SIZE, sizeof(struct sync_data));
 
 	channels->event_sem = freerdp_sem_new(1);
 	channels->signal = wait_obj_new();
@@ -631,11 +632,15 @@ rdpChannels* freerdp_channels_new(void)
 
 void freerdp_channels_free(rdpChannels* channels)
 {
+	int index;
 	rdpChannelsList* list;
 	rdpChannelsList* prev;
 
+	for (index = 0; index < channels->num_channels_data; index++)
+		handle_table_remove(g_open_handles, channels->channels_data[index].open_handle);
+
 	freerdp_mutex_free(channels->sync_data_mutex);
-	list_free(channels->sync_data_list);
+	ring_free(channels->sync_data_ring);
 
 	freerdp_sem_free(channels->event_sem);
 	wait_obj_free(channels->signal);
@@ -815,7 +820,12 @@ int freerdp_channels_data(freerdp* instance, int channel_id, void* data, int dat
 	rdpChannel* lrdp_channel;
 	struct channel_data* lchannel_data;
 
-	channels = freerdp_channels_find_by_instance(instance);
+	/* avoid the locked search over all channel managers for the common case */
+	if (instance->context != NULL && instance->context->channels != NULL &&
+			instance->context->channels->instance == instance)
+		channels = instance->context->channels;
+	else
+		channels = freerdp_channels_find_by_instance(instance);
 
 	if (channels == 0)
 	{
@@ -902,33 +912,25 @@ FREERDP_API int freerdp_channels_send_event(rdpChannels* channels, RDP_EVENT* ev
  */
 static void freerdp_channels_process_sync(rdpChannels* channels, freerdp* instance)
 {
-	struct sync_data* item;
+	struct sync_data item;
 	rdpChannel* lrdp_channel;
 	struct channel_data* lchannel_data;
 
-	while (list_size(channels->sync_data_list) > 0)
+	while (ring_dequeue(channels->sync_data_ring, &item))
 	{
-		freerdp_mutex_lock(channels->sync_data_mutex);
-		item = (struct sync_data*)list_dequeue(channels->sync_data_list);
-		freerdp_mutex_unlock(channels->sync_data_mutex);
-
-		if (!item)
-			break ;
-
-		lchannel_data = channels->channels_data + item->index;
+		lchannel_data = channels->channels_data + item.index;
 		lrdp_channel = freerdp_channels_find_channel_by_name(channels, instance->settings,
-			lchannel_data->name, &item->index);
+			lchannel_data->name, &item.index);
 
 		if (lrdp_channel != NULL)
-			instance->SendChannelData(instance, lrdp_channel->channel_id, item->data, item->data_length);
+			instance->SendChannelData(instance, lrdp_channel->channel_id, item.data, item.data_length);
 
 		if (lchannel_data->open_event_proc != 0)
 		{
 			lchannel_data->open_event_proc(lchannel_data->open_handle,
 				CHANNEL_EVENT_WRITE_COMPLETE,
-				item->user_data, sizeof(void *), sizeof(void *), 0);
+				item.user_data, sizeof(void *), sizeof(void *), 0);
 		}
-		xfree(item);
 	}
 }
 
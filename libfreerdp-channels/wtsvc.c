@@ -32,12 +32,84 @@
 #define CLOSE_REQUEST_PDU      0x04
 #define CAPABILITY_REQUEST_PDU 0x05
 
-typedef struct wts_data_item
+/**
+ * Outgoing data is queued per channel and sent by a weighted round robin
+ * scheduler: each priority class may send a number of bytes per call to
+ * WTSVirtualChannelManagerCheckFileDescriptor, shared between its channels
+ * in quanta of a few chunks. Dynamic channel data is queued in chunks, so
+ * a large transfer never holds the connection for more than its budget.
+ * A budget or quantum of 0 means unlimited.
+ */
+static const uint32 wts_priority_budget[WTS_PRIORITY_COUNT] =
+{
+	0,		/* WTS_PRIORITY_CONTROL */
+	256 * 1024,	/* WTS_PRIORITY_GRAPHICS */
+	64 * 1024,	/* WTS_PRIORITY_AUDIO */
+	32 * 1024	/* WTS_PRIORITY_BULK */
+};
+
+static const uint32 wts_priority_quantum[WTS_PRIORITY_COUNT] =
+{
+	0,		/* WTS_PRIORITY_CONTROL */
+	16 * 1024,	/* WTS_PRIORITY_GRAPHICS */
+	8 * 1024,	/* WTS_PRIORITY_AUDIO */
+	8 * 1024	/* WTS_PRIORITY_BULK */
+};
+
+static const struct
+{
+	const char* name;
+	uint8 priority;
+} wts_channel_priorities[] =
+{
+	{ "drdynvc", WTS_PRIORITY_CONTROL },
+	{ "rail", WTS_PRIORITY_GRAPHICS },
+	{ "TSMF", WTS_PRIORITY_GRAPHICS },
+	{ "rdpsnd", WTS_PRIORITY_AUDIO },
+	{ "AUDIO_INPUT", WTS_PRIORITY_AUDIO },
+	{ "AUDIO_PLAYBACK_DVC", WTS_PRIORITY_AUDIO },
+	{ "AUDIO_PLAYBACK_LOSSY_DVC", WTS_PRIORITY_AUDIO }
+};
+
+/**
+ * Outgoing data lives in reference counted buffers taken from a per manager
+ * pool. Each buffer keeps some headroom in front of its data so that the
+ * header of a dynamic channel chunk can be written right before the chunk
+ * when it is sent: for the first chunk it goes into the headroom, for the
+ * following ones it overwrites the tail of the previous chunk, which has
+ * already been sent by then. A message is therefore never copied into
+ * per-chunk buffers, and the queue items referencing it are pooled as well.
+ */
+#define WTS_BUFFER_HEADROOM		16
+#define WTS_BUFFER_MIN_SIZE		4096
+#define WTS_BUFFER_POOL_MAX_SIZE	(256 * 1024)
+#define WTS_BUFFER_POOL_COUNT		16
+
+/* Cmd/Sp/cbChId, ChannelId and Length of a DATA_FIRST PDU */
+#define WTS_DVC_HEADER_MAX_LENGTH	9
+
+typedef struct wts_buffer wtsBuffer;
+struct wts_buffer
+{
+	wtsBuffer* next;
+	uint32 capacity;
+	uint32 refs;
+};
+
+#define WTS_BUFFER_DATA(_b) ((uint8*) ((_b) + 1) + WTS_BUFFER_HEADROOM)
+#define WTS_BUFFER_FROM_DATA(_d) ((wtsBuffer*) ((_d) - WTS_BUFFER_HEADROOM) - 1)
+
+typedef struct wts_data_item wts_data_item;
+struct wts_data_item
 {
+	wts_data_item* next;
 	uint16 channel_id;
 	uint8* buffer;
 	uint32 length;
-} wts_data_item;
+	wtsBuffer* ref;
+	uint8 header[WTS_DVC_HEADER_MAX_LENGTH];
+	uint8 header_length;
+};
 
 static void wts_data_item_free(wts_data_item* item)
 {
@@ -45,6 +117,119 @@ static void wts_data_item_free(wts_data_item* item)
 	xfree(item);
 }
 
+/**
+ * Returns the smallest pooled buffer of at least length bytes, or a new one.
+ * Called with vcm->mutex held.
+ */
+static wtsBuffer* wts_buffer_get(WTSVirtualChannelManager* vcm, uint32 length)
+{
+	uint32 capacity;
+	wtsBuffer* buffer;
+	wtsBuffer** link;
+	wtsBuffer** best = NULL;
+
+	for (link = &vcm->buffer_pool; *link != NULL; link = &(*link)->next)
+	{
+		if ((*link)->capacity >= length && (best == NULL || (*link)->capacity < (*best)->capacity))
+			best = link;
+	}
+
+	if (best != NULL)
+	{
+		buffer = *best;
+		*best = buffer->next;
+		vcm->buffer_pool_count--;
+	}
+	else
+	{
+		if (length > 0xFFFFFFFF - sizeof(wtsBuffer) - WTS_BUFFER_HEADROOM)
+			return NULL;
+
+		capacity = WTS_BUFFER_MIN_SIZE;
+		while (capacity < length && capacity < WTS_BUFFER_POOL_MAX_SIZE)
+			capacity <<= 1;
+		if (capacity < length)
+			capacity = length;
+
+		buffer = (wtsBuffer*) xmalloc(sizeof(wtsBuffer) + WTS_BUFFER_HEADROOM + capacity);
+		if (buffer == NULL)
+			return NULL;
+		buffer->capacity = capacity;
+	}
+
+	buffer->next = NULL;
+	buffer->refs = 1;
+
+	return buffer;
+}
+
+/**
+ * Drops a reference, returning the buffer to the pool when it was the last.
+ * Called with vcm->mutex held.
+ */
+static void wts_buffer_unref(WTSVirtualChannelManager* vcm, wtsBuffer* buffer)
+{
+	if (--buffer->refs > 0)
+		return;
+
+	if (buffer->capacity <= WTS_BUFFER_POOL_MAX_SIZE && vcm->buffer_pool_count < WTS_BUFFER_POOL_COUNT)
+	{
+		buffer->next = vcm->buffer_pool;
+		vcm->buffer_pool = buffer;
+		vcm->buffer_pool_count++;
+	}
+	else
+	{
+		xfree(buffer);
+	}
+}
+
+/* Called with vcm->mutex held. */
+static wts_data_item* wts_send_item_new(WTSVirtualChannelManager* vcm, wtsBuffer* buffer, uint8* data, uint32 length)
+{
+	wts_data_item* item;
+
+	item = vcm->item_pool;
+	if (item != NULL)
+		vcm->item_pool = item->next;
+	else
+		item = xnew(wts_data_item);
+
+	item->next = NULL;
+	item->ref = buffer;
+	item->buffer = data;
+	item->length = length;
+	item->header_length = 0;
+	buffer->refs++;
+
+	return item;
+}
+
+/* Called with vcm->mutex held. */
+static void wts_send_item_free(WTSVirtualChannelManager* vcm, wts_data_item* item)
+{
+	wts_buffer_unref(vcm, item->ref);
+	item->ref = NULL;
+	item->next = vcm->item_pool;
+	vcm->item_pool = item;
+}
+
+static uint8 wts_get_channel_priority(const char* name, uint32 options)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(wts_channel_priorities); i++)
+	{
+		if (strcmp(wts_channel_priorities[i].name, name) == 0)
+			return wts_channel_priorities[i].priority;
+	}
+
+	if (options & CHANNEL_OPTION_PRI_HIGH)
+		return WTS_PRIORITY_GRAPHICS;
+
+	return WTS_PRIORITY_BULK;
+}
+
 static rdpPeerChannel* wts_get_dvc_channel_by_id(WTSVirtualChannelManager* vcm, uint32 ChannelId)
 {
 	LIST_ITEM* item;
@@ -76,19 +261,124 @@ static void wts_queue_receive_data(rdpPeerChannel* channel, const uint8* buffer,
 	wait_obj_set(channel->receive_event);
 }
 
+/**
+ * Appends an item to the send queue of its channel and makes the channel
+ * active. Called with vcm->mutex held.
+ */
 static void wts_queue_send_item(rdpPeerChannel* channel, wts_data_item* item)
 {
 	WTSVirtualChannelManager* vcm;
 
 	vcm = channel->vcm;
 
-	item->channel_id = channel->channel_id;
+	/* dynamic channel data goes out on drdynvc but keeps its own queue and priority */
+	if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_DVC)
+		item->channel_id = vcm->drdynvc_channel->channel_id;
+	else
+		item->channel_id = channel->channel_id;
 
-	freerdp_mutex_lock(vcm->mutex);
-	list_enqueue(vcm->send_queue, item);
-	freerdp_mutex_unlock(vcm->mutex);
+	if (channel->send_tail != NULL)
+		channel->send_tail->next = item;
+	else
+		channel->send_head = item;
+	channel->send_tail = item;
+
+	if (!channel->send_active)
+	{
+		channel->send_active = true;
+		list_enqueue(vcm->send_channels[channel->priority], channel);
+	}
+}
+
+/* Called with vcm->mutex held. */
+static void wts_send_queue_clear(rdpPeerChannel* channel)
+{
+	wts_data_item* item;
+
+	while ((item = channel->send_head) != NULL)
+	{
+		channel->send_head = item->next;
+		wts_send_item_free(channel->vcm, item);
+	}
+	channel->send_tail = NULL;
+}
+
+static void wts_channel_free(rdpPeerChannel* channel)
+{
+	wts_send_queue_clear(channel);
+	xfree(channel);
+}
+
+/**
+ * Send what the channels of one priority class may send in this round.
+ * Called with vcm->mutex held.
+ */
+static boolean wts_send_priority_class(WTSVirtualChannelManager* vcm, int priority)
+{
+	uint8* data;
+	uint32 length;
+	uint32 sent;
+	uint32 used;
+	boolean result = true;
+	wts_data_item* item;
+	rdpPeerChannel* channel;
+	LIST* active = vcm->send_channels[priority];
+	uint32 budget = wts_priority_budget[priority];
+	uint32 quantum = wts_priority_quantum[priority];
+
+	used = 0;
+
+	while ((channel = (rdpPeerChannel*) list_dequeue(active)) != NULL)
+	{
+		sent = 0;
+
+		while ((item = channel->send_head) != NULL)
+		{
+			length = item->header_length + item->length;
+
+			if (quantum > 0 && sent > 0 && sent + length > quantum)
+				break;
+
+			if (budget > 0 && used > 0 && used + length > budget)
+				break;
+
+			channel->send_head = item->next;
+			if (channel->send_head == NULL)
+				channel->send_tail = NULL;
+
+			/* the previous chunk of this buffer is gone, its tail can take the header */
+			data = item->buffer - item->header_length;
+			memcpy(data, item->header, item->header_length);
+
+			if (vcm->client->SendChannelData(vcm->client, item->channel_id, data, length) == false)
+				result = false;
 
-	wait_obj_set(vcm->send_event);
+			sent += length;
+			used += length;
+			wts_send_item_free(vcm, item);
+
+			if (result == false)
+				break;
+		}
+
+		if (channel->send_head != NULL)
+		{
+			list_enqueue(active, channel);
+		}
+		else
+		{
+			channel->send_active = false;
+
+			if (channel->closing)
+				wts_channel_free(channel);
+		}
+
+		/* the class budget is spent once a channel could not send anything */
+		if (result == false || sent == 0)
+			break;
+	}
+
+	return result;
 }
 
 static int wts_read_variable_uint(STREAM* s, int cbLen, uint32 *val)
@@ -358,6 +648,7 @@ static int WTSReceiveChannelData(freerdp_peer* client, int channelId, uint8* dat
 
 WTSVirtualChannelManager* WTSCreateVirtualChannelManager(freerdp_peer* client)
 {
+	int i;
 	WTSVirtualChannelManager* vcm;
 
 	vcm = xnew(WTSVirtualChannelManager);
@@ -365,7 +656,8 @@ WTSVirtualChannelManager* WTSCreateVirtualChannelManager(freerdp_peer* client)
 	{
 		vcm->client = client;
 		vcm->send_event = wait_obj_new();
-		vcm->send_queue = list_new();
+		for (i = 0; i < WTS_PRIORITY_COUNT; i++)
+			vcm->send_channels[i] = list_new();
 		vcm->mutex = freerdp_mutex_new();
 		vcm->dvc_channel_id_seq = 1;
 		vcm->dvc_channel_list = list_new();
@@ -378,6 +670,8 @@ WTSVirtualChannelManager* WTSCreateVirtualChannelManager(freerdp_peer* client)
 
 void WTSDestroyVirtualChannelManager(WTSVirtualChannelManager* vcm)
 {
+	int i;
+	wtsBuffer* buffer;
 	wts_data_item* item;
 	rdpPeerChannel* channel;
 
@@ -395,11 +689,35 @@ void WTSDestroyVirtualChannelManager(WTSVirtualChannelManager* vcm)
 		}
 
 		wait_obj_free(vcm->send_event);
-		while ((item = (wts_data_item*) list_dequeue(vcm->send_queue)) != NULL)
+		for (i = 0; i < WTS_PRIORITY_COUNT; i++)
+		{
+			/* drop what is still pending, freeing channels already closed */
+			while ((channel = (rdpPeerChannel*) list_dequeue(vcm->send_channels[i])) != NULL)
+			{
+				channel->send_active = false;
+
+				if (channel->closing)
+				{
+					wts_channel_free(channel);
+				}
+				else
+				{
+					wts_send_queue_clear(channel);
+				}
+			}
+			list_free(vcm->send_channels[i]);
+		}
+
+		while ((buffer = vcm->buffer_pool) != NULL)
 		{
-			wts_data_item_free(item);
+			vcm->buffer_pool = buffer->next;
+			xfree(buffer);
+		}
+		while ((item = vcm->item_pool) != NULL)
+		{
+			vcm->item_pool = item->next;
+			xfree(item);
 		}
-		list_free(vcm->send_queue);
 		freerdp_mutex_free(vcm->mutex);
 		xfree(vcm);
 	}
@@ -417,8 +735,9 @@ void WTSVirtualChannelManagerGetFileDescriptor(WTSVirtualChannelManager* vcm,
 
 boolean WTSVirtualChannelManagerCheckFileDescriptor(WTSVirtualChannelManager* vcm)
 {
+	int i;
 	boolean result = true;
-	wts_data_item* item;
+	boolean pending = false;
 	rdpPeerChannel* channel;
 	uint32 dynvc_caps;
 
@@ -439,18 +758,20 @@ boolean WTSVirtualChannelManagerCheckFileDescriptor(WTSVirtualChannelManager* vc
 	wait_obj_clear(vcm->send_event);
 
 	freerdp_mutex_lock(vcm->mutex);
-	while ((item = (wts_data_item*) list_dequeue(vcm->send_queue)) != NULL)
+	for (i = 0; i < WTS_PRIORITY_COUNT && result; i++)
+		result = wts_send_priority_class(vcm, i);
+
+	for (i = 0; i < WTS_PRIORITY_COUNT; i++)
 	{
-		if (vcm->client->SendChannelData(vcm->client, item->channel_id, item->buffer, item->length) == false)
-		{
-			result = false;
-		}
-		wts_data_item_free(item);
-		if (result == false)
-			break;
+		if (list_size(vcm->send_channels[i]) > 0)
+			pending = true;
 	}
 	freerdp_mutex_unlock(vcm->mutex);
 
+	/* come back for the rest once the caller had a chance to send its own updates */
+	if (pending)
+		wait_obj_set(vcm->send_event);
+
 	return result;
 }
 
@@ -481,6 +802,7 @@ void* WTSVirtualChannelOpenEx(
 		channel->receive_event = wait_obj_new();
 		channel->receive_queue = list_new();
 		channel->mutex = freerdp_mutex_new();
+		channel->priority = wts_get_channel_priority(pVirtualName, 0);
 
 		freerdp_mutex_lock(vcm->mutex);
 		channel->channel_id = vcm->dvc_channel_id_seq++;
@@ -524,6 +846,8 @@ void* WTSVirtualChannelOpenEx(
 			channel->receive_event = wait_obj_new();
 			channel->receive_queue = list_new();
 			channel->mutex = freerdp_mutex_new();
+			channel->priority = wts_get_channel_priority(pVirtualName,
+					client->settings->channels[i].options);
 
 			client->settings->channels[i].handle = channel;
 		}
@@ -635,78 +959,154 @@ boolean WTSVirtualChannelWrite(
 	/* __in */  uint32 Length,
 	/* __out */ uint32* pBytesWritten)
 {
+	uint8* data;
+
+	data = WTSVirtualChannelAllocBuffer(hChannelHandle, Length);
+	if (data == NULL)
+		return false;
+
+	memcpy(data, Buffer, Length);
+
+	if (WTSVirtualChannelWriteBuffer(hChannelHandle, data, Length) == false)
+		return false;
+
+	if (pBytesWritten != NULL)
+		*pBytesWritten = Length;
+	return true;
+}
+
+uint8* WTSVirtualChannelAllocBuffer(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint32 Length)
+{
+	wtsBuffer* buffer;
+	WTSVirtualChannelManager* vcm;
 	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
-	wts_data_item* item;
-	STREAM* s;
+
+	if (channel == NULL)
+		return NULL;
+
+	vcm = channel->vcm;
+
+	freerdp_mutex_lock(vcm->mutex);
+	buffer = wts_buffer_get(vcm, Length);
+	freerdp_mutex_unlock(vcm->mutex);
+
+	return (buffer != NULL ? WTS_BUFFER_DATA(buffer) : NULL);
+}
+
+boolean WTSVirtualChannelWriteBuffer(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint8* Buffer,
+	/* __in */  uint32 Length)
+{
+	STREAM _s;
+	STREAM* s = &_s;
 	int cbLen;
 	int cbChId;
-	int first;
+	boolean first;
+	boolean result;
 	uint32 written;
+	uint32 chunk_size;
+	wtsBuffer* buffer;
+	wts_data_item* item;
+	WTSVirtualChannelManager* vcm;
+	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
 
-	if (channel == NULL)
+	if (channel == NULL || Buffer == NULL)
 		return false;
 
-	if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_SVC)
-	{
-		item = xnew(wts_data_item);
-		item->buffer = xmalloc(Length);
-		item->length = Length;
-		memcpy(item->buffer, Buffer, Length);
+	vcm = channel->vcm;
+	buffer = WTS_BUFFER_FROM_DATA(Buffer);
+	result = true;
 
+	freerdp_mutex_lock(vcm->mutex);
+
+	if (Length > buffer->capacity)
+	{
+		DEBUG_WARN("write of %u bytes exceeds the %u byte buffer", Length, buffer->capacity);
+		result = false;
+	}
+	else if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_SVC)
+	{
+		item = wts_send_item_new(vcm, buffer, Buffer, Length);
 		wts_queue_send_item(channel, item);
 	}
-	else if (channel->vcm->drdynvc_channel == NULL || channel->vcm->drdynvc_state != DRDYNVC_STATE_READY)
+	else if (vcm->drdynvc_channel == NULL || vcm->drdynvc_state != DRDYNVC_STATE_READY)
 	{
 		DEBUG_DVC("drdynvc not ready");
-		return false;
+		result = false;
 	}
 	else
 	{
-		s = stream_new(0);
+		chunk_size = channel->client->settings->vc_chunk_size;
 		first = true;
 
 		while (Length > 0)
 		{
-			item = xnew(wts_data_item);
-			item->buffer = xmalloc(channel->client->settings->vc_chunk_size);
-			stream_attach(s, item->buffer, channel->client->settings->vc_chunk_size);
+			item = wts_send_item_new(vcm, buffer, Buffer, 0);
+			stream_attach(s, item->header, sizeof(item->header));
 
 			stream_seek_uint8(s);
 			cbChId = wts_write_variable_uint(s, channel->channel_id);
-			if (first && Length > stream_get_left(s))
+			if (first && Length > chunk_size - stream_get_pos(s))
 			{
 				cbLen = wts_write_variable_uint(s, Length);
-				item->buffer[0] = (DATA_FIRST_PDU << 4) | (cbLen << 2) | cbChId;
+				item->header[0] = (DATA_FIRST_PDU << 4) | (cbLen << 2) | cbChId;
 			}
 			else
 			{
-				item->buffer[0] = (DATA_PDU << 4) | cbChId;
+				item->header[0] = (DATA_PDU << 4) | cbChId;
 			}
 			first = false;
-			written = stream_get_left(s);
+			item->header_length = stream_get_pos(s);
+
+			written = chunk_size - item->header_length;
 			if (written > Length)
 				written = Length;
-			stream_write(s, Buffer, written);
-			item->length = stream_get_length(s);
-			stream_detach(s);
+			item->length = written;
 			Length -= written;
 			Buffer += written;
 
-			wts_queue_send_item(channel->vcm->drdynvc_channel, item);
+			wts_queue_send_item(channel, item);
 		}
-
-		stream_free(s);
 	}
 
-	if (pBytesWritten != NULL)
-		*pBytesWritten = Length;
-	return true;
+	/* the queued items hold their own references */
+	wts_buffer_unref(vcm, buffer);
+
+	freerdp_mutex_unlock(vcm->mutex);
+
+	if (result)
+		wait_obj_set(vcm->send_event);
+
+	return result;
+}
+
+void WTSVirtualChannelFreeBuffer(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint8* Buffer)
+{
+	WTSVirtualChannelManager* vcm;
+	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
+
+	if (channel == NULL || Buffer == NULL)
+		return;
+
+	vcm = channel->vcm;
+
+	freerdp_mutex_lock(vcm->mutex);
+	wts_buffer_unref(vcm, WTS_BUFFER_FROM_DATA(Buffer));
+	freerdp_mutex_unlock(vcm->mutex);
 }
 
 boolean WTSVirtualChannelClose(
 	/* __in */ void* hChannelHandle)
 {
-	STREAM* s;
+	STREAM _s;
+	STREAM* s = &_s;
+	boolean closing;
+	wtsBuffer* buffer;
 	wts_data_item* item;
 	WTSVirtualChannelManager* vcm;
 	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
@@ -728,10 +1128,20 @@ boolean WTSVirtualChannelClose(
 
 			if (channel->dvc_open_state == DVC_OPEN_STATE_SUCCEEDED)
 			{
-				s = stream_new(8);
-				wts_write_drdynvc_header(s, CLOSE_REQUEST_PDU, channel->channel_id);
-				WTSVirtualChannelWrite(vcm->drdynvc_channel, stream_get_head(s), stream_get_length(s), NULL);
-				stream_free(s);
+				/* queued on the channel itself so that it follows the pending data */
+				freerdp_mutex_lock(vcm->mutex);
+				buffer = wts_buffer_get(vcm, 8);
+				if (buffer != NULL)
+				{
+					stream_attach(s, WTS_BUFFER_DATA(buffer), 8);
+					wts_write_drdynvc_header(s, CLOSE_REQUEST_PDU, channel->channel_id);
+					item = wts_send_item_new(vcm, buffer, WTS_BUFFER_DATA(buffer), stream_get_length(s));
+					wts_buffer_unref(vcm, buffer);
+					wts_queue_send_item(channel, item);
+				}
+				freerdp_mutex_unlock(vcm->mutex);
+
+				wait_obj_set(vcm->send_event);
 			}
 		}
 		if (channel->receive_data)
@@ -748,7 +1158,15 @@ boolean WTSVirtualChannelClose(
 		}
 		if (channel->mutex)
 			freerdp_mutex_free(channel->mutex);
-		xfree(channel);
+
+		/* a channel with data still queued is freed by the scheduler once drained */
+		freerdp_mutex_lock(vcm->mutex);
+		closing = channel->send_active;
+		channel->closing = closing;
+		freerdp_mutex_unlock(vcm->mutex);
+
+		if (!closing)
+			wts_channel_free(channel);
 	}
 	return true;
 }
@@ -47,6 +47,16 @@ enum
 	DRDYNVC_STATE_READY = 2
 };
 
+/* Send priority classes, lower values are served first */
+enum
+{
+	WTS_PRIORITY_CONTROL = 0,
+	WTS_PRIORITY_GRAPHICS = 1,
+	WTS_PRIORITY_AUDIO = 2,
+	WTS_PRIORITY_BULK = 3,
+	WTS_PRIORITY_COUNT = 4
+};
+
 enum
 {
 	DVC_OPEN_STATE_NONE = 0,
@@ -71,15 +81,25 @@ struct rdp_peer_channel
 
 	uint8 dvc_open_state;
 	uint32 dvc_total_length;
+
+	struct wts_data_item* send_head;
+	struct wts_data_item* send_tail;
+	uint8 priority;
+	boolean send_active;
+	boolean closing;
 };
 
 struct WTSVirtualChannelManager
 {
 	freerdp_peer* client;
 	struct wait_obj* send_event;
-	LIST* send_queue;
+	LIST* send_channels[WTS_PRIORITY_COUNT];
 	freerdp_mutex mutex;
 
+	struct wts_buffer* buffer_pool;
+	int buffer_pool_count;
+	struct wts_data_item* item_pool;
+
 	rdpPeerChannel* drdynvc_channel;
 	uint8 drdynvc_state;
 	uint32 dvc_channel_id_seq;
@@ -22,9 +22,20 @@
 #include <stdlib.h>
 #include <freerdp/api.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
 #include <freerdp/codec/color.h>
 #include <freerdp/utils/memory.h>
 
+#include "color_types.h"
+
+#ifdef WITH_SSE2
+#include "color_sse2.h"
+#endif
+
+#ifndef COLOR_INIT_SIMD
+#define COLOR_INIT_SIMD(_kernels) do { } while (0)
+#endif
+
 int freerdp_get_pixel(uint8 * data, int x, int y, int width, int height, int bpp)
 {
 	int start;
@@ -611,98 +622,149 @@ uint8* freerdp_image_convert_24bpp(uint8* srcData, uint8* dstData, int width, in
 	return srcData;
 }
 
-uint8* freerdp_image_convert_32bpp(uint8* srcData, uint8* dstData, int width, int height, int srcBpp, int dstBpp, HCLRCONV clrconv)
+static void color_copy32_alpha_c(uint8* src, uint8* dst, int count)
 {
-	if (dstBpp == 16)
-	{
-		int index;
-		uint16 *dst16;
-		uint32 *src32;
-		uint8 red, green, blue;
+	int i;
 
-		if (dstData == NULL)
-			dstData = (uint8*) xmalloc(width * height * 2);
+	for (i = 0; i < count; i++)
+		((uint32*) dst)[i] = ((uint32*) src)[i] | 0xFF000000;
+}
 
-		dst16 = (uint16*) dstData;
-		src32 = (uint32*) srcData;
+static void color_swap32_c(uint8* src, uint8* dst, int count)
+{
+	int i;
+	uint32 pixel;
+	uint8 a, r, g, b;
 
-		for (index = 0; index < width * height; index++)
-		{
-			GetBGR32(blue, green, red, *src32);
-			*dst16 = (clrconv->invert) ? BGR16(red, green, blue) : RGB16(red, green, blue);
-			src32++;
-			dst16++;
-		}
-		return dstData;
-	}
-	else if (dstBpp == 24)
+	for (i = 0; i < count; i++)
 	{
-		uint8 *dstp;
-		int index;
-		uint8 red, green, blue;
+		pixel = ((uint32*) src)[i];
+		GetARGB32(a, r, g, b, pixel);
+		((uint32*) dst)[i] = ABGR32(a, r, g, b);
+	}
+}
 
-		if (dstData == NULL)
-			dstData = (uint8*) xmalloc(width * height * 3);
+static void color_rgb32_to_rgb24_c(uint8* src, uint8* dst, int count)
+{
+	int i;
 
-		dstp = dstData;
-		for (index = 0; index < width * height; index++)
-		{
-			red = *(srcData++);
-			green = *(srcData++);
-			blue = *(srcData++);
+	for (i = 0; i < count; i++)
+	{
+		*dst++ = src[0];
+		*dst++ = src[1];
+		*dst++ = src[2];
+		src += 4;
+	}
+}
 
-			if (clrconv->invert)
-			{
-				*dstp++ = blue;
-				*dstp++ = green;
-				*dstp++ = red;
-			}
-			else
-			{
-				*dstp++ = red;
-				*dstp++ = green;
-				*dstp++ = blue;
-			}
+static void color_rgb32_to_bgr24_c(uint8* src, uint8* dst, int count)
+{
+	int i;
 
-			srcData++;
-		}
-		return dstData;
+	for (i = 0; i < count; i++)
+	{
+		*dst++ = src[2];
+		*dst++ = src[1];
+		*dst++ = src[0];
+		src += 4;
 	}
-	else if (dstBpp == 32)
+}
+
+#define COLOR_CONVERT_16_C(_name, _make) \
+static void _name(uint8* src, uint8* dst, int count) \
+{ \
+	int i; \
+	uint32 pixel; \
+	uint8 red, green, blue; \
+	uint16* dst16 = (uint16*) dst; \
+	uint32* src32 = (uint32*) src; \
+	for (i = 0; i < count; i++) \
+	{ \
+		pixel = src32[i]; \
+		GetBGR32(blue, green, red, pixel); \
+		dst16[i] = _make(red, green, blue); \
+	} \
+}
+
+COLOR_CONVERT_16_C(color_rgb32_to_rgb16_c, RGB16)
+COLOR_CONVERT_16_C(color_rgb32_to_bgr16_c, BGR16)
+COLOR_CONVERT_16_C(color_rgb32_to_rgb15_c, RGB15)
+COLOR_CONVERT_16_C(color_rgb32_to_bgr15_c, BGR15)
+
+static COLOR_CONVERT_KERNELS color_kernels =
+{
+	color_copy32_alpha_c,
+	color_swap32_c,
+	color_rgb32_to_rgb24_c,
+	color_rgb32_to_bgr24_c,
+	color_rgb32_to_rgb16_c,
+	color_rgb32_to_bgr16_c,
+	color_rgb32_to_rgb15_c,
+	color_rgb32_to_bgr15_c
+};
+
+/**
+ * Enable SIMD CPU acceleration for the image conversion kernels.
+ * @param cpu_opt detected CPU features (CPU_SSE2)
+ */
+
+void freerdp_color_set_cpu_opt(uint32 cpu_opt)
+{
+	if (cpu_opt & CPU_SSE2)
+		COLOR_INIT_SIMD(&color_kernels);
+}
+
+/**
+ * Pick the 32bpp conversion kernel for a destination format.
+ * The layout only depends on dstBpp and the clrconv flags, so this
+ * is done once per image instead of once per pixel.
+ */
+
+static pColorConvert32 freerdp_image_convert_32bpp_kernel(int dstBpp, HCLRCONV clrconv)
+{
+	switch (dstBpp)
 	{
-		if (clrconv->alpha)
-		{
-			int x, y;
-			uint8 *dstp;
+		case 32:
+			return (clrconv->alpha) ? color_kernels.copy32_alpha : NULL;
 
-			if (dstData == NULL)
-				dstData = (uint8*) xmalloc(width * height * 4);
+		case 24:
+			return (clrconv->invert) ? color_kernels.rgb32_to_bgr24 : color_kernels.rgb32_to_rgb24;
 
-			memcpy(dstData, srcData, width * height * 4);
+		case 16:
+			if (clrconv->rgb555)
+				return (clrconv->invert) ? color_kernels.rgb32_to_bgr15 : color_kernels.rgb32_to_rgb15;
 
-			dstp = dstData;
-			for (y = 0; y < height; y++)
-			{
-				for (x = 0; x < width * 4; x += 4)
-				{
-					dstp += 3;
-					*dstp = 0xFF;
-					dstp++;
-				}
-			}
-		}
-		else
-		{
-			if (dstData == NULL)
-				dstData = (uint8*) xmalloc(width * height * 4);
+			return (clrconv->invert) ? color_kernels.rgb32_to_bgr16 : color_kernels.rgb32_to_rgb16;
 
-			memcpy(dstData, srcData, width * height * 4);
-		}
+		case 15:
+			return (clrconv->invert) ? color_kernels.rgb32_to_bgr15 : color_kernels.rgb32_to_rgb15;
 
-		return dstData;
+		default:
+			break;
 	}
 
-	return srcData;
+	return NULL;
+}
+
+uint8* freerdp_image_convert_32bpp(uint8* srcData, uint8* dstData, int width, int height, int srcBpp, int dstBpp, HCLRCONV clrconv)
+{
+	pColorConvert32 kernel;
+
+	if ((dstBpp != 32) && (dstBpp != 24) && (dstBpp != 16) && (dstBpp != 15))
+		return srcData;
+
+	if (dstData == NULL)
+		dstData = (uint8*) xmalloc(width * height * ((dstBpp + 1) / 8));
+
+	kernel = freerdp_image_convert_32bpp_kernel(dstBpp, clrconv);
+
+	/* identical layouts are a plain copy */
+	if (kernel == NULL)
+		memcpy(dstData, srcData, width * height * 4);
+	else
+		kernel(srcData, dstData, width * height);
+
+	return dstData;
 }
 
 p_freerdp_image_convert freerdp_image_convert_[5] =
@@ -1031,21 +1093,7 @@ void freerdp_alpha_cursor_convert(uint8* alphaData, uint8* xorMask, uint8* andMa
 
 void freerdp_image_swap_color_order(uint8* data, int width, int height)
 {
-	int x, y;
-	uint32* pixel;
-	uint8 a, r, g, b;
-
-	pixel = (uint32*) data;
-
-	for (y = 0; y < height; y++)
-	{
-		for (x = 0; x < width; x++)
-		{
-			GetARGB32(a, r, g, b, *pixel);
-			*pixel = ABGR32(a, r, g, b);
-			pixel++;
-		}
-	}
+	color_kernels.swap32(data, data, width * height);
 }
 
 HCLRCONV freerdp_clrconv_new(uint32 flags)
@@ -0,0 +1,193 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Color Conversion Routines - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include <freerdp/codec/color.h>
+
+#include "color_sse2.h"
+
+/* exchange the red and blue channels of four x8r8g8b8 pixels */
+static INLINE __m128i color_swap_rb_sse2(__m128i p)
+{
+	__m128i ag = _mm_and_si128(p, _mm_set1_epi32(0xFF00FF00));
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xFF));
+	__m128i b = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFF)), 16);
+
+	return _mm_or_si128(ag, _mm_or_si128(r, b));
+}
+
+/* pack the low 16 bits of each 32 bit lane of two registers */
+static INLINE __m128i color_pack_16_sse2(__m128i lo, __m128i hi)
+{
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+static void color_copy32_alpha_sse2(uint8* src, uint8* dst, int count)
+{
+	int i;
+	__m128i alpha = _mm_set1_epi32(0xFF000000);
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_si128((__m128i*) &dst[i * 4],
+			_mm_or_si128(_mm_loadu_si128((__m128i*) &src[i * 4]), alpha));
+	}
+
+	for (; i < count; i++)
+		((uint32*) dst)[i] = ((uint32*) src)[i] | 0xFF000000;
+}
+
+static void color_swap32_sse2(uint8* src, uint8* dst, int count)
+{
+	int i;
+	uint8 a, r, g, b;
+	uint32 pixel;
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_si128((__m128i*) &dst[i * 4],
+			color_swap_rb_sse2(_mm_loadu_si128((__m128i*) &src[i * 4])));
+	}
+
+	for (; i < count; i++)
+	{
+		pixel = ((uint32*) src)[i];
+		GetARGB32(a, r, g, b, pixel);
+		((uint32*) dst)[i] = ABGR32(a, r, g, b);
+	}
+}
+
+static INLINE void color_store_24_sse2(uint8* dst, __m128i p)
+{
+	__m128i lo, hi;
+
+	/* squeeze each 64 bit lane from two 4 byte pixels to 6 bytes */
+	p = _mm_or_si128(_mm_and_si128(p, _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF)),
+		_mm_and_si128(_mm_srli_epi64(p, 8), _mm_set_epi32(0x0000FFFF, 0xFF000000, 0x0000FFFF, 0xFF000000)));
+
+	lo = _mm_and_si128(p, _mm_set_epi32(0, 0, 0x0000FFFF, 0xFFFFFFFF));
+	hi = _mm_slli_si128(_mm_srli_si128(p, 8), 6);
+	p = _mm_or_si128(lo, hi);
+
+	_mm_storel_epi64((__m128i*) dst, p);
+	*((uint32*) &dst[8]) = _mm_cvtsi128_si32(_mm_srli_si128(p, 8));
+}
+
+static void color_rgb32_to_rgb24_sse2(uint8* src, uint8* dst, int count)
+{
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+		color_store_24_sse2(&dst[i * 3], _mm_loadu_si128((__m128i*) &src[i * 4]));
+
+	for (; i < count; i++)
+	{
+		dst[i * 3] = src[i * 4];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + 2];
+	}
+}
+
+static void color_rgb32_to_bgr24_sse2(uint8* src, uint8* dst, int count)
+{
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+		color_store_24_sse2(&dst[i * 3], color_swap_rb_sse2(_mm_loadu_si128((__m128i*) &src[i * 4])));
+
+	for (; i < count; i++)
+	{
+		dst[i * 3] = src[i * 4 + 2];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4];
+	}
+}
+
+/* r5g6b5 from x8r8g8b8 */
+static INLINE __m128i color_rgb16_sse2(__m128i p)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F));
+
+	return _mm_or_si128(r, _mm_or_si128(g, b));
+}
+
+/* x1r5g5b5 from x8r8g8b8 */
+static INLINE __m128i color_rgb15_sse2(__m128i p)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 9), _mm_set1_epi32(0x7C00));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 6), _mm_set1_epi32(0x03E0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F));
+
+	return _mm_or_si128(r, _mm_or_si128(g, b));
+}
+
+#define COLOR_CONVERT_16_SSE2(_name, _pack, _swap, _scalar) \
+static void _name(uint8* src, uint8* dst, int count) \
+{ \
+	int i; \
+	uint32 pixel; \
+	uint8 red, green, blue; \
+	__m128i p0, p1; \
+	uint16* dst16 = (uint16*) dst; \
+	uint32* src32 = (uint32*) src; \
+	for (i = 0; i + 8 <= count; i += 8) \
+	{ \
+		p0 = _mm_loadu_si128((__m128i*) &src32[i]); \
+		p1 = _mm_loadu_si128((__m128i*) &src32[i + 4]); \
+		if (_swap) \
+		{ \
+			p0 = color_swap_rb_sse2(p0); \
+			p1 = color_swap_rb_sse2(p1); \
+		} \
+		_mm_storeu_si128((__m128i*) &dst16[i], color_pack_16_sse2(_pack(p0), _pack(p1))); \
+	} \
+	for (; i < count; i++) \
+	{ \
+		pixel = src32[i]; \
+		GetBGR32(blue, green, red, pixel); \
+		dst16[i] = _scalar(red, green, blue); \
+	} \
+}
+
+COLOR_CONVERT_16_SSE2(color_rgb32_to_rgb16_sse2, color_rgb16_sse2, 0, RGB16)
+COLOR_CONVERT_16_SSE2(color_rgb32_to_bgr16_sse2, color_rgb16_sse2, 1, BGR16)
+COLOR_CONVERT_16_SSE2(color_rgb32_to_rgb15_sse2, color_rgb15_sse2, 0, RGB15)
+COLOR_CONVERT_16_SSE2(color_rgb32_to_bgr15_sse2, color_rgb15_sse2, 1, BGR15)
+
+void color_init_sse2(COLOR_CONVERT_KERNELS* kernels)
+{
+	kernels->copy32_alpha = color_copy32_alpha_sse2;
+	kernels->swap32 = color_swap32_sse2;
+	kernels->rgb32_to_rgb24 = color_rgb32_to_rgb24_sse2;
+	kernels->rgb32_to_bgr24 = color_rgb32_to_bgr24_sse2;
+	kernels->rgb32_to_rgb16 = color_rgb32_to_rgb16_sse2;
+	kernels->rgb32_to_bgr16 = color_rgb32_to_bgr16_sse2;
+	kernels->rgb32_to_rgb15 = color_rgb32_to_rgb15_sse2;
+	kernels->rgb32_to_bgr15 = color_rgb32_to_bgr15_sse2;
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
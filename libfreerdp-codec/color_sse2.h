@@ -0,0 +1,31 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Color Conversion Routines - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __COLOR_SSE2_H
+#define __COLOR_SSE2_H
+
+#include "color_types.h"
+
+void color_init_sse2(COLOR_CONVERT_KERNELS* kernels);
+
+#ifndef COLOR_INIT_SIMD
+#define COLOR_INIT_SIMD(_kernels) color_init_sse2(_kernels)
+#endif
+
+#endif /* __COLOR_SSE2_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,43 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Color Conversion Routines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __COLOR_TYPES_H
+#define __COLOR_TYPES_H
+
+#include "config.h"
+
+#include <freerdp/types.h>
+
+/* convert count contiguous 32bpp pixels */
+typedef void (*pColorConvert32)(uint8* src, uint8* dst, int count);
+
+struct _COLOR_CONVERT_KERNELS
+{
+	pColorConvert32 copy32_alpha; /* 32 -> 32, alpha forced to 0xFF */
+	pColorConvert32 swap32; /* 32 -> 32, red and blue swapped */
+	pColorConvert32 rgb32_to_rgb24;
+	pColorConvert32 rgb32_to_bgr24;
+	pColorConvert32 rgb32_to_rgb16;
+	pColorConvert32 rgb32_to_bgr16;
+	pColorConvert32 rgb32_to_rgb15;
+	pColorConvert32 rgb32_to_bgr15;
+};
+typedef struct _COLOR_CONVERT_KERNELS COLOR_CONVERT_KERNELS;
+
+#endif /* __COLOR_TYPES_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
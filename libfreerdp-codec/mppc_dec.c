@@ -175,8 +175,6 @@ int decompress_rdp_4(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 	int       tmp;
 	uint32    i32;
 
-	printf("decompress_rdp_4:\n");
-
 	if ((dec == NULL) || (dec->history_buf == NULL))
 	{
 		printf("decompress_rdp_4: null\n");
@@ -219,6 +217,11 @@ int decompress_rdp_4(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 	if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED)
 	{
 		/* data in cbuf is not compressed - copy to history buf as is */
+		if (len > dec->history_buf_end - history_ptr + 1)
+		{
+			printf("decompress_rdp_4: data overflows history buffer\n");
+			return false;
+		}
 		memcpy(history_ptr, cbuf, len);
 		history_ptr += len;
 		*rlen = history_ptr - dec->history_ptr;
@@ -256,6 +259,12 @@ int decompress_rdp_4(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 
 	while (bits_left >= 8)
 	{
+		if (history_ptr > dec->history_buf_end)
+		{
+			printf("decompress_rdp_4: data overflows history buffer\n");
+			return false;
+		}
+
 		/*
 		   value 0xxxxxxx  = literal, not encoded
 		   value 10xxxxxx  = literal, encoded
@@ -485,6 +494,12 @@ int decompress_rdp_4(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 
 		/* now that we have copy_offset and LoM, process them */
 
+		if (lom > dec->history_buf_end - history_ptr + 1)
+		{
+			printf("decompress_rdp_4: match overflows history buffer\n");
+			return false;
+		}
+
 		src_ptr = history_ptr - copy_offset;
 		if (src_ptr >= dec->history_buf)
 		{
@@ -647,6 +662,11 @@ int decompress_rdp_5(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 	if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED)
 	{
 		/* data in cbuf is not compressed - copy to history buf as is */
+		if (len > dec->history_buf_end - history_ptr + 1)
+		{
+			printf("decompress_rdp_5: data overflows history buffer\n");
+			return false;
+		}
 		memcpy(history_ptr, cbuf, len);
 		history_ptr += len;
 		*rlen = history_ptr - dec->history_ptr;
@@ -684,6 +704,12 @@ int decompress_rdp_5(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 
 	while (bits_left >= 8)
 	{
+		if (history_ptr > dec->history_buf_end)
+		{
+			printf("decompress_rdp_5: data overflows history buffer\n");
+			return false;
+		}
+
 		/*
 		   value 0xxxxxxx  = literal, not encoded
 		   value 10xxxxxx  = literal, encoded
@@ -948,6 +974,12 @@ int decompress_rdp_5(struct rdp_mppc_dec* dec, uint8* cbuf, int len, int ctype,
 
 		/* now that we have copy_offset and LoM, process them */
 
+		if (lom > dec->history_buf_end - history_ptr + 1)
+		{
+			printf("decompress_rdp_5: match overflows history buffer\n");
+			return false;
+		}
+
 		src_ptr = history_ptr - copy_offset;
 		if (src_ptr >= dec->history_buf)
 		{
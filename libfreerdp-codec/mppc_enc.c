@@ -28,6 +28,9 @@
 
 #define RDP_40_HIST_BUF_LEN (1024 * 8) /* RDP 4.0 uses 8K history buf */
 #define RDP_50_HIST_BUF_LEN (1024 * 64) /* RDP 5.0 uses 64K history buf */
+#define HASH_TABLE_LEN (1024 * 64) /* indexed by 16 bit CRC */
+#define MIN_COMPRESS_LEN 4 /* shorter data is never compressed */
+#define OPB_SLACK 16 /* room for the token that crosses the input length */
 
 #define CRC_INIT 0xFFFF
 #define CRC(crcval, newchar) crcval = (crcval >> 8) ^ crc_table[(crcval ^ newchar) & 0x00ff]
@@ -446,7 +449,7 @@ struct rdp_mppc_enc* mppc_enc_new(int protocol_type)
 		xfree(enc);
 		return NULL;
 	}
-	enc->outputBufferPlus = (char*) xzalloc(enc->buf_len + 64);
+	enc->outputBufferPlus = (char*) xzalloc(enc->buf_len + 64 + OPB_SLACK);
 	if (enc->outputBufferPlus == NULL)
 	{
 		xfree(enc->historyBuffer);
@@ -454,7 +457,7 @@ struct rdp_mppc_enc* mppc_enc_new(int protocol_type)
 		return NULL;
 	}
 	enc->outputBuffer = enc->outputBufferPlus + 64;
-	enc->hash_table = (uint16*) xzalloc(enc->buf_len * 2);
+	enc->hash_table = (uint16*) xzalloc(HASH_TABLE_LEN * 2);
 	if (enc->hash_table == NULL)
 	{
 		xfree(enc->historyBuffer);
@@ -519,12 +522,13 @@ boolean compress_rdp(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 
 boolean compress_rdp_4(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 {
-	/* RDP 4.0 encoding not yet implemented */
-	return false;
+	/* RDP 4.0 only differs from RDP 5.0 in history size and copy offset encoding */
+	return compress_rdp_5(enc, srcData, len);
 }
 
 /**
- * encode (compress) data using RDP 5.0 protocol using hash table
+ * encode (compress) data using RDP 5.0 protocol using hash table,
+ * or RDP 4.0 when the encoder was created for PROTO_RDP_40
  *
  * @param   enc           encoder state info
  * @param   srcData       uncompressed data
@@ -546,6 +550,7 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 	uint32 copy_offset;     /* pattern match starts here... */
 	uint32 lom;             /* ...and matches this many bytes */
 	int last_crc_index;     /* don't compute CRC beyond this index */
+	int crc_index;          /* index of the match in historyBuffer */
 	uint16 *hash_table;     /* hash table for pattern matching */
 
 	uint32 i;
@@ -569,7 +574,11 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 	hbuf_start = enc->historyBuffer;
 	outputBuffer = enc->outputBuffer;
 	memset(outputBuffer, 0, len);
-	enc->flags = PACKET_COMPR_TYPE_64K;
+	enc->flags = (enc->protocol_type == PROTO_RDP_40) ? PACKET_COMPR_TYPE_8K : PACKET_COMPR_TYPE_64K;
+
+	/* too short to hold a match - leave it uncompressed and out of the history */
+	if (len < MIN_COMPRESS_LEN)
+		return true;
 	if (enc->first_pkt)
 	{
 		enc->first_pkt = 0;
@@ -581,7 +590,7 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 		/* historyBuffer cannot hold srcData - rewind it */
 		enc->historyOffset = 0;
 		enc->flagsHold |= PACKET_AT_FRONT;
-		memset(hash_table, 0, enc->buf_len * 2);
+		memset(hash_table, 0, HASH_TABLE_LEN * 2);
 	}
 
 	/* point to next free byte in historyBuffer */
@@ -656,6 +665,10 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 
 	while (ctr < data_end)
 	{
+		/* output is already as long as the input, compression will be abandoned */
+		if (opb_index >= len)
+			break;
+
 		cptr1 = historyPointer + ctr;
 
 		crc = CRC_INIT;
@@ -711,11 +724,11 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 
 		/* compute CRC for matching segment and store in hash table */
 
-		cptr1 = historyPointer + ctr;
-		if (cptr1 + lom > hbuf_start + last_crc_index)
+		crc_index = (historyPointer + ctr) - hbuf_start;
+		if (crc_index + (int) lom > last_crc_index)
 		{
 			/* we have gone beyond last_crc_index - go back */
-			j = last_crc_index - (cptr1 - hbuf_start);
+			j = (last_crc_index > crc_index) ? last_crc_index - crc_index : 0;
 		}
 		else
 		{
@@ -745,7 +758,40 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 
 		/* encode copy_offset and insert into output buffer */
 
-		if ((copy_offset >= 0) && (copy_offset <= 63))
+		if (enc->protocol_type == PROTO_RDP_40)
+		{
+			if (copy_offset <= 63)
+			{
+				/* insert binary header */
+				data = 0x0f;
+				insert_4_bits(data);
+
+				/* insert 6 bits of copy_offset */
+				data = (char) (copy_offset & 0x3f);
+				insert_6_bits(data);
+			}
+			else if (copy_offset <= 319)
+			{
+				/* insert binary header */
+				data = 0x0e;
+				insert_4_bits(data);
+
+				/* insert 8 bits of copy offset */
+				data = (char) (copy_offset - 64);
+				insert_8_bits(data);
+			}
+			else
+			{
+				/* insert binary header */
+				data = 0x06;
+				insert_3_bits(data);
+
+				/* insert 13 bits of copy offset */
+				data16 = copy_offset - 320;
+				insert_13_bits(data16);
+			}
+		}
+		else if ((copy_offset >= 0) && (copy_offset <= 63))
 		{
 			/* insert binary header */
 			data = 0x1f;
@@ -944,7 +990,7 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 	} /* end while (ctr < data_end) */
 
 	/* add remaining data to the output */
-	while (len - ctr > 0)
+	while ((len - ctr > 0) && (opb_index < len))
 	{
 		data = srcData[ctr];
 		DLOG(("%.2x ", (unsigned char) data));
@@ -964,12 +1010,22 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 	}
 
 	/* if bits_left == 8, opb_index has already been incremented */
-	if ((bits_left == 8) && (opb_index > len))
+	if (ctr < len)
+	{
+		/* stopped early because the output outgrew the input */
+		/* give up */
+		enc->historyOffset = 0;
+		memset(hash_table, 0, HASH_TABLE_LEN * 2);
+		enc->flagsHold |= PACKET_FLUSHED;
+		enc->first_pkt = 1;
+		return true;
+	}
+	else if ((bits_left == 8) && (opb_index > len))
 	{
 		/* compressed data longer than uncompressed data */
 		/* give up */
 		enc->historyOffset = 0;
-		memset(hash_table, 0, enc->buf_len * 2);
+		memset(hash_table, 0, HASH_TABLE_LEN * 2);
 		enc->flagsHold |= PACKET_FLUSHED;
 		enc->first_pkt = 1;
 		return true;
@@ -979,7 +1035,7 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 		/* compressed data longer than uncompressed data */
 		/* give up */
 		enc->historyOffset = 0;
-		memset(hash_table, 0, enc->buf_len * 2);
+		memset(hash_table, 0, HASH_TABLE_LEN * 2);
 		enc->flagsHold |= PACKET_FLUSHED;
 		enc->first_pkt = 1;
 		return true;
@@ -995,7 +1051,7 @@ boolean compress_rdp_5(struct rdp_mppc_enc* enc, uint8* srcData, int len)
 	{
 		/* give up */
 		enc->historyOffset = 0;
-		memset(hash_table, 0, enc->buf_len * 2);
+		memset(hash_table, 0, HASH_TABLE_LEN * 2);
 		enc->flagsHold |= PACKET_FLUSHED;
 		enc->first_pkt = 1;
 		return true;
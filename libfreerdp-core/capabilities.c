@@ -1045,6 +1045,9 @@ void rdp_read_virtual_channel_capability_set(STREAM* s, uint16 length, rdpSettin
 
 	if (settings->server_mode != true)
 		settings->vc_chunk_size = VCChunkSize;
+
+	/* what the peer is able to decompress */
+	settings->vc_compression_flags = flags;
 }
 
 /**
@@ -1063,6 +1066,10 @@ void rdp_write_virtual_channel_capability_set(STREAM* s, rdpSettings* settings)
 
 	flags = VCCAPS_NO_COMPR;
 
+	/* advertise which direction of channel traffic we can decompress */
+	if (settings->compression)
+		flags = settings->server_mode ? VCCAPS_COMPR_CS_8K : VCCAPS_COMPR_SC;
+
 	stream_write_uint32(s, flags); /* flags (4 bytes) */
 	stream_write_uint32(s, settings->vc_chunk_size); /* VCChunkSize (4 bytes) */
 
@@ -28,6 +28,77 @@
 
 #include "rdp.h"
 #include "channel.h"
+#include "capabilities.h"
+
+/**
+ * Virtual channel data is compressed per chunk, with a history kept apart
+ * from the one used for slow-path and fast-path PDUs. Server to client
+ * traffic uses the 64K (RDP 5.0) encoding, client to server traffic is
+ * limited to 8K (RDP 4.0) by the capability exchange.
+ */
+
+static boolean freerdp_channel_compression_enabled(rdpRdp* rdp, rdpChannel* channel)
+{
+	rdpSettings* settings = rdp->settings;
+
+	if (!settings->compression || !(channel->options & CHANNEL_OPTION_COMPRESS_RDP))
+		return false;
+
+	if (settings->server_mode)
+		return (settings->vc_compression_flags & VCCAPS_COMPR_SC) ? true : false;
+	else
+		return (settings->vc_compression_flags & VCCAPS_COMPR_CS_8K) ? true : false;
+}
+
+static uint8* freerdp_channel_compress(rdpRdp* rdp, uint8* data, int* length, uint32* flags)
+{
+	if (rdp->vc_mppc_enc == NULL)
+		rdp->vc_mppc_enc = mppc_enc_new(rdp->settings->server_mode ? PROTO_RDP_50 : PROTO_RDP_40);
+
+	/* chunks that do not fit the history or do not shrink are sent as is */
+	if (!compress_rdp(rdp->vc_mppc_enc, data, *length))
+		return data;
+
+	if (!(rdp->vc_mppc_enc->flags & PACKET_COMPRESSED))
+		return data;
+
+	*flags |= (rdp->vc_mppc_enc->flags << 16) & CHANNEL_FLAG_PACKET_COMPRESSION_MASK;
+	*length = rdp->vc_mppc_enc->bytes_in_opb;
+
+	return (uint8*) rdp->vc_mppc_enc->outputBuffer;
+}
+
+static boolean freerdp_channel_decompress(rdpRdp* rdp, uint8** data, int* length, uint32* flags)
+{
+	uint32 roff;
+	uint32 rlen;
+	uint32 ctype;
+
+	if (*flags & CHANNEL_FLAG_PACKET_COMPRESSED)
+	{
+		ctype = (*flags & CHANNEL_FLAG_PACKET_COMPRESSION_MASK) >> 16;
+
+		/* only accept the compression type negotiated for this direction */
+		if ((ctype & CompressionTypeMask) != (rdp->settings->server_mode ? PACKET_COMPR_TYPE_8K : PACKET_COMPR_TYPE_64K))
+		{
+			printf("freerdp_channel_decompress: unexpected compression type 0x%X\n", ctype & CompressionTypeMask);
+			return false;
+		}
+
+		if (!decompress_rdp(rdp->vc_mppc_dec, *data, *length, ctype, &roff, &rlen))
+		{
+			printf("freerdp_channel_decompress: decompress_rdp() failed\n");
+			return false;
+		}
+
+		*data = rdp->vc_mppc_dec->history_buf + roff;
+		*length = rlen;
+	}
+
+	*flags &= ~CHANNEL_FLAG_PACKET_COMPRESSION_MASK;
+
+	return true;
+}
 
 boolean freerdp_channel_send(rdpRdp* rdp, uint16 channel_id, uint8* data, int size)
 {
@@ -35,6 +106,9 @@ boolean freerdp_channel_send(rdpRdp* rdp, uint16 channel_id, uint8* data, int si
 	uint32 flags;
 	int i, left;
 	int chunk_size;
+	int send_size;
+	uint8* send_data;
+	boolean compress;
 	rdpChannel* channel = NULL;
 
 	for (i = 0; i < rdp->settings->num_channels; i++)
@@ -52,6 +126,8 @@ boolean freerdp_channel_send(rdpRdp* rdp, uint16 channel_id, uint8* data, int si
 		return false;
 	}
 
+	compress = freerdp_channel_compression_enabled(rdp, channel);
+
 	flags = CHANNEL_FLAG_FIRST;
 	left = size;
 	while (left > 0)
@@ -72,10 +148,16 @@ boolean freerdp_channel_send(rdpRdp* rdp, uint16 channel_id, uint8* data, int si
 			flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
 		}
 
+		send_data = data;
+		send_size = chunk_size;
+
+		if (compress)
+			send_data = freerdp_channel_compress(rdp, data, &send_size, &flags);
+
 		stream_write_uint32(s, size);
 		stream_write_uint32(s, flags);
-		stream_check_size(s, chunk_size);
-		stream_write(s, data, chunk_size);
+		stream_check_size(s, send_size);
+		stream_write(s, send_data, send_size);
 
 		rdp_send(rdp, s, channel_id);
 
@@ -92,13 +174,18 @@ void freerdp_channel_process(freerdp* instance, STREAM* s, uint16 channel_id)
 	uint32 length;
 	uint32 flags;
 	int chunk_length;
+	uint8* chunk;
 
 	stream_read_uint32(s, length);
 	stream_read_uint32(s, flags);
 	chunk_length = stream_get_left(s);
+	chunk = stream_get_tail(s);
+
+	if (!freerdp_channel_decompress(instance->context->rdp, &chunk, &chunk_length, &flags))
+		return;
 
 	IFCALL(instance->ReceiveChannelData, instance,
-		channel_id, stream_get_tail(s), chunk_length, flags, length);
+		channel_id, chunk, chunk_length, flags, length);
 }
 
 void freerdp_channel_peer_process(freerdp_peer* client, STREAM* s, uint16 channel_id)
@@ -106,13 +193,18 @@ void freerdp_channel_peer_process(freerdp_peer* client, STREAM* s, uint16 channe
 	uint32 length;
 	uint32 flags;
 	int chunk_length;
+	uint8* chunk;
 
 	stream_read_uint32(s, length);
 	stream_read_uint32(s, flags);
 	chunk_length = stream_get_left(s);
+	chunk = stream_get_tail(s);
+
+	if (!freerdp_channel_decompress(client->context->rdp, &chunk, &chunk_length, &flags))
+		return;
 
 	IFCALL(client->ReceiveChannelData, client,
-		channel_id, stream_get_tail(s), chunk_length, flags, length);
+		channel_id, chunk, chunk_length, flags, length);
 }
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
@@ -23,6 +23,8 @@
 #include "connection.h"
 
 #include <freerdp/errorcodes.h>
+#include <freerdp/utils/time.h>
+#include <freerdp/utils/thread.h>
 
 /**
  *                                      Connection Sequence\n
@@ -54,6 +56,182 @@
  *
  */
 
+/**
+ * Ends the current connection phase, reporting its duration, and starts the given one.
+ * @param rdp RDP module
+ * @param phase FREERDP_CONNECTION_PHASE, or -1 to only end the current phase
+ */
+void rdp_client_begin_phase(rdpRdp* rdp, int phase)
+{
+	uint32 duration;
+	uint64 now = freerdp_get_time_usec();
+
+	if (rdp->connect_phase >= 0)
+	{
+		duration = (uint32) (now - rdp->connect_phase_start);
+		rdp->connect_phase_times[rdp->connect_phase] += duration;
+
+		DEBUG_RDP("connection phase %d took %u us", rdp->connect_phase, duration);
+
+		if (rdp->instance != NULL)
+			IFCALL(rdp->instance->ConnectionPhase, rdp->instance, rdp->connect_phase, duration);
+	}
+
+	rdp->connect_phase = phase;
+	rdp->connect_phase_start = now;
+}
+
+void rdp_client_end_phase(rdpRdp* rdp)
+{
+	rdp_client_begin_phase(rdp, -1);
+}
+
+/**
+ * Sets the client connection state, moving on to the matching connection phase
+ * while the connection sequence is being timed.
+ * @param rdp RDP module
+ * @param state new connection state
+ */
+void rdp_client_transition_to_state(rdpRdp* rdp, int state)
+{
+	int phase;
+
+	rdp->state = state;
+
+	if (rdp->connect_phase < 0)
+		return;
+
+	switch (state)
+	{
+		case CONNECTION_STATE_NEGO:
+			phase = FREERDP_PHASE_MCS_CONNECT;
+			break;
+
+		case CONNECTION_STATE_MCS_ATTACH_USER:
+			phase = FREERDP_PHASE_MCS_ATTACH_USER;
+			break;
+
+		case CONNECTION_STATE_MCS_CHANNEL_JOIN:
+			phase = FREERDP_PHASE_MCS_CHANNEL_JOIN;
+			break;
+
+		case CONNECTION_STATE_LICENSE:
+			phase = FREERDP_PHASE_LICENSING;
+			break;
+
+		case CONNECTION_STATE_CAPABILITY:
+			phase = FREERDP_PHASE_CAPABILITIES;
+			break;
+
+		case CONNECTION_STATE_FINALIZATION:
+			phase = FREERDP_PHASE_FINALIZATION;
+			break;
+
+		case CONNECTION_STATE_ACTIVE:
+			phase = -1;
+			break;
+
+		default:
+			phase = rdp->connect_phase;
+			break;
+	}
+
+	if (phase != rdp->connect_phase)
+		rdp_client_begin_phase(rdp, phase);
+}
+
+static void* rdp_client_local_init_thread(void* arg)
+{
+	boolean status = true;
+	rdpRdp* rdp = (rdpRdp*) arg;
+	rdpSettings* settings = rdp->settings;
+
+	if ((settings->tls_security || settings->nla_security) && !settings->ignore_certificate)
+		rdp->certificate_store = certificate_store_new(settings);
+
+	wait_obj_set(rdp->certificate_store_event);
+
+	IFCALLRET(rdp->instance->ParallelPreConnect, status, rdp->instance);
+
+	rdp->local_init_status = status;
+	wait_obj_set(rdp->local_init_event);
+
+	return NULL;
+}
+
+/**
+ * Starts the local initialization that does not depend on the server:
+ * opening the certificate store and the ParallelPreConnect callback.
+ * It overlaps with the network round-trips up to the MCS Connect Initial.
+ * @param rdp RDP module
+ */
+void rdp_client_start_local_init(rdpRdp* rdp)
+{
+	freerdp_thread* thread;
+
+	rdp->certificate_store = NULL;
+	rdp->local_init_status = false;
+	rdp->local_init_event = wait_obj_new();
+	rdp->certificate_store_event = wait_obj_new();
+
+	/* the thread is detached, completion is signalled through the wait objects */
+	thread = freerdp_thread_new();
+	freerdp_thread_start(thread, rdp_client_local_init_thread, rdp);
+	freerdp_thread_free(thread);
+}
+
+static void rdp_client_wait_event(struct wait_obj* event)
+{
+	while (!wait_obj_is_set(event))
+		wait_obj_select(&event, 1, -1);
+}
+
+static void rdp_client_attach_certificate_store(rdpRdp* rdp)
+{
+	rdpTransport* transport = rdp->transport;
+
+	if (rdp->certificate_store_event == NULL)
+		return;
+
+	rdp_client_wait_event(rdp->certificate_store_event);
+
+	if (rdp->certificate_store == NULL)
+		return;
+
+	if (transport->tls == NULL)
+		transport->tls = tls_new(rdp->settings);
+
+	if (transport->tls->certificate_store == NULL)
+	{
+		transport->tls->certificate_store = rdp->certificate_store;
+		rdp->certificate_store = NULL;
+	}
+}
+
+/**
+ * Waits for the local initialization started by rdp_client_start_local_init.
+ * @param rdp RDP module
+ * @return false if the ParallelPreConnect callback failed
+ */
+boolean rdp_client_wait_local_init(rdpRdp* rdp)
+{
+	if (rdp->local_init_event == NULL)
+		return true;
+
+	rdp_client_wait_event(rdp->local_init_event);
+
+	wait_obj_free(rdp->local_init_event);
+	wait_obj_free(rdp->certificate_store_event);
+	rdp->local_init_event = NULL;
+	rdp->certificate_store_event = NULL;
+
+	/* not handed over to TLS, e.g. when standard RDP security was negotiated */
+	certificate_store_free(rdp->certificate_store);
+	rdp->certificate_store = NULL;
+
+	return rdp->local_init_status;
+}
+
 /**
  * Establish RDP Connection based on the settings given in the 'rdp' paremeter.
  * @msdn{cc240452}
@@ -78,6 +256,8 @@ boolean rdp_client_connect(rdpRdp* rdp)
 		nego_enable_tls(rdp->nego, settings->tls_security);
 	}
 
+	rdp_client_begin_phase(rdp, FREERDP_PHASE_NEGOTIATION);
+
 	if (nego_connect(rdp->nego) != true)
 	{
 		printf("Error: protocol security negotiation failure\n");
@@ -86,6 +266,11 @@ boolean rdp_client_connect(rdpRdp* rdp)
 
 	selectedProtocol = rdp->nego->selected_protocol;
 
+	rdp_client_begin_phase(rdp, FREERDP_PHASE_SECURITY);
+
+	if (selectedProtocol & (PROTOCOL_NLA | PROTOCOL_TLS))
+		rdp_client_attach_certificate_store(rdp);
+
 	if ((selectedProtocol & PROTOCOL_TLS) || (selectedProtocol == PROTOCOL_RDP))
 	{
 		if ((settings->username != NULL) && ((settings->password != NULL) || (settings->password_cookie != NULL && settings->password_cookie->length > 0)))
@@ -103,8 +288,19 @@ boolean rdp_client_connect(rdpRdp* rdp)
 	if (status != true)
 		return false;
 
+	rdp_client_begin_phase(rdp, FREERDP_PHASE_LOCAL_INIT);
+
+	if (rdp_client_wait_local_init(rdp) != true)
+	{
+		if (!connectErrorCode)
+			connectErrorCode = PREECONNECTERROR;
+
+		printf("Error: parallel pre-connect failure\n");
+		return false;
+	}
+
 	rdp_set_blocking_mode(rdp, false);
-	rdp->state = CONNECTION_STATE_NEGO;
+	rdp_client_transition_to_state(rdp, CONNECTION_STATE_NEGO);
 	rdp->finalize_sc_pdus = 0;
 
 	if (mcs_send_connect_initial(rdp->mcs) != true)
@@ -349,7 +545,7 @@ boolean rdp_client_connect_mcs_connect_response(rdpRdp* rdp, STREAM* s)
 	if (!mcs_send_attach_user_request(rdp->mcs))
 		return false;
 
-	rdp->state = CONNECTION_STATE_MCS_ATTACH_USER;
+	rdp_client_transition_to_state(rdp, CONNECTION_STATE_MCS_ATTACH_USER);
 
 	return true;
 }
@@ -362,7 +558,7 @@ boolean rdp_client_connect_mcs_attach_user_confirm(rdpRdp* rdp, STREAM* s)
 	if (!mcs_send_channel_join_request(rdp->mcs, rdp->mcs->user_id))
 		return false;
 
-	rdp->state = CONNECTION_STATE_MCS_CHANNEL_JOIN;
+	rdp_client_transition_to_state(rdp, CONNECTION_STATE_MCS_CHANNEL_JOIN);
 
 	return true;
 }
@@ -427,7 +623,7 @@ boolean rdp_client_connect_mcs_channel_join_confirm(rdpRdp* rdp, STREAM* s)
 			return false;
 		if (!rdp_send_client_info(rdp))
 			return false;
-		rdp->state = CONNECTION_STATE_LICENSE;
+		rdp_client_transition_to_state(rdp, CONNECTION_STATE_LICENSE);
 	}
 
 	return true;
@@ -446,7 +642,7 @@ boolean rdp_client_connect_license(rdpRdp* rdp, STREAM* s)
 
 	if (rdp->license->state == LICENSE_STATE_COMPLETED)
 	{
-		rdp->state = CONNECTION_STATE_CAPABILITY;
+		rdp_client_transition_to_state(rdp, CONNECTION_STATE_CAPABILITY);
 	}
 
 	return true;
@@ -491,7 +687,7 @@ boolean rdp_client_connect_demand_active(rdpRdp* rdp, STREAM* s)
 		IFCALL(rdp->update->DesktopResize, rdp->update->context);
 	}
 
-	rdp->state = CONNECTION_STATE_FINALIZATION;
+	rdp_client_transition_to_state(rdp, CONNECTION_STATE_FINALIZATION);
 	update_reset_state(rdp->update);
 
 	rdp_client_connect_finalize(rdp);
@@ -46,6 +46,12 @@ enum CONNECTION_STATE
 	CONNECTION_STATE_ACTIVE
 };
 
+void rdp_client_begin_phase(rdpRdp* rdp, int phase);
+void rdp_client_end_phase(rdpRdp* rdp);
+void rdp_client_transition_to_state(rdpRdp* rdp, int state);
+void rdp_client_start_local_init(rdpRdp* rdp);
+boolean rdp_client_wait_local_init(rdpRdp* rdp);
+
 boolean rdp_client_connect(rdpRdp* rdp);
 boolean rdp_client_redirect(rdpRdp* rdp);
 boolean rdp_client_connect_mcs_connect_response(rdpRdp* rdp, STREAM* s);
@@ -577,11 +577,8 @@ boolean fastpath_send_input_pdu(rdpFastPath* fastpath, STREAM* s)
 
 		fpInputEvents = stream_get_tail(s) + sec_bytes;
 		fpInputEvents_length = length - 3 - sec_bytes;
-		if (rdp->sec_flags & SEC_SECURE_CHECKSUM)
-			security_salted_mac_signature(rdp, fpInputEvents, fpInputEvents_length, true, stream_get_tail(s));
-		else
-			security_mac_signature(rdp, fpInputEvents, fpInputEvents_length, stream_get_tail(s));
-		security_encrypt(fpInputEvents, fpInputEvents_length, rdp);
+		security_sign_and_encrypt(rdp, fpInputEvents, fpInputEvents_length,
+			(rdp->sec_flags & SEC_SECURE_CHECKSUM) ? true : false, stream_get_tail(s));
 	}
 
 	rdp->sec_flags = 0;
@@ -639,6 +636,9 @@ boolean fastpath_send_update_pdu(rdpFastPath* fastpath, uint8 updateCode, STREAM
 	try_comp = rdp->settings->compression;
 	comp_update = stream_new(0);
 
+	/* fragments of the update share TLS records */
+	transport_cork(rdp->transport);
+
 	for (fragment = 0; totalLength > 0 || fragment == 0; fragment++)
 	{
 		stream_get_mark(s, holdp);
@@ -707,11 +707,8 @@ boolean fastpath_send_update_pdu(rdpFastPath* fastpath, uint8 updateCode, STREAM
 			/* does this work ? */
 			ptr_to_crypt = bm + 3 + sec_bytes;
 			ptr_sig = bm + 3;
-			if (rdp->sec_flags & SEC_SECURE_CHECKSUM)
-				security_salted_mac_signature(rdp, ptr_to_crypt, bytes_to_crypt, true, ptr_sig);
-			else
-				security_mac_signature(rdp, ptr_to_crypt, bytes_to_crypt, ptr_sig);
-			security_encrypt(ptr_to_crypt, bytes_to_crypt, rdp);
+			security_sign_and_encrypt(rdp, ptr_to_crypt, bytes_to_crypt,
+				(rdp->sec_flags & SEC_SECURE_CHECKSUM) ? true : false, ptr_sig);
 		}
 
 		if (transport_write(fastpath->rdp->transport, update) < 0)
@@ -724,6 +721,9 @@ boolean fastpath_send_update_pdu(rdpFastPath* fastpath, uint8 updateCode, STREAM
 		stream_set_mark(s, holdp + dlen);
 	}
 
+	if (transport_uncork(rdp->transport) < 0)
+		result = false;
+
 	stream_detach(update);
 	stream_detach(comp_update);
 	stream_free(update);
@@ -52,6 +52,9 @@ boolean freerdp_connect(freerdp* instance)
 
 	rdp = instance->context->rdp;
 
+	memset(rdp->connect_phase_times, 0, sizeof(rdp->connect_phase_times));
+	rdp_client_begin_phase(rdp, FREERDP_PHASE_PRE_CONNECT);
+
 	IFCALLRET(instance->PreConnect, status, instance);
 
 	rdp->extension = extension_new(instance);
@@ -63,10 +66,18 @@ boolean freerdp_connect(freerdp* instance)
 			connectErrorCode = PREECONNECTERROR;
 		}
 		fprintf(stderr, "%s:%d: freerdp_pre_connect failed\n", __FILE__, __LINE__);
+		rdp_client_end_phase(rdp);
 		return false;
 	}
 
+	rdp_client_start_local_init(rdp);
+
 	status = rdp_client_connect(rdp);
+
+	/* the connection may have failed before the local initialization was waited for */
+	rdp_client_wait_local_init(rdp);
+	rdp_client_end_phase(rdp);
+
 	// --authonly tests the connection without a UI
 	if (instance->settings->authentication_only) {
 		fprintf(stderr, "%s:%d: Authentication only, exit status %d\n", __FILE__, __LINE__, !status);
@@ -84,7 +95,9 @@ boolean freerdp_connect(freerdp* instance)
 
 		extension_post_connect(rdp->extension);
 
+		rdp_client_begin_phase(rdp, FREERDP_PHASE_POST_CONNECT);
 		IFCALLRET(instance->PostConnect, status, instance);
+		rdp_client_end_phase(rdp);
 
 		if (status != true)
 		{
@@ -263,6 +276,20 @@ uint32 freerdp_error_info(freerdp* instance)
 	return instance->context->rdp->errorInfo;
 }
 
+/**
+ * Returns the time spent in a phase of the last connection sequence.
+ * @param instance FreeRDP instance
+ * @param phase FREERDP_CONNECTION_PHASE
+ * @return duration in microseconds, 0 if the phase was not reached
+ */
+uint32 freerdp_get_connection_phase_time(freerdp* instance, int phase)
+{
+	if (phase < 0 || phase >= FREERDP_PHASE_COUNT)
+		return 0;
+
+	return instance->context->rdp->connect_phase_times[phase];
+}
+
 /** Allocator function for the rdp_freerdp structure.
  *  @return an allocated structure filled with 0s. Need to be deallocated using freerdp_free()
  */
@@ -186,6 +186,11 @@ void Glyph_EndDraw(rdpContext* context, int x, int y, int width, int height, uin
 	context->graphics->Glyph_Prototype->EndDraw(context, x, y, width, height, bgcolor, fgcolor);
 }
 
+void Glyph_DrawBatch(rdpContext* context, GLYPH_BATCH* batch)
+{
+	context->graphics->Glyph_Prototype->DrawBatch(context, batch);
+}
+
 void graphics_register_glyph(rdpGraphics* graphics, rdpGlyph* glyph)
 {
 	memcpy(graphics->Glyph_Prototype, glyph, sizeof(rdpGlyph));
@@ -332,12 +332,9 @@ static uint32 rdp_security_stream_out(rdpRdp* rdp, STREAM* s, int length)
 			{
 				data = s->p + 8;
 				length = length - (data - s->data);
-				if (sec_flags & SEC_SECURE_CHECKSUM)
-					security_salted_mac_signature(rdp, data, length, true, s->p);
-				else
-					security_mac_signature(rdp, data, length, s->p);
+				security_sign_and_encrypt(rdp, data, length,
+					(sec_flags & SEC_SECURE_CHECKSUM) ? true : false, s->p);
 				stream_seek(s, 8);
-				security_encrypt(s->p, length, rdp);
 			}
 		}
 
@@ -859,7 +856,7 @@ static boolean rdp_recv_callback(rdpTransport* transport, STREAM* s, void* extra
 			if (!rdp_recv_pdu(rdp, s))
 				return false;
 			if (rdp->finalize_sc_pdus == FINALIZE_SC_COMPLETE)
-				rdp->state = CONNECTION_STATE_ACTIVE;
+				rdp_client_transition_to_state(rdp, CONNECTION_STATE_ACTIVE);
 			break;
 
 		case CONNECTION_STATE_ACTIVE:
@@ -911,6 +908,7 @@ rdpRdp* rdp_new(freerdp* instance)
 	if (rdp != NULL)
 	{
 		rdp->instance = instance;
+		rdp->connect_phase = -1;
 		rdp->settings = settings_new((void*) instance);
 
 		if (instance != NULL)
@@ -926,6 +924,7 @@ rdpRdp* rdp_new(freerdp* instance)
 		rdp->redirection = redirection_new();
 		rdp->mppc_dec = mppc_dec_new();
 		rdp->mppc_enc = mppc_enc_new(PROTO_RDP_50);
+		rdp->vc_mppc_dec = mppc_dec_new();
 	}
 
 	return rdp;
@@ -942,6 +941,8 @@ void rdp_free(rdpRdp* rdp)
 	{
 		crypto_rc4_free(rdp->rc4_decrypt_key);
 		crypto_rc4_free(rdp->rc4_encrypt_key);
+		crypto_sha1_free(rdp->mac_sha1);
+		crypto_md5_free(rdp->mac_md5);
 		crypto_des3_free(rdp->fips_encrypt);
 		crypto_des3_free(rdp->fips_decrypt);
 		crypto_hmac_free(rdp->fips_hmac);
@@ -957,6 +958,8 @@ void rdp_free(rdpRdp* rdp)
 		redirection_free(rdp->redirection);
 		mppc_dec_free(rdp->mppc_dec);
 		mppc_enc_free(rdp->mppc_enc);
+		mppc_dec_free(rdp->vc_mppc_dec);
+		mppc_enc_free(rdp->vc_mppc_enc);
 		xfree(rdp);
 	}
 }
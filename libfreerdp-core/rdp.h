@@ -42,6 +42,8 @@
 #include <freerdp/settings.h>
 #include <freerdp/utils/debug.h>
 #include <freerdp/utils/stream.h>
+#include <freerdp/utils/wait_obj.h>
+#include <freerdp/crypto/certificate.h>
 #include <freerdp/codec/mppc_dec.h>
 #include <freerdp/codec/mppc_enc.h>
 
@@ -128,6 +130,8 @@ struct rdp_rdp
 	struct rdp_extension* extension;
 	struct rdp_mppc_dec* mppc_dec;
 	struct rdp_mppc_enc* mppc_enc;
+	struct rdp_mppc_dec* vc_mppc_dec;
+	struct rdp_mppc_enc* vc_mppc_enc;
 	struct crypto_rc4_struct* rc4_decrypt_key;
 	int decrypt_use_count;
 	int decrypt_checksum_use_count;
@@ -141,6 +145,8 @@ struct rdp_rdp
 	boolean do_crypt;
 	boolean do_secure_checksum;
 	uint8 sign_key[16];
+	struct crypto_sha1_struct* mac_sha1;
+	struct crypto_md5_struct* mac_md5;
 	uint8 decrypt_key[16];
 	uint8 encrypt_key[16];
 	uint8 decrypt_update_key[16];
@@ -152,6 +158,15 @@ struct rdp_rdp
 	uint32 errorInfo;
 	uint32 finalize_sc_pdus;
 	boolean disconnect;
+
+	int connect_phase;
+	uint64 connect_phase_start;
+	uint32 connect_phase_times[FREERDP_PHASE_COUNT];
+
+	struct wait_obj* local_init_event;
+	struct wait_obj* certificate_store_event;
+	rdpCertificateStore* certificate_store;
+	boolean local_init_status;
 };
 
 void rdp_read_security_header(STREAM* s, uint16* flags);
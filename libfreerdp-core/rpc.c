@@ -29,6 +29,15 @@
 
 #include "rpc.h"
 
+/* OUT channel data is read into a buffer of this size, enough for any PDU */
+#define RPC_RECV_BUFFER_SIZE	(64 * 1024)
+/* initial size of the reused request buffer, grown for larger requests */
+#define RPC_SEND_BUFFER_SIZE	0x1000
+
+/* [MS-RPCH] 2.2.3.5.1: ReceiveWindowSize ranges from 8 KB to 256 KB */
+#define RPC_MIN_RECEIVE_WINDOW	0x00002000
+#define RPC_MAX_RECEIVE_WINDOW	0x00040000
+
 boolean ntlm_client_init(rdpNtlm* ntlm, boolean confidentiality, char* user, char* domain, char* password)
 {
 	size_t size;
@@ -363,11 +372,16 @@ int rpc_in_write(rdpRpc* rpc, uint8* data, int length)
 	printf("\n");
 #endif
 
+	/* gateway requests and flow control acks are written from different threads */
+	freerdp_mutex_lock(rpc->in_mutex);
+
 	status = tls_write_all(rpc->tls_in, data, length);
 
 	if (status > 0)
 		rpc->VirtualConnection->DefaultInChannel->BytesSent += status;
 
+	freerdp_mutex_unlock(rpc->in_mutex);
+
 	return status;
 }
 
@@ -506,27 +520,23 @@ int rpc_recv_bind_ack_pdu(rdpRpc* rpc)
 	uint8* pdu;
 	uint8* auth_data;
 	RPC_PDU_HEADER header;
-	int pdu_length = 0x8FFF;
 
-	pdu = xmalloc(pdu_length);
-	if (pdu == NULL)
-		return -1 ;
-	status = rpc_out_read(rpc, pdu, pdu_length);
+	status = rpc_recv_pdu(rpc, &pdu);
 
 	if (status > 0)
 	{
 		s = stream_new(0);
-		stream_attach(s, pdu, pdu_length);
+		stream_attach(s, pdu, status);
 		rpc_pdu_header_read(s, &header);
 		stream_detach(s);
 		stream_free(s);
 
+		if (header.auth_length > header.frag_length - 16)
+			return -1;
+
 		auth_data = xmalloc(header.auth_length);
 		if (auth_data == NULL)
-		{
-			xfree(pdu) ;
 			return -1 ;
-		}
 		p = (pdu + (header.frag_length - header.auth_length));
 		memcpy(auth_data, p, header.auth_length);
 
@@ -536,7 +546,6 @@ int rpc_recv_bind_ack_pdu(rdpRpc* rpc)
 		ntlm_authenticate(rpc->ntlm);
 	}
 
-	xfree(pdu);
 	return status;
 }
 
@@ -595,164 +604,179 @@ boolean rpc_send_rpc_auth_3_pdu(rdpRpc* rpc)
 	return true;
 }
 
-int rpc_out_read(rdpRpc* rpc, uint8* data, int length)
+/**
+ * Accounts for a PDU received on the OUT channel. Data is consumed as soon
+ * as it is read, so once half of the receive window is used a FlowControlAck
+ * gives all of it back to the proxy, keeping it sending on links with a
+ * large bandwidth-delay product.
+ */
+static void rpc_out_channel_received(rdpRpc* rpc, uint32 length)
 {
-	STREAM* s;
-	int status;
-	uint8* pdu;
-	int content_length;
-	RPC_PDU_HEADER header;
+	RpcOutChannel* channel = rpc->VirtualConnection->DefaultOutChannel;
+
+	channel->BytesReceived += length;
 
-	if (rpc->VirtualConnection->DefaultOutChannel->ReceiverAvailableWindow < 0x00008FFF) /* Just a simple workaround */
-		rts_send_flow_control_ack_pdu(rpc);  /* Send FlowControlAck every time AvailableWindow reaches the half */
+	if (length < channel->ReceiverAvailableWindow)
+		channel->ReceiverAvailableWindow -= length;
+	else
+		channel->ReceiverAvailableWindow = 0;
 
-	pdu = xmalloc(0xFFFF);
-	if (pdu == NULL)
+	if (channel->ReceiverAvailableWindow < channel->ReceiveWindow / 2)
 	{
-		printf("rpc_out_read error: memory allocation failed") ;
-		return -1 ;
+		channel->ReceiverAvailableWindow = channel->ReceiveWindow;
+		rts_send_flow_control_ack_pdu(rpc);
 	}
+}
 
-	status = tls_read(rpc->tls_out, pdu, 16); /* read first 16 bytes to get RPC PDU Header */
+/**
+ * Returns the next complete PDU received on the OUT channel. TLS data is read
+ * in large blocks into rpc->recv_buffer and PDUs are returned in place; the
+ * pointer stays valid until the next call. Returns the PDU length, 0 when no
+ * complete PDU is available yet (a partial one is kept for the next call),
+ * or -1 on error.
+ */
+int rpc_recv_pdu(rdpRpc* rpc, uint8** pdu)
+{
+	int status;
+	uint8* data;
+	uint32 available;
+	uint16 frag_length;
+	STREAM* s = rpc->recv_buffer;
 
-	if (status <= 0)
+	while (true)
 	{
-		xfree(pdu);
-		return status;
-	}
+		data = stream_get_head(s) + rpc->recv_offset;
+		available = stream_get_pos(s) - rpc->recv_offset;
 
-	s = stream_new(0);
-	stream_attach(s, pdu, 16);
+		if (available >= 16)
+		{
+			frag_length = data[8] | (data[9] << 8); /* frag_length (2 bytes) */
 
-	rpc_pdu_header_read(s, &header);
+			if (frag_length < 16)
+			{
+				printf("rpc_recv_pdu error: invalid frag_length %d\n", frag_length);
+				return -1;
+			}
 
-	stream_detach(s);
-	stream_free(s);
+			if (available >= frag_length)
+			{
+				rpc->recv_offset += frag_length;
 
-	content_length = header.frag_length - 16;
-	status = tls_read(rpc->tls_out, pdu + 16, content_length);
+				/* RTS PDUs are not subject to flow control */
+				if (data[2] != PTYPE_RTS)
+					rpc_out_channel_received(rpc, frag_length);
 
-	if (status < 0)
-	{
-		xfree(pdu);
-		return status;
-	}
+#ifdef WITH_DEBUG_RPC
+				printf("rpc_recv_pdu(): length: %d\n", frag_length);
+				freerdp_hexdump(data, frag_length);
+				printf("\n");
+#endif
 
-	if (header.ptype == PTYPE_RTS) /* RTS PDU */
-	{
-		printf("rpc_out_read error: Unexpected RTS PDU\n");
-		xfree(pdu);
-		return -1;
-	}
-	else
-	{
-		/* RTS PDUs are not subject to flow control */
-		rpc->VirtualConnection->DefaultOutChannel->BytesReceived += header.frag_length;
-		rpc->VirtualConnection->DefaultOutChannel->ReceiverAvailableWindow -= header.frag_length;
-	}
+				*pdu = data;
+				return frag_length;
+			}
+		}
 
-	if (length < header.frag_length)
-	{
-		printf("rpc_out_read error! receive buffer is not large enough\n");
-		xfree(pdu);
-		return -1;
+		/* move the partial PDU to the front and read as much as fits after it */
+		if (rpc->recv_offset > 0)
+		{
+			memmove(stream_get_head(s), data, available);
+			stream_set_pos(s, available);
+			rpc->recv_offset = 0;
+		}
+
+		status = tls_read(rpc->tls_out, stream_get_tail(s), stream_get_left(s));
+
+		if (status <= 0)
+			return status;
+
+		stream_seek(s, status);
 	}
+}
 
-	memcpy(data, pdu, header.frag_length);
+/* rpc_vers, rpc_vers_minor, PTYPE, pfc_flags and packed_drep of every request */
+static const uint8 rpc_request_header_template[8] =
+{
+	5, 0, PTYPE_REQUEST, PFC_FIRST_FRAG | PFC_LAST_FRAG, 0x10, 0x00, 0x00, 0x00
+};
 
-#ifdef WITH_DEBUG_RPC
-	printf("rpc_out_read(): length: %d\n", header.frag_length);
-	freerdp_hexdump(data, header.frag_length);
-	printf("\n");
-#endif
+/**
+ * Returns the request stream, positioned at the stub data, so that callers
+ * can marshal a request in place before passing it to rpc_tsg_write_stream.
+ * The stream is reused by every request.
+ */
+STREAM* rpc_tsg_write_init(rdpRpc* rpc)
+{
+	STREAM* s = rpc->send_buffer;
+
+	stream_set_pos(s, 24);
 
-	xfree(pdu);
-	return header.frag_length;
+	return s;
 }
 
-int rpc_tsg_write(rdpRpc* rpc, uint8* data, int length, uint16 opnum)
+int rpc_tsg_write_stream(rdpRpc* rpc, STREAM* s, uint16 opnum)
 {
-	int i;
 	int status;
-	STREAM* pdu;
-	rdpNtlm* ntlm;
+	int length;
+	uint16 frag_length;
+	uint8 auth_pad_length;
+	rdpNtlm* ntlm = rpc->ntlm;
 	SecBuffer Buffers[2];
 	SecBufferDesc Message;
 	SECURITY_STATUS encrypt_status;
-	rpcconn_request_hdr_t* request_pdu;
 
-	uint8 auth_pad_length = 16 - ((24 + length + 8 + 16) % 16);
+	if (ntlm->ContextSizes.cbMaxSignature == 0)
+	{
+		if (ntlm->table->QueryContextAttributes(&ntlm->context, SECPKG_ATTR_SIZES, &ntlm->ContextSizes) != SEC_E_OK)
+		{
+			printf("QueryContextAttributes SECPKG_ATTR_SIZES failure\n");
+			return 0;
+		}
+	}
 
-	ntlm = rpc->ntlm;
+	length = stream_get_pos(s) - 24;
+	auth_pad_length = 16 - ((24 + length + 8 + 16) % 16);
 
 	if (auth_pad_length == 16)
 		auth_pad_length = 0;
 
-	request_pdu = xnew(rpcconn_request_hdr_t);
-	request_pdu->rpc_vers = 5;
-	request_pdu->rpc_vers_minor = 0;
-	request_pdu->PTYPE = PTYPE_REQUEST;
-	request_pdu->pfc_flags = PFC_FIRST_FRAG | PFC_LAST_FRAG;
-	request_pdu->packed_drep[0] = 0x10;
-	request_pdu->packed_drep[1] = 0x00;
-	request_pdu->packed_drep[2] = 0x00;
-	request_pdu->packed_drep[3] = 0x00;
-	request_pdu->frag_length = 24 + length + auth_pad_length + 8 + 16;
-	request_pdu->auth_length = 16;
-	request_pdu->call_id = ++rpc->call_id;
+	frag_length = 24 + length + auth_pad_length + 8 + 16;
+	stream_check_size(s, auth_pad_length + 8 + ntlm->ContextSizes.cbMaxSignature);
+
+	stream_write_zero(s, auth_pad_length); /* auth_pad */
+	stream_write_uint8(s, 0x0A); /* auth_type */
+	stream_write_uint8(s, 0x05); /* auth_level */
+	stream_write_uint8(s, auth_pad_length); /* auth_pad_length */
+	stream_write_uint8(s, 0x00); /* auth_reserved */
+	stream_write_uint32(s, 0x00000000); /* auth_context_id */
+	length = stream_get_pos(s);
+
+	rpc->call_id++;
 
 	/* opnum=8 means [MS-TSGU] TsProxySetupReceivePipe, save call_id for checking pipe responses */
 
 	if (opnum == 8)
 		rpc->pipe_call_id = rpc->call_id;
 
-	request_pdu->alloc_hint = length;
-	request_pdu->p_cont_id = 0x0000;
-	request_pdu->opnum = opnum;
-	request_pdu->stub_data = data;
-	request_pdu->auth_verifier.auth_type = 0x0A; /* :01  which authentication service */
-	request_pdu->auth_verifier.auth_level = 0x05; /* :01  which level within service */
-	request_pdu->auth_verifier.auth_pad_length = auth_pad_length; /* :01 */
-	request_pdu->auth_verifier.auth_pad = xmalloc(auth_pad_length); /* align(4); size_is(auth_pad_length) p */
-
-	for (i = 0; i < auth_pad_length; i++)
-	{
-		request_pdu->auth_verifier.auth_pad[i] = 0x00;
-	}
-
-	request_pdu->auth_verifier.auth_reserved = 0x00; /* :01 reserved, m.b.z. */
-	request_pdu->auth_verifier.auth_context_id = 0x00000000; /* :04 */
-	request_pdu->auth_verifier.auth_value = xmalloc(request_pdu->auth_length); /* credentials; size_is(auth_length) p */
-
-	pdu = stream_new(request_pdu->frag_length);
-
-	stream_write(pdu, request_pdu, 24);
-	stream_write(pdu, request_pdu->stub_data, request_pdu->alloc_hint);
-
-	if (request_pdu->auth_verifier.auth_pad_length > 0)
-		stream_write(pdu, request_pdu->auth_verifier.auth_pad, request_pdu->auth_verifier.auth_pad_length);
-
-	stream_write(pdu, &request_pdu->auth_verifier.auth_type, 8);
-
-	xfree(request_pdu->auth_verifier.auth_value);
-	xfree(request_pdu->auth_verifier.auth_pad);
-	xfree(request_pdu);
-
-	if (ntlm->table->QueryContextAttributes(&ntlm->context, SECPKG_ATTR_SIZES, &ntlm->ContextSizes) != SEC_E_OK)
-	{
-		printf("QueryContextAttributes SECPKG_ATTR_SIZES failure\n");
-		stream_free(pdu) ;
-		return 0;
-	}
+	stream_set_pos(s, 0);
+	stream_write(s, rpc_request_header_template, sizeof(rpc_request_header_template));
+	stream_write_uint16(s, frag_length); /* frag_length */
+	stream_write_uint16(s, 16); /* auth_length */
+	stream_write_uint32(s, rpc->call_id); /* call_id */
+	stream_write_uint32(s, length - 24 - auth_pad_length - 8); /* alloc_hint */
+	stream_write_uint16(s, 0x0000); /* p_cont_id */
+	stream_write_uint16(s, opnum); /* opnum */
+	stream_set_pos(s, length);
 
 	Buffers[0].BufferType = SECBUFFER_DATA; /* auth_data */
 	Buffers[1].BufferType = SECBUFFER_TOKEN; /* signature */
 
-	Buffers[0].pvBuffer = pdu->data;
-	Buffers[0].cbBuffer = stream_get_length(pdu);
+	Buffers[0].pvBuffer = stream_get_head(s);
+	Buffers[0].cbBuffer = length;
 
+	/* the signature is written straight after the auth verifier */
 	Buffers[1].cbBuffer = ntlm->ContextSizes.cbMaxSignature;
-	Buffers[1].pvBuffer = xzalloc(Buffers[1].cbBuffer);
+	Buffers[1].pvBuffer = stream_get_tail(s);
 
 	Message.cBuffers = 2;
 	Message.ulVersion = SECBUFFER_VERSION;
@@ -763,15 +787,12 @@ int rpc_tsg_write(rdpRpc* rpc, uint8* data, int length, uint16 opnum)
 	if (encrypt_status != SEC_E_OK)
 	{
 		printf("EncryptMessage status: 0x%08X\n", encrypt_status);
-		stream_free(pdu) ;
 		return 0;
 	}
 
-	stream_write(pdu, Buffers[1].pvBuffer, Buffers[1].cbBuffer);
+	stream_seek(s, Buffers[1].cbBuffer);
 
-	status = rpc_in_write(rpc, pdu->data, pdu->p - pdu->data);
-
-	stream_free(pdu) ;
+	status = rpc_in_write(rpc, stream_get_head(s), stream_get_length(s));
 
 	if (status < 0)
 	{
@@ -779,94 +800,119 @@ int rpc_tsg_write(rdpRpc* rpc, uint8* data, int length, uint16 opnum)
 		return -1;
 	}
 
-	return length;
+	return length - 24 - auth_pad_length - 8;
+}
+
+int rpc_tsg_write(rdpRpc* rpc, uint8* data, int length, uint16 opnum)
+{
+	STREAM* s;
+
+	s = rpc_tsg_write_init(rpc);
+	stream_check_size(s, length);
+	stream_write(s, data, length);
+
+	return rpc_tsg_write_stream(rpc, s, opnum);
 }
 
 int rpc_read(rdpRpc* rpc, uint8* data, int length)
 {
+	STREAM* s;
 	int status;
 	int read = 0;
-	int data_length;
+	uint8* pdu;
+	boolean more;
+	uint32 alloc_hint;
+	uint32 data_length;
 	uint16 frag_length;
 	uint16 auth_length;
 	uint8 auth_pad_length;
-	uint32 call_id = -1;
-	int rpc_length = length + 0xFF;
-	uint8* rpc_data = xmalloc(rpc_length);
-
-	if (rpc_data == NULL)
-	{
-		printf("rpc_read error: memory allocation failed\n") ;
-		return -1 ;
-	}
+	RTS_PDU rts_pdu;
 
-	if (rpc->read_buffer_len > 0)
+	/* stub data the previous call had no room for comes first */
+	if (rpc->pending_length > 0)
 	{
-		if (rpc->read_buffer_len > (uint32) length)
-		{
-			printf("rpc_read error: receiving buffer is not large enough\n");
-			xfree(rpc_data) ;
-			return -1;
-		}
+		data_length = MIN(rpc->pending_length, (uint32) length);
+		memcpy(data, rpc->pending_data, data_length);
+		rpc->pending_data += data_length;
+		rpc->pending_length -= data_length;
+		read += data_length;
 
-		memcpy(data, rpc->read_buffer, rpc->read_buffer_len);
-		read += rpc->read_buffer_len;
-		xfree(rpc->read_buffer);
-		rpc->read_buffer_len = 0;
+		if (rpc->pending_length > 0 || !rpc->pending_more)
+			return read;
 	}
 
-	while (true)
+	while (read < length)
 	{
-		status = rpc_out_read(rpc, rpc_data, rpc_length);
+		status = rpc_recv_pdu(rpc, &pdu);
 
 		if (status == 0)
 		{
-			xfree(rpc_data);
 			return read;
 		}
 		else if (status < 0)
 		{
-			printf("Error! rpc_out_read() returned negative value. BytesSent: %d, BytesReceived: %d\n",
+			printf("Error! rpc_recv_pdu() returned negative value. BytesSent: %d, BytesReceived: %d\n",
 					rpc->VirtualConnection->DefaultInChannel->BytesSent,
 					rpc->VirtualConnection->DefaultOutChannel->BytesReceived);
 
-			xfree(rpc_data);
 			return status;
 		}
 
-		frag_length = *(uint16*)(rpc_data + 8);
-		auth_length = *(uint16*)(rpc_data + 10);
-		call_id = *(uint32*)(rpc_data + 12);
-		status = *(uint32*)(rpc_data + 16); /* alloc_hint */
-		auth_pad_length = *(rpc_data + frag_length - auth_length - 6); /* -6 = -8 + 2 (sec_trailer + 2) */
+		if (pdu[2] == PTYPE_RTS)
+		{
+			s = stream_new(0);
+			stream_attach(s, pdu, status);
+			rts_pdu_header_read(s, &rts_pdu.header);
+			stream_detach(s);
+			stream_free(s);
+
+			rts_pdu.content = pdu + 20;
+			rts_recv_pdu_commands(rpc, &rts_pdu);
+			continue;
+		}
+
+		frag_length = *(uint16*)(pdu + 8);
+		auth_length = *(uint16*)(pdu + 10);
+		alloc_hint = *(uint32*)(pdu + 16);
+
+		if (frag_length < 24 + 8 + auth_length)
+		{
+			printf("rpc_read error: invalid PDU length %d\n", frag_length);
+			return -1;
+		}
+
+		auth_pad_length = *(pdu + frag_length - auth_length - 6); /* -6 = -8 + 2 (sec_trailer + 2) */
+
+		if (frag_length < 24 + 8 + auth_length + auth_pad_length)
+		{
+			printf("rpc_read error: invalid auth_pad_length %d\n", auth_pad_length);
+			return -1;
+		}
 
 		/* data_length must be calculated because alloc_hint carries size of more than one pdu */
 		data_length = frag_length - auth_length - 24 - 8 - auth_pad_length; /* 24 is header; 8 is sec_trailer */
 
-		if (status == 4)
+		if (alloc_hint == 4)
 			continue;
 
-		if (read + data_length > length) /* if read data is greater then given buffer */
-		{
-			rpc->read_buffer_len = read + data_length - length;
-			rpc->read_buffer = xmalloc(rpc->read_buffer_len);
-
-			data_length -= rpc->read_buffer_len;
+		more = (alloc_hint > data_length);
 
-			memcpy(rpc->read_buffer, rpc_data + 24 + data_length, rpc->read_buffer_len);
+		/* the rest stays in the receive buffer until the next call */
+		if (read + data_length > (uint32) length)
+		{
+			rpc->pending_data = pdu + 24 + (length - read);
+			rpc->pending_length = read + data_length - length;
+			rpc->pending_more = more;
+			data_length = length - read;
 		}
 
-		memcpy(data + read, rpc_data + 24, data_length);
-
+		memcpy(data + read, pdu + 24, data_length);
 		read += data_length;
 
-		if (status > data_length && read < length)
-			continue;
-
-		break;
+		if (!more)
+			break;
 	}
 
-	xfree(rpc_data);
 	return read;
 }
 
@@ -1006,12 +1052,21 @@ rdpRpc* rpc_new(rdpTransport* transport)
 		rpc_ntlm_http_init_channel(rpc, rpc->ntlm_http_in, TSG_CHANNEL_IN);
 		rpc_ntlm_http_init_channel(rpc, rpc->ntlm_http_out, TSG_CHANNEL_OUT);
 
-		rpc->read_buffer = NULL;
 		rpc->write_buffer = NULL;
-		rpc->read_buffer_len = 0;
 		rpc->write_buffer_len = 0;
 
-		rpc->ReceiveWindow = 0x00010000;
+		rpc->send_buffer = stream_new(RPC_SEND_BUFFER_SIZE);
+		rpc->in_mutex = freerdp_mutex_new();
+		rpc->recv_buffer = stream_new(RPC_RECV_BUFFER_SIZE);
+		rpc->recv_offset = 0;
+		rpc->pending_data = NULL;
+		rpc->pending_length = 0;
+
+		rpc->ReceiveWindow = rpc->settings->tsg_receive_window;
+		if (rpc->ReceiveWindow == 0)
+			rpc->ReceiveWindow = RPC_MAX_RECEIVE_WINDOW;
+		rpc->ReceiveWindow = MAX(rpc->ReceiveWindow, RPC_MIN_RECEIVE_WINDOW);
+		rpc->ReceiveWindow = MIN(rpc->ReceiveWindow, RPC_MAX_RECEIVE_WINDOW);
 		rpc->VirtualConnection = rpc_client_virtual_connection_new(rpc);
 
 		rpc->call_id = 0;
@@ -1027,6 +1082,9 @@ void rpc_free(rdpRpc* rpc)
 		ntlm_http_free(rpc->ntlm_http_in);
 		ntlm_http_free(rpc->ntlm_http_out);
 		rpc_client_virtual_connection_free(rpc->VirtualConnection);
+		stream_free(rpc->recv_buffer);
+		stream_free(rpc->send_buffer);
+		freerdp_mutex_free(rpc->in_mutex);
 		xfree(rpc);
 	}
 }
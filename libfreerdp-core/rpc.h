@@ -35,6 +35,7 @@ typedef struct rdp_ntlm_http rdpNtlmHttp;
 #include <freerdp/settings.h>
 #include <freerdp/crypto/tls.h>
 #include <freerdp/crypto/crypto.h>
+#include <freerdp/utils/mutex.h>
 #include <freerdp/utils/wait_obj.h>
 #include <freerdp/utils/sleep.h>
 #include <freerdp/utils/debug.h>
@@ -653,8 +654,13 @@ struct rdp_rpc
 
 	uint8* write_buffer;
 	uint32 write_buffer_len;
-	uint8* read_buffer;
-	uint32 read_buffer_len;
+	STREAM* send_buffer;
+	freerdp_mutex in_mutex;
+	STREAM* recv_buffer;
+	uint32 recv_offset;
+	uint8* pending_data;
+	uint32 pending_length;
+	boolean pending_more;
 
 	uint32 call_id;
 	uint32 pipe_call_id;
@@ -682,8 +688,10 @@ void rpc_pdu_header_read(STREAM* s, RPC_PDU_HEADER* header);
 int rpc_out_write(rdpRpc* rpc, uint8* data, int length);
 int rpc_in_write(rdpRpc* rpc, uint8* data, int length);
 
-int rpc_out_read(rdpRpc* rpc, uint8* data, int length);
+int rpc_recv_pdu(rdpRpc* rpc, uint8** pdu);
 
+STREAM* rpc_tsg_write_init(rdpRpc* rpc);
+int rpc_tsg_write_stream(rdpRpc* rpc, STREAM* s, uint16 opnum);
 int rpc_tsg_write(rdpRpc* rpc, uint8* data, int length, uint16 opnum);
 int rpc_read(rdpRpc* rpc, uint8* data, int length);
 
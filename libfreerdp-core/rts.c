@@ -165,10 +165,20 @@ void rts_receive_window_size_command_write(STREAM* s, uint32 ReceiveWindowSize)
 
 void rts_flow_control_ack_command_read(rdpRpc* rpc, STREAM* s)
 {
+	uint32 BytesReceived;
+	uint32 AvailableWindow;
+	RpcInChannel* channel = rpc->VirtualConnection->DefaultInChannel;
+
 	/* Ack (24 bytes) */
-	stream_seek_uint32(s); /* BytesReceived (4 bytes) */
-	stream_seek_uint32(s); /* AvailableWindow (4 bytes) */
+	stream_read_uint32(s, BytesReceived); /* BytesReceived (4 bytes) */
+	stream_read_uint32(s, AvailableWindow); /* AvailableWindow (4 bytes) */
 	stream_seek(s, 16); /* ChannelCookie (16 bytes) */
+
+	/* what the proxy can take now, minus what is still on the way to it */
+	if (channel->BytesSent - BytesReceived < AvailableWindow)
+		channel->SenderAvailableWindow = AvailableWindow - (channel->BytesSent - BytesReceived);
+	else
+		channel->SenderAvailableWindow = 0;
 }
 
 void rts_flow_control_ack_command_write(STREAM* s, uint32 BytesReceived, uint32 AvailableWindow, uint8* ChannelCookie)
@@ -662,12 +672,9 @@ int rts_recv_pdu(rdpRpc* rpc, RTS_PDU* rts_pdu)
 {
 	STREAM* s;
 	int status;
-	int length;
-	uint8 header_buffer[20];
-	rdpTls* tls_out = rpc->tls_out;
+	uint8* pdu;
 
-	/* read first 20 bytes to get RTS PDU Header */
-	status = tls_read(tls_out, (uint8*) &header_buffer, 20);
+	status = rpc_recv_pdu(rpc, &pdu);
 
 	if (status <= 0)
 	{
@@ -675,24 +682,22 @@ int rts_recv_pdu(rdpRpc* rpc, RTS_PDU* rts_pdu)
 		return status;
 	}
 
+	if (status < 20)
+	{
+		printf("rts_recv error: PDU too short\n");
+		return -1;
+	}
+
 	s = stream_new(0);
-	stream_attach(s, header_buffer, 20);
+	stream_attach(s, pdu, status);
 
 	rts_pdu_header_read(s, &(rts_pdu->header));
 
 	stream_detach(s);
 	stream_free(s);
 
-	length = rts_pdu->header.frag_length - 20;
-	rts_pdu->content = (uint8*) xmalloc(length);
-
-	status = tls_read(tls_out, rts_pdu->content, length);
-
-	if (status < 0)
-	{
-		printf("rts_recv error\n");
-		return status;
-	}
+	/* points into the RPC receive buffer, valid until the next PDU is read */
+	rts_pdu->content = pdu + 20;
 
 	if (rts_pdu->header.ptype != PTYPE_RTS)
 	{
@@ -701,8 +706,8 @@ int rts_recv_pdu(rdpRpc* rpc, RTS_PDU* rts_pdu)
 	}
 
 #ifdef WITH_DEBUG_RTS
-	printf("rts_recv(): length: %d\n", length);
-	freerdp_hexdump(rts_pdu->content, length);
+	printf("rts_recv(): length: %d\n", status - 20);
+	freerdp_hexdump(rts_pdu->content, status - 20);
 	printf("\n");
 #endif
 
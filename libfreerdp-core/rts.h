@@ -153,6 +153,7 @@ boolean rts_send_keep_alive_pdu(rdpRpc* rpc);
 boolean rts_send_flow_control_ack_pdu(rdpRpc* rpc);
 boolean rts_send_ping_pdu(rdpRpc* rpc);
 
+int rts_recv_pdu_commands(rdpRpc* rpc, RTS_PDU* rts_pdu);
 int rts_recv_pdu(rdpRpc* rpc, RTS_PDU* rts_pdu);
 
 #ifdef WITH_DEBUG_TSG
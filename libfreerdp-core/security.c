@@ -223,44 +223,68 @@ void security_mac_data(uint8* mac_salt_key, uint8* data, uint32 length, uint8* o
 	crypto_md5_final(md5, output);
 }
 
-void security_mac_signature(rdpRdp *rdp, uint8* data, uint32 length, uint8* output)
+/**
+ * Prepare the MAC key dependent parts of the MAC signature.
+ * MACKeyN does not change when the encryption keys are updated, so the
+ * SHA1 state after (MACKeyN + pad1) and the MD5 state after (MACKeyN + pad2)
+ * are computed once per session and copied for each PDU.
+ */
+
+static void security_mac_init(rdpRdp* rdp)
+{
+	crypto_sha1_free(rdp->mac_sha1);
+	crypto_md5_free(rdp->mac_md5);
+
+	rdp->mac_sha1 = crypto_sha1_init();
+	crypto_sha1_update(rdp->mac_sha1, rdp->sign_key, rdp->rc4_key_len); /* MacKeyN */
+	crypto_sha1_update(rdp->mac_sha1, pad1, sizeof(pad1)); /* pad1 */
+
+	rdp->mac_md5 = crypto_md5_init();
+	crypto_md5_update(rdp->mac_md5, rdp->sign_key, rdp->rc4_key_len); /* MacKeyN */
+	crypto_md5_update(rdp->mac_md5, pad2, sizeof(pad2)); /* pad2 */
+}
+
+static void security_mac_begin(rdpRdp* rdp, struct crypto_sha1_struct* sha1, uint32 length)
 {
-	CryptoMd5 md5;
-	CryptoSha1 sha1;
 	uint8 length_le[4];
-	uint8 md5_digest[CRYPTO_MD5_DIGEST_LENGTH];
-	uint8 sha1_digest[CRYPTO_SHA1_DIGEST_LENGTH];
 
 	security_uint32_le(length_le, length); /* length must be little-endian */
 
 	/* SHA1_Digest = SHA1(MACKeyN + pad1 + length + data) */
-	sha1 = crypto_sha1_init();
-	crypto_sha1_update(sha1, rdp->sign_key, rdp->rc4_key_len); /* MacKeyN */
-	crypto_sha1_update(sha1, pad1, sizeof(pad1)); /* pad1 */
+	*sha1 = *rdp->mac_sha1;
 	crypto_sha1_update(sha1, length_le, sizeof(length_le)); /* length */
-	crypto_sha1_update(sha1, data, length); /* data */
-	crypto_sha1_final(sha1, sha1_digest);
+}
+
+static void security_mac_end(rdpRdp* rdp, struct crypto_sha1_struct* sha1, uint8* output)
+{
+	struct crypto_md5_struct md5;
+	uint8 md5_digest[CRYPTO_MD5_DIGEST_LENGTH];
+	uint8 sha1_digest[CRYPTO_SHA1_DIGEST_LENGTH];
+
+	crypto_sha1_digest(sha1, sha1_digest);
 
 	/* MACSignature = First64Bits(MD5(MACKeyN + pad2 + SHA1_Digest)) */
-	md5 = crypto_md5_init();
-	crypto_md5_update(md5, rdp->sign_key, rdp->rc4_key_len); /* MacKeyN */
-	crypto_md5_update(md5, pad2, sizeof(pad2)); /* pad2 */
-	crypto_md5_update(md5, sha1_digest, sizeof(sha1_digest)); /* SHA1_Digest */
-	crypto_md5_final(md5, md5_digest);
+	md5 = *rdp->mac_md5;
+	crypto_md5_update(&md5, sha1_digest, sizeof(sha1_digest)); /* SHA1_Digest */
+	crypto_md5_digest(&md5, md5_digest);
 
 	memcpy(output, md5_digest, 8);
 }
 
+void security_mac_signature(rdpRdp *rdp, uint8* data, uint32 length, uint8* output)
+{
+	struct crypto_sha1_struct sha1;
+
+	security_mac_begin(rdp, &sha1, length);
+	crypto_sha1_update(&sha1, data, length); /* data */
+	security_mac_end(rdp, &sha1, output);
+}
+
 void security_salted_mac_signature(rdpRdp *rdp, uint8* data, uint32 length, boolean encryption, uint8* output)
 {
-	CryptoMd5 md5;
-	CryptoSha1 sha1;
-	uint8 length_le[4];
+	struct crypto_sha1_struct sha1;
 	uint8 use_count_le[4];
-	uint8 md5_digest[CRYPTO_MD5_DIGEST_LENGTH];
-	uint8 sha1_digest[CRYPTO_SHA1_DIGEST_LENGTH];
 
-	security_uint32_le(length_le, length); /* length must be little-endian */
 	if (encryption)
 	{
 		security_uint32_le(use_count_le, rdp->encrypt_checksum_use_count);
@@ -275,23 +299,10 @@ void security_salted_mac_signature(rdpRdp *rdp, uint8* data, uint32 length, bool
 		security_uint32_le(use_count_le, rdp->decrypt_checksum_use_count - 1);
 	}
 
-	/* SHA1_Digest = SHA1(MACKeyN + pad1 + length + data) */
-	sha1 = crypto_sha1_init();
-	crypto_sha1_update(sha1, rdp->sign_key, rdp->rc4_key_len); /* MacKeyN */
-	crypto_sha1_update(sha1, pad1, sizeof(pad1)); /* pad1 */
-	crypto_sha1_update(sha1, length_le, sizeof(length_le)); /* length */
-	crypto_sha1_update(sha1, data, length); /* data */
-	crypto_sha1_update(sha1, use_count_le, sizeof(use_count_le)); /* encryptionCount */
-	crypto_sha1_final(sha1, sha1_digest);
-
-	/* MACSignature = First64Bits(MD5(MACKeyN + pad2 + SHA1_Digest)) */
-	md5 = crypto_md5_init();
-	crypto_md5_update(md5, rdp->sign_key, rdp->rc4_key_len); /* MacKeyN */
-	crypto_md5_update(md5, pad2, sizeof(pad2)); /* pad2 */
-	crypto_md5_update(md5, sha1_digest, sizeof(sha1_digest)); /* SHA1_Digest */
-	crypto_md5_final(md5, md5_digest);
-
-	memcpy(output, md5_digest, 8);
+	security_mac_begin(rdp, &sha1, length);
+	crypto_sha1_update(&sha1, data, length); /* data */
+	crypto_sha1_update(&sha1, use_count_le, sizeof(use_count_le)); /* encryptionCount */
+	security_mac_end(rdp, &sha1, output);
 }
 
 static void security_A(uint8* master_secret, uint8* client_random, uint8* server_random, uint8* output)
@@ -425,6 +436,8 @@ boolean security_establish_keys(uint8* client_random, rdpRdp* rdp)
 	rdp->encrypt_use_count =0;
 	rdp->encrypt_checksum_use_count =0;
 
+	security_mac_init(rdp);
+
 	return true;
 }
 
@@ -458,7 +471,7 @@ boolean security_key_update(uint8* key, uint8* update_key, int key_len)
 	return true;
 }
 
-boolean security_encrypt(uint8* data, int length, rdpRdp* rdp)
+static void security_encrypt_update_key(rdpRdp* rdp)
 {
 	if (rdp->encrypt_use_count >= 4096)
 	{
@@ -467,12 +480,84 @@ boolean security_encrypt(uint8* data, int length, rdpRdp* rdp)
 		rdp->rc4_encrypt_key = crypto_rc4_init(rdp->encrypt_key, rdp->rc4_key_len);
 		rdp->encrypt_use_count = 0;
 	}
+}
+
+boolean security_encrypt(uint8* data, int length, rdpRdp* rdp)
+{
+	security_encrypt_update_key(rdp);
 	crypto_rc4(rdp->rc4_encrypt_key, length, data, data);
 	rdp->encrypt_use_count++;
 	rdp->encrypt_checksum_use_count++;
 	return true;
 }
 
+/**
+ * Sign and encrypt a PDU split across several buffers in a single pass.
+ * Each buffer is hashed and encrypted in place one chunk at a time, so the
+ * plain text is still in cache when RC4 runs over it. The signature is the
+ * same as security_mac_signature (or security_salted_mac_signature when
+ * salted is set) over the concatenated buffers, followed by security_encrypt.
+ * @param rdp rdp module
+ * @param buffers PDU fragments, encrypted in place
+ * @param lengths length of each fragment
+ * @param count number of fragments
+ * @param salted use the salted MAC (SEC_SECURE_CHECKSUM)
+ * @param output 8 byte signature
+ */
+
+boolean security_sign_and_encrypt_buffers(rdpRdp* rdp, uint8** buffers, uint32* lengths, int count, boolean salted, uint8* output)
+{
+	int i;
+	uint8* data;
+	uint32 length;
+	uint32 chunk;
+	uint32 total_length;
+	uint8 use_count_le[4];
+	struct crypto_sha1_struct sha1;
+
+	total_length = 0;
+
+	for (i = 0; i < count; i++)
+		total_length += lengths[i];
+
+	security_mac_begin(rdp, &sha1, total_length);
+	security_encrypt_update_key(rdp);
+
+	for (i = 0; i < count; i++)
+	{
+		data = buffers[i];
+		length = lengths[i];
+
+		while (length > 0)
+		{
+			chunk = (length > SECURITY_CHUNK_SIZE) ? SECURITY_CHUNK_SIZE : length;
+
+			crypto_sha1_update(&sha1, data, chunk); /* data */
+			crypto_rc4(rdp->rc4_encrypt_key, chunk, data, data);
+
+			data += chunk;
+			length -= chunk;
+		}
+	}
+
+	if (salted)
+	{
+		security_uint32_le(use_count_le, rdp->encrypt_checksum_use_count);
+		crypto_sha1_update(&sha1, use_count_le, sizeof(use_count_le)); /* encryptionCount */
+	}
+
+	security_mac_end(rdp, &sha1, output);
+
+	rdp->encrypt_use_count++;
+	rdp->encrypt_checksum_use_count++;
+	return true;
+}
+
+boolean security_sign_and_encrypt(rdpRdp* rdp, uint8* data, uint32 length, boolean salted, uint8* output)
+{
+	return security_sign_and_encrypt_buffers(rdp, &data, &length, 1, salted, output);
+}
+
 boolean security_decrypt(uint8* data, int length, rdpRdp* rdp)
 {
 	if (rdp->decrypt_use_count >= 4096)
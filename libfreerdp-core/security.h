@@ -26,6 +26,9 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/utils/stream.h>
 
+/* Fused MAC and RC4 passes are interleaved in chunks of this size */
+#define SECURITY_CHUNK_SIZE	4096
+
 void security_master_secret(uint8* premaster_secret, uint8* client_random, uint8* server_random, uint8* output);
 void security_session_key_blob(uint8* master_secret, uint8* client_random, uint8* server_random, uint8* output);
 void security_mac_salt_key(uint8* session_key_blob, uint8* client_random, uint8* server_random, uint8* output);
@@ -38,6 +41,8 @@ boolean security_establish_keys(uint8* client_random, rdpRdp* rdp);
 
 boolean security_encrypt(uint8* data, int length, rdpRdp* rdp);
 boolean security_decrypt(uint8* data, int length, rdpRdp* rdp);
+boolean security_sign_and_encrypt(rdpRdp* rdp, uint8* data, uint32 length, boolean salted, uint8* output);
+boolean security_sign_and_encrypt_buffers(rdpRdp* rdp, uint8** buffers, uint32* lengths, int count, boolean salted, uint8* output);
 
 void security_hmac_signature(uint8* data, int length, uint8* output, rdpRdp* rdp);
 boolean security_fips_encrypt(uint8* data, int length, rdpRdp* rdp);
@@ -167,6 +167,7 @@ rdpSettings* settings_new(void* instance)
 
 		settings->bitmap_cache = true;
 		settings->persistent_bitmap_cache = false;
+		settings->bitmap_cache_max_memory = 0;
 		settings->bitmapCacheV2CellInfo = xzalloc(sizeof(BITMAP_CACHE_V2_CELL_INFO) * 6);
 
 		settings->refresh_rect = true;
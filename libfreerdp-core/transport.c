@@ -311,6 +311,20 @@ static int transport_read_nonblocking(rdpTransport* transport)
 	return status;
 }
 
+static void transport_write_wait(rdpTransport* transport)
+{
+	/* blocking while sending */
+	freerdp_usleep(transport->usleep_interval);
+
+	/* when sending is blocked in nonblocking mode, the receiving buffer should be checked */
+	if (!transport->blocking)
+	{
+		/* and in case we do have buffered some data, we set the event so next loop will get it */
+		if (transport_read_nonblocking(transport) > 0)
+			wait_obj_set(transport->recv_event);
+	}
+}
+
 int transport_write(rdpTransport* transport, STREAM* s)
 {
 	int status = -1;
@@ -340,18 +354,7 @@ int transport_write(rdpTransport* transport, STREAM* s)
 			break; /* error occurred */
 
 		if (status == 0)
-		{
-			/* blocking while sending */
-			freerdp_usleep(transport->usleep_interval);
-
-			/* when sending is blocked in nonblocking mode, the receiving buffer should be checked */
-			if (!transport->blocking)
-			{
-				/* and in case we do have buffered some data, we set the event so next loop will get it */
-				if (transport_read_nonblocking(transport) > 0)
-					wait_obj_set(transport->recv_event);
-			}
-		}
+			transport_write_wait(transport);
 
 		length -= status;
 		stream_seek(s, status);
@@ -366,6 +369,42 @@ int transport_write(rdpTransport* transport, STREAM* s)
 	return status;
 }
 
+/**
+ * Corks the transport so that the following PDUs are coalesced into full size
+ * TLS records, until the matching transport_uncork. Has no effect on other layers.
+ */
+void transport_cork(rdpTransport* transport)
+{
+	if (transport->layer == TRANSPORT_LAYER_TLS)
+		tls_cork(transport->tls);
+}
+
+/**
+ * Releases a cork taken with transport_cork. Once the last cork is released,
+ * the buffered data is sent before returning, waiting for the socket if needed.
+ */
+int transport_uncork(rdpTransport* transport)
+{
+	int status = 1;
+
+	if (transport->layer == TRANSPORT_LAYER_TLS)
+	{
+		status = tls_uncork(transport->tls);
+
+		/* the main loop may not wake up to flush the rest, so drain it like transport_write */
+		while (status == 0)
+		{
+			transport_write_wait(transport);
+			status = tls_flush(transport->tls);
+		}
+	}
+
+	if (status < 0)
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+
+	return status;
+}
+
 void transport_get_fds(rdpTransport* transport, void** rfds, int* rcount)
 {
 	rfds[*rcount] = (void*)(long)(transport->tcp->sockfd);
@@ -383,6 +422,16 @@ int transport_check_fds(rdpTransport** ptransport)
 
 	wait_obj_clear(transport->recv_event);
 
+	/* send what a blocked write left behind, or what has been corked for too long */
+	if (transport->layer == TRANSPORT_LAYER_TLS)
+	{
+		if (tls_flush(transport->tls) < 0)
+		{
+			transport->layer = TRANSPORT_LAYER_CLOSED;
+			return -1;
+		}
+	}
+
 	status = transport_read_nonblocking(transport);
 
 	if (status < 0)
@@ -1607,85 +1607,158 @@ uint8 tsg_packet5[20] =
 	0x00, 0x00, 0x00, 0x00
 };
 
-DWORD TsProxySendToServer(handle_t IDL_handle, byte pRpcMessage[], uint32 count, uint32* lengths)
+/* TsProxySendToServer carries at most three buffers */
+#define TSG_SEND_MAX_BUFFERS		3
+
+/* largest request fragment, matching the max_xmit_frag we negotiate in the bind */
+#define TSG_SEND_MAX_FRAGMENT		0x0FF8
+
+/* request header, stub header, worst case auth padding, auth verifier and signature */
+#define TSG_SEND_OVERHEAD		(24 + 28 + 16 + 8 + 16)
+
+/* bytes queued for the writer thread before tsg_write reports the gateway as busy */
+#define TSG_SEND_QUEUE_MAX_LENGTH	(512 * 1024)
+
+/* how long tsg_free lets the writer thread flush the queue, in 100ms steps */
+#define TSG_SEND_DRAIN_STEPS		20
+
+static int tsg_send_to_server(rdpTsg* tsg, uint8** buffers, uint32* lengths, uint32 count)
 {
+	int i;
 	STREAM* s;
 	int status;
-	int length;
-	rdpTsg* tsg;
-	byte* buffer1 = NULL ;
-	byte* buffer2 = NULL ;
-	byte* buffer3 = NULL ;
-	uint32 buffer1Length;
-	uint32 buffer2Length;
-	uint32 buffer3Length;
-	uint32 numBuffers = 0;
 	uint32 totalDataBytes = 0;
 
-	tsg = (rdpTsg*) IDL_handle;
-	buffer1Length = buffer2Length = buffer3Length = 0;
+	for (i = 0; i < count; i++)
+		totalDataBytes += lengths[i] + 4;
+
+	/* the stub is marshalled straight into the RPC request */
+	s = rpc_tsg_write_init(tsg->rpc);
+	stream_check_size(s, 28 + totalDataBytes);
+
+	/* PCHANNEL_CONTEXT_HANDLE_NOSERIALIZE_NR (20 bytes) */
+	stream_write_uint32(s, 0); /* ContextType (4 bytes) */
+	stream_write(s, tsg->ChannelContext, 16); /* ContextUuid (16 bytes) */
 
-	if (count > 0)
+	stream_write_uint32_be(s, totalDataBytes); /* totalDataBytes (4 bytes) */
+	stream_write_uint32_be(s, count); /* numBuffers (4 bytes) */
+
+	for (i = 0; i < count; i++)
+		stream_write_uint32_be(s, lengths[i]); /* bufferLength (4 bytes) */
+
+	for (i = 0; i < count; i++)
+		stream_write(s, buffers[i], lengths[i]); /* buffer (variable) */
+
+	status = rpc_tsg_write_stream(tsg->rpc, s, 9);
+
+	if (status <= 0)
 	{
-		numBuffers++;
-		buffer1 = &pRpcMessage[0];
-		buffer1Length = lengths[0];
-		totalDataBytes += lengths[0] + 4;
+		printf("rpc_tsg_write failed!\n");
+		return -1;
 	}
 
-	if (count > 1)
+	return status;
+}
+
+DWORD TsProxySendToServer(handle_t IDL_handle, byte pRpcMessage[], uint32 count, uint32* lengths)
+{
+	int i;
+	rdpTsg* tsg;
+	uint32 offset = 0;
+	uint8* buffers[TSG_SEND_MAX_BUFFERS];
+
+	tsg = (rdpTsg*) IDL_handle;
+
+	if (count > TSG_SEND_MAX_BUFFERS)
+		count = TSG_SEND_MAX_BUFFERS;
+
+	/* the buffers are stored back to back in pRpcMessage */
+	for (i = 0; i < count; i++)
 	{
-		numBuffers++;
-		buffer2 = &pRpcMessage[1];
-		buffer2Length = lengths[1];
-		totalDataBytes += lengths[1] + 4;
+		buffers[i] = &pRpcMessage[offset];
+		offset += lengths[i];
 	}
 
-	if (count > 2)
+	return tsg_send_to_server(tsg, buffers, lengths, count);
+}
+
+/**
+ * Sends everything queued by tsg_write, packing up to three consecutive PDUs
+ * into each TsProxySendToServer call as long as the request still fits in a
+ * single fragment. A PDU that does not fit with others is sent on its own.
+ */
+static void tsg_process_send_queue(rdpTsg* tsg)
+{
+	int i;
+	int count;
+	int status;
+	uint32 size;
+	STREAM* pdus[TSG_SEND_MAX_BUFFERS];
+	uint8* buffers[TSG_SEND_MAX_BUFFERS];
+	uint32 lengths[TSG_SEND_MAX_BUFFERS];
+
+	while (!freerdp_thread_is_stopped(tsg->send_thread))
 	{
-		numBuffers++;
-		buffer3 = &pRpcMessage[2];
-		buffer3Length = lengths[2];
-		totalDataBytes += lengths[2] + 4;
-	}
+		size = 0;
+		count = 0;
 
-	s = stream_new(28 + totalDataBytes);
+		freerdp_thread_lock(tsg->send_thread);
 
-	/* PCHANNEL_CONTEXT_HANDLE_NOSERIALIZE_NR (20 bytes) */
-	stream_write_uint32(s, 0); /* ContextType (4 bytes) */
-	stream_write(s, tsg->ChannelContext, 16); /* ContextUuid (4 bytes) */
+		while (count < TSG_SEND_MAX_BUFFERS && list_peek(tsg->send_queue) != NULL)
+		{
+			STREAM* s = (STREAM*) list_peek(tsg->send_queue);
 
-	stream_write_uint32_be(s, totalDataBytes); /* totalDataBytes (4 bytes) */
-	stream_write_uint32_be(s, numBuffers); /* numBuffers (4 bytes) */
+			if (count > 0 && TSG_SEND_OVERHEAD + 4 * (count + 1) + size + stream_get_length(s) > TSG_SEND_MAX_FRAGMENT)
+				break;
 
-	if (buffer1Length > 0)
-		stream_write_uint32_be(s, buffer1Length); /* buffer1Length (4 bytes) */
-	if (buffer2Length > 0)
-		stream_write_uint32_be(s, buffer2Length); /* buffer2Length (4 bytes) */
-	if (buffer3Length > 0)
-		stream_write_uint32_be(s, buffer3Length); /* buffer3Length (4 bytes) */
+			pdus[count] = (STREAM*) list_dequeue(tsg->send_queue);
+			buffers[count] = stream_get_head(s);
+			lengths[count] = stream_get_length(s);
+			size += lengths[count];
+			count++;
+		}
 
-	if (buffer1Length > 0)
-		stream_write(s, buffer1, buffer1Length); /* buffer1 (variable) */
-	if (buffer2Length > 0)
-		stream_write(s, buffer2, buffer2Length); /* buffer2 (variable) */
-	if (buffer3Length > 0)
-		stream_write(s, buffer3, buffer3Length); /* buffer3 (variable) */
+		freerdp_thread_unlock(tsg->send_thread);
 
-	stream_seal(s);
+		if (count < 1)
+			break;
 
-	length = s->size;
-	status = rpc_tsg_write(tsg->rpc, s->data, s->size, 9);
+		status = tsg_send_to_server(tsg, buffers, lengths, count);
 
-	stream_free(s);
+		for (i = 0; i < count; i++)
+			stream_free(pdus[i]);
 
-	if (status <= 0)
+		freerdp_thread_lock(tsg->send_thread);
+		tsg->send_queue_length -= size;
+
+		if (status < 0)
+			tsg->send_failed = true;
+
+		freerdp_thread_unlock(tsg->send_thread);
+
+		if (status < 0)
+			break;
+	}
+}
+
+static void* tsg_send_thread_func(void* arg)
+{
+	rdpTsg* tsg = (rdpTsg*) arg;
+
+	while (1)
 	{
-		printf("rpc_tsg_write failed!\n");
-		return -1;
+		freerdp_thread_wait(tsg->send_thread);
+
+		if (freerdp_thread_is_stopped(tsg->send_thread))
+			break;
+
+		freerdp_thread_reset(tsg->send_thread);
+		tsg_process_send_queue(tsg);
 	}
 
-	return length;
+	freerdp_thread_quit(tsg->send_thread);
+
+	return NULL;
 }
 
 #ifndef WITH_MSRPC
@@ -2019,9 +2092,46 @@ int tsg_read(rdpTsg* tsg, uint8* data, uint32 length)
 	return status;
 }
 
+/**
+ * Queues an RDP PDU for the writer thread, which performs the NTLM sealing and
+ * the IN channel write. Returns 0 while too much data is still queued so that
+ * transport_write can service the OUT channel before trying again.
+ */
 int tsg_write(rdpTsg* tsg, uint8* data, uint32 length)
 {
-	return TsProxySendToServer((handle_t) tsg, data, 1, &length);
+	STREAM* s;
+
+	if (tsg->send_thread == NULL)
+	{
+		tsg->send_queue = list_new();
+		tsg->send_thread = freerdp_thread_new();
+		freerdp_thread_start(tsg->send_thread, tsg_send_thread_func, tsg);
+	}
+
+	freerdp_thread_lock(tsg->send_thread);
+
+	if (tsg->send_failed)
+	{
+		freerdp_thread_unlock(tsg->send_thread);
+		return -1;
+	}
+
+	if (tsg->send_queue_length > 0 && tsg->send_queue_length + length > TSG_SEND_QUEUE_MAX_LENGTH)
+	{
+		freerdp_thread_unlock(tsg->send_thread);
+		freerdp_thread_signal(tsg->send_thread);
+		return 0;
+	}
+
+	s = stream_new(length);
+	stream_write(s, data, length);
+	list_enqueue(tsg->send_queue, s);
+	tsg->send_queue_length += length;
+
+	freerdp_thread_unlock(tsg->send_thread);
+	freerdp_thread_signal(tsg->send_thread);
+
+	return length;
 }
 
 rdpTsg* tsg_new(rdpTransport* transport)
@@ -2040,10 +2150,54 @@ rdpTsg* tsg_new(rdpTransport* transport)
 	return tsg;
 }
 
+/**
+ * Gives the writer thread a bounded amount of time to send what tsg_write
+ * already accepted, so that the last PDUs before a disconnect are not lost.
+ */
+static void tsg_drain_send_queue(rdpTsg* tsg)
+{
+	int i;
+	boolean failed;
+	uint32 length;
+
+	for (i = 0; ; i++)
+	{
+		freerdp_thread_lock(tsg->send_thread);
+		length = tsg->send_queue_length;
+		failed = tsg->send_failed;
+		freerdp_thread_unlock(tsg->send_thread);
+
+		if (length == 0 || failed || !freerdp_thread_is_running(tsg->send_thread))
+			return;
+
+		if (i == TSG_SEND_DRAIN_STEPS)
+			break;
+
+		freerdp_thread_signal(tsg->send_thread);
+		freerdp_usleep(100000);
+	}
+
+	DEBUG_WARN("discarding %d queued bytes", length);
+}
+
 void tsg_free(rdpTsg* tsg)
 {
+	STREAM* s;
+
 	if (tsg != NULL)
 	{
+		if (tsg->send_thread != NULL)
+		{
+			tsg_drain_send_queue(tsg);
+			freerdp_thread_stop(tsg->send_thread);
+			freerdp_thread_free(tsg->send_thread);
+
+			while ((s = (STREAM*) list_dequeue(tsg->send_queue)) != NULL)
+				stream_free(s);
+
+			list_free(tsg->send_queue);
+		}
+
 		rpc_free(tsg->rpc);
 		xfree(tsg);
 	}
@@ -32,7 +32,9 @@ typedef struct rdp_tsg rdpTsg;
 #include <time.h>
 #include <freerdp/types.h>
 #include <freerdp/settings.h>
+#include <freerdp/utils/list.h>
 #include <freerdp/utils/stream.h>
+#include <freerdp/utils/thread.h>
 #include <freerdp/utils/wait_obj.h>
 #include <freerdp/utils/debug.h>
 
@@ -43,6 +45,11 @@ struct rdp_tsg
 	rdpTransport* transport;
 	uint8 TunnelContext[16];
 	uint8 ChannelContext[16];
+
+	freerdp_thread* send_thread;
+	LIST* send_queue;
+	uint32 send_queue_length;
+	boolean send_failed;
 };
 
 typedef wchar_t* RESOURCENAME;
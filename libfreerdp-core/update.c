@@ -335,12 +335,13 @@ void update_reset_state(rdpUpdate* update)
 
 static void update_begin_paint(rdpContext* context)
 {
-
+	/* the updates of a paint are sent together once it ends */
+	transport_cork(context->rdp->transport);
 }
 
 static void update_end_paint(rdpContext* context)
 {
-
+	transport_uncork(context->rdp->transport);
 }
 
 static void update_write_refresh_rect(STREAM* s, uint8 count, RECTANGLE_16* areas)
@@ -37,6 +37,21 @@ void crypto_sha1_final(CryptoSha1 sha1, uint8* out_data)
 	xfree(sha1);
 }
 
+/**
+ * Finalize a SHA1 context without releasing it, for contexts that are
+ * owned by the caller (copies of a precomputed state kept on the stack).
+ */
+
+void crypto_sha1_digest(CryptoSha1 sha1, uint8* out_data)
+{
+	SHA1_Final(out_data, &sha1->sha_ctx);
+}
+
+void crypto_sha1_free(CryptoSha1 sha1)
+{
+	xfree(sha1);
+}
+
 CryptoMd5 crypto_md5_init(void)
 {
 	CryptoMd5 md5 = xmalloc(sizeof(*md5));
@@ -55,6 +70,16 @@ void crypto_md5_final(CryptoMd5 md5, uint8* out_data)
 	xfree(md5);
 }
 
+void crypto_md5_digest(CryptoMd5 md5, uint8* out_data)
+{
+	MD5_Final(out_data, &md5->md5_ctx);
+}
+
+void crypto_md5_free(CryptoMd5 md5)
+{
+	xfree(md5);
+}
+
 CryptoRc4 crypto_rc4_init(const uint8* key, uint32 length)
 {
 	CryptoRc4 rc4 = xmalloc(sizeof(*rc4));
@@ -17,6 +17,17 @@
  * limitations under the License.
  */
 
+#ifndef _WIN32
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include <freerdp/utils/time.h>
+#include <freerdp/utils/mutex.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/memory.h>
 
@@ -53,20 +64,115 @@ static void tls_free_certificate(CryptoCert cert)
 	xfree(cert);
 }
 
-boolean tls_connect(rdpTls* tls)
+/* largest TLS record payload, corked writes are sent in records of this size */
+#define TLS_RECORD_SIZE			16384
+
+/* corked data buffered before writes report the connection as busy */
+#define TLS_WRITE_BUFFER_MAX		(256 * 1024)
+
+/* microseconds corked data may be held back before the next write or tls_flush sends it anyway */
+#define TLS_CORK_MAX_DELAY		10000
+
+/* client sessions kept for resumption, one per server address */
+#define TLS_SESSION_CACHE_SIZE		32
+
+/* numeric host, separator, numeric port and terminator */
+#define TLS_ADDRESS_LENGTH		(NI_MAXHOST + NI_MAXSERV + 2)
+
+struct tls_session_entry
 {
-	CryptoCert cert;
-	long options = 0;
-	int connection_status;
+	char address[TLS_ADDRESS_LENGTH];
+	SSL_SESSION* session;
+	struct tls_session_entry* next;
+};
+
+/* server contexts, one per certificate and private key pair */
+struct tls_server_context
+{
+	char* cert_file;
+	char* privatekey_file;
+	SSL_CTX* ctx;
+	rdpBlob public_key;
+	struct tls_server_context* next;
+};
+
+static freerdp_mutex tls_mutex = NULL;
+static SSL_CTX* tls_client_ctx = NULL;
+static struct tls_session_entry* tls_sessions = NULL;
+static struct tls_server_context* tls_server_contexts = NULL;
+static rdpTlsStats tls_stats;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static freerdp_mutex* tls_locks = NULL;
+
+static void tls_locking_callback(int mode, int type, const char* file, int line)
+{
+	if (mode & CRYPTO_LOCK)
+		freerdp_mutex_lock(tls_locks[type]);
+	else
+		freerdp_mutex_unlock(tls_locks[type]);
+}
+
+static unsigned long tls_thread_id_callback(void)
+{
+#ifdef _WIN32
+	return (unsigned long) GetCurrentThreadId();
+#else
+	return (unsigned long) pthread_self();
+#endif
+}
+#endif
+
+static void tls_global_init(void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	int i;
+#endif
+
+	SSL_load_error_strings();
+	SSL_library_init();
 
-	tls->ctx = SSL_CTX_new(TLSv1_client_method());
+	tls_mutex = freerdp_mutex_new();
 
-	if (tls->ctx == NULL)
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	/* contexts and session caches are shared between connection threads */
+	if (CRYPTO_get_locking_callback() == NULL)
 	{
-		printf("SSL_CTX_new failed\n");
-		return false;
+		tls_locks = (freerdp_mutex*) xzalloc(CRYPTO_num_locks() * sizeof(freerdp_mutex));
+
+		for (i = 0; i < CRYPTO_num_locks(); i++)
+			tls_locks[i] = freerdp_mutex_new();
+
+		CRYPTO_set_id_callback(tls_thread_id_callback);
+		CRYPTO_set_locking_callback(tls_locking_callback);
 	}
+#endif
+}
 
+#ifndef _WIN32
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+#else
+static volatile LONG tls_once = 0;
+#endif
+
+static void tls_init(void)
+{
+#ifndef _WIN32
+	pthread_once(&tls_once, tls_global_init);
+#else
+	if (InterlockedCompareExchange(&tls_once, 1, 0) == 0)
+	{
+		tls_global_init();
+		tls_once = 2;
+	}
+
+	while (tls_once != 2)
+		Sleep(0);
+#endif
+}
+
+static void tls_set_options(SSL_CTX* ctx, long options)
+{
 	/**
 	 * SSL_OP_NO_COMPRESSION:
 	 *
@@ -94,16 +200,187 @@ boolean tls_connect(rdpTls* tls)
 	 */
 	options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
 
-	SSL_CTX_set_options(tls->ctx, options);
+	SSL_CTX_set_options(ctx, options);
+
+	/* a blocked write is retried from the write buffer, which may have been moved by then */
+	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+
+/**
+ * Returns the client context shared by all connections, creating it on first use.
+ * Must be called with tls_mutex held.
+ */
+static SSL_CTX* tls_get_client_context(void)
+{
+	if (tls_client_ctx == NULL)
+	{
+		tls_client_ctx = SSL_CTX_new(TLSv1_client_method());
+
+		if (tls_client_ctx == NULL)
+			return NULL;
+
+		tls_set_options(tls_client_ctx, 0);
+	}
+
+	return tls_client_ctx;
+}
+
+/**
+ * Formats the address of the peer as host:port, the key of the session cache.
+ */
+static boolean tls_get_peer_address(int sockfd, char* address, int length)
+{
+	socklen_t addrlen;
+	char host[NI_MAXHOST];
+	char service[NI_MAXSERV];
+	struct sockaddr_storage addr;
+
+	addrlen = sizeof(addr);
+
+	if (getpeername(sockfd, (struct sockaddr*) &addr, &addrlen) != 0)
+		return false;
+
+	if (getnameinfo((struct sockaddr*) &addr, addrlen, host, sizeof(host),
+			service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+		return false;
+
+	if (snprintf(address, length, "%s:%s", host, service) >= length)
+		return false;
+
+	return true;
+}
+
+/**
+ * Removes the session cached for an address, returning the entry for reuse.
+ * Must be called with tls_mutex held.
+ */
+static struct tls_session_entry* tls_session_cache_remove(const char* address)
+{
+	struct tls_session_entry* entry;
+	struct tls_session_entry** prev;
+
+	for (prev = &tls_sessions; *prev != NULL; prev = &(*prev)->next)
+	{
+		entry = *prev;
+
+		if (strcmp(entry->address, address) == 0)
+		{
+			*prev = entry->next;
+			SSL_SESSION_free(entry->session);
+			entry->session = NULL;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void tls_session_cache_invalidate(const char* address)
+{
+	freerdp_mutex_lock(tls_mutex);
+	xfree(tls_session_cache_remove(address));
+	freerdp_mutex_unlock(tls_mutex);
+}
+
+/**
+ * Caches the session of an established connection, most recent first.
+ */
+static void tls_session_cache_add(const char* address, SSL_SESSION* session)
+{
+	int count;
+	size_t length;
+	struct tls_session_entry* entry;
+	struct tls_session_entry** prev;
+
+	freerdp_mutex_lock(tls_mutex);
+
+	entry = tls_session_cache_remove(address);
+
+	if (entry == NULL)
+	{
+		entry = xnew(struct tls_session_entry);
+
+		length = strlen(address);
+
+		if (length > sizeof(entry->address) - 1)
+			length = sizeof(entry->address) - 1;
+
+		memcpy(entry->address, address, length);
+		entry->address[length] = '\0';
+	}
+
+	entry->session = session;
+	entry->next = tls_sessions;
+	tls_sessions = entry;
+
+	/* drop the least recently established sessions */
+	count = 0;
+
+	for (prev = &tls_sessions; *prev != NULL; prev = &(*prev)->next)
+	{
+		if (++count > TLS_SESSION_CACHE_SIZE)
+		{
+			entry = *prev;
+			*prev = NULL;
+
+			while (entry != NULL)
+			{
+				struct tls_session_entry* next = entry->next;
+				SSL_SESSION_free(entry->session);
+				xfree(entry);
+				entry = next;
+			}
+
+			break;
+		}
+	}
+
+	freerdp_mutex_unlock(tls_mutex);
+}
+
+boolean tls_connect(rdpTls* tls)
+{
+	CryptoCert cert;
+	int connection_status;
+	boolean cached = false;
+	char address[TLS_ADDRESS_LENGTH] = "";
+	struct tls_session_entry* entry;
+
+	tls_init();
+
+	freerdp_mutex_lock(tls_mutex);
+
+	if (tls_get_client_context() == NULL)
+	{
+		freerdp_mutex_unlock(tls_mutex);
+		printf("SSL_CTX_new failed\n");
+		return false;
+	}
 
-	tls->ssl = SSL_new(tls->ctx);
+	tls->ssl = SSL_new(tls_client_ctx);
 
 	if (tls->ssl == NULL)
 	{
+		freerdp_mutex_unlock(tls_mutex);
 		printf("SSL_new failed\n");
 		return false;
 	}
 
+	/* offer the session of the last connection to the same server for resumption */
+	if (tls_get_peer_address(tls->sockfd, address, sizeof(address)))
+	{
+		for (entry = tls_sessions; entry != NULL; entry = entry->next)
+		{
+			if (strcmp(entry->address, address) == 0)
+			{
+				cached = (SSL_set_session(tls->ssl, entry->session) == 1);
+				break;
+			}
+		}
+	}
+
+	freerdp_mutex_unlock(tls_mutex);
+
 	if (SSL_set_fd(tls->ssl, tls->sockfd) < 1)
 	{
 		printf("SSL_set_fd failed\n");
@@ -116,6 +393,9 @@ boolean tls_connect(rdpTls* tls)
 	{
 		if (tls_print_error("SSL_connect", tls->ssl, connection_status))
 		{
+			if (cached)
+				tls_session_cache_invalidate(address);
+
 			return false;
 		}
 	}
@@ -138,6 +418,10 @@ boolean tls_connect(rdpTls* tls)
 	if (!tls_verify_certificate(tls, cert, tls->settings->hostname))
 	{
 		printf("tls_connect: certificate not trusted, aborting.\n");
+
+		if (cached)
+			tls_session_cache_invalidate(address);
+
 		tls_disconnect(tls);
 		tls_free_certificate(cert);
 		return false;
@@ -145,21 +429,35 @@ boolean tls_connect(rdpTls* tls)
 
 	tls_free_certificate(cert);
 
+	freerdp_mutex_lock(tls_mutex);
+
+	if (SSL_session_reused(tls->ssl))
+		tls_stats.client_resumed_handshakes++;
+	else
+		tls_stats.client_full_handshakes++;
+
+	freerdp_mutex_unlock(tls_mutex);
+
+	if (address[0] != '\0')
+		tls_session_cache_add(address, SSL_get1_session(tls->ssl));
+
 	return true;
 }
 
-boolean tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_file)
+static struct tls_server_context* tls_server_context_new(const char* cert_file, const char* privatekey_file)
 {
-	CryptoCert cert;
-	long options = 0;
-	int connection_status;
+	SSL* ssl;
+	struct crypto_cert_struct cert;
+	struct tls_server_context* server;
 
-	tls->ctx = SSL_CTX_new(SSLv23_server_method());
+	server = xnew(struct tls_server_context);
+	server->ctx = SSL_CTX_new(SSLv23_server_method());
 
-	if (tls->ctx == NULL)
+	if (server->ctx == NULL)
 	{
 		printf("SSL_CTX_new failed\n");
-		return false;
+		xfree(server);
+		return NULL;
 	}
 
 	/*
@@ -168,73 +466,112 @@ boolean tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_fi
 	 * We only want SSLv3 and TLSv1, so disable SSLv2.
 	 * SSLv3 is used by, eg. Microsoft RDC for Mac OS X.
 	 */
-	options |= SSL_OP_NO_SSLv2;
+	tls_set_options(server->ctx, SSL_OP_NO_SSLv2);
 
-	/**
-	 * SSL_OP_NO_COMPRESSION:
-	 *
-	 * The Microsoft RDP server does not advertise support
-	 * for TLS compression, but alternative servers may support it.
-	 * This was observed between early versions of the FreeRDP server
-	 * and the FreeRDP client, and caused major performance issues,
-	 * which is why we're disabling it.
-	 */
-	options |= SSL_OP_NO_COMPRESSION;
-
-	/**
-	 * SSL_OP_TLS_BLOCK_PADDING_BUG:
-	 *
-	 * The Microsoft RDP server does *not* support TLS padding.
-	 * It absolutely needs to be disabled otherwise it won't work.
-	 */
-	options |= SSL_OP_TLS_BLOCK_PADDING_BUG;
-
-	/**
-	 * SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS:
-	 *
-	 * Just like TLS padding, the Microsoft RDP server does not
-	 * support empty fragments. This needs to be disabled.
-	 */
-	options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
+	/* sessions and tickets issued by this context can be resumed by any connection using it */
+	SSL_CTX_set_session_cache_mode(server->ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(server->ctx, (uint8*) "FreeRDP", 7);
 
-	SSL_CTX_set_options(tls->ctx, options);
+	if (SSL_CTX_use_certificate_file(server->ctx, cert_file, SSL_FILETYPE_PEM) <= 0)
+	{
+		printf("SSL_CTX_use_certificate_file failed\n");
+		goto fail;
+	}
 
-	if (SSL_CTX_use_RSAPrivateKey_file(tls->ctx, privatekey_file, SSL_FILETYPE_PEM) <= 0)
+	if (SSL_CTX_use_RSAPrivateKey_file(server->ctx, privatekey_file, SSL_FILETYPE_PEM) <= 0)
 	{
 		printf("SSL_CTX_use_RSAPrivateKey_file failed\n");
-		return false;
+		goto fail;
 	}
 
-	tls->ssl = SSL_new(tls->ctx);
+	ssl = SSL_new(server->ctx);
 
-	if (tls->ssl == NULL)
+	if (ssl == NULL)
 	{
 		printf("SSL_new failed\n");
-		return false;
+		goto fail;
 	}
 
-	if (SSL_use_certificate_file(tls->ssl, cert_file, SSL_FILETYPE_PEM) <= 0)
+	cert.px509 = SSL_get_certificate(ssl);
+
+	if (cert.px509 == NULL || !crypto_cert_get_public_key(&cert, &server->public_key))
 	{
-		printf("SSL_use_certificate_file failed\n");
-		return false;
+		printf("tls_accept: failed to get the public key of the server certificate.\n");
+		SSL_free(ssl);
+		goto fail;
 	}
 
-	cert = tls_get_certificate(tls, false);
+	SSL_free(ssl);
 
-	if (cert == NULL)
+	server->cert_file = xstrdup(cert_file);
+	server->privatekey_file = xstrdup(privatekey_file);
+
+	return server;
+
+fail:
+	SSL_CTX_free(server->ctx);
+	xfree(server);
+	return NULL;
+}
+
+/**
+ * Returns the server context for a certificate and private key, loading them on first use.
+ * Must be called with tls_mutex held.
+ */
+static struct tls_server_context* tls_get_server_context(const char* cert_file, const char* privatekey_file)
+{
+	struct tls_server_context* server;
+
+	for (server = tls_server_contexts; server != NULL; server = server->next)
 	{
-		printf("tls_connect: tls_get_certificate failed to return the server certificate.\n");
+		if (strcmp(server->cert_file, cert_file) == 0 &&
+				strcmp(server->privatekey_file, privatekey_file) == 0)
+			return server;
+	}
+
+	server = tls_server_context_new(cert_file, privatekey_file);
+
+	if (server != NULL)
+	{
+		server->next = tls_server_contexts;
+		tls_server_contexts = server;
+	}
+
+	return server;
+}
+
+boolean tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_file)
+{
+	int connection_status;
+	struct tls_server_context* server;
+
+	if (cert_file == NULL || privatekey_file == NULL)
+		return false;
+
+	tls_init();
+
+	freerdp_mutex_lock(tls_mutex);
+
+	server = tls_get_server_context(cert_file, privatekey_file);
+
+	if (server == NULL)
+	{
+		freerdp_mutex_unlock(tls_mutex);
 		return false;
 	}
 
-	if (!crypto_cert_get_public_key(cert, &tls->public_key))
+	tls->ssl = SSL_new(server->ctx);
+
+	freerdp_mutex_unlock(tls_mutex);
+
+	if (tls->ssl == NULL)
 	{
-		printf("tls_connect: crypto_cert_get_public_key failed to return the server public key.\n");
-		tls_free_certificate(cert);
+		printf("SSL_new failed\n");
 		return false;
 	}
 
-	xfree(cert);
+	freerdp_blob_alloc(&tls->public_key, server->public_key.length);
+	memcpy(tls->public_key.data, server->public_key.data, server->public_key.length);
 
 	if (SSL_set_fd(tls->ssl, tls->sockfd) < 1)
 	{
@@ -267,11 +604,32 @@ boolean tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_fi
 		}
 	}
 
+	freerdp_mutex_lock(tls_mutex);
+
+	if (SSL_session_reused(tls->ssl))
+		tls_stats.server_resumed_handshakes++;
+	else
+		tls_stats.server_full_handshakes++;
+
+	freerdp_mutex_unlock(tls_mutex);
+
 	printf("TLS connection accepted\n");
 
 	return true;
 }
 
+/**
+ * Returns the number of full and resumed TLS handshakes done by this process.
+ */
+void tls_get_stats(rdpTlsStats* stats)
+{
+	tls_init();
+
+	freerdp_mutex_lock(tls_mutex);
+	memcpy(stats, &tls_stats, sizeof(rdpTlsStats));
+	freerdp_mutex_unlock(tls_mutex);
+}
+
 boolean tls_disconnect(rdpTls* tls)
 {
 	SSL_shutdown(tls->ssl);
@@ -316,7 +674,7 @@ int tls_read_all(rdpTls* tls, uint8* data, int length)
 	return status;
 }
 
-int tls_write(rdpTls* tls, uint8* data, int length)
+static int tls_write_record(rdpTls* tls, uint8* data, int length)
 {
 	int status;
 
@@ -341,6 +699,125 @@ int tls_write(rdpTls* tls, uint8* data, int length)
 	return status;
 }
 
+/**
+ * Writes buffered data in full size records, and the remainder as well if
+ * requested. Returns 0 if the socket would block, leaving the data buffered.
+ */
+static int tls_write_buffered(rdpTls* tls, boolean all)
+{
+	int status;
+	int length;
+	STREAM* s = tls->write_stream;
+
+	while ((length = stream_get_length(s) - tls->write_offset) > 0)
+	{
+		if (length > TLS_RECORD_SIZE)
+			length = TLS_RECORD_SIZE;
+		else if (length < TLS_RECORD_SIZE && !all)
+			break;
+
+		status = tls_write_record(tls, stream_get_head(s) + tls->write_offset, length);
+
+		if (status <= 0)
+			return status;
+
+		tls->write_offset += status;
+	}
+
+	/* keep the remaining partial record at the start of the buffer */
+	length = stream_get_length(s) - tls->write_offset;
+
+	if (tls->write_offset > 0)
+	{
+		memmove(stream_get_head(s), stream_get_head(s) + tls->write_offset, length);
+		stream_set_pos(s, length);
+		tls->write_offset = 0;
+	}
+
+	return 1;
+}
+
+int tls_write(rdpTls* tls, uint8* data, int length)
+{
+	int status;
+	STREAM* s = tls->write_stream;
+
+	if (tls->cork > 0)
+	{
+		if (stream_get_length(s) - tls->write_offset >= TLS_WRITE_BUFFER_MAX)
+		{
+			status = tls_write_buffered(tls, false);
+
+			if (status <= 0)
+				return status;
+		}
+
+		if (stream_get_length(s) == 0)
+			tls->write_time = freerdp_get_time_usec();
+
+		stream_check_size(s, length);
+		stream_write(s, data, length);
+
+		/* do not hold data back for longer than TLS_CORK_MAX_DELAY, even if the cork is never released */
+		if (tls_write_buffered(tls, freerdp_get_time_usec() - tls->write_time >= TLS_CORK_MAX_DELAY) < 0)
+			return -1;
+
+		return length;
+	}
+
+	/* data left behind by a blocked write goes first */
+	if (stream_get_length(s) > 0)
+	{
+		status = tls_write_buffered(tls, true);
+
+		if (status <= 0)
+			return status;
+	}
+
+	return tls_write_record(tls, data, length);
+}
+
+/**
+ * Corks the connection: until the matching tls_uncork, writes are packed
+ * into full size TLS records instead of producing one record each.
+ * Corks nest, so callers can cork a paint as well as a single update.
+ */
+void tls_cork(rdpTls* tls)
+{
+	tls->cork++;
+}
+
+/**
+ * Releases a cork taken with tls_cork, sending the buffered data once the last one is released.
+ * @return 1 if everything was sent, 0 if some data is left for tls_flush, -1 on error
+ */
+int tls_uncork(rdpTls* tls)
+{
+	if (tls->cork > 0)
+		tls->cork--;
+
+	if (tls->cork > 0)
+		return 1;
+
+	return tls_write_buffered(tls, true);
+}
+
+/**
+ * Sends buffered data left behind by a blocked write, as well as corked data
+ * that has been held back for longer than TLS_CORK_MAX_DELAY.
+ * @return 1 if nothing is left to send, 0 if the socket would block, -1 on error
+ */
+int tls_flush(rdpTls* tls)
+{
+	if (stream_get_length(tls->write_stream) == 0)
+		return 1;
+
+	if (tls->cork > 0 && freerdp_get_time_usec() - tls->write_time < TLS_CORK_MAX_DELAY)
+		return 1;
+
+	return tls_write_buffered(tls, true);
+}
+
 
 int tls_write_all(rdpTls* tls, uint8* data, int length)
 {
@@ -428,6 +905,10 @@ boolean tls_verify_certificate(rdpTls* tls, CryptoCert cert, char* hostname)
 	if (tls->settings->certificate_name)
 		hostname = tls->settings->certificate_name;
 
+	/* the store may already have been opened while the connection was negotiated */
+	if (tls->certificate_store == NULL)
+		tls->certificate_store = certificate_store_new(tls->settings);
+
 	/* attempt verification using OpenSSL and the ~/.freerdp/certs certificate store */
 	certificate_status = x509_verify_certificate(cert, tls->certificate_store->path);
 
@@ -611,11 +1092,10 @@ rdpTls* tls_new(rdpSettings* settings)
 
 	if (tls != NULL)
 	{
-		SSL_load_error_strings();
-		SSL_library_init();
+		tls_init();
 
 		tls->settings = settings;
-		tls->certificate_store = certificate_store_new(settings);
+		tls->write_stream = stream_new(TLS_RECORD_SIZE);
 	}
 
 	return tls;
@@ -628,10 +1108,8 @@ void tls_free(rdpTls* tls)
 		if (tls->ssl)
 			SSL_free(tls->ssl);
 
-		if (tls->ctx)
-			SSL_CTX_free(tls->ctx);
-
 		freerdp_blob_free(&tls->public_key);
+		stream_free(tls->write_stream);
 
 		certificate_store_free(tls->certificate_store);
 
@@ -33,6 +33,8 @@
 
 #include <freerdp/gdi/16bpp.h>
 
+#include "primitives.h"
+
 uint16 gdi_get_color_16bpp(HGDI_DC hdc, GDI_COLOR color)
 {
 	uint8 r, g, b;
@@ -68,7 +70,7 @@ uint16 gdi_get_color_16bpp(HGDI_DC hdc, GDI_COLOR color)
 
 int FillRect_16bpp(HGDI_DC hdc, HGDI_RECT rect, HGDI_BRUSH hbr)
 {
-	int x, y;
+	int y;
 	uint16 *dstp;
 	int nXDest, nYDest;
 	int nWidth, nHeight;
@@ -87,13 +89,7 @@ int FillRect_16bpp(HGDI_DC hdc, HGDI_RECT rect, HGDI_BRUSH hbr)
 		dstp = (uint16*) gdi_get_bitmap_pointer(hdc, nXDest, nYDest + y);
 
 		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp = color16;
-				dstp++;
-			}
-		}
+			gdi_primitives.fill_16bpp(dstp, nWidth, color16);
 	}
 
 	gdi_InvalidateRegion(hdc, nXDest, nYDest, nWidth, nHeight);
@@ -292,24 +288,17 @@ static int BitBlt_NOTSRCERASE_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int
 
 static int BitBlt_SRCINVERT_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {
-	int x, y;
-	uint16* srcp;
-	uint16* dstp;
+	int y;
+	uint8* srcp;
+	uint8* dstp;
 		
 	for (y = 0; y < nHeight; y++)
 	{
-		srcp = (uint16*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
-		dstp = (uint16*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+		srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
+		dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp ^= *srcp;
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.rop_xor(dstp, srcp, nWidth * 2);
 	}
 
 	return 0;
@@ -317,24 +306,17 @@ static int BitBlt_SRCINVERT_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int n
 
 static int BitBlt_SRCAND_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {
-	int x, y;
-	uint16* srcp;
-	uint16* dstp;
+	int y;
+	uint8* srcp;
+	uint8* dstp;
 		
 	for (y = 0; y < nHeight; y++)
 	{
-		srcp = (uint16*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
-		dstp = (uint16*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+		srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
+		dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp &= *srcp;
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.rop_and(dstp, srcp, nWidth * 2);
 	}
 
 	return 0;
@@ -342,24 +324,17 @@ static int BitBlt_SRCAND_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWid
 
 static int BitBlt_SRCPAINT_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {
-	int x, y;
-	uint16* srcp;
-	uint16* dstp;
+	int y;
+	uint8* srcp;
+	uint8* dstp;
 		
 	for (y = 0; y < nHeight; y++)
 	{
-		srcp = (uint16*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
-		dstp = (uint16*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+		srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
+		dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp |= *srcp;
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.rop_or(dstp, srcp, nWidth * 2);
 	}
 
 	return 0;
@@ -367,10 +342,9 @@ static int BitBlt_SRCPAINT_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nW
 
 static int BitBlt_DSPDxax_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {	
-	int x, y;
+	int y;
 	uint8* srcp;
 	uint16* dstp;
-	uint16 src16;
 	uint16 color16;
 	HGDI_BITMAP hSrcBmp;
 
@@ -392,16 +366,8 @@ static int BitBlt_DSPDxax_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 		srcp = (uint8*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
 		dstp = (uint16*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				src16 = (*srcp << 8) | *srcp;
-				*dstp = (src16 & color16) | (~src16 & *dstp);
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.glyph_blend_16bpp(dstp, srcp, nWidth, color16);
 	}
 
 	return 0;
@@ -621,6 +587,7 @@ static int BitBlt_PATCOPY_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 	uint16* dstp;
 	uint16* patp;
 	uint16 color16;
+	HGDI_BITMAP hBmpBrush;
 
 	if (hdcDest->brush->style == GDI_BS_SOLID)
 	{
@@ -631,13 +598,24 @@ static int BitBlt_PATCOPY_16bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 			dstp = (uint16*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
 			if (dstp != 0)
-			{
-				for (x = 0; x < nWidth; x++)
-				{
-					*dstp = color16;
-					dstp++;
-				}
-			}
+				gdi_primitives.fill_16bpp(dstp, nWidth, color16);
+		}
+
+		return 0;
+	}
+
+	hBmpBrush = hdcDest->brush->pattern;
+
+	if ((hdcDest->brush->style == GDI_BS_PATTERN) && (hBmpBrush->width == 8) &&
+			(hBmpBrush->height == 8) && (hBmpBrush->bytesPerPixel == 2))
+	{
+		for (y = 0; y < nHeight; y++)
+		{
+			dstp = (uint16*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+			patp = (uint16*) gdi_get_brush_pointer(hdcDest, 0, y);
+
+			if (dstp != 0)
+				gdi_primitives.pattern_16bpp(dstp, nWidth, patp);
 		}
 	}
 	else
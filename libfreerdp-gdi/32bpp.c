@@ -33,6 +33,8 @@
 
 #include <freerdp/gdi/32bpp.h>
 
+#include "primitives.h"
+
 uint32 gdi_get_color_32bpp(HGDI_DC hdc, GDI_COLOR color)
 {
 	uint32 color32;
@@ -55,7 +57,7 @@ uint32 gdi_get_color_32bpp(HGDI_DC hdc, GDI_COLOR color)
 
 int FillRect_32bpp(HGDI_DC hdc, HGDI_RECT rect, HGDI_BRUSH hbr)
 {
-	int x, y;
+	int y;
 	uint32 *dstp;
 	uint32 color32;
 	int nXDest, nYDest;
@@ -73,13 +75,7 @@ int FillRect_32bpp(HGDI_DC hdc, HGDI_RECT rect, HGDI_BRUSH hbr)
 		dstp = (uint32*) gdi_get_bitmap_pointer(hdc, nXDest, nYDest + y);
 
 		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp = color32;
-				dstp++;
-			}
-		}
+			gdi_primitives.fill_32bpp(dstp, nWidth, color32);
 	}
 
 	gdi_InvalidateRegion(hdc, nXDest, nYDest, nWidth, nHeight);
@@ -309,24 +305,17 @@ static int BitBlt_NOTSRCERASE_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int
 
 static int BitBlt_SRCINVERT_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {
-	int x, y;
-	uint32* srcp;
-	uint32* dstp;
+	int y;
+	uint8* srcp;
+	uint8* dstp;
 		
 	for (y = 0; y < nHeight; y++)
 	{
-		srcp = (uint32*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
-		dstp = (uint32*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+		srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
+		dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp ^= *srcp;
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.rop_xor(dstp, srcp, nWidth * 4);
 	}
 
 	return 0;
@@ -334,24 +323,17 @@ static int BitBlt_SRCINVERT_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int n
 
 static int BitBlt_SRCAND_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {
-	int x, y;
-	uint32* srcp;
-	uint32* dstp;
+	int y;
+	uint8* srcp;
+	uint8* dstp;
 		
 	for (y = 0; y < nHeight; y++)
 	{
-		srcp = (uint32*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
-		dstp = (uint32*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+		srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
+		dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp &= *srcp;
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.rop_and(dstp, srcp, nWidth * 4);
 	}
 
 	return 0;
@@ -359,24 +341,17 @@ static int BitBlt_SRCAND_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWid
 
 static int BitBlt_SRCPAINT_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HGDI_DC hdcSrc, int nXSrc, int nYSrc)
 {
-	int x, y;
-	uint32* srcp;
-	uint32* dstp;
+	int y;
+	uint8* srcp;
+	uint8* dstp;
 		
 	for (y = 0; y < nHeight; y++)
 	{
-		srcp = (uint32*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
-		dstp = (uint32*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+		srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
+		dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-		if (dstp != 0)
-		{
-			for (x = 0; x < nWidth; x++)
-			{
-				*dstp |= *srcp;
-				srcp++;
-				dstp++;
-			}
-		}
+		if (dstp != 0 && srcp != 0)
+			gdi_primitives.rop_or(dstp, srcp, nWidth * 4);
 	}
 
 	return 0;
@@ -389,7 +364,6 @@ static int BitBlt_DSPDxax_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 	uint32* dstp;
 	uint32* patp;
 	uint8* srcp8;
-	uint32 src32;
 	uint32 color32;
 	HGDI_BITMAP hSrcBmp;
 
@@ -404,25 +378,13 @@ static int BitBlt_DSPDxax_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 	{
 		/* DSPDxax, used to draw glyphs */
 
-		srcp = (uint32*) & src32;
-
 		for (y = 0; y < nHeight; y++)
 		{
 			srcp8 = (uint8*) gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + y);
 			dstp = (uint32*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
-			if (dstp != 0)
-			{
-				for (x = 0; x < nWidth; x++)
-				{
-					*srcp = ((*srcp8) | (*srcp8 << 8) | (*srcp8 << 16) | (*srcp8 << 24));
-
-					*dstp = (*srcp & *patp) | (~(*srcp) & *dstp);
-					dstp++;
-
-					srcp8++;
-				}
-			}
+			if (dstp != 0 && srcp8 != 0)
+				gdi_primitives.glyph_blend_32bpp(dstp, srcp8, nWidth, color32);
 		}
 	}
 	else
@@ -663,6 +625,7 @@ static int BitBlt_PATCOPY_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 	uint32* dstp;
 	uint32* patp;
 	uint32 color32;
+	HGDI_BITMAP hBmpBrush;
 
 	if (hdcDest->brush->style == GDI_BS_SOLID)
 	{
@@ -673,13 +636,26 @@ static int BitBlt_PATCOPY_32bpp(HGDI_DC hdcDest, int nXDest, int nYDest, int nWi
 			dstp = (uint32*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
 
 			if (dstp != 0)
-			{
-				for (x = 0; x < nWidth; x++)
-				{
-					*dstp = color32;
-					dstp++;
-				}
-			}
+				gdi_primitives.fill_32bpp(dstp, nWidth, color32);
+		}
+
+		return 0;
+	}
+
+	hBmpBrush = hdcDest->brush->pattern;
+
+	if ((hdcDest->brush->style == GDI_BS_PATTERN) && (hBmpBrush->width == 8) &&
+			(hBmpBrush->height == 8) && (hBmpBrush->bytesPerPixel == 4))
+	{
+		/* 8x8 brushes repeat every 8 pixels, copy whole pattern rows at once */
+
+		for (y = 0; y < nHeight; y++)
+		{
+			dstp = (uint32*) gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + y);
+			patp = (uint32*) gdi_get_brush_pointer(hdcDest, 0, y);
+
+			if (dstp != 0)
+				gdi_primitives.pattern_32bpp(dstp, nWidth, patp);
 		}
 	}
 	else
@@ -71,7 +71,7 @@ HGDI_DC gdi_CreateDC(HCLRCONV clrconv, int bpp)
 	hDC->invert = clrconv->invert;
 	hDC->rgb555 = clrconv->rgb555;
 
-	hDC->hwnd = (HGDI_WND) xmalloc(sizeof(GDI_WND));
+	hDC->hwnd = (HGDI_WND) xzalloc(sizeof(GDI_WND));
 	hDC->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 	hDC->hwnd->invalid->null = 1;
 
@@ -220,6 +220,9 @@ int gdi_DeleteDC(HGDI_DC hdc)
 		if (hdc->hwnd->cinvalid != NULL)
 			free(hdc->hwnd->cinvalid);
 
+		xfree(hdc->hwnd->scratch.rects);
+		xfree(hdc->hwnd->bands);
+
 		if (hdc->hwnd->invalid != NULL)
 			free(hdc->hwnd->invalid);
 
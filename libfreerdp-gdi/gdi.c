@@ -45,6 +45,14 @@
 
 #include "gdi.h"
 
+#ifdef WITH_SSE2
+#include "primitives_sse2.h"
+#endif
+
+#ifndef GDI_INIT_SIMD
+#define GDI_INIT_SIMD(_primitives) do { } while (0)
+#endif
+
 /* Ternary Raster Operation Table */
 static const uint32 rop3_code_table[] =
 {
@@ -838,7 +846,7 @@ void gdi_init_primary(rdpGdi* gdi)
 	if (gdi->drawing == NULL)
 		gdi->drawing = gdi->primary;
 
-	gdi->primary->hdc->hwnd = (HGDI_WND) xmalloc(sizeof(GDI_WND));
+	gdi->primary->hdc->hwnd = (HGDI_WND) xzalloc(sizeof(GDI_WND));
 	gdi->primary->hdc->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 	gdi->primary->hdc->hwnd->invalid->null = 1;
 
@@ -864,6 +872,26 @@ void gdi_resize(rdpGdi* gdi, int width, int height)
 	}
 }
 
+/**
+ * Enable SIMD CPU acceleration for the GDI raster operations and codecs
+ * @param gdi current GDI
+ * @param cpu_opt detected CPU features (CPU_SSE2)
+ */
+
+void gdi_set_cpu_opt(rdpGdi* gdi, uint32 cpu_opt)
+{
+	if (cpu_opt & CPU_SSE2)
+		GDI_INIT_SIMD(&gdi_primitives);
+
+	freerdp_color_set_cpu_opt(cpu_opt);
+
+	if (gdi->rfx_context != NULL)
+		rfx_context_set_cpu_opt((RFX_CONTEXT*) gdi->rfx_context, cpu_opt);
+
+	if (gdi->nsc_context != NULL)
+		nsc_context_set_cpu_opt((NSC_CONTEXT*) gdi->nsc_context, cpu_opt);
+}
+
 /**
  * Initialize GDI
  * @param inst current instance
@@ -946,6 +974,8 @@ int gdi_init(freerdp* instance, uint32 flags, uint8* buffer)
 		instance->context->cache = cache;
 	}
 
+	cache->bitmap->dstBpp = gdi->dstBpp;
+
 	gdi_register_update_callbacks(instance->update);
 
 	brush_cache_register_callbacks(instance->update);
@@ -24,6 +24,7 @@
 #include <freerdp/gdi/bitmap.h>
 #include <freerdp/gdi/drawing.h>
 #include <freerdp/gdi/clipping.h>
+#include <freerdp/gdi/32bpp.h>
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/utils/memory.h>
@@ -31,6 +32,7 @@
 #include <freerdp/cache/glyph.h>
 
 #include "graphics.h"
+#include "primitives.h"
 
 /* Bitmap Class */
 
@@ -179,6 +181,100 @@ void gdi_Glyph_Draw(rdpContext* context, rdpGlyph* glyph, int x, int y)
 			gdi_glyph->bitmap->height, gdi_glyph->hdc, 0, 0, GDI_DSPDxax);
 }
 
+void gdi_Glyph_DrawBatch(rdpContext* context, GLYPH_BATCH* batch)
+{
+	int i;
+	int x, y;
+	int width, height;
+	int srcx, srcy;
+	int row;
+	uint8* dstp;
+	uint8* mask;
+	uint32 color;
+	HGDI_DC hdc;
+	boolean empty;
+	HGDI_BITMAP hBmp;
+	GLYPH_ATLAS* atlas;
+	GLYPH_BATCH_ITEM* item;
+	int left, top, right, bottom;
+	rdpGdi* gdi = context->gdi;
+
+	hdc = gdi->drawing->hdc;
+	hBmp = (HGDI_BITMAP) hdc->selectedObject;
+	atlas = batch->atlas;
+
+	if ((hdc->bytesPerPixel != 4) || (hBmp == NULL))
+	{
+		for (i = 0; i < (int) batch->count; i++)
+			gdi_Glyph_Draw(context, batch->items[i].glyph, batch->items[i].x, batch->items[i].y);
+
+		return;
+	}
+
+	color = gdi_get_color_32bpp(hdc, hdc->textColor);
+
+	empty = true;
+	left = top = right = bottom = 0;
+
+	for (i = 0; i < (int) batch->count; i++)
+	{
+		item = &batch->items[i];
+
+		if (item->cx == 0)
+		{
+			/* not in the atlas */
+			gdi_Glyph_Draw(context, item->glyph, item->x, item->y);
+			continue;
+		}
+
+		x = item->x;
+		y = item->y;
+		width = item->cx;
+		height = item->cy;
+		srcx = item->atlasX;
+		srcy = item->atlasY;
+
+		if (gdi_ClipCoords(hdc, &x, &y, &width, &height, &srcx, &srcy) == 0)
+			continue;
+
+		if ((width <= 0) || (height <= 0))
+			continue;
+
+		dstp = gdi_get_bitmap_pointer(hdc, x, y);
+
+		if (dstp == NULL)
+			continue;
+
+		mask = &atlas->data[srcy * atlas->width + srcx];
+
+		for (row = 0; row < height; row++)
+		{
+			gdi_primitives.glyph_blend_32bpp((uint32*) dstp, mask, width, color);
+			dstp += hBmp->width * 4;
+			mask += atlas->width;
+		}
+
+		if (empty)
+		{
+			empty = false;
+			left = x;
+			top = y;
+			right = x + width;
+			bottom = y + height;
+		}
+		else
+		{
+			left = (x < left) ? x : left;
+			top = (y < top) ? y : top;
+			right = (x + width > right) ? x + width : right;
+			bottom = (y + height > bottom) ? y + height : bottom;
+		}
+	}
+
+	if (!empty)
+		gdi_InvalidateRegion(hdc, left, top, right - left, bottom - top);
+}
+
 void gdi_Glyph_BeginDraw(rdpContext* context, int x, int y, int width, int height, uint32 bgcolor, uint32 fgcolor)
 {
 	GDI_RECT rect;
@@ -232,6 +328,7 @@ void gdi_register_graphics(rdpGraphics* graphics)
 	glyph->Draw = gdi_Glyph_Draw;
 	glyph->BeginDraw = gdi_Glyph_BeginDraw;
 	glyph->EndDraw = gdi_Glyph_EndDraw;
+	glyph->DrawBatch = gdi_Glyph_DrawBatch;
 
 	graphics_register_glyph(graphics, glyph);
 	xfree(glyph);
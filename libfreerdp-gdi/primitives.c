@@ -0,0 +1,130 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * GDI Raster Operation Primitives
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "primitives.h"
+
+static void gdi_fill_32bpp_c(uint32* dst, int width, uint32 color)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = color;
+}
+
+static void gdi_fill_16bpp_c(uint16* dst, int width, uint16 color)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = color;
+}
+
+static void gdi_pattern_32bpp_c(uint32* dst, int width, uint32* pattern)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = pattern[x % 8];
+}
+
+static void gdi_pattern_16bpp_c(uint16* dst, int width, uint16* pattern)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = pattern[x % 8];
+}
+
+static void gdi_rop_and_c(uint8* dst, uint8* src, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dst[i] &= src[i];
+}
+
+static void gdi_rop_or_c(uint8* dst, uint8* src, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dst[i] |= src[i];
+}
+
+static void gdi_rop_xor_c(uint8* dst, uint8* src, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dst[i] ^= src[i];
+}
+
+static void gdi_glyph_blend_32bpp_c(uint32* dst, uint8* mask, int width, uint32 color)
+{
+	int x;
+	uint32 src32;
+
+	for (x = 0; x < width; x++)
+	{
+		src32 = mask[x] | (mask[x] << 8) | (mask[x] << 16) | (mask[x] << 24);
+		dst[x] = (src32 & color) | (~src32 & dst[x]);
+	}
+}
+
+static void gdi_glyph_blend_16bpp_c(uint16* dst, uint8* mask, int width, uint16 color)
+{
+	int x;
+	uint16 src16;
+
+	for (x = 0; x < width; x++)
+	{
+		src16 = (mask[x] << 8) | mask[x];
+		dst[x] = (src16 & color) | (~src16 & dst[x]);
+	}
+}
+
+void gdi_primitives_init_c(GDI_PRIMITIVES* primitives)
+{
+	primitives->fill_32bpp = gdi_fill_32bpp_c;
+	primitives->fill_16bpp = gdi_fill_16bpp_c;
+	primitives->pattern_32bpp = gdi_pattern_32bpp_c;
+	primitives->pattern_16bpp = gdi_pattern_16bpp_c;
+	primitives->rop_and = gdi_rop_and_c;
+	primitives->rop_or = gdi_rop_or_c;
+	primitives->rop_xor = gdi_rop_xor_c;
+	primitives->glyph_blend_32bpp = gdi_glyph_blend_32bpp_c;
+	primitives->glyph_blend_16bpp = gdi_glyph_blend_16bpp_c;
+}
+
+GDI_PRIMITIVES gdi_primitives =
+{
+	gdi_fill_32bpp_c,
+	gdi_fill_16bpp_c,
+	gdi_pattern_32bpp_c,
+	gdi_pattern_16bpp_c,
+	gdi_rop_and_c,
+	gdi_rop_or_c,
+	gdi_rop_xor_c,
+	gdi_glyph_blend_32bpp_c,
+	gdi_glyph_blend_16bpp_c
+};
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,64 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * GDI Raster Operation Primitives
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GDI_PRIMITIVES_H
+#define __GDI_PRIMITIVES_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+/**
+ * Scanline kernels used by the 16bpp and 32bpp raster operations.
+ * Each call processes a single row of width pixels (or bytes for the
+ * bitwise source operations, which do not depend on the pixel format).
+ */
+
+typedef void (*pGdiFill_32bpp)(uint32* dst, int width, uint32 color);
+typedef void (*pGdiFill_16bpp)(uint16* dst, int width, uint16 color);
+
+/* pattern is one row of an 8x8 brush, starting at brush x = 0 */
+typedef void (*pGdiPattern_32bpp)(uint32* dst, int width, uint32* pattern);
+typedef void (*pGdiPattern_16bpp)(uint16* dst, int width, uint16* pattern);
+
+/* SRCAND, SRCPAINT, SRCINVERT */
+typedef void (*pGdiRop)(uint8* dst, uint8* src, int length);
+
+/* DSPDxax: D = (S & P) | (~S & D), with S a one-byte-per-pixel glyph mask */
+typedef void (*pGdiGlyphBlend_32bpp)(uint32* dst, uint8* mask, int width, uint32 color);
+typedef void (*pGdiGlyphBlend_16bpp)(uint16* dst, uint8* mask, int width, uint16 color);
+
+struct _GDI_PRIMITIVES
+{
+	pGdiFill_32bpp fill_32bpp;
+	pGdiFill_16bpp fill_16bpp;
+	pGdiPattern_32bpp pattern_32bpp;
+	pGdiPattern_16bpp pattern_16bpp;
+	pGdiRop rop_and;
+	pGdiRop rop_or;
+	pGdiRop rop_xor;
+	pGdiGlyphBlend_32bpp glyph_blend_32bpp;
+	pGdiGlyphBlend_16bpp glyph_blend_16bpp;
+};
+typedef struct _GDI_PRIMITIVES GDI_PRIMITIVES;
+
+FREERDP_API extern GDI_PRIMITIVES gdi_primitives;
+
+FREERDP_API void gdi_primitives_init_c(GDI_PRIMITIVES* primitives);
+
+#endif /* __GDI_PRIMITIVES_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
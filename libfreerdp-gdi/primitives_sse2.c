@@ -0,0 +1,196 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * GDI Raster Operation Primitives - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "primitives_sse2.h"
+
+static void gdi_fill_32bpp_sse2(uint32* dst, int width, uint32 color)
+{
+	int x;
+	__m128i c = _mm_set1_epi32(color);
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		_mm_storeu_si128((__m128i*) &dst[x], c);
+		_mm_storeu_si128((__m128i*) &dst[x + 4], c);
+		_mm_storeu_si128((__m128i*) &dst[x + 8], c);
+		_mm_storeu_si128((__m128i*) &dst[x + 12], c);
+	}
+
+	for (; x + 4 <= width; x += 4)
+		_mm_storeu_si128((__m128i*) &dst[x], c);
+
+	for (; x < width; x++)
+		dst[x] = color;
+}
+
+static void gdi_fill_16bpp_sse2(uint16* dst, int width, uint16 color)
+{
+	int x;
+	__m128i c = _mm_set1_epi16(color);
+
+	for (x = 0; x + 32 <= width; x += 32)
+	{
+		_mm_storeu_si128((__m128i*) &dst[x], c);
+		_mm_storeu_si128((__m128i*) &dst[x + 8], c);
+		_mm_storeu_si128((__m128i*) &dst[x + 16], c);
+		_mm_storeu_si128((__m128i*) &dst[x + 24], c);
+	}
+
+	for (; x + 8 <= width; x += 8)
+		_mm_storeu_si128((__m128i*) &dst[x], c);
+
+	for (; x < width; x++)
+		dst[x] = color;
+}
+
+static void gdi_pattern_32bpp_sse2(uint32* dst, int width, uint32* pattern)
+{
+	int x;
+	__m128i p0 = _mm_loadu_si128((__m128i*) &pattern[0]);
+	__m128i p1 = _mm_loadu_si128((__m128i*) &pattern[4]);
+
+	/* the pattern repeats every 8 pixels, which is exactly two registers */
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		_mm_storeu_si128((__m128i*) &dst[x], p0);
+		_mm_storeu_si128((__m128i*) &dst[x + 4], p1);
+	}
+
+	for (; x < width; x++)
+		dst[x] = pattern[x & 7];
+}
+
+static void gdi_pattern_16bpp_sse2(uint16* dst, int width, uint16* pattern)
+{
+	int x;
+	__m128i p = _mm_loadu_si128((__m128i*) pattern);
+
+	for (x = 0; x + 8 <= width; x += 8)
+		_mm_storeu_si128((__m128i*) &dst[x], p);
+
+	for (; x < width; x++)
+		dst[x] = pattern[x & 7];
+}
+
+#define GDI_ROP_SSE2(_name, _op, _sse2) \
+static void _name(uint8* dst, uint8* src, int length) \
+{ \
+	int i; \
+	__m128i d, s; \
+	for (i = 0; i + 16 <= length; i += 16) \
+	{ \
+		d = _mm_loadu_si128((__m128i*) &dst[i]); \
+		s = _mm_loadu_si128((__m128i*) &src[i]); \
+		_mm_storeu_si128((__m128i*) &dst[i], _sse2(d, s)); \
+	} \
+	for (; i < length; i++) \
+		dst[i] _op src[i]; \
+}
+
+GDI_ROP_SSE2(gdi_rop_and_sse2, &=, _mm_and_si128)
+GDI_ROP_SSE2(gdi_rop_or_sse2, |=, _mm_or_si128)
+GDI_ROP_SSE2(gdi_rop_xor_sse2, ^=, _mm_xor_si128)
+
+static void gdi_glyph_blend_32bpp_sse2(uint32* dst, uint8* mask, int width, uint32 color)
+{
+	int x;
+	uint32 src32;
+	__m128i m, m16, s0, s1, s2, s3;
+	__m128i c = _mm_set1_epi32(color);
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		m = _mm_loadu_si128((__m128i*) &mask[x]);
+
+		/* glyph masks are mostly empty, skip blocks without any set pixel */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) == 0xFFFF)
+			continue;
+
+		m16 = _mm_unpacklo_epi8(m, m);
+		s0 = _mm_unpacklo_epi16(m16, m16);
+		s1 = _mm_unpackhi_epi16(m16, m16);
+		m16 = _mm_unpackhi_epi8(m, m);
+		s2 = _mm_unpacklo_epi16(m16, m16);
+		s3 = _mm_unpackhi_epi16(m16, m16);
+
+		_mm_storeu_si128((__m128i*) &dst[x], _mm_or_si128(_mm_and_si128(s0, c),
+			_mm_andnot_si128(s0, _mm_loadu_si128((__m128i*) &dst[x]))));
+		_mm_storeu_si128((__m128i*) &dst[x + 4], _mm_or_si128(_mm_and_si128(s1, c),
+			_mm_andnot_si128(s1, _mm_loadu_si128((__m128i*) &dst[x + 4]))));
+		_mm_storeu_si128((__m128i*) &dst[x + 8], _mm_or_si128(_mm_and_si128(s2, c),
+			_mm_andnot_si128(s2, _mm_loadu_si128((__m128i*) &dst[x + 8]))));
+		_mm_storeu_si128((__m128i*) &dst[x + 12], _mm_or_si128(_mm_and_si128(s3, c),
+			_mm_andnot_si128(s3, _mm_loadu_si128((__m128i*) &dst[x + 12]))));
+	}
+
+	for (; x < width; x++)
+	{
+		src32 = mask[x] | (mask[x] << 8) | (mask[x] << 16) | (mask[x] << 24);
+		dst[x] = (src32 & color) | (~src32 & dst[x]);
+	}
+}
+
+static void gdi_glyph_blend_16bpp_sse2(uint16* dst, uint8* mask, int width, uint16 color)
+{
+	int x;
+	uint16 src16;
+	__m128i m, s0, s1;
+	__m128i c = _mm_set1_epi16(color);
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		m = _mm_loadu_si128((__m128i*) &mask[x]);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) == 0xFFFF)
+			continue;
+
+		s0 = _mm_unpacklo_epi8(m, m);
+		s1 = _mm_unpackhi_epi8(m, m);
+
+		_mm_storeu_si128((__m128i*) &dst[x], _mm_or_si128(_mm_and_si128(s0, c),
+			_mm_andnot_si128(s0, _mm_loadu_si128((__m128i*) &dst[x]))));
+		_mm_storeu_si128((__m128i*) &dst[x + 8], _mm_or_si128(_mm_and_si128(s1, c),
+			_mm_andnot_si128(s1, _mm_loadu_si128((__m128i*) &dst[x + 8]))));
+	}
+
+	for (; x < width; x++)
+	{
+		src16 = (mask[x] << 8) | mask[x];
+		dst[x] = (src16 & color) | (~src16 & dst[x]);
+	}
+}
+
+void gdi_primitives_init_sse2(GDI_PRIMITIVES* primitives)
+{
+	primitives->fill_32bpp = gdi_fill_32bpp_sse2;
+	primitives->fill_16bpp = gdi_fill_16bpp_sse2;
+	primitives->pattern_32bpp = gdi_pattern_32bpp_sse2;
+	primitives->pattern_16bpp = gdi_pattern_16bpp_sse2;
+	primitives->rop_and = gdi_rop_and_sse2;
+	primitives->rop_or = gdi_rop_or_sse2;
+	primitives->rop_xor = gdi_rop_xor_sse2;
+	primitives->glyph_blend_32bpp = gdi_glyph_blend_32bpp_sse2;
+	primitives->glyph_blend_16bpp = gdi_glyph_blend_16bpp_sse2;
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
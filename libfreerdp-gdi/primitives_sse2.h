@@ -0,0 +1,31 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * GDI Raster Operation Primitives - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GDI_PRIMITIVES_SSE2_H
+#define __GDI_PRIMITIVES_SSE2_H
+
+#include "primitives.h"
+
+FREERDP_API void gdi_primitives_init_sse2(GDI_PRIMITIVES* primitives);
+
+#ifndef GDI_INIT_SIMD
+#define GDI_INIT_SIMD(_primitives) gdi_primitives_init_sse2(_primitives)
+#endif
+
+#endif /* __GDI_PRIMITIVES_SSE2_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -28,6 +28,10 @@
 
 #include <freerdp/gdi/region.h>
 
+/* an update rectangle costs about as much as copying this many pixels */
+#define GDI_REGION_RECT_COST		4096
+#define GDI_REGION_MAX_RECTS		32
+
 /**
  * Create a region from rectangular coordinates.\n
  * @msdn{dd183514}
@@ -350,6 +354,434 @@ INLINE int gdi_PtInRect(HGDI_RECT rc, int x, int y)
 	return 0;
 }
 
+/**
+ * Create an empty complex region.
+ * @return new region
+ */
+
+HGDI_REGION gdi_CreateRegion(void)
+{
+	HGDI_REGION region = (HGDI_REGION) xzalloc(sizeof(GDI_REGION));
+	return region;
+}
+
+/**
+ * Delete a complex region.
+ * @param region region
+ */
+
+void gdi_DeleteRegion(HGDI_REGION region)
+{
+	if (region == NULL)
+		return;
+
+	xfree(region->rects);
+	xfree(region);
+}
+
+/**
+ * Remove all rectangles from a complex region, keeping its storage.
+ * @param region region
+ */
+
+void gdi_EmptyRegion(HGDI_REGION region)
+{
+	region->count = 0;
+}
+
+static void gdi_region_append(HGDI_REGION region, int x, int y, int w, int h)
+{
+	if (region->count + 1 > region->size)
+	{
+		region->size = (region->size < 16) ? 16 : region->size * 2;
+		region->rects = (HGDI_RGN) xrealloc(region->rects, sizeof(GDI_RGN) * region->size);
+	}
+
+	region->rects[region->count].objectType = GDIOBJECT_REGION;
+	gdi_SetRgn(&region->rects[region->count], x, y, w, h);
+	region->count++;
+}
+
+static int gdi_region_band_end(HGDI_RGN rects, int count, int index)
+{
+	int end = index + 1;
+
+	while ((end < count) && (rects[end].y == rects[index].y))
+		end++;
+
+	return end;
+}
+
+static int gdi_region_edge(HGDI_RGN rects, int edge)
+{
+	HGDI_RGN rect = &rects[edge / 2];
+	return (edge & 1) ? rect->x + rect->w : rect->x;
+}
+
+static int gdi_region_compare_int(const void* a, const void* b)
+{
+	return *((int*) a) - *((int*) b);
+}
+
+/**
+ * Combine the spans of two bands covering the same rows and append the result
+ * to dst as a band [y, y + h). Adjacent identical bands are coalesced.
+ */
+
+static void gdi_region_combine_band(HGDI_REGION dst, int* bandStart, HGDI_RGN s1, int n1,
+		HGDI_RGN s2, int n2, int mode, int y, int h)
+{
+	int i, x;
+	int p1, p2;
+	int e1, e2;
+	int start;
+	int first;
+	int prevStart;
+	int prevCount;
+	boolean in1, in2, inside;
+
+	first = dst->count;
+	start = -1;
+	in1 = in2 = false;
+	p1 = p2 = 0;
+
+	while ((p1 < n1 * 2) || (p2 < n2 * 2))
+	{
+		e1 = (p1 < n1 * 2) ? gdi_region_edge(s1, p1) : 0x7FFFFFFF;
+		e2 = (p2 < n2 * 2) ? gdi_region_edge(s2, p2) : 0x7FFFFFFF;
+		x = (e1 < e2) ? e1 : e2;
+
+		/* touching spans toggle twice and stay inside */
+		while ((p1 < n1 * 2) && (gdi_region_edge(s1, p1) == x))
+		{
+			in1 = !in1;
+			p1++;
+		}
+
+		while ((p2 < n2 * 2) && (gdi_region_edge(s2, p2) == x))
+		{
+			in2 = !in2;
+			p2++;
+		}
+
+		if (mode == GDI_RGN_AND)
+			inside = in1 && in2;
+		else if (mode == GDI_RGN_DIFF)
+			inside = in1 && !in2;
+		else
+			inside = in1 || in2;
+
+		if (inside && (start < 0))
+		{
+			start = x;
+		}
+		else if (!inside && (start >= 0))
+		{
+			gdi_region_append(dst, start, y, x - start, h);
+			start = -1;
+		}
+	}
+
+	if (dst->count == first)
+		return;
+
+	/* coalesce with the band right above when it has the same spans */
+
+	prevStart = *bandStart;
+	prevCount = first - prevStart;
+
+	if ((prevCount == dst->count - first) && (prevStart < first) &&
+		(dst->rects[prevStart].y + dst->rects[prevStart].h == y))
+	{
+		for (i = 0; i < prevCount; i++)
+		{
+			if ((dst->rects[prevStart + i].x != dst->rects[first + i].x) ||
+				(dst->rects[prevStart + i].w != dst->rects[first + i].w))
+				break;
+		}
+
+		if (i == prevCount)
+		{
+			for (i = 0; i < prevCount; i++)
+				dst->rects[prevStart + i].h += h;
+
+			dst->count = first;
+			return;
+		}
+	}
+
+	*bandStart = first;
+}
+
+/**
+ * Combine two complex regions into the storage of scratch, then swap it with
+ * dst so that neither array is freed. The band boundary array is kept in
+ * *bands and only grows, letting callers reuse it across calls.
+ */
+
+static int gdi_region_combine(HGDI_REGION dst, HGDI_REGION src1, HGDI_REGION src2, int mode,
+		HGDI_REGION scratch, int** bands, int* nbands)
+{
+	int i, n;
+	int i1, i2;
+	int b1, b2;
+	int ya, yb;
+	int* ys;
+	int bandStart;
+	GDI_REGION result;
+
+	result.count = 0;
+	result.size = scratch->size;
+	result.rects = scratch->rects;
+	bandStart = 0;
+
+	n = 2 * (src1->count + src2->count);
+
+	if (n > *nbands)
+	{
+		*nbands = (n < 64) ? 64 : n;
+		*bands = (int*) xrealloc(*bands, sizeof(int) * (*nbands));
+	}
+
+	n = 0;
+	ys = *bands;
+
+	for (i = 0; i < src1->count; i++)
+	{
+		ys[n++] = src1->rects[i].y;
+		ys[n++] = src1->rects[i].y + src1->rects[i].h;
+	}
+
+	for (i = 0; i < src2->count; i++)
+	{
+		ys[n++] = src2->rects[i].y;
+		ys[n++] = src2->rects[i].y + src2->rects[i].h;
+	}
+
+	qsort(ys, n, sizeof(int), gdi_region_compare_int);
+
+	i1 = i2 = 0;
+
+	/* every band boundary is a breakpoint, so a band either covers a slab or misses it */
+
+	for (i = 0; i + 1 < n; i++)
+	{
+		ya = ys[i];
+		yb = ys[i + 1];
+
+		if (ya == yb)
+			continue;
+
+		while ((i1 < src1->count) && (src1->rects[i1].y + src1->rects[i1].h <= ya))
+			i1 = gdi_region_band_end(src1->rects, src1->count, i1);
+
+		while ((i2 < src2->count) && (src2->rects[i2].y + src2->rects[i2].h <= ya))
+			i2 = gdi_region_band_end(src2->rects, src2->count, i2);
+
+		b1 = ((i1 < src1->count) && (src1->rects[i1].y <= ya)) ?
+			gdi_region_band_end(src1->rects, src1->count, i1) - i1 : 0;
+
+		b2 = ((i2 < src2->count) && (src2->rects[i2].y <= ya)) ?
+			gdi_region_band_end(src2->rects, src2->count, i2) - i2 : 0;
+
+		if ((b1 == 0) && (b2 == 0))
+			continue;
+
+		gdi_region_combine_band(&result, &bandStart, &src1->rects[i1], b1,
+				&src2->rects[i2], b2, mode, ya, yb - ya);
+	}
+
+	/* an empty result may not own any storage yet, keep the one dst has */
+	if (result.rects == NULL)
+	{
+		dst->count = 0;
+		return 0;
+	}
+
+	scratch->size = dst->size;
+	scratch->rects = dst->rects;
+	scratch->count = 0;
+
+	dst->count = result.count;
+	dst->size = result.size;
+	dst->rects = result.rects;
+
+	return dst->count;
+}
+
+static int gdi_region_combine_rect(HGDI_REGION region, int x, int y, int w, int h, int mode,
+		HGDI_REGION scratch, int** bands, int* nbands)
+{
+	GDI_RGN rect;
+	GDI_REGION src;
+
+	src.count = 0;
+	src.size = 1;
+	src.rects = &rect;
+
+	if ((w > 0) && (h > 0))
+	{
+		gdi_SetRgn(&rect, x, y, w, h);
+		src.count = 1;
+	}
+
+	return gdi_region_combine(region, region, &src, mode, scratch, bands, nbands);
+}
+
+/**
+ * Combine two complex regions.\n
+ * @msdn{dd183465}
+ * @param dst destination region, may be the same as src1 or src2
+ * @param src1 first source region
+ * @param src2 second source region
+ * @param mode GDI_RGN_AND, GDI_RGN_OR or GDI_RGN_DIFF
+ * @return number of rectangles in the destination region
+ */
+
+int gdi_CombineRegion(HGDI_REGION dst, HGDI_REGION src1, HGDI_REGION src2, int mode)
+{
+	int count;
+	int* bands = NULL;
+	int nbands = 0;
+	GDI_REGION scratch = { 0, 0, NULL };
+
+	count = gdi_region_combine(dst, src1, src2, mode, &scratch, &bands, &nbands);
+
+	xfree(scratch.rects);
+	xfree(bands);
+
+	return count;
+}
+
+/**
+ * Combine a complex region with a rectangle.
+ * @param region source and destination region
+ * @param x x1
+ * @param y y1
+ * @param w width
+ * @param h height
+ * @param mode GDI_RGN_AND, GDI_RGN_OR or GDI_RGN_DIFF
+ * @return number of rectangles in the region
+ */
+
+int gdi_CombineRegionRect(HGDI_REGION region, int x, int y, int w, int h, int mode)
+{
+	int count;
+	int* bands = NULL;
+	int nbands = 0;
+	GDI_REGION scratch = { 0, 0, NULL };
+
+	count = gdi_region_combine_rect(region, x, y, w, h, mode, &scratch, &bands, &nbands);
+
+	xfree(scratch.rects);
+	xfree(bands);
+
+	return count;
+}
+
+static void gdi_region_simplify(HGDI_REGION region, int rectCost, int maxRects,
+		HGDI_REGION scratch, int** bands, int* nbands)
+{
+	int i, j;
+	int pass;
+	int waste;
+	int best;
+	int bestI, bestJ;
+	GDI_RECT a, b, u;
+	int left, top, right, bottom;
+
+	for (pass = 0; (pass < maxRects) && (region->count > 1); pass++)
+	{
+		best = 0x7FFFFFFF;
+		bestI = bestJ = -1;
+
+		for (i = 0; i < region->count; i++)
+		{
+			gdi_RgnToRect(&region->rects[i], &a);
+
+			for (j = i + 1; j < region->count; j++)
+			{
+				gdi_RgnToRect(&region->rects[j], &b);
+
+				/* later bands only get further away */
+				if (b.top - a.bottom > best)
+					break;
+
+				u.left = (a.left < b.left) ? a.left : b.left;
+				u.top = (a.top < b.top) ? a.top : b.top;
+				u.right = (a.right > b.right) ? a.right : b.right;
+				u.bottom = (a.bottom > b.bottom) ? a.bottom : b.bottom;
+
+				waste = (u.right - u.left + 1) * (u.bottom - u.top + 1) -
+					region->rects[i].w * region->rects[i].h -
+					region->rects[j].w * region->rects[j].h;
+
+				if (waste < best)
+				{
+					best = waste;
+					bestI = i;
+					bestJ = j;
+				}
+			}
+		}
+
+		if ((bestI < 0) || ((best > rectCost) && (region->count <= maxRects)))
+			return;
+
+		gdi_RgnToCRect(&region->rects[bestI], &left, &top, &right, &bottom);
+		gdi_RgnToRect(&region->rects[bestJ], &b);
+
+		left = (b.left < left) ? b.left : left;
+		top = (b.top < top) ? b.top : top;
+		right = (b.right > right) ? b.right : right;
+		bottom = (b.bottom > bottom) ? b.bottom : bottom;
+
+		gdi_region_combine_rect(region, left, top, right - left + 1, bottom - top + 1,
+				GDI_RGN_OR, scratch, bands, nbands);
+	}
+
+	if (region->count > maxRects)
+	{
+		/* give up and keep the extents */
+
+		left = region->rects[0].x;
+		top = region->rects[0].y;
+		right = left + region->rects[0].w;
+		bottom = region->rects[region->count - 1].y + region->rects[region->count - 1].h;
+
+		for (i = 1; i < region->count; i++)
+		{
+			left = (region->rects[i].x < left) ? region->rects[i].x : left;
+			right = (region->rects[i].x + region->rects[i].w > right) ? region->rects[i].x + region->rects[i].w : right;
+		}
+
+		region->count = 0;
+		gdi_region_append(region, left, top, right - left, bottom - top);
+	}
+}
+
+/**
+ * Reduce the number of rectangles in a complex region by merging rectangles
+ * into their bounding box. A merge is taken when the area it adds costs less
+ * than updating one more rectangle, or when the region is over maxRects.
+ * The resulting region always covers the original one.
+ * @param region region
+ * @param rectCost cost of an additional rectangle, in pixels
+ * @param maxRects maximum number of rectangles to keep
+ */
+
+void gdi_SimplifyRegion(HGDI_REGION region, int rectCost, int maxRects)
+{
+	int* bands = NULL;
+	int nbands = 0;
+	GDI_REGION scratch = { 0, 0, NULL };
+
+	gdi_region_simplify(region, rectCost, maxRects, &scratch, &bands, &nbands);
+
+	xfree(scratch.rects);
+	xfree(bands);
+}
+
 /**
  * Invalidate a given region, such that it is redrawn on the next region update.\n
  * @msdn{dd145003}
@@ -363,29 +795,60 @@ INLINE int gdi_PtInRect(HGDI_RECT rc, int x, int y)
 
 INLINE int gdi_InvalidateRegion(HGDI_DC hdc, int x, int y, int w, int h)
 {
+	int i;
+	int cx, cy;
+	int cw, ch;
 	GDI_RECT inv;
 	GDI_RECT rgn;
+	HGDI_RGN rect;
+	HGDI_WND hwnd;
 	HGDI_RGN invalid;
-	HGDI_RGN cinvalid;
+	GDI_REGION region;
+
+	hwnd = hdc->hwnd;
 
-	if (hdc->hwnd == NULL)
+	if (hwnd == NULL)
 		return 0;
 
-	if (hdc->hwnd->invalid == NULL)
+	if (hwnd->invalid == NULL)
 		return 0;
 
-	cinvalid = hdc->hwnd->cinvalid;
+	invalid = hwnd->invalid;
+
+	/* front-ends validate the window by resetting the bounding box */
+	if (invalid->null)
+		hwnd->ninvalid = 0;
+
+	cx = (x < 0) ? 0 : x;
+	cy = (y < 0) ? 0 : y;
+	cw = (x < 0) ? w + x : w;
+	ch = (y < 0) ? h + y : h;
 
-	if (hdc->hwnd->ninvalid + 1 > hdc->hwnd->count)
+	/* repeated updates of an area that is already invalid leave the region as is */
+	for (i = 0; (cw > 0) && (ch > 0) && (i < hwnd->ninvalid); i++)
 	{
-		hdc->hwnd->count *= 2;
-		cinvalid = (HGDI_RGN) realloc(cinvalid, sizeof(GDI_RGN) * (hdc->hwnd->count));
-	}
+		rect = &hwnd->cinvalid[i];
 
-	gdi_SetRgn(&cinvalid[hdc->hwnd->ninvalid++], x, y, w, h);
-	hdc->hwnd->cinvalid = cinvalid;
+		if ((cx >= rect->x) && (cy >= rect->y) &&
+			(cx + cw <= rect->x + rect->w) && (cy + ch <= rect->y + rect->h))
+			cw = ch = 0;
+	}
 
-	invalid = hdc->hwnd->invalid;
+	if ((cw > 0) && (ch > 0))
+	{
+		region.count = hwnd->ninvalid;
+		region.size = hwnd->count;
+		region.rects = hwnd->cinvalid;
+
+		gdi_region_combine_rect(&region, cx, cy, cw, ch, GDI_RGN_OR,
+				&hwnd->scratch, &hwnd->bands, &hwnd->nbands);
+		gdi_region_simplify(&region, GDI_REGION_RECT_COST, GDI_REGION_MAX_RECTS,
+				&hwnd->scratch, &hwnd->bands, &hwnd->nbands);
+
+		hwnd->ninvalid = region.count;
+		hwnd->count = region.size;
+		hwnd->cinvalid = region.rects;
+	}
 
 	if (invalid->null)
 	{
@@ -112,6 +112,7 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 				"  --gdi: graphics rendering (hw, sw)\n"
 				"  --no-osb: disable offscreen bitmaps\n"
 				"  --no-bmp-cache: disable bitmap cache\n"
+				"  --bmp-cache-size: bitmap cache memory budget in kilobytes, default is unlimited (0)\n"
 				"  --plugin: load a virtual channel plugin\n"
 				"  --rfx: enable RemoteFX\n"
 				"  --rfx-mode: RemoteFX operational flags (v[ideo], i[mage]), default is video\n"
@@ -130,6 +131,7 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 				"  --certificate-name: use this name for the logon certificate, instead of the server name\n"
 				"  --sec: force protocol security (rdp, tls or nla)\n"
 				"  --tsg: Terminal Server Gateway (<username> <password> <hostname>)\n"
+				"  --tsg-window: gateway receive window in bytes (8192 to 262144, default 262144)\n"
 				"  --kbd-list: list all keyboard layout ids used by -k\n"
 				"  --no-salted-checksum: disable salted checksums with Standard RDP encryption\n"
 				"  --version: print version information\n"
@@ -328,6 +330,27 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 		{
 			settings->bitmap_cache = false;
 		}
+		else if (strcmp("--bmp-cache-size", argv[index]) == 0)
+		{
+			long size;
+
+			index++;
+			if (index == argc)
+			{
+				printf("missing bitmap cache size\n");
+				return FREERDP_ARGS_PARSE_FAILURE;
+			}
+
+			size = strtol(argv[index], &p, 10);
+
+			if ((p == argv[index]) || (*p != '\0') || (size < 0) || (size > 0xFFFFFFFF / 1024))
+			{
+				printf("invalid bitmap cache size: %s\n", argv[index]);
+				return FREERDP_ARGS_PARSE_FAILURE;
+			}
+
+			settings->bitmap_cache_max_memory = (uint32) size * 1024;
+		}
 		else if (strcmp("--no-auth", argv[index]) == 0)
 		{
 			settings->authentication = false;
@@ -604,6 +627,16 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 			}
 			settings->tsg_hostname = xstrdup(argv[index]);
 		}
+		else if (strcmp("--tsg-window", argv[index]) == 0)
+		{
+			index++;
+			if (index == argc)
+			{
+				printf("missing TSG receive window\n");
+				return FREERDP_ARGS_PARSE_FAILURE;
+			}
+			settings->tsg_receive_window = strtoul(argv[index], NULL, 0);
+		}
 		else if (strcmp("--plugin", argv[index]) == 0)
 		{
 			index++;
@@ -20,11 +20,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <freerdp/types.h>
+#include <freerdp/constants.h>
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/dsp.h>
 
-static void freerdp_dsp_resample(FREERDP_DSP_CONTEXT* context,
+#include "dsp_types.h"
+
+#ifdef WITH_SSE2
+#include "dsp_sse2.h"
+#endif
+
+#ifndef DSP_INIT_SIMD
+#define DSP_INIT_SIMD(_kernels) do { } while (0)
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static void freerdp_dsp_resample_nearest(FREERDP_DSP_CONTEXT* context,
 	const uint8* src, int bytes_per_sample,
 	uint32 schan, uint32 srate, int sframes,
 	uint32 rchan, uint32 rrate)
@@ -70,18 +86,318 @@ static void freerdp_dsp_resample(FREERDP_DSP_CONTEXT* context,
 }
 
 /**
- * Microsoft IMA ADPCM specification:
+ * Polyphase windowed-sinc resampler for 16-bit samples.
  *
- * http://wiki.multimedia.cx/index.php?title=Microsoft_IMA_ADPCM
- * http://wiki.multimedia.cx/index.php?title=IMA_ADPCM
+ * The conversion ratio rrate/srate is reduced to L/M. Output frame n sits
+ * at input position n * M / L, and its fractional part selects one of the
+ * filter phases. Channels are converted first, then the frames are kept
+ * planar so that each output sample is a dot product over contiguous
+ * input. The last taps - 1 input frames of a block stay in the work buffer
+ * for the next call, so block boundaries are seamless.
  */
 
-static const sint16 ima_step_index_table[] =
+#define DSP_RESAMPLE_MAX_PHASES		1024
+#define DSP_RESAMPLE_MAX_TAPS		256
+#define DSP_RESAMPLE_COEFF_SHIFT	14
+
+static sint32 dsp_fir16_c(const sint16* samples, const sint16* coeffs, int taps)
 {
-	-1, -1, -1, -1, 2, 4, 6, 8,
-	-1, -1, -1, -1, 2, 4, 6, 8
+	int k;
+	sint32 sum = 0;
+
+	for (k = 0; k < taps; k++)
+		sum += samples[k] * coeffs[k];
+
+	return sum;
+}
+
+static DSP_KERNELS dsp_kernels =
+{
+	dsp_fir16_c
 };
 
+/**
+ * Enable SIMD CPU acceleration for the resampler.
+ * @param cpu_opt detected CPU features (CPU_SSE2)
+ */
+
+void freerdp_dsp_set_cpu_opt(uint32 cpu_opt)
+{
+	if (cpu_opt & CPU_SSE2)
+		DSP_INIT_SIMD(&dsp_kernels);
+}
+
+struct _DSP_RESAMPLER
+{
+	uint32 srate;
+	uint32 rrate;
+	uint32 rchan;
+	int quality;
+
+	int taps;
+	uint32 L; /* output steps per input frame */
+	uint32 M; /* input steps per output frame */
+	int phases;
+	sint16* coeffs; /* phases * taps */
+
+	sint16* work; /* rchan planes of work_size frames */
+	int work_size;
+	int work_frames;
+	uint32 position; /* fractional input position of the next output frame, in 1/L */
+};
+typedef struct _DSP_RESAMPLER DSP_RESAMPLER;
+
+static uint32 dsp_gcd(uint32 a, uint32 b)
+{
+	uint32 t;
+
+	while (b != 0)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static void dsp_resampler_free(DSP_RESAMPLER* resampler)
+{
+	if (resampler)
+	{
+		xfree(resampler->coeffs);
+		xfree(resampler->work);
+		xfree(resampler);
+	}
+}
+
+static void dsp_resampler_design(DSP_RESAMPLER* resampler)
+{
+	int p, k;
+	int center;
+	double cutoff;
+	double t, x, w;
+	double sum;
+	double* h;
+	sint16* coeffs;
+	sint32 isum;
+
+	/* low-pass at the lower of the two Nyquist frequencies, leaving room for the transition band */
+	cutoff = (resampler->rrate < resampler->srate ? (double) resampler->rrate / resampler->srate : 1.0);
+	cutoff *= (resampler->taps >= 32 ? 0.95 : (resampler->taps >= 16 ? 0.9 : 0.8));
+
+	center = resampler->taps / 2 - 1;
+	h = (double*) xmalloc(resampler->taps * sizeof(double));
+	resampler->coeffs = (sint16*) xmalloc(resampler->phases * resampler->taps * sizeof(sint16));
+
+	for (p = 0; p < resampler->phases; p++)
+	{
+		coeffs = &resampler->coeffs[p * resampler->taps];
+		sum = 0;
+
+		for (k = 0; k < resampler->taps; k++)
+		{
+			t = k - center - (double) p / resampler->phases;
+			x = M_PI * cutoff * t;
+			/* Blackman window over the filter span */
+			w = 0.42 + 0.5 * cos(M_PI * t / (resampler->taps / 2)) +
+				0.08 * cos(2 * M_PI * t / (resampler->taps / 2));
+			h[k] = (x == 0 ? 1.0 : sin(x) / x) * (w > 0 ? w : 0);
+			sum += h[k];
+		}
+
+		/* unity gain for every phase, the rounding error goes to a center tap */
+		isum = 0;
+		for (k = 0; k < resampler->taps; k++)
+		{
+			coeffs[k] = (sint16) floor(h[k] / sum * (1 << DSP_RESAMPLE_COEFF_SHIFT) + 0.5);
+			isum += coeffs[k];
+		}
+		coeffs[center + (p * 2 >= resampler->phases ? 1 : 0)] += (1 << DSP_RESAMPLE_COEFF_SHIFT) - isum;
+	}
+
+	xfree(h);
+}
+
+static DSP_RESAMPLER* dsp_resampler_new(uint32 srate, uint32 rrate, uint32 rchan, int quality)
+{
+	DSP_RESAMPLER* resampler;
+	uint32 gcd;
+
+	resampler = xnew(DSP_RESAMPLER);
+	resampler->srate = srate;
+	resampler->rrate = rrate;
+	resampler->rchan = rchan;
+	resampler->quality = quality;
+
+	switch (quality)
+	{
+		case FREERDP_DSP_RESAMPLE_LOW:
+			resampler->taps = 8;
+			break;
+		case FREERDP_DSP_RESAMPLE_HIGH:
+			resampler->taps = 32;
+			break;
+		default:
+			resampler->taps = 16;
+			break;
+	}
+
+	/* when decimating, the filter has to span the same time at the lower rate */
+	if (srate > rrate)
+	{
+		resampler->taps = (int) (((uint64) resampler->taps * srate / rrate + 7) & ~7);
+		if (resampler->taps > DSP_RESAMPLE_MAX_TAPS)
+			resampler->taps = DSP_RESAMPLE_MAX_TAPS;
+	}
+
+	gcd = dsp_gcd(srate, rrate);
+	resampler->L = rrate / gcd;
+	resampler->M = srate / gcd;
+	resampler->phases = (resampler->L > DSP_RESAMPLE_MAX_PHASES ? DSP_RESAMPLE_MAX_PHASES : resampler->L);
+
+	dsp_resampler_design(resampler);
+
+	/* prime with silence so the first output frame lines up with the first input frame */
+	resampler->work_frames = resampler->taps / 2 - 1;
+
+	return resampler;
+}
+
+static void dsp_resampler_process(DSP_RESAMPLER* resampler, FREERDP_DSP_CONTEXT* context,
+	const uint8* src, uint32 schan, int sframes)
+{
+	int i, c, sc;
+	int frames;
+	int rframes;
+	int rsize;
+	int base;
+	int taps = resampler->taps;
+	int rchan = resampler->rchan;
+	uint32 L = resampler->L;
+	uint32 M = resampler->M;
+	uint32 position;
+	sint32 v;
+	sint16* dst;
+	sint16* work;
+	sint16* plane;
+	const sint16* coeffs;
+	const sint16* in = (const sint16*) src;
+	pDspFir16 fir16 = dsp_kernels.fir16;
+
+	frames = resampler->work_frames + sframes;
+
+	if (frames > resampler->work_size)
+	{
+		/* the planes are laid out back to back, so growing repacks them */
+		work = (sint16*) xzalloc(frames * rchan * sizeof(sint16));
+		for (c = 0; c < rchan && resampler->work; c++)
+		{
+			memcpy(&work[c * frames], &resampler->work[c * resampler->work_size],
+				resampler->work_frames * sizeof(sint16));
+		}
+		xfree(resampler->work);
+		resampler->work = work;
+		resampler->work_size = frames;
+	}
+
+	/* append the new frames, converted to rchan planar channels */
+	for (c = 0; c < rchan; c++)
+	{
+		plane = &resampler->work[c * resampler->work_size + resampler->work_frames];
+
+		if (schan == 2 && rchan == 1)
+		{
+			for (i = 0; i < sframes; i++)
+				plane[i] = (sint16) ((in[i * 2] + in[i * 2 + 1]) >> 1);
+		}
+		else
+		{
+			sc = (c < (int) schan ? c : (int) schan - 1);
+			for (i = 0; i < sframes; i++)
+				plane[i] = in[i * schan + sc];
+		}
+	}
+
+	/* upper bound of the frames produced from this block */
+	rframes = (frames >= taps ? (int) (((uint64) (frames - taps + 1) * L + M - 1) / M) + 1 : 0);
+	rsize = rframes * rchan * sizeof(sint16);
+
+	if (rsize > (int) context->resampled_maxlength)
+	{
+		context->resampled_maxlength = rsize + 1024;
+		context->resampled_buffer = (uint8*) xrealloc(context->resampled_buffer, context->resampled_maxlength);
+	}
+
+	dst = (sint16*) context->resampled_buffer;
+	position = resampler->position;
+	base = 0;
+	rframes = 0;
+
+	while (base + taps <= frames)
+	{
+		coeffs = &resampler->coeffs[(uint64) position * resampler->phases / L * taps];
+
+		for (c = 0; c < rchan; c++)
+		{
+			v = fir16(&resampler->work[c * resampler->work_size + base], coeffs, taps);
+			v = (v + (1 << (DSP_RESAMPLE_COEFF_SHIFT - 1))) >> DSP_RESAMPLE_COEFF_SHIFT;
+			*dst++ = (sint16) (v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+		}
+		rframes++;
+
+		position += M;
+		base += position / L;
+		position %= L;
+	}
+
+	/* keep the frames the next output frames still need */
+	if (base > frames)
+		base = frames;
+	for (c = 0; c < rchan; c++)
+	{
+		plane = &resampler->work[c * resampler->work_size];
+		memmove(plane, plane + base, (frames - base) * sizeof(sint16));
+	}
+	resampler->work_frames = frames - base;
+	resampler->position = position;
+
+	context->resampled_frames = rframes;
+	context->resampled_size = rframes * rchan * sizeof(sint16);
+}
+
+static void freerdp_dsp_resample(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int bytes_per_sample,
+	uint32 schan, uint32 srate, int sframes,
+	uint32 rchan, uint32 rrate)
+{
+	DSP_RESAMPLER* resampler = (DSP_RESAMPLER*) context->resampler;
+
+	if (bytes_per_sample != 2 || srate == rrate || srate == 0 || rrate == 0)
+	{
+		freerdp_dsp_resample_nearest(context, src, bytes_per_sample,
+			schan, srate, sframes, rchan, rrate);
+		return;
+	}
+
+	if (resampler == NULL || resampler->srate != srate || resampler->rrate != rrate ||
+		resampler->rchan != rchan || resampler->quality != context->resample_quality)
+	{
+		dsp_resampler_free(resampler);
+		resampler = dsp_resampler_new(srate, rrate, rchan, context->resample_quality);
+		context->resampler = resampler;
+	}
+
+	dsp_resampler_process(resampler, context, src, schan, sframes);
+}
+
+/**
+ * Microsoft IMA ADPCM specification:
+ *
+ * http://wiki.multimedia.cx/index.php?title=Microsoft_IMA_ADPCM
+ * http://wiki.multimedia.cx/index.php?title=IMA_ADPCM
+ */
+
 static const sint16 ima_step_size_table[] =
 {
 	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 
@@ -95,20 +411,216 @@ static const sint16 ima_step_size_table[] =
 	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767 
 };
 
-static uint16 dsp_decode_ima_adpcm_sample(ADPCM* adpcm,
+/**
+ * Difference magnitude for each step index and the low three bits of a
+ * nibble: ss >> 3, plus ss >> 2, ss >> 1 and ss for bits 0, 1 and 2.
+ * The sign comes from bit 3.
+ */
+static const uint16 ima_step_delta_table[89][8] =
+{
+	{ 0, 1, 3, 4, 7, 8, 10, 11 },
+	{ 1, 3, 5, 7, 9, 11, 13, 15 },
+	{ 1, 3, 5, 7, 10, 12, 14, 16 },
+	{ 1, 3, 6, 8, 11, 13, 16, 18 },
+	{ 1, 3, 6, 8, 12, 14, 17, 19 },
+	{ 1, 4, 7, 10, 13, 16, 19, 22 },
+	{ 1, 4, 7, 10, 14, 17, 20, 23 },
+	{ 1, 4, 8, 11, 15, 18, 22, 25 },
+	{ 2, 6, 10, 14, 18, 22, 26, 30 },
+	{ 2, 6, 10, 14, 19, 23, 27, 31 },
+	{ 2, 6, 11, 15, 21, 25, 30, 34 },
+	{ 2, 7, 12, 17, 23, 28, 33, 38 },
+	{ 2, 7, 13, 18, 25, 30, 36, 41 },
+	{ 3, 9, 15, 21, 28, 34, 40, 46 },
+	{ 3, 10, 17, 24, 31, 38, 45, 52 },
+	{ 3, 10, 18, 25, 34, 41, 49, 56 },
+	{ 4, 12, 21, 29, 38, 46, 55, 63 },
+	{ 4, 13, 22, 31, 41, 50, 59, 68 },
+	{ 5, 15, 25, 35, 46, 56, 66, 76 },
+	{ 5, 16, 27, 38, 50, 61, 72, 83 },
+	{ 6, 18, 31, 43, 56, 68, 81, 93 },
+	{ 6, 19, 33, 46, 61, 74, 88, 101 },
+	{ 7, 22, 37, 52, 67, 82, 97, 112 },
+	{ 8, 24, 41, 57, 74, 90, 107, 123 },
+	{ 9, 27, 45, 63, 82, 100, 118, 136 },
+	{ 10, 30, 50, 70, 90, 110, 130, 150 },
+	{ 11, 33, 55, 77, 99, 121, 143, 165 },
+	{ 12, 36, 60, 84, 109, 133, 157, 181 },
+	{ 13, 39, 66, 92, 120, 146, 173, 199 },
+	{ 14, 43, 73, 102, 132, 161, 191, 220 },
+	{ 16, 48, 81, 113, 146, 178, 211, 243 },
+	{ 17, 52, 88, 123, 160, 195, 231, 266 },
+	{ 19, 58, 97, 136, 176, 215, 254, 293 },
+	{ 21, 64, 107, 150, 194, 237, 280, 323 },
+	{ 23, 70, 118, 165, 213, 260, 308, 355 },
+	{ 26, 78, 130, 182, 235, 287, 339, 391 },
+	{ 28, 85, 143, 200, 258, 315, 373, 430 },
+	{ 31, 94, 157, 220, 284, 347, 410, 473 },
+	{ 34, 103, 173, 242, 313, 382, 452, 521 },
+	{ 38, 114, 191, 267, 345, 421, 498, 574 },
+	{ 42, 126, 210, 294, 379, 463, 547, 631 },
+	{ 46, 138, 231, 323, 417, 509, 602, 694 },
+	{ 51, 153, 255, 357, 459, 561, 663, 765 },
+	{ 56, 168, 280, 392, 505, 617, 729, 841 },
+	{ 61, 184, 308, 431, 555, 678, 802, 925 },
+	{ 68, 204, 340, 476, 612, 748, 884, 1020 },
+	{ 74, 223, 373, 522, 672, 821, 971, 1120 },
+	{ 82, 246, 411, 575, 740, 904, 1069, 1233 },
+	{ 90, 271, 452, 633, 814, 995, 1176, 1357 },
+	{ 99, 298, 497, 696, 895, 1094, 1293, 1492 },
+	{ 109, 328, 547, 766, 985, 1204, 1423, 1642 },
+	{ 120, 360, 601, 841, 1083, 1323, 1564, 1804 },
+	{ 132, 397, 662, 927, 1192, 1457, 1722, 1987 },
+	{ 145, 436, 728, 1019, 1311, 1602, 1894, 2185 },
+	{ 160, 480, 801, 1121, 1442, 1762, 2083, 2403 },
+	{ 176, 528, 881, 1233, 1587, 1939, 2292, 2644 },
+	{ 194, 582, 970, 1358, 1746, 2134, 2522, 2910 },
+	{ 213, 639, 1066, 1492, 1920, 2346, 2773, 3199 },
+	{ 234, 703, 1173, 1642, 2112, 2581, 3051, 3520 },
+	{ 258, 774, 1291, 1807, 2324, 2840, 3357, 3873 },
+	{ 284, 852, 1420, 1988, 2556, 3124, 3692, 4260 },
+	{ 312, 936, 1561, 2185, 2811, 3435, 4060, 4684 },
+	{ 343, 1030, 1717, 2404, 3092, 3779, 4466, 5153 },
+	{ 378, 1134, 1890, 2646, 3402, 4158, 4914, 5670 },
+	{ 415, 1246, 2078, 2909, 3742, 4573, 5405, 6236 },
+	{ 457, 1372, 2287, 3202, 4117, 5032, 5947, 6862 },
+	{ 503, 1509, 2516, 3522, 4529, 5535, 6542, 7548 },
+	{ 553, 1660, 2767, 3874, 4981, 6088, 7195, 8302 },
+	{ 608, 1825, 3043, 4260, 5479, 6696, 7914, 9131 },
+	{ 669, 2008, 3348, 4687, 6027, 7366, 8706, 10045 },
+	{ 736, 2209, 3683, 5156, 6630, 8103, 9577, 11050 },
+	{ 810, 2431, 4052, 5673, 7294, 8915, 10536, 12157 },
+	{ 891, 2674, 4457, 6240, 8023, 9806, 11589, 13372 },
+	{ 980, 2941, 4902, 6863, 8825, 10786, 12747, 14708 },
+	{ 1078, 3235, 5393, 7550, 9708, 11865, 14023, 16180 },
+	{ 1186, 3559, 5932, 8305, 10679, 13052, 15425, 17798 },
+	{ 1305, 3915, 6526, 9136, 11747, 14357, 16968, 19578 },
+	{ 1435, 4306, 7178, 10049, 12922, 15793, 18665, 21536 },
+	{ 1579, 4737, 7896, 11054, 14214, 17372, 20531, 23689 },
+	{ 1737, 5211, 8686, 12160, 15636, 19110, 22585, 26059 },
+	{ 1911, 5733, 9555, 13377, 17200, 21022, 24844, 28666 },
+	{ 2102, 6306, 10511, 14715, 18920, 23124, 27329, 31533 },
+	{ 2312, 6937, 11562, 16187, 20812, 25437, 30062, 34687 },
+	{ 2543, 7630, 12718, 17805, 22893, 27980, 33068, 38155 },
+	{ 2798, 8394, 13990, 19586, 25183, 30779, 36375, 41971 },
+	{ 3077, 9232, 15388, 21543, 27700, 33855, 40011, 46166 },
+	{ 3385, 10156, 16928, 23699, 30471, 37242, 44014, 50785 },
+	{ 3724, 11172, 18621, 26069, 33518, 40966, 48415, 55863 },
+	{ 4095, 12286, 20478, 28669, 36862, 45053, 53245, 61436 },
+};
+
+/* step index that follows each step index and nibble, already clamped to 0..88 */
+static const uint8 ima_next_step_table[89][8] =
+{
+	{ 0, 0, 0, 0, 2, 4, 6, 8 },
+	{ 0, 0, 0, 0, 3, 5, 7, 9 },
+	{ 1, 1, 1, 1, 4, 6, 8, 10 },
+	{ 2, 2, 2, 2, 5, 7, 9, 11 },
+	{ 3, 3, 3, 3, 6, 8, 10, 12 },
+	{ 4, 4, 4, 4, 7, 9, 11, 13 },
+	{ 5, 5, 5, 5, 8, 10, 12, 14 },
+	{ 6, 6, 6, 6, 9, 11, 13, 15 },
+	{ 7, 7, 7, 7, 10, 12, 14, 16 },
+	{ 8, 8, 8, 8, 11, 13, 15, 17 },
+	{ 9, 9, 9, 9, 12, 14, 16, 18 },
+	{ 10, 10, 10, 10, 13, 15, 17, 19 },
+	{ 11, 11, 11, 11, 14, 16, 18, 20 },
+	{ 12, 12, 12, 12, 15, 17, 19, 21 },
+	{ 13, 13, 13, 13, 16, 18, 20, 22 },
+	{ 14, 14, 14, 14, 17, 19, 21, 23 },
+	{ 15, 15, 15, 15, 18, 20, 22, 24 },
+	{ 16, 16, 16, 16, 19, 21, 23, 25 },
+	{ 17, 17, 17, 17, 20, 22, 24, 26 },
+	{ 18, 18, 18, 18, 21, 23, 25, 27 },
+	{ 19, 19, 19, 19, 22, 24, 26, 28 },
+	{ 20, 20, 20, 20, 23, 25, 27, 29 },
+	{ 21, 21, 21, 21, 24, 26, 28, 30 },
+	{ 22, 22, 22, 22, 25, 27, 29, 31 },
+	{ 23, 23, 23, 23, 26, 28, 30, 32 },
+	{ 24, 24, 24, 24, 27, 29, 31, 33 },
+	{ 25, 25, 25, 25, 28, 30, 32, 34 },
+	{ 26, 26, 26, 26, 29, 31, 33, 35 },
+	{ 27, 27, 27, 27, 30, 32, 34, 36 },
+	{ 28, 28, 28, 28, 31, 33, 35, 37 },
+	{ 29, 29, 29, 29, 32, 34, 36, 38 },
+	{ 30, 30, 30, 30, 33, 35, 37, 39 },
+	{ 31, 31, 31, 31, 34, 36, 38, 40 },
+	{ 32, 32, 32, 32, 35, 37, 39, 41 },
+	{ 33, 33, 33, 33, 36, 38, 40, 42 },
+	{ 34, 34, 34, 34, 37, 39, 41, 43 },
+	{ 35, 35, 35, 35, 38, 40, 42, 44 },
+	{ 36, 36, 36, 36, 39, 41, 43, 45 },
+	{ 37, 37, 37, 37, 40, 42, 44, 46 },
+	{ 38, 38, 38, 38, 41, 43, 45, 47 },
+	{ 39, 39, 39, 39, 42, 44, 46, 48 },
+	{ 40, 40, 40, 40, 43, 45, 47, 49 },
+	{ 41, 41, 41, 41, 44, 46, 48, 50 },
+	{ 42, 42, 42, 42, 45, 47, 49, 51 },
+	{ 43, 43, 43, 43, 46, 48, 50, 52 },
+	{ 44, 44, 44, 44, 47, 49, 51, 53 },
+	{ 45, 45, 45, 45, 48, 50, 52, 54 },
+	{ 46, 46, 46, 46, 49, 51, 53, 55 },
+	{ 47, 47, 47, 47, 50, 52, 54, 56 },
+	{ 48, 48, 48, 48, 51, 53, 55, 57 },
+	{ 49, 49, 49, 49, 52, 54, 56, 58 },
+	{ 50, 50, 50, 50, 53, 55, 57, 59 },
+	{ 51, 51, 51, 51, 54, 56, 58, 60 },
+	{ 52, 52, 52, 52, 55, 57, 59, 61 },
+	{ 53, 53, 53, 53, 56, 58, 60, 62 },
+	{ 54, 54, 54, 54, 57, 59, 61, 63 },
+	{ 55, 55, 55, 55, 58, 60, 62, 64 },
+	{ 56, 56, 56, 56, 59, 61, 63, 65 },
+	{ 57, 57, 57, 57, 60, 62, 64, 66 },
+	{ 58, 58, 58, 58, 61, 63, 65, 67 },
+	{ 59, 59, 59, 59, 62, 64, 66, 68 },
+	{ 60, 60, 60, 60, 63, 65, 67, 69 },
+	{ 61, 61, 61, 61, 64, 66, 68, 70 },
+	{ 62, 62, 62, 62, 65, 67, 69, 71 },
+	{ 63, 63, 63, 63, 66, 68, 70, 72 },
+	{ 64, 64, 64, 64, 67, 69, 71, 73 },
+	{ 65, 65, 65, 65, 68, 70, 72, 74 },
+	{ 66, 66, 66, 66, 69, 71, 73, 75 },
+	{ 67, 67, 67, 67, 70, 72, 74, 76 },
+	{ 68, 68, 68, 68, 71, 73, 75, 77 },
+	{ 69, 69, 69, 69, 72, 74, 76, 78 },
+	{ 70, 70, 70, 70, 73, 75, 77, 79 },
+	{ 71, 71, 71, 71, 74, 76, 78, 80 },
+	{ 72, 72, 72, 72, 75, 77, 79, 81 },
+	{ 73, 73, 73, 73, 76, 78, 80, 82 },
+	{ 74, 74, 74, 74, 77, 79, 81, 83 },
+	{ 75, 75, 75, 75, 78, 80, 82, 84 },
+	{ 76, 76, 76, 76, 79, 81, 83, 85 },
+	{ 77, 77, 77, 77, 80, 82, 84, 86 },
+	{ 78, 78, 78, 78, 81, 83, 85, 87 },
+	{ 79, 79, 79, 79, 82, 84, 86, 88 },
+	{ 80, 80, 80, 80, 83, 85, 87, 88 },
+	{ 81, 81, 81, 81, 84, 86, 88, 88 },
+	{ 82, 82, 82, 82, 85, 87, 88, 88 },
+	{ 83, 83, 83, 83, 86, 88, 88, 88 },
+	{ 84, 84, 84, 84, 87, 88, 88, 88 },
+	{ 85, 85, 85, 85, 88, 88, 88, 88 },
+	{ 86, 86, 86, 86, 88, 88, 88, 88 },
+	{ 87, 87, 87, 87, 88, 88, 88, 88 },
+};
+
+static INLINE sint16 dsp_read_sint16(const uint8* src)
+{
+	return (sint16) (((uint16) src[0]) | (((uint16) src[1]) << 8));
+}
+
+static INLINE sint16 dsp_ima_adpcm_step_index(uint8 step)
+{
+	return (step > 88 ? 88 : step);
+}
+
+static INLINE uint16 dsp_decode_ima_adpcm_sample(ADPCM* adpcm,
 	int channel, uint8 sample)
 {
-	sint32 ss;
 	sint32 d;
+	int step;
 
-	ss = ima_step_size_table[adpcm->ima.last_step[channel]];
-	d = (ss >> 3);
-	if (sample & 1)
-		d += (ss >> 2);
-	if (sample & 2)
-		d += (ss >> 1);
-	if (sample & 4)
-		d += ss;
+	step = adpcm->ima.last_step[channel];
+	d = ima_step_delta_table[step][sample & 7];
 	if (sample & 8)
 		d = -d;
 	d += adpcm->ima.last_sample[channel];
@@ -119,12 +631,7 @@ static uint16 dsp_decode_ima_adpcm_sample(ADPCM* adpcm,
 		d = 32767;
 
 	adpcm->ima.last_sample[channel] = (sint16) d;
-
-	adpcm->ima.last_step[channel] += ima_step_index_table[sample];
-	if (adpcm->ima.last_step[channel] < 0)
-		adpcm->ima.last_step[channel] = 0;
-	else if (adpcm->ima.last_step[channel] > 88)
-		adpcm->ima.last_step[channel] = 88;
+	adpcm->ima.last_step[channel] = ima_next_step_table[step][sample & 7];
 
 	return (uint16) d;
 }
@@ -150,15 +657,15 @@ static void freerdp_dsp_decode_ima_adpcm(FREERDP_DSP_CONTEXT* context,
 	{
 		if (size % block_size == 0)
 		{
-			context->adpcm.ima.last_sample[0] = (sint16) (((uint16)(*src)) | (((uint16)(*(src + 1))) << 8));
-			context->adpcm.ima.last_step[0] = (sint16) (*(src + 2));
+			context->adpcm.ima.last_sample[0] = dsp_read_sint16(src);
+			context->adpcm.ima.last_step[0] = dsp_ima_adpcm_step_index(src[2]);
 			src += 4;
 			size -= 4;
 			out_size -= 16;
 			if (channels > 1)
 			{
-				context->adpcm.ima.last_sample[1] = (sint16) (((uint16)(*src)) | (((uint16)(*(src + 1))) << 8));
-				context->adpcm.ima.last_step[1] = (sint16) (*(src + 2));
+				context->adpcm.ima.last_sample[1] = dsp_read_sint16(src);
+				context->adpcm.ima.last_step[1] = dsp_ima_adpcm_step_index(src[2]);
 				src += 4;
 				size -= 4;
 				out_size -= 16;
@@ -201,49 +708,18 @@ static void freerdp_dsp_decode_ima_adpcm(FREERDP_DSP_CONTEXT* context,
 	context->adpcm_size = dst - context->adpcm_buffer;
 }
 
-/**
- * 0     1     2     3
- * 2 0   6 4   10 8  14 12   <left>
- *
- * 4     5     6     7
- * 3 1   7 5   11 9  15 13   <right>
- */
-static const struct
-{
-	uint8 byte_num;
-	uint8 byte_shift;
-} ima_stereo_encode_map[] =
-{
-	{ 0, 0 },
-	{ 4, 0 },
-	{ 0, 4 },
-	{ 4, 4 },
-	{ 1, 0 },
-	{ 5, 0 },
-	{ 1, 4 },
-	{ 5, 4 },
-	{ 2, 0 },
-	{ 6, 0 },
-	{ 2, 4 },
-	{ 6, 4 },
-	{ 3, 0 },
-	{ 7, 0 },
-	{ 3, 4 },
-	{ 7, 4 }
-};
-
-static uint8 dsp_encode_ima_adpcm_sample(ADPCM* adpcm,
+static INLINE uint8 dsp_encode_ima_adpcm_sample(ADPCM* adpcm,
 	int channel, sint16 sample)
 {
 	sint32 e;
-	sint32 d;
 	sint32 ss;
-	uint8 enc;
 	sint32 diff;
+	uint8 enc;
+	int step;
 
-	ss = ima_step_size_table[adpcm->ima.last_step[channel]];
-	d = e = sample - adpcm->ima.last_sample[channel];
-	diff = ss >> 3;
+	step = adpcm->ima.last_step[channel];
+	ss = ima_step_size_table[step];
+	e = sample - adpcm->ima.last_sample[channel];
 	enc = 0;
 	if (e < 0)
 	{
@@ -263,92 +739,111 @@ static uint8 dsp_encode_ima_adpcm_sample(ADPCM* adpcm,
 	}
 	ss >>= 1;
 	if (e >= ss)
-	{
 		enc |= 1;
-		e -= ss;
-	}
-
-	if (d < 0)
-		diff = d + e - diff;
-	else
-		diff = d - e + diff;
 
+	/* reconstruct exactly as the decoder will */
+	diff = ima_step_delta_table[step][enc & 7];
+	if (enc & 8)
+		diff = -diff;
 	diff += adpcm->ima.last_sample[channel];
+
 	if (diff < -32768)
 		diff = -32768;
 	else if (diff > 32767)
 		diff = 32767;
-	adpcm->ima.last_sample[channel] = (sint16) diff;
 
-	adpcm->ima.last_step[channel] += ima_step_index_table[enc];
-	if (adpcm->ima.last_step[channel] < 0)
-		adpcm->ima.last_step[channel] = 0;
-	else if (adpcm->ima.last_step[channel] > 88)
-		adpcm->ima.last_step[channel] = 88;
+	adpcm->ima.last_sample[channel] = (sint16) diff;
+	adpcm->ima.last_step[channel] = ima_next_step_table[step][enc & 7];
 
 	return enc;
 }
 
-static void freerdp_dsp_encode_ima_adpcm(FREERDP_DSP_CONTEXT* context,
-	const uint8* src, int size, int channels, int block_size)
+/**
+ * Encode size bytes of 16-bit PCM into dst, which must hold at least
+ * freerdp_dsp_adpcm_encode_max_size(size) bytes. Returns the encoded size.
+ */
+
+int freerdp_dsp_encode_ima_adpcm_to(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int size, int channels, int block_size, uint8* dst)
 {
-	uint8* dst;
-	sint16 sample;
-	uint8 encoded;
-	uint32 out_size;
+	ADPCM adpcm;
+	uint8* start;
 	int i;
 
-	out_size = size / 2;
-	if (out_size > context->adpcm_maxlength)
-	{
-		context->adpcm_maxlength = out_size + 1024;
-		context->adpcm_buffer = xrealloc(context->adpcm_buffer, context->adpcm_maxlength);
-	}
-	dst = context->adpcm_buffer;
+	/* work on a local copy so that the channel states stay in registers */
+	adpcm = context->adpcm;
+	start = dst;
+
 	while (size > 0)
 	{
-		if ((dst - context->adpcm_buffer) % block_size == 0)
+		if ((dst - start) % block_size == 0)
 		{
-			*dst++ = context->adpcm.ima.last_sample[0] & 0xff;
-			*dst++ = (context->adpcm.ima.last_sample[0] >> 8) & 0xff;
-			*dst++ = (uint8) context->adpcm.ima.last_step[0];
+			*dst++ = adpcm.ima.last_sample[0] & 0xff;
+			*dst++ = (adpcm.ima.last_sample[0] >> 8) & 0xff;
+			*dst++ = (uint8) adpcm.ima.last_step[0];
 			*dst++ = 0;
 			if (channels > 1)
 			{
-				*dst++ = context->adpcm.ima.last_sample[1] & 0xff;
-				*dst++ = (context->adpcm.ima.last_sample[1] >> 8) & 0xff;
-				*dst++ = (uint8) context->adpcm.ima.last_step[1];
+				*dst++ = adpcm.ima.last_sample[1] & 0xff;
+				*dst++ = (adpcm.ima.last_sample[1] >> 8) & 0xff;
+				*dst++ = (uint8) adpcm.ima.last_step[1];
 				*dst++ = 0;
 			}
 		}
 
 		if (channels > 1)
 		{
-			memset(dst, 0, 8);
-			for (i = 0; i < 16; i++)
+			/**
+			 * 8 frames give 4 bytes of left nibbles followed by 4 bytes of right
+			 * nibbles, low nibble first. The two channels are independent, so
+			 * their dependency chains are interleaved.
+			 *
+			 * 0     1     2     3
+			 * 2 0   6 4   10 8  14 12   <left>
+			 *
+			 * 4     5     6     7
+			 * 3 1   7 5   11 9  15 13   <right>
+			 */
+			for (i = 0; i < 4; i++)
 			{
-				sample = (sint16) (((uint16)(*src)) | (((uint16)(*(src + 1))) << 8));
-				src += 2;
-				encoded = dsp_encode_ima_adpcm_sample(&context->adpcm, i % 2, sample);
-				dst[ima_stereo_encode_map[i].byte_num] |= encoded << ima_stereo_encode_map[i].byte_shift;
+				dst[i] = dsp_encode_ima_adpcm_sample(&adpcm, 0, dsp_read_sint16(src));
+				dst[i + 4] = dsp_encode_ima_adpcm_sample(&adpcm, 1, dsp_read_sint16(src + 2));
+				dst[i] |= dsp_encode_ima_adpcm_sample(&adpcm, 0, dsp_read_sint16(src + 4)) << 4;
+				dst[i + 4] |= dsp_encode_ima_adpcm_sample(&adpcm, 1, dsp_read_sint16(src + 6)) << 4;
+				src += 8;
 			}
 			dst += 8;
 			size -= 32;
 		}
 		else
 		{
-			sample = (sint16) (((uint16)(*src)) | (((uint16)(*(src + 1))) << 8));
-			src += 2;
-			encoded = dsp_encode_ima_adpcm_sample(&context->adpcm, 0, sample);
-			sample = (sint16) (((uint16)(*src)) | (((uint16)(*(src + 1))) << 8));
-			src += 2;
-			encoded |= dsp_encode_ima_adpcm_sample(&context->adpcm, 0, sample) << 4;
-			*dst++ = encoded;
+			*dst = dsp_encode_ima_adpcm_sample(&adpcm, 0, dsp_read_sint16(src));
+			*dst++ |= dsp_encode_ima_adpcm_sample(&adpcm, 0, dsp_read_sint16(src + 2)) << 4;
+			src += 4;
 			size -= 4;
 		}
 	}
-	
-	context->adpcm_size = dst - context->adpcm_buffer;
+
+	context->adpcm = adpcm;
+
+	return dst - start;
+}
+
+static void dsp_check_adpcm_buffer(FREERDP_DSP_CONTEXT* context, uint32 out_size)
+{
+	if (out_size > context->adpcm_maxlength)
+	{
+		context->adpcm_maxlength = out_size;
+		context->adpcm_buffer = xrealloc(context->adpcm_buffer, context->adpcm_maxlength);
+	}
+}
+
+static void freerdp_dsp_encode_ima_adpcm(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int size, int channels, int block_size)
+{
+	dsp_check_adpcm_buffer(context, freerdp_dsp_adpcm_encode_max_size(size));
+	context->adpcm_size = freerdp_dsp_encode_ima_adpcm_to(context,
+		src, size, channels, block_size, context->adpcm_buffer);
 }
 
 /**
@@ -373,7 +868,7 @@ static const sint16 ms_adpcm_coeff2_table[] =
 	0, -256, 0, 64, 0, -208, -232
 };
 
-static sint16 freerdp_dsp_decode_ms_adpcm_sample(ADPCM* adpcm, uint8 sample, int channel)
+static INLINE sint16 freerdp_dsp_decode_ms_adpcm_sample(ADPCM* adpcm, uint8 sample, int channel)
 {
 	sint8 nibble;
 	sint32 presample;
@@ -487,7 +982,7 @@ static void freerdp_dsp_decode_ms_adpcm(FREERDP_DSP_CONTEXT* context,
 	context->adpcm_size = dst - context->adpcm_buffer;
 }
 
-static uint8 freerdp_dsp_encode_ms_adpcm_sample(ADPCM* adpcm, sint32 sample, int channel)
+static INLINE uint8 freerdp_dsp_encode_ms_adpcm_sample(ADPCM* adpcm, sint32 sample, int channel)
 {
 	sint32 presample;
 	sint32 errordelta;
@@ -514,76 +1009,94 @@ static uint8 freerdp_dsp_encode_ms_adpcm_sample(ADPCM* adpcm, sint32 sample, int
 	return ((uint8)errordelta) & 0x0F;
 }
 
-static void freerdp_dsp_encode_ms_adpcm(FREERDP_DSP_CONTEXT* context,
-	const uint8* src, int size, int channels, int block_size)
+/**
+ * Encode size bytes of 16-bit PCM into dst, which must hold at least
+ * freerdp_dsp_adpcm_encode_max_size(size) bytes. Returns the encoded size.
+ */
+
+int freerdp_dsp_encode_ms_adpcm_to(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int size, int channels, int block_size, uint8* dst)
 {
-	uint8* dst;
+	ADPCM adpcm;
+	uint8* start;
 	sint32 sample;
-	uint32 out_size;
 
-	out_size = size / 2;
-	if (out_size > context->adpcm_maxlength)
-	{
-		context->adpcm_maxlength = out_size + 1024;
-		context->adpcm_buffer = xrealloc(context->adpcm_buffer, context->adpcm_maxlength);
-	}
-	dst = context->adpcm_buffer;
+	/* work on a local copy so that the channel states stay in registers */
+	adpcm = context->adpcm;
+	start = dst;
 
-	if (context->adpcm.ms.delta[0] < 16)
-		context->adpcm.ms.delta[0] = 16;
-	if (context->adpcm.ms.delta[1] < 16)
-		context->adpcm.ms.delta[1] = 16;
+	if (adpcm.ms.delta[0] < 16)
+		adpcm.ms.delta[0] = 16;
+	if (adpcm.ms.delta[1] < 16)
+		adpcm.ms.delta[1] = 16;
 
 	while (size > 0)
 	{
-		if ((dst - context->adpcm_buffer) % block_size == 0)
+		if ((dst - start) % block_size == 0)
 		{
 			if (channels > 1)
 			{
-				*dst++ = context->adpcm.ms.predictor[0];
-				*dst++ = context->adpcm.ms.predictor[1];
-				*dst++ = (uint8) (context->adpcm.ms.delta[0] & 0xff);
-				*dst++ = (uint8) ((context->adpcm.ms.delta[0] >> 8) & 0xff);
-				*dst++ = (uint8) (context->adpcm.ms.delta[1] & 0xff);
-				*dst++ = (uint8) ((context->adpcm.ms.delta[1] >> 8) & 0xff);
-				context->adpcm.ms.sample1[0] = *((sint16*) (src + 4));
-				context->adpcm.ms.sample1[1] = *((sint16*) (src + 6));
-				context->adpcm.ms.sample2[0] = *((sint16*) (src + 0));
-				context->adpcm.ms.sample2[1] = *((sint16*) (src + 2));
-				*((sint16*) (dst + 0)) = (sint16) context->adpcm.ms.sample1[0];
-				*((sint16*) (dst + 2)) = (sint16) context->adpcm.ms.sample1[1];
-				*((sint16*) (dst + 4)) = (sint16) context->adpcm.ms.sample2[0];
-				*((sint16*) (dst + 6)) = (sint16) context->adpcm.ms.sample2[1];
+				*dst++ = adpcm.ms.predictor[0];
+				*dst++ = adpcm.ms.predictor[1];
+				*dst++ = (uint8) (adpcm.ms.delta[0] & 0xff);
+				*dst++ = (uint8) ((adpcm.ms.delta[0] >> 8) & 0xff);
+				*dst++ = (uint8) (adpcm.ms.delta[1] & 0xff);
+				*dst++ = (uint8) ((adpcm.ms.delta[1] >> 8) & 0xff);
+				adpcm.ms.sample1[0] = *((sint16*) (src + 4));
+				adpcm.ms.sample1[1] = *((sint16*) (src + 6));
+				adpcm.ms.sample2[0] = *((sint16*) (src + 0));
+				adpcm.ms.sample2[1] = *((sint16*) (src + 2));
+				*((sint16*) (dst + 0)) = (sint16) adpcm.ms.sample1[0];
+				*((sint16*) (dst + 2)) = (sint16) adpcm.ms.sample1[1];
+				*((sint16*) (dst + 4)) = (sint16) adpcm.ms.sample2[0];
+				*((sint16*) (dst + 6)) = (sint16) adpcm.ms.sample2[1];
 				dst += 8;
 				src += 8;
 				size -= 8;
 			}
 			else
 			{
-				*dst++ = context->adpcm.ms.predictor[0];
-				*dst++ = (uint8) (context->adpcm.ms.delta[0] & 0xff);
-				*dst++ = (uint8) ((context->adpcm.ms.delta[0] >> 8) & 0xff);
-				context->adpcm.ms.sample1[0] = *((sint16*) (src + 2));
-				context->adpcm.ms.sample2[0] = *((sint16*) (src + 0));
-				*((sint16*) (dst + 0)) = (sint16) context->adpcm.ms.sample1[0];
-				*((sint16*) (dst + 2)) = (sint16) context->adpcm.ms.sample2[0];
+				*dst++ = adpcm.ms.predictor[0];
+				*dst++ = (uint8) (adpcm.ms.delta[0] & 0xff);
+				*dst++ = (uint8) ((adpcm.ms.delta[0] >> 8) & 0xff);
+				adpcm.ms.sample1[0] = *((sint16*) (src + 2));
+				adpcm.ms.sample2[0] = *((sint16*) (src + 0));
+				*((sint16*) (dst + 0)) = (sint16) adpcm.ms.sample1[0];
+				*((sint16*) (dst + 2)) = (sint16) adpcm.ms.sample2[0];
 				dst += 4;
 				src += 4;
 				size -= 4;
 			}
 		}
 
-		sample = *((sint16*) src);
-		src += 2;
-		*dst = freerdp_dsp_encode_ms_adpcm_sample(&context->adpcm, sample, 0) << 4;
-		sample = *((sint16*) src);
-		src += 2;
-		*dst += freerdp_dsp_encode_ms_adpcm_sample(&context->adpcm, sample, channels > 1 ? 1 : 0);
-		dst++;
+		if (channels > 1)
+		{
+			/* one byte per stereo frame, the two channel chains are independent */
+			*dst = freerdp_dsp_encode_ms_adpcm_sample(&adpcm, *((sint16*) src), 0) << 4;
+			*dst++ |= freerdp_dsp_encode_ms_adpcm_sample(&adpcm, *((sint16*) (src + 2)), 1);
+		}
+		else
+		{
+			sample = *((sint16*) src);
+			*dst = freerdp_dsp_encode_ms_adpcm_sample(&adpcm, sample, 0) << 4;
+			sample = *((sint16*) (src + 2));
+			*dst++ |= freerdp_dsp_encode_ms_adpcm_sample(&adpcm, sample, 0);
+		}
+		src += 4;
 		size -= 4;
 	}
-	
-	context->adpcm_size = dst - context->adpcm_buffer;
+
+	context->adpcm = adpcm;
+
+	return dst - start;
+}
+
+static void freerdp_dsp_encode_ms_adpcm(FREERDP_DSP_CONTEXT* context,
+	const uint8* src, int size, int channels, int block_size)
+{
+	dsp_check_adpcm_buffer(context, freerdp_dsp_adpcm_encode_max_size(size));
+	context->adpcm_size = freerdp_dsp_encode_ms_adpcm_to(context,
+		src, size, channels, block_size, context->adpcm_buffer);
 }
 
 FREERDP_DSP_CONTEXT* freerdp_dsp_context_new(void)
@@ -605,6 +1118,7 @@ void freerdp_dsp_context_free(FREERDP_DSP_CONTEXT* context)
 {
 	if (context)
 	{
+		dsp_resampler_free((DSP_RESAMPLER*) context->resampler);
 		if (context->resampled_buffer)
 			xfree(context->resampled_buffer);
 		if (context->adpcm_buffer)
@@ -612,5 +1126,24 @@ void freerdp_dsp_context_free(FREERDP_DSP_CONTEXT* context)
 		xfree(context);
 	}
 }
+
+/**
+ * Select the resampler filter length, one of the FREERDP_DSP_RESAMPLE_* levels.
+ */
+
+void freerdp_dsp_context_set_resample_quality(FREERDP_DSP_CONTEXT* context, int quality)
+{
+	context->resample_quality = quality;
+}
+
+/**
+ * Drop the filter history, to be called when a new stream starts.
+ */
+
+void freerdp_dsp_context_reset_resampler(FREERDP_DSP_CONTEXT* context)
+{
+	dsp_resampler_free((DSP_RESAMPLER*) context->resampler);
+	context->resampler = NULL;
+}
 /* Modeline for vim. Don't delete */
 /* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,50 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol client.
+ * Digital Sound Processing - SSE2 Optimizations
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "dsp_sse2.h"
+
+static sint32 dsp_fir16_sse2(const sint16* samples, const sint16* coeffs, int taps)
+{
+	int k;
+	__m128i acc = _mm_setzero_si128();
+
+	for (k = 0; k < taps; k += 8)
+	{
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i*) &samples[k]),
+			_mm_loadu_si128((const __m128i*) &coeffs[k])));
+	}
+
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	return _mm_cvtsi128_si32(acc);
+}
+
+void dsp_init_sse2(DSP_KERNELS* kernels)
+{
+	kernels->fir16 = dsp_fir16_sse2;
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,37 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol client.
+ * Digital Sound Processing
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DSP_TYPES_H
+#define __DSP_TYPES_H
+
+#include "config.h"
+
+#include <freerdp/types.h>
+
+/* dot product of taps 16-bit samples with Q14 coefficients, taps is a multiple of 8 */
+typedef sint32 (*pDspFir16)(const sint16* samples, const sint16* coeffs, int taps);
+
+struct _DSP_KERNELS
+{
+	pDspFir16 fir16;
+};
+typedef struct _DSP_KERNELS DSP_KERNELS;
+
+#endif /* __DSP_TYPES_H */
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,181 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Handle Table Utils
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freerdp/utils/memory.h>
+#include <freerdp/utils/handle_table.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define handle_table_barrier() MemoryBarrier()
+#else
+#define handle_table_barrier() __sync_synchronize()
+#endif
+
+/**
+ * Allocates a handle table.
+ * @param size - number of directly indexed slots, rounded up to a power of two
+ */
+HANDLE_TABLE* handle_table_new(int size)
+{
+	HANDLE_TABLE* table;
+	uint32 count = 1;
+
+	while (count < (uint32) size)
+		count <<= 1;
+
+	table = xnew(HANDLE_TABLE);
+	table->entries = (HANDLE_TABLE_ENTRY*) xzalloc(count * sizeof(HANDLE_TABLE_ENTRY));
+	table->mask = count - 1;
+	table->mutex = freerdp_mutex_new();
+	table->overflow = list_new();
+
+	return table;
+}
+
+void handle_table_free(HANDLE_TABLE* table)
+{
+	HANDLE_TABLE_ENTRY* entry;
+
+	if (table == NULL)
+		return;
+
+	while ((entry = (HANDLE_TABLE_ENTRY*) list_dequeue(table->overflow)) != NULL)
+		xfree(entry);
+	list_free(table->overflow);
+	freerdp_mutex_free(table->mutex);
+
+	xfree(table->entries);
+	xfree(table);
+}
+
+void handle_table_add(HANDLE_TABLE* table, uint32 handle, void* value)
+{
+	HANDLE_TABLE_ENTRY* entry;
+
+	if (handle == 0)
+		return;
+
+	freerdp_mutex_lock(table->mutex);
+
+	entry = &table->entries[handle & table->mask];
+
+	if (entry->handle == 0)
+	{
+		/* the value must be visible before a reader can match the handle */
+		entry->value = value;
+		handle_table_barrier();
+		entry->handle = handle;
+	}
+	else
+	{
+		entry = xnew(HANDLE_TABLE_ENTRY);
+		entry->handle = handle;
+		entry->value = value;
+		list_enqueue(table->overflow, entry);
+		table->num_overflow = list_size(table->overflow);
+	}
+
+	freerdp_mutex_unlock(table->mutex);
+}
+
+void handle_table_remove(HANDLE_TABLE* table, uint32 handle)
+{
+	HANDLE_TABLE_ENTRY* entry;
+	LIST_ITEM* item;
+
+	if (handle == 0)
+		return;
+
+	freerdp_mutex_lock(table->mutex);
+
+	entry = &table->entries[handle & table->mask];
+
+	if (entry->handle == handle)
+	{
+		entry->handle = 0;
+		handle_table_barrier();
+		entry->value = NULL;
+	}
+	else
+	{
+		for (item = table->overflow->head; item; item = item->next)
+		{
+			entry = (HANDLE_TABLE_ENTRY*) item->data;
+
+			if (entry->handle == handle)
+			{
+				list_remove(table->overflow, entry);
+				xfree(entry);
+				break;
+			}
+		}
+		table->num_overflow = list_size(table->overflow);
+	}
+
+	freerdp_mutex_unlock(table->mutex);
+}
+
+/**
+ * Returns the value registered for a handle, or NULL.
+ * Safe to call from any thread concurrently with add and remove.
+ */
+void* handle_table_lookup(HANDLE_TABLE* table, uint32 handle)
+{
+	HANDLE_TABLE_ENTRY* entry;
+	LIST_ITEM* item;
+	void* value;
+
+	entry = &table->entries[handle & table->mask];
+
+	if (handle != 0 && entry->handle == handle)
+	{
+		handle_table_barrier();
+		value = entry->value;
+		handle_table_barrier();
+
+		/* the slot was not recycled while the value was read */
+		if (entry->handle == handle)
+			return value;
+	}
+
+	if (table->num_overflow == 0)
+		return NULL;
+
+	value = NULL;
+	freerdp_mutex_lock(table->mutex);
+
+	for (item = table->overflow->head; item; item = item->next)
+	{
+		entry = (HANDLE_TABLE_ENTRY*) item->data;
+
+		if (entry->handle == handle)
+		{
+			value = entry->value;
+			break;
+		}
+	}
+
+	freerdp_mutex_unlock(table->mutex);
+
+	return value;
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
@@ -0,0 +1,180 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Single-Producer/Single-Consumer Ring Buffer Utils
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freerdp/utils/memory.h>
+#include <freerdp/utils/ring.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define ring_barrier() MemoryBarrier()
+#else
+#define ring_barrier() __sync_synchronize()
+#endif
+
+#define RING_SLOT(_r, _i) ((_r)->items + ((_i) & (_r)->mask) * (_r)->item_size)
+
+/**
+ * Allocates a ring holding up to capacity items without spilling.
+ * @param capacity - number of slots, rounded up to a power of two
+ * @param item_size - size in bytes of one item
+ */
+RING* ring_new(int capacity, int item_size)
+{
+	RING* ring;
+	uint32 size = 1;
+
+	while (size < (uint32) capacity)
+		size <<= 1;
+
+	ring = xnew(RING);
+	ring->items = (uint8*) xzalloc(size * item_size);
+	ring->item_size = item_size;
+	ring->mask = size - 1;
+
+	ring->spill_mutex = freerdp_mutex_new();
+	ring->spill = list_new();
+
+	return ring;
+}
+
+/**
+ * Frees the ring. Items still queued are dropped, callers owning
+ * resources through them must drain the ring first.
+ */
+void ring_free(RING* ring)
+{
+	void* item;
+
+	if (ring == NULL)
+		return;
+
+	while ((item = list_dequeue(ring->spill)) != NULL)
+		xfree(item);
+	list_free(ring->spill);
+	freerdp_mutex_free(ring->spill_mutex);
+
+	xfree(ring->items);
+	xfree(ring);
+}
+
+static boolean ring_try_enqueue(RING* ring, const void* item)
+{
+	uint32 tail = ring->tail;
+
+	if (tail - ring->head > ring->mask)
+		return false;
+
+	memcpy(RING_SLOT(ring, tail), item, ring->item_size);
+
+	/* publish the slot contents before the new tail */
+	ring_barrier();
+	ring->tail = tail + 1;
+
+	return true;
+}
+
+static boolean ring_try_dequeue(RING* ring, void* item)
+{
+	uint32 head = ring->head;
+
+	if (head == ring->tail)
+		return false;
+
+	/* read the slot only after seeing the tail that published it */
+	ring_barrier();
+	memcpy(item, RING_SLOT(ring, head), ring->item_size);
+
+	/* finish reading the slot before handing it back to the producer */
+	ring_barrier();
+	ring->head = head + 1;
+
+	return true;
+}
+
+/**
+ * Copies an item into the ring. Must only be called from the producer thread.
+ */
+void ring_enqueue(RING* ring, const void* item)
+{
+	void* copy;
+
+	/* the overflow list holds the newest items, the ring may only be used again once it drained */
+	if (ring->spilled == 0 && ring_try_enqueue(ring, item))
+		return;
+
+	freerdp_mutex_lock(ring->spill_mutex);
+
+	if (list_size(ring->spill) == 0 && ring_try_enqueue(ring, item))
+	{
+		freerdp_mutex_unlock(ring->spill_mutex);
+		return;
+	}
+
+	copy = xmalloc(ring->item_size);
+	memcpy(copy, item, ring->item_size);
+	list_enqueue(ring->spill, copy);
+	ring->spilled = list_size(ring->spill);
+
+	freerdp_mutex_unlock(ring->spill_mutex);
+}
+
+/**
+ * Copies the oldest item out of the ring. Must only be called from the consumer thread.
+ * @return false if the ring is empty
+ */
+boolean ring_dequeue(RING* ring, void* item)
+{
+	void* copy;
+
+	if (ring_try_dequeue(ring, item))
+		return true;
+
+	if (ring->spilled == 0)
+		return false;
+
+	freerdp_mutex_lock(ring->spill_mutex);
+
+	/* items that reached the ring before the spill started are older */
+	if (ring_try_dequeue(ring, item))
+	{
+		freerdp_mutex_unlock(ring->spill_mutex);
+		return true;
+	}
+
+	copy = list_dequeue(ring->spill);
+	ring->spilled = list_size(ring->spill);
+
+	freerdp_mutex_unlock(ring->spill_mutex);
+
+	if (copy == NULL)
+		return false;
+
+	memcpy(item, copy, ring->item_size);
+	xfree(copy);
+
+	return true;
+}
+
+boolean ring_is_empty(RING* ring)
+{
+	return (ring->head == ring->tail && ring->spilled == 0);
+}
+/* Modeline for vim. Don't delete */
+/* vim: set cindent:noet:sw=8:ts=8 */
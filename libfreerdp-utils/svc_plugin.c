@@ -28,6 +28,8 @@
 #include <freerdp/utils/debug.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/list.h>
+#include <freerdp/utils/ring.h>
+#include <freerdp/utils/handle_table.h>
 #include <freerdp/utils/thread.h>
 #include <freerdp/utils/event.h>
 #include <freerdp/utils/svc_plugin.h>
@@ -45,7 +47,13 @@ static rdpSvcPluginList* g_svc_plugin_list = NULL;
 /* For locking the global resources */
 static freerdp_mutex g_mutex = NULL;
 
-/* Queue for receiving packets */
+/* Open handle to plugin, looked up without locking for every received chunk */
+#define SVC_PLUGIN_HANDLE_TABLE_SIZE 256
+static HANDLE_TABLE* g_svc_plugin_handles = NULL;
+
+/* Queue for receiving packets, filled by the channel manager thread and drained by the plugin thread */
+#define SVC_DATA_IN_RING_SIZE 64
+
 struct _svc_data_in_item
 {
 	STREAM* data_in;
@@ -65,7 +73,6 @@ static void svc_data_in_item_free(svc_data_in_item* item)
 		freerdp_event_free(item->event_in);
 		item->event_in = NULL;
 	}
-	xfree(item);
 }
 
 struct rdp_svc_plugin_private
@@ -74,7 +81,7 @@ struct rdp_svc_plugin_private
 	uint32 open_handle;
 	STREAM* data_in;
 
-	LIST* data_in_list;
+	RING* data_in_ring;
 	freerdp_thread* thread;
 };
 
@@ -99,21 +106,7 @@ static rdpSvcPlugin* svc_plugin_find_by_init_handle(void* init_handle)
 
 static rdpSvcPlugin* svc_plugin_find_by_open_handle(uint32 open_handle)
 {
-	rdpSvcPluginList * list;
-	rdpSvcPlugin * plugin;
-
-	freerdp_mutex_lock(g_mutex);
-	for (list = g_svc_plugin_list; list; list = list->next)
-	{
-		plugin = list->plugin;
-		if (plugin->priv->open_handle == open_handle)
-		{
-			freerdp_mutex_unlock(g_mutex);
-			return plugin;
-		}
-	}
-	freerdp_mutex_unlock(g_mutex);
-	return NULL;
+	return (rdpSvcPlugin*) handle_table_lookup(g_svc_plugin_handles, open_handle);
 }
 
 static void svc_plugin_remove(rdpSvcPlugin* plugin)
@@ -143,8 +136,8 @@ static void svc_plugin_process_received(rdpSvcPlugin* plugin, void* pData, uint3
 	uint32 totalLength, uint32 dataFlags)
 {
 	STREAM* data_in;
-	svc_data_in_item* item;
-	
+	svc_data_in_item item;
+
 	if ( (dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
 	{
 		/* According to MS-RDPBCGR 2.2.6.1, "All virtual channel traffic MUST be suspended.
@@ -175,12 +168,9 @@ static void svc_plugin_process_received(rdpSvcPlugin* plugin, void* pData, uint3
 		plugin->priv->data_in = NULL;
 		stream_set_pos(data_in, 0);
 
-		item = xnew(svc_data_in_item);
-		item->data_in = data_in;
-
-		freerdp_thread_lock(plugin->priv->thread);
-		list_enqueue(plugin->priv->data_in_list, item);
-		freerdp_thread_unlock(plugin->priv->thread);
+		item.data_in = data_in;
+		item.event_in = NULL;
+		ring_enqueue(plugin->priv->data_in_ring, &item);
 
 		freerdp_thread_signal(plugin->priv->thread);
 	}
@@ -188,14 +178,11 @@ static void svc_plugin_process_received(rdpSvcPlugin* plugin, void* pData, uint3
 
 static void svc_plugin_process_event(rdpSvcPlugin* plugin, RDP_EVENT* event_in)
 {
-	svc_data_in_item* item;
-
-	item = xnew(svc_data_in_item);
-	item->event_in = event_in;
+	svc_data_in_item item;
 
-	freerdp_thread_lock(plugin->priv->thread);
-	list_enqueue(plugin->priv->data_in_list, item);
-	freerdp_thread_unlock(plugin->priv->thread);
+	item.data_in = NULL;
+	item.event_in = event_in;
+	ring_enqueue(plugin->priv->data_in_ring, &item);
 
 	freerdp_thread_signal(plugin->priv->thread);
 }
@@ -230,7 +217,7 @@ static void svc_plugin_open_event(uint32 openHandle, uint32 event, void* pData,
 
 static void svc_plugin_process_data_in(rdpSvcPlugin* plugin)
 {
-	svc_data_in_item* item;
+	svc_data_in_item item;
 
 	while (1)
 	{
@@ -238,21 +225,14 @@ static void svc_plugin_process_data_in(rdpSvcPlugin* plugin)
 		if (freerdp_thread_is_stopped(plugin->priv->thread))
 			break;
 
-		freerdp_thread_lock(plugin->priv->thread);
-		item = list_dequeue(plugin->priv->data_in_list);
-		freerdp_thread_unlock(plugin->priv->thread);
-
-		if (item != NULL)
-		{
-			/* the ownership of the data is passed to the callback */
-			if (item->data_in)
-				IFCALL(plugin->receive_callback, plugin, item->data_in);
-			if (item->event_in)
-				IFCALL(plugin->event_callback, plugin, item->event_in);
-			xfree(item);
-		}
-		else
+		if (!ring_dequeue(plugin->priv->data_in_ring, &item))
 			break;
+
+		/* the ownership of the data is passed to the callback */
+		if (item.data_in)
+			IFCALL(plugin->receive_callback, plugin, item.data_in);
+		if (item.event_in)
+			IFCALL(plugin->event_callback, plugin, item.event_in);
 	}
 }
 
@@ -301,7 +281,9 @@ static void svc_plugin_process_connected(rdpSvcPlugin* plugin, void* pData, uint
 		return;
 	}
 
-	plugin->priv->data_in_list = list_new();
+	handle_table_add(g_svc_plugin_handles, plugin->priv->open_handle, plugin);
+
+	plugin->priv->data_in_ring = ring_new(SVC_DATA_IN_RING_SIZE, sizeof(svc_data_in_item));
 	plugin->priv->thread = freerdp_thread_new();
 
 	freerdp_thread_start(plugin->priv->thread, svc_plugin_thread_func, plugin);
@@ -309,7 +291,7 @@ static void svc_plugin_process_connected(rdpSvcPlugin* plugin, void* pData, uint
 
 static void svc_plugin_process_terminated(rdpSvcPlugin* plugin)
 {
-	svc_data_in_item* item;
+	svc_data_in_item item;
 
 	freerdp_thread_stop(plugin->priv->thread);
 	freerdp_thread_free(plugin->priv->thread);
@@ -317,11 +299,13 @@ static void svc_plugin_process_terminated(rdpSvcPlugin* plugin)
 	plugin->channel_entry_points.pVirtualChannelClose(plugin->priv->open_handle);
 	xfree(plugin->channel_entry_points.pExtendedData);
 
+	handle_table_remove(g_svc_plugin_handles, plugin->priv->open_handle);
+
 	svc_plugin_remove(plugin);
 
-	while ((item = list_dequeue(plugin->priv->data_in_list)) != NULL)
-		svc_data_in_item_free(item);
-	list_free(plugin->priv->data_in_list);
+	while (ring_dequeue(plugin->priv->data_in_ring, &item))
+		svc_data_in_item_free(&item);
+	ring_free(plugin->priv->data_in_ring);
 
 	if (plugin->priv->data_in != NULL)
 	{
@@ -369,6 +353,8 @@ void svc_plugin_init(rdpSvcPlugin* plugin, CHANNEL_ENTRY_POINTS* pEntryPoints)
 	 */
 	if (g_mutex == NULL)
 		g_mutex = freerdp_mutex_new();
+	if (g_svc_plugin_handles == NULL)
+		g_svc_plugin_handles = handle_table_new(SVC_PLUGIN_HANDLE_TABLE_SIZE);
 
 	memcpy(&plugin->channel_entry_points, pEntryPoints, pEntryPoints->cbSize);
 
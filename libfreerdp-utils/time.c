@@ -20,6 +20,10 @@
 #include <winpr/windows.h>
 #include <freerdp/utils/time.h>
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 uint64 freerdp_windows_gmtime()
 {
 	time_t unix_time;
@@ -31,6 +35,29 @@ uint64 freerdp_windows_gmtime()
 	return windows_time;
 }
 
+/**
+ * Returns a timestamp in microseconds, meant for measuring intervals.
+ */
+uint64 freerdp_get_time_usec()
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+		((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart;
+#else
+	struct timeval tp;
+
+	gettimeofday(&tp, 0);
+
+	return ((uint64) tp.tv_sec) * 1000000 + tp.tv_usec;
+#endif
+}
+
 uint64 freerdp_get_windows_time_from_unix_time(time_t unix_time)
 {
 	uint64 windows_time;
@@ -285,6 +285,7 @@ static boolean rdpsnd_server_send_audio_pdu(rdpsnd_server* rdpsnd)
 	STREAM* s = rdpsnd->rdpsnd_pdu;
 	rdpsndFormat* format;
 	int tbytes_per_frame;
+	uint8* wave;
 	uint8* src;
 	int size;
 	int frames;
@@ -309,19 +310,32 @@ static boolean rdpsnd_server_send_audio_pdu(rdpsnd_server* rdpsnd)
 	}
 	size = frames * tbytes_per_frame;
 
+	/**
+	 * The WaveInfo PDU carries the first 4 bytes of the audio data and the Wave PDU
+	 * replaces them with padding. The data is encoded straight into a channel buffer
+	 * which then becomes the Wave PDU, so it is queued for sending without a copy.
+	 */
+	wave = WTSVirtualChannelAllocBuffer(rdpsnd->rdpsnd_channel,
+		MAX(freerdp_dsp_adpcm_encode_max_size(size), size) + format->nBlockAlign);
+	if (wave == NULL)
+	{
+		rdpsnd->out_pending_frames = 0;
+		return false;
+	}
+
 	if (format->wFormatTag == 0x11)
 	{
-		rdpsnd->dsp_context->encode_ima_adpcm(rdpsnd->dsp_context,
-			src, size, format->nChannels, format->nBlockAlign);
-		src = rdpsnd->dsp_context->adpcm_buffer;
-		size = rdpsnd->dsp_context->adpcm_size;
+		size = freerdp_dsp_encode_ima_adpcm_to(rdpsnd->dsp_context,
+			src, size, format->nChannels, format->nBlockAlign, wave);
 	}
 	else if (format->wFormatTag == 0x02)
 	{
-		rdpsnd->dsp_context->encode_ms_adpcm(rdpsnd->dsp_context,
-			src, size, format->nChannels, format->nBlockAlign);
-		src = rdpsnd->dsp_context->adpcm_buffer;
-		size = rdpsnd->dsp_context->adpcm_size;
+		size = freerdp_dsp_encode_ms_adpcm_to(rdpsnd->dsp_context,
+			src, size, format->nChannels, format->nBlockAlign, wave);
+	}
+	else
+	{
+		memcpy(wave, src, size);
 	}
 
 	rdpsnd->context.block_no = (rdpsnd->context.block_no + 1) % 256;
@@ -343,20 +357,17 @@ static boolean rdpsnd_server_send_audio_pdu(rdpsnd_server* rdpsnd)
 	stream_write_uint16(s, rdpsnd->context.selected_client_format); /* wFormatNo */
 	stream_write_uint8(s, rdpsnd->context.block_no); /* cBlockNo */
 	stream_seek(s, 3); /* bPad */
-	stream_write(s, src, 4);
+	stream_write(s, wave, 4); /* Data */
 
 	WTSVirtualChannelWrite(rdpsnd->rdpsnd_channel, stream_get_head(s), stream_get_length(s), NULL);
 	stream_set_pos(s, 0);
 
 	/* Wave PDU */
-	stream_check_size(s, size + fill_size);
-	stream_write_uint32(s, 0); /* bPad */
-	stream_write(s, src + 4, size - 4);
+	memset(wave, 0, 4); /* bPad */
 	if (fill_size > 0)
-		stream_write_zero(s, fill_size);
+		memset(wave + size, 0, fill_size);
 
-	r = WTSVirtualChannelWrite(rdpsnd->rdpsnd_channel, stream_get_head(s), stream_get_length(s), NULL);
-	stream_set_pos(s, 0);
+	r = WTSVirtualChannelWriteBuffer(rdpsnd->rdpsnd_channel, wave, size + fill_size);
 
 	rdpsnd->out_pending_frames = 0;
 